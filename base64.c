@@ -79,3 +79,160 @@ int base64encode(const void* data_buf, int dataLength, char* result, int resultS
    result[resultIndex] = 0;
    return 0;   /* indicate success */
 }
+
+/* Scalar encoder/decoder and runtime dispatch for base64_encode() and
+ * base64_decode().  Vector kernels are in base64_x86.c.
+ */
+
+static const char base64_alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+size_t base64_encode_scalar(const void *src, size_t len, char *dst){
+  const uint8_t *s = (const uint8_t *)src;
+  char *d = dst;
+  size_t i;
+
+  for(i = 0; i + 3 <= len; i += 3){
+    uint32_t n = ((uint32_t)s[i] << 16) | ((uint32_t)s[i+1] << 8) | s[i+2];
+    d[0] = base64_alphabet[(n >> 18) & 63];
+    d[1] = base64_alphabet[(n >> 12) & 63];
+    d[2] = base64_alphabet[(n >>  6) & 63];
+    d[3] = base64_alphabet[n & 63];
+    d += 4;
+  }
+
+  if(i < len){
+    uint32_t n = (uint32_t)s[i] << 16;
+    if(i + 1 < len) n |= (uint32_t)s[i+1] << 8;
+
+    d[0] = base64_alphabet[(n >> 18) & 63];
+    d[1] = base64_alphabet[(n >> 12) & 63];
+    d[2] = (i + 1 < len) ? base64_alphabet[(n >> 6) & 63] : '=';
+    d[3] = '=';
+    d += 4;
+  }
+
+  return d - dst;
+}
+
+/* 0..63 for valid chars, 0xff otherwise */
+static const uint8_t *base64_reverse(){
+  static uint8_t table[256];
+  static int ready = 0;
+  int i;
+
+  if(!ready){
+    memset(table, 0xff, sizeof(table));
+    for(i = 0; i < 64; i++) table[(uint8_t)base64_alphabet[i]] = i;
+    ready = 1;
+  }
+
+  return table;
+}
+
+int base64_decode_scalar(const char *src, size_t len, void *dst, size_t *dst_len){
+  const uint8_t *rev = base64_reverse();
+  const uint8_t *s = (const uint8_t *)src;
+  uint8_t *d = (uint8_t *)dst;
+  size_t i;
+
+  if(len % 4) return -1;
+
+  for(i = 0; i < len; i += 4){
+    uint32_t a = rev[s[i]], b = rev[s[i+1]], c = rev[s[i+2]], e = rev[s[i+3]];
+
+    // '=' padding is only allowed in the last quantum
+    if((i + 4 == len) && (s[i+3] == '=')){
+      if((a | b) > 63) return -1;
+      *d++ = (a << 2) | (b >> 4);
+
+      if(s[i+2] != '='){
+        if(c > 63) return -1;
+        *d++ = (b << 4) | (c >> 2);
+      }
+      break;
+    }
+
+    if((a | b | c | e) > 63) return -1;
+
+    uint32_t n = (a << 18) | (b << 12) | (c << 6) | e;
+    d[0] = n >> 16;
+    d[1] = n >> 8;
+    d[2] = n;
+    d += 3;
+  }
+
+  *dst_len = d - (uint8_t *)dst;
+  return 0;
+}
+
+static enum base64_impl base64_active = BASE64_IMPL_AUTO;
+
+static int base64_supported(enum base64_impl impl){
+  switch(impl){
+    case BASE64_IMPL_SCALAR:
+      return 1;
+#if defined(__x86_64__) || defined(__i386__)
+    case BASE64_IMPL_SSSE3:
+      return __builtin_cpu_supports("ssse3");
+    case BASE64_IMPL_AVX2:
+      return __builtin_cpu_supports("avx2");
+#endif
+    default:
+      return 0;
+  }
+}
+
+int base64_select(enum base64_impl impl){
+  if(impl == BASE64_IMPL_AUTO){
+    impl = base64_supported(BASE64_IMPL_AVX2)  ? BASE64_IMPL_AVX2  :
+           base64_supported(BASE64_IMPL_SSSE3) ? BASE64_IMPL_SSSE3 :
+                                                 BASE64_IMPL_SCALAR;
+  }
+
+  if(!base64_supported(impl)) return 0;
+
+  base64_reverse(); // build the table before any threads use it
+  base64_active = impl;
+  return 1;
+}
+
+const char *base64_impl_name(enum base64_impl impl){
+  switch(impl){
+    case BASE64_IMPL_SCALAR: return "scalar";
+    case BASE64_IMPL_SSSE3:  return "ssse3";
+    case BASE64_IMPL_AVX2:   return "avx2";
+    default:                 return "auto";
+  }
+}
+
+size_t base64_encode(const void *src, size_t len, char *dst){
+  const unsigned char *s = (const unsigned char *)src;
+  size_t done = 0;
+
+  if(base64_active == BASE64_IMPL_AUTO) base64_select(BASE64_IMPL_AUTO);
+
+#if defined(__x86_64__) || defined(__i386__)
+  if(base64_active == BASE64_IMPL_AVX2)  done = base64_encode_avx2_blocks(s, len, dst);
+  if(base64_active == BASE64_IMPL_SSSE3) done = base64_encode_ssse3_blocks(s, len, dst);
+#endif
+
+  // every 3 bytes consumed produced 4 chars
+  return (done / 3) * 4 + base64_encode_scalar(s + done, len - done, dst + (done / 3) * 4);
+}
+
+int base64_decode(const char *src, size_t len, void *dst, size_t *dst_len){
+  unsigned char *d = (unsigned char *)dst;
+  size_t done = 0, produced = 0, tail_len = 0;
+
+  if(base64_active == BASE64_IMPL_AUTO) base64_select(BASE64_IMPL_AUTO);
+
+#if defined(__x86_64__) || defined(__i386__)
+  if(base64_active == BASE64_IMPL_AVX2)  done = base64_decode_avx2_blocks(src, len, d, &produced);
+  if(base64_active == BASE64_IMPL_SSSE3) done = base64_decode_ssse3_blocks(src, len, d, &produced);
+#endif
+
+  if(base64_decode_scalar(src + done, len - done, d + produced, &tail_len) != 0) return -1;
+
+  *dst_len = produced + tail_len;
+  return 0;
+}
@@ -1,2 +1,58 @@
 
 int base64encode(const void* data_buf, int dataLength, char* result, int resultSize);
+
+/* Vectorized base64 with runtime cpu dispatch
+ *
+ * base64_encode() and base64_decode() use AVX2 or SSSE3 when the cpu
+ * supports them and fall back to a scalar implementation otherwise.
+ * Output is identical to base64encode() (standard alphabet, '=' padding)
+ * but is not 0 terminated, so it can be written straight into an output
+ * buffer.
+ */
+
+#include <stddef.h>
+
+enum base64_impl {
+  BASE64_IMPL_AUTO = 0,   // best available
+  BASE64_IMPL_SCALAR,
+  BASE64_IMPL_SSSE3,
+  BASE64_IMPL_AVX2
+};
+
+/* Length of the base64 encoding of len bytes */
+#define base64_encoded_len(len) ((((len) + 2) / 3) * 4)
+
+/* Upper bound of the decoded length of len base64 chars */
+#define base64_decoded_len(len) ((((len) + 3) / 4) * 3)
+
+/* Encode len bytes from src into dst.
+ * dst must have room for base64_encoded_len(len) bytes.
+ * Returns the number of chars written.
+ */
+size_t base64_encode(const void *src, size_t len, char *dst);
+
+/* Decode len chars from src into dst.
+ * dst must have room for base64_decoded_len(len) bytes.
+ * Returns 0 on success and sets *dst_len, -1 if src is not valid base64.
+ */
+int base64_decode(const char *src, size_t len, void *dst, size_t *dst_len);
+
+/* Select the implementation used by base64_encode() / base64_decode().
+ * Returns 0 if the implementation is not supported by this cpu.
+ */
+int base64_select(enum base64_impl impl);
+
+const char *base64_impl_name(enum base64_impl impl);
+
+/* Implementations (see base64.c, base64_x86.c)
+ *
+ * Vector kernels process whole blocks and return the number of input
+ * bytes consumed, the caller finishes the tail with the scalar code.
+ */
+size_t base64_encode_scalar(const void *src, size_t len, char *dst);
+int    base64_decode_scalar(const char *src, size_t len, void *dst, size_t *dst_len);
+
+size_t base64_encode_ssse3_blocks(const unsigned char *src, size_t len, char *dst);
+size_t base64_encode_avx2_blocks(const unsigned char *src, size_t len, char *dst);
+size_t base64_decode_ssse3_blocks(const char *src, size_t len, unsigned char *dst, size_t *dst_len);
+size_t base64_decode_avx2_blocks(const char *src, size_t len, unsigned char *dst, size_t *dst_len);
@@ -0,0 +1,151 @@
+/* base64 throughput benchmark
+ *
+ * Compares the original base64encode() with base64_encode() / base64_decode()
+ * for each implementation this cpu supports, and checks every
+ * implementation produces identical output and round trips, for every
+ * size up to CHECK_MAX_SIZE (the scalar tails) and the packet size.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>    /* for getopt */
+#include <time.h>
+
+#include "base64.h"
+
+#define CHECK_MAX_SIZE 64
+
+static uint64_t now_usec(){
+  struct timespec tv;
+  clock_gettime (CLOCK_MONOTONIC, &tv);
+  return (tv.tv_sec * (uint64_t) 1000000 + tv.tv_nsec / 1000);
+}
+
+static void report(const char *name, uint64_t bytes, uint64_t usec){
+  usec = (usec > 0) ? usec : 1;
+  fprintf(stdout, "    %-28s %8.1f MBytes/sec\n", name, (double)bytes / usec);
+}
+
+/* Encode size bytes with the selected implementation, compare with
+ * base64encode() and decode it again
+ */
+static int round_trip(const uint8_t *pkt, size_t size){
+  size_t   cap = base64_encoded_len(size) + 1;
+  char    *ref = malloc(cap);
+  char    *enc = malloc(cap);
+  uint8_t *dec = malloc(base64_decoded_len(cap));
+  size_t   len, dec_len = 0;
+
+  base64encode(pkt, size, ref, cap);
+  len = base64_encode(pkt, size, enc);
+
+  int ok = (len == strlen(ref)) && !memcmp(enc, ref, len) &&
+           (base64_decode(enc, len, dec, &dec_len) == 0) &&
+           (dec_len == size) && !memcmp(dec, pkt, size);
+
+  free(ref);
+  free(enc);
+  free(dec);
+
+  return ok;
+}
+
+int main(int argc, char *argv[])
+{
+  struct {
+    int pkt_size;
+    int iterations;
+  } config = {
+    .pkt_size = 2048,
+    .iterations = 200000
+  };
+
+  int opt, i;
+  enum base64_impl impl;
+
+  while ((opt = getopt(argc, argv, "hm:i:")) != -1) {
+    switch (opt) {
+
+      case 'm':
+        config.pkt_size = atoi(optarg);
+        break;
+
+      case 'i':
+        config.iterations = atoi(optarg);
+        break;
+
+      case 'h':
+      default: /* '?' */
+        fprintf(stderr, "Usage: %s [-h][-m <bytes>][-i <count>]\n"
+                "-h     help\n"
+                "-m     packet size in <bytes> (default 2048)\n"
+                "-i     encode/decode each packet <count> times (default 200000)\n",
+                argv[0]);
+        exit(EXIT_FAILURE);
+    }
+  }
+
+  if(config.pkt_size < 0) config.pkt_size = 0;
+
+  size_t enc_cap = base64_encoded_len(config.pkt_size) + 1;
+
+  uint8_t *pkt     = malloc((config.pkt_size > CHECK_MAX_SIZE) ? config.pkt_size : CHECK_MAX_SIZE);
+  char    *ref     = malloc(enc_cap);
+  char    *enc     = malloc(enc_cap);
+  uint8_t *dec     = malloc(base64_decoded_len(enc_cap));
+  uint64_t usec;
+  size_t   len = 0, dec_len, size;
+
+  for(i = 0; i < ((config.pkt_size > CHECK_MAX_SIZE) ? config.pkt_size : CHECK_MAX_SIZE); i++) pkt[i] = rand();
+
+  fprintf(stdout, "packet size %i bytes, %i iterations\n", config.pkt_size, config.iterations);
+
+  // Reference, the original byte at a time encoder
+  usec = now_usec();
+  for(i = 0; i < config.iterations; i++){
+    base64encode(pkt, config.pkt_size, ref, enc_cap);
+  }
+  report("encode base64encode()", (uint64_t)config.pkt_size * config.iterations, now_usec() - usec);
+
+  for(impl = BASE64_IMPL_SCALAR; impl <= BASE64_IMPL_AVX2; impl++){
+    char name[64];
+
+    if(!base64_select(impl)){
+      fprintf(stdout, "    %-28s not supported\n", base64_impl_name(impl));
+      continue;
+    }
+
+    for(size = 0; size <= CHECK_MAX_SIZE; size++){
+      if(!round_trip(pkt, size)) break;
+    }
+
+    if((size <= CHECK_MAX_SIZE) || !round_trip(pkt, config.pkt_size)){
+      fprintf(stdout, "FAIL %s differs from base64encode() or doesn't round trip, %lu bytes\n",
+              base64_impl_name(impl), (size <= CHECK_MAX_SIZE) ? size : (size_t)config.pkt_size);
+      exit(EXIT_FAILURE);
+    }
+
+    usec = now_usec();
+    for(i = 0; i < config.iterations; i++){
+      len = base64_encode(pkt, config.pkt_size, enc);
+    }
+    snprintf(name, sizeof(name), "encode %s", base64_impl_name(impl));
+    report(name, (uint64_t)config.pkt_size * config.iterations, now_usec() - usec);
+
+    usec = now_usec();
+    for(i = 0; i < config.iterations; i++){
+      base64_decode(enc, len, dec, &dec_len);
+    }
+    snprintf(name, sizeof(name), "decode %s", base64_impl_name(impl));
+    report(name, (uint64_t)config.pkt_size * config.iterations, now_usec() - usec);
+  }
+
+  free(pkt);
+  free(ref);
+  free(enc);
+  free(dec);
+
+  return 0;
+}
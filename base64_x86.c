@@ -0,0 +1,256 @@
+/* SSSE3 and AVX2 base64 kernels
+ *
+ * Encode: bytes are shuffled so each 32 bit lane holds 3 input bytes, the
+ * four 6 bit fields are split out with multiplies and translated to ASCII
+ * with a pshufb offset table.
+ *
+ * Decode: ASCII is validated and translated back to 6 bit values with
+ * nibble indexed pshufb tables, then packed with multiply-add.
+ *
+ * Kernels only process whole blocks and never touch bytes outside the
+ * source or destination, the caller finishes the tail with scalar code.
+ * Compiled with per function target attributes, selected at runtime by
+ * base64_select().
+ */
+
+#include <stddef.h>
+
+#include "base64.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+#define SSSE3 __attribute__((target("ssse3")))
+#define AVX2  __attribute__((target("avx2")))
+
+/******* SSSE3 ************/
+
+static inline SSSE3 __m128i enc_reshuffle_ssse3(__m128i in){
+  // a0 a1 a2 -> a1 a0 a2 a1 per 32 bit lane
+  in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11,  9, 10,
+                                           7,  8,  6,  7,
+                                           4,  5,  3,  4,
+                                           1,  2,  0,  1));
+
+  const __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+  const __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+  const __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+  const __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+
+  return _mm_or_si128(t1, t3);
+}
+
+static inline SSSE3 __m128i enc_translate_ssse3(__m128i in){
+  // offset to add to each 6 bit value, indexed by its range
+  const __m128i lut = _mm_setr_epi8(65, 71, -4, -4, -4, -4, -4, -4,
+                                    -4, -4, -4, -4, -19, -16, 0, 0);
+
+  __m128i indices = _mm_subs_epu8(in, _mm_set1_epi8(51));
+  __m128i mask = _mm_cmpgt_epi8(in, _mm_set1_epi8(25));
+  indices = _mm_sub_epi8(indices, mask);
+
+  return _mm_add_epi8(in, _mm_shuffle_epi8(lut, indices));
+}
+
+SSSE3 size_t base64_encode_ssse3_blocks(const unsigned char *src, size_t len, char *dst){
+  size_t done = 0;
+
+  // 16 byte loads, 12 bytes used
+  while(len - done >= 16){
+    __m128i in = _mm_loadu_si128((const __m128i *)(src + done));
+    __m128i out = enc_translate_ssse3(enc_reshuffle_ssse3(in));
+    _mm_storeu_si128((__m128i *)dst, out);
+    done += 12;
+    dst  += 16;
+  }
+
+  return done;
+}
+
+static inline SSSE3 __m128i dec_reshuffle_ssse3(__m128i in){
+  const __m128i merge_ab_and_bc = _mm_maddubs_epi16(in, _mm_set1_epi32(0x01400140));
+  const __m128i out = _mm_madd_epi16(merge_ab_and_bc, _mm_set1_epi32(0x00011000));
+
+  return _mm_shuffle_epi8(out, _mm_setr_epi8( 2,  1,  0,
+                                              6,  5,  4,
+                                             10,  9,  8,
+                                             14, 13, 12,
+                                             -1, -1, -1, -1));
+}
+
+/* Returns 0 if any char is not in the base64 alphabet, else sets *out to the 6 bit values
+ */
+static inline SSSE3 int dec_translate_ssse3(__m128i str, __m128i *out){
+  const __m128i lut_lo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                       0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+  const __m128i lut_hi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                       0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+  const __m128i lut_roll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71,
+                                         0,  0,  0, 0,   0,   0,   0,   0);
+  const __m128i mask_2f = _mm_set1_epi8(0x2f);
+
+  const __m128i hi_nibbles = _mm_and_si128(_mm_srli_epi32(str, 4), mask_2f);
+  const __m128i lo_nibbles = _mm_and_si128(str, mask_2f);
+  const __m128i hi = _mm_shuffle_epi8(lut_hi, hi_nibbles);
+  const __m128i lo = _mm_shuffle_epi8(lut_lo, lo_nibbles);
+
+  if(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(lo, hi), _mm_setzero_si128())) != 0xffff) return 0;
+
+  const __m128i eq_2f = _mm_cmpeq_epi8(str, mask_2f);
+  const __m128i roll = _mm_shuffle_epi8(lut_roll, _mm_add_epi8(eq_2f, hi_nibbles));
+
+  *out = _mm_add_epi8(str, roll);
+  return 1;
+}
+
+SSSE3 size_t base64_decode_ssse3_blocks(const char *src, size_t len, unsigned char *dst, size_t *dst_len){
+  size_t done = 0;
+  size_t produced = 0;
+  __m128i values;
+
+  // 16 chars -> 12 bytes with a 16 byte store, stay clear of the
+  // padded final quantum and the end of dst
+  while(len - done >= 24){
+    __m128i str = _mm_loadu_si128((const __m128i *)(src + done));
+
+    if(!dec_translate_ssse3(str, &values)) break; // let the scalar code report it
+
+    _mm_storeu_si128((__m128i *)(dst + produced), dec_reshuffle_ssse3(values));
+    done     += 16;
+    produced += 12;
+  }
+
+  *dst_len = produced;
+  return done;
+}
+
+/******* AVX2 ************/
+
+static inline AVX2 __m256i enc_reshuffle_avx2(__m256i in){
+  in = _mm256_shuffle_epi8(in, _mm256_set_epi8(10, 11,  9, 10,  7,  8,  6,  7,
+                                                4,  5,  3,  4,  1,  2,  0,  1,
+                                               10, 11,  9, 10,  7,  8,  6,  7,
+                                                4,  5,  3,  4,  1,  2,  0,  1));
+
+  const __m256i t0 = _mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00));
+  const __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+  const __m256i t2 = _mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0));
+  const __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+
+  return _mm256_or_si256(t1, t3);
+}
+
+static inline AVX2 __m256i enc_translate_avx2(__m256i in){
+  const __m256i lut = _mm256_setr_epi8(65, 71, -4, -4, -4, -4, -4, -4,
+                                       -4, -4, -4, -4, -19, -16, 0, 0,
+                                       65, 71, -4, -4, -4, -4, -4, -4,
+                                       -4, -4, -4, -4, -19, -16, 0, 0);
+
+  __m256i indices = _mm256_subs_epu8(in, _mm256_set1_epi8(51));
+  __m256i mask = _mm256_cmpgt_epi8(in, _mm256_set1_epi8(25));
+  indices = _mm256_sub_epi8(indices, mask);
+
+  return _mm256_add_epi8(in, _mm256_shuffle_epi8(lut, indices));
+}
+
+AVX2 size_t base64_encode_avx2_blocks(const unsigned char *src, size_t len, char *dst){
+  size_t done = 0;
+
+  // two 16 byte loads 12 bytes apart, 24 bytes used
+  while(len - done >= 28){
+    __m128i lo = _mm_loadu_si128((const __m128i *)(src + done));
+    __m128i hi = _mm_loadu_si128((const __m128i *)(src + done + 12));
+    __m256i in = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+
+    __m256i out = enc_translate_avx2(enc_reshuffle_avx2(in));
+    _mm256_storeu_si256((__m256i *)dst, out);
+    done += 24;
+    dst  += 32;
+  }
+
+  // finish whole 12 byte blocks with 128 bit lanes
+  return done + base64_encode_ssse3_blocks(src + done, len - done, dst);
+}
+
+static inline AVX2 __m256i dec_reshuffle_avx2(__m256i in){
+  const __m256i merge_ab_and_bc = _mm256_maddubs_epi16(in, _mm256_set1_epi32(0x01400140));
+  __m256i out = _mm256_madd_epi16(merge_ab_and_bc, _mm256_set1_epi32(0x00011000));
+
+  out = _mm256_shuffle_epi8(out, _mm256_setr_epi8( 2,  1,  0,  6,  5,  4, 10,  9,
+                                                   8, 14, 13, 12, -1, -1, -1, -1,
+                                                   2,  1,  0,  6,  5,  4, 10,  9,
+                                                   8, 14, 13, 12, -1, -1, -1, -1));
+
+  // 12 bytes per lane -> 24 contiguous bytes
+  return _mm256_permutevar8x32_epi32(out, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, -1, -1));
+}
+
+static inline AVX2 int dec_translate_avx2(__m256i str, __m256i *out){
+  const __m256i lut_lo = _mm256_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                          0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A,
+                                          0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                          0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+  const __m256i lut_hi = _mm256_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                          0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+                                          0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                          0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+  const __m256i lut_roll = _mm256_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71,
+                                            0,  0,  0, 0,   0,   0,   0,   0,
+                                            0, 16, 19, 4, -65, -65, -71, -71,
+                                            0,  0,  0, 0,   0,   0,   0,   0);
+  const __m256i mask_2f = _mm256_set1_epi8(0x2f);
+
+  const __m256i hi_nibbles = _mm256_and_si256(_mm256_srli_epi32(str, 4), mask_2f);
+  const __m256i lo_nibbles = _mm256_and_si256(str, mask_2f);
+  const __m256i hi = _mm256_shuffle_epi8(lut_hi, hi_nibbles);
+  const __m256i lo = _mm256_shuffle_epi8(lut_lo, lo_nibbles);
+
+  if(!_mm256_testz_si256(lo, hi)) return 0;
+
+  const __m256i eq_2f = _mm256_cmpeq_epi8(str, mask_2f);
+  const __m256i roll = _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(eq_2f, hi_nibbles));
+
+  *out = _mm256_add_epi8(str, roll);
+  return 1;
+}
+
+AVX2 size_t base64_decode_avx2_blocks(const char *src, size_t len, unsigned char *dst, size_t *dst_len){
+  size_t done = 0;
+  size_t produced = 0;
+  size_t tail_produced = 0;
+  __m256i values;
+
+  // 32 chars -> 24 bytes with a 32 byte store
+  while(len - done >= 48){
+    __m256i str = _mm256_loadu_si256((const __m256i *)(src + done));
+
+    if(!dec_translate_avx2(str, &values)) break;
+
+    _mm256_storeu_si256((__m256i *)(dst + produced), dec_reshuffle_avx2(values));
+    done     += 32;
+    produced += 24;
+  }
+
+  done += base64_decode_ssse3_blocks(src + done, len - done, dst + produced, &tail_produced);
+
+  *dst_len = produced + tail_produced;
+  return done;
+}
+
+#else  // not x86, scalar only
+
+size_t base64_encode_ssse3_blocks(const unsigned char *src, size_t len, char *dst){ return 0; }
+size_t base64_encode_avx2_blocks(const unsigned char *src, size_t len, char *dst){ return 0; }
+
+size_t base64_decode_ssse3_blocks(const char *src, size_t len, unsigned char *dst, size_t *dst_len){
+  *dst_len = 0;
+  return 0;
+}
+
+size_t base64_decode_avx2_blocks(const char *src, size_t len, unsigned char *dst, size_t *dst_len){
+  *dst_len = 0;
+  return 0;
+}
+
+#endif
@@ -4,6 +4,7 @@
 #include "logger.h"
 #include "context.h"
 #include "discovery.h"
+#include "msg_arena.h"
 #include "util.h"
 
 #include <nanomsg/nn.h>
@@ -33,6 +34,7 @@ struct log_context g_log = {
   //.pub_send_buf_size  = (1<<20) * 8, // Default to 8 MByte
   //.pub_send_buf_size  = (1<<20) * 1, // Default to 1 MByte
   .publish_context_ready = 0,
+  .pub_arena_huge_pages = 0,      // back message arena with huge pages
 
   .discovery_fd = -1,
   .discovery_context_ready = 0,
@@ -42,7 +44,9 @@ struct log_context g_log = {
 
   .msg_sent = 0,
   .msg_bytes_sent = 0,
-  .payload_bytes_sent = 0
+  .payload_bytes_sent = 0,
+
+  .shed = {0}
 };
 
 
@@ -64,6 +68,8 @@ struct log_context * ready_static_info(struct log_context *g_log){
 void ready_publish_context(){
   int rc;
 
+  msg_arena_huge_pages(g_log.pub_arena_huge_pages);
+
   /* Ready Socket we publish log messages on */
 
   g_log.pub_fd   = nn_socket (AF_SP, NN_PUB);
@@ -97,6 +103,10 @@ void ready_discovery_context(){
 
 
 
+void log_context_huge_pages(int enable){
+  g_log.pub_arena_huge_pages = enable;
+}
+
 /* Return pointer to log context for this actor.
  * Make the log context ready prior to returning the pointer (if needed)
  */
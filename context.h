@@ -1,5 +1,7 @@
 #include <netinet/in.h>
 
+#include "load_shed.h"
+
 // global socket to communicate with trace server
 struct log_context {
   char    *prog_name;
@@ -10,6 +12,7 @@ struct log_context {
   int pub_send_buf_size;
   int publish_context_ready;
   int pub_sendmsg_flags;
+  int pub_arena_huge_pages;
 
   int discovery_fd;
   int discovery_context_ready;
@@ -19,8 +22,15 @@ struct log_context {
   int msg_bytes_sent;
   int payload_bytes_sent;
 
+  struct load_shed shed;
+
   int verbose;
 };
 
 struct log_context * get_log_context();
 
+/* Back the message arena with huge pages (default off), see msg_arena.h.
+ * Takes effect only if called before the first message is logged.
+ */
+void log_context_huge_pages(int enable);
+
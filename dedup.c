@@ -0,0 +1,192 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dedup.h"
+#include "fnv_hash.h"
+
+/* A run of identical records, the first one's header and payload
+ */
+struct dedup_run {
+  uint64_t hash;
+  struct Msg_Hdr lm;        // usec of the first record
+  uint64_t start_usec;      // received, 0 = free slot
+  uint64_t last_usec;
+  uint64_t count;           // records not written
+  int      pending;         // slot is in the pending list
+  uint32_t payload_len;
+  uint32_t payload_cap;
+  char    *payload;
+};
+
+struct dedup *dedup_new(uint64_t window_usec, dedup_emit_fn emit, void *emit_arg){
+  struct dedup *d = calloc(1, sizeof(*d));
+
+  d->window_usec = window_usec;
+  d->emit        = emit;
+  d->emit_arg    = emit_arg;
+  d->runs        = calloc(DEDUP_SLOTS, sizeof(d->runs[0]));
+  d->pending     = calloc(DEDUP_SLOTS, sizeof(d->pending[0]));
+  d->next_usec   = UINT64_MAX;
+
+  return d;
+}
+
+void dedup_free(struct dedup *d){
+  int i;
+
+  for(i = 0; i < DEDUP_SLOTS; i++) free(d->runs[i].payload);
+
+  free(d->runs);
+  free(d->pending);
+  free(d->repeat);
+  free(d);
+}
+
+static inline uint64_t dedup_hash(const struct Msg_Hdr *lm, const void *payload, uint64_t payload_len){
+  struct {
+    char     type_lvl[8];
+    uint64_t prog_hash;
+    uint64_t process_id;
+    uint64_t function_ptr;
+    uint64_t file_line_number;
+  } key;
+
+  memcpy(key.type_lvl, lm->type_lvl, sizeof(key.type_lvl));
+  key.prog_hash        = lm->prog_hash;
+  key.process_id       = lm->process_id;
+  key.function_ptr     = lm->function_ptr;
+  key.file_line_number = lm->file_line_number;
+
+  return fnv_64a_buf((void *)payload, payload_len, fnv_64a_buf(&key, sizeof(key), FNV1A_64_INIT));
+}
+
+static inline int run_matches(const struct dedup_run *run, uint64_t hash, const struct Msg_Hdr *lm,
+                              const void *payload, uint64_t payload_len){
+  return (run->hash == hash) &&
+         (run->payload_len == payload_len) &&
+         (run->lm.prog_hash == lm->prog_hash) &&
+         (run->lm.process_id == lm->process_id) &&
+         (run->lm.function_ptr == lm->function_ptr) &&
+         (run->lm.file_line_number == lm->file_line_number) &&
+         (memcmp(run->lm.type_lvl, lm->type_lvl, sizeof(lm->type_lvl)) == 0) &&
+         (memcmp(run->payload, payload, payload_len) == 0);
+}
+
+/* Emit the repeat record of a run, if it has records not written
+ */
+static void close_run(struct dedup *d, struct dedup_run *run){
+  if(!run->count) return;
+
+  uint64_t text_len = strnlen(run->payload, run->payload_len);
+  uint64_t need = text_len + 128;
+
+  if(d->repeat_cap < need){
+    free(d->repeat);
+    d->repeat_cap = need;
+    d->repeat     = malloc(need);
+  }
+
+  memcpy(d->repeat, run->payload, text_len);
+  int n = snprintf(d->repeat + text_len, need - text_len, DEDUP_REPEAT_FMT,
+                   run->count, run->lm.usec, run->last_usec);
+
+  struct Msg_Hdr lm = run->lm;
+  lm.usec = run->last_usec;
+
+  d->emit(d->emit_arg, &lm, d->repeat, text_len + n + 1);
+
+  d->stats.repeats += 1;
+  run->count = 0;
+}
+
+static void start_run(struct dedup_run *run, uint64_t hash, const struct Msg_Hdr *lm,
+                      const void *payload, uint64_t payload_len, uint64_t now_usec){
+  if(run->payload_cap < payload_len){
+    free(run->payload);
+    run->payload_cap = (payload_len < 64) ? 64 : payload_len;
+    run->payload     = malloc(run->payload_cap);
+  }
+
+  memcpy(run->payload, payload, payload_len);
+  run->payload_len = payload_len;
+  run->hash        = hash;
+  run->lm          = *lm;
+  run->start_usec  = now_usec;
+  run->last_usec   = lm->usec;
+  run->count       = 0;
+}
+
+int dedup_check(struct dedup *d, const struct Msg_Hdr *lm, const void *payload, uint64_t payload_len,
+                uint64_t now_usec){
+  struct dedup_run *victim = 0;
+  int i;
+
+  if((lm->type_lvl[0] != 'L') || (payload_len > DEDUP_MAX_PAYLOAD)) return 0;
+
+  uint64_t hash = dedup_hash(lm, payload, payload_len);
+
+  for(i = 0; i < DEDUP_PROBES; i++){
+    uint32_t slot = (hash + i) & (DEDUP_SLOTS - 1);
+    struct dedup_run *run = &d->runs[slot];
+
+    if(run->start_usec && run_matches(run, hash, lm, payload, payload_len)){
+      uint64_t end_usec = run->start_usec + d->window_usec;
+
+      // the window has ended, this record is written and starts the next run
+      if(now_usec >= end_usec){
+        close_run(d, run);
+        start_run(run, hash, lm, payload, payload_len, now_usec);
+        return 0;
+      }
+
+      run->count    += 1;
+      run->last_usec = lm->usec;
+      d->stats.suppressed += 1;
+
+      if(!run->pending){
+        run->pending = 1;
+        d->pending[d->pending_count++] = slot;
+        if(end_usec < d->next_usec) d->next_usec = end_usec;
+      }
+
+      return 1;
+    }
+
+    // a free slot, else the oldest run
+    if(!victim || (victim->start_usec && (run->start_usec < victim->start_usec))) victim = run;
+  }
+
+  if(victim->count && (now_usec < victim->start_usec + d->window_usec)) d->stats.evicted += 1;
+
+  close_run(d, victim);
+  start_run(victim, hash, lm, payload, payload_len, now_usec);
+
+  return 0;
+}
+
+void dedup_expire(struct dedup *d, uint64_t now_usec){
+  uint64_t next_usec = UINT64_MAX;
+  uint32_t i, kept = 0;
+
+  if(now_usec < d->next_usec) return;
+
+  for(i = 0; i < d->pending_count; i++){
+    struct dedup_run *run = &d->runs[d->pending[i]];
+    uint64_t end_usec = run->start_usec + d->window_usec;
+
+    // closed early, or by the window of the next run
+    if(!run->count || (now_usec >= end_usec)){
+      close_run(d, run);
+      run->pending = 0;
+      continue;
+    }
+
+    d->pending[kept++] = d->pending[i];
+    if(end_usec < next_usec) next_usec = end_usec;
+  }
+
+  d->pending_count = kept;
+  d->next_usec     = next_usec;
+}
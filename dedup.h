@@ -0,0 +1,103 @@
+
+/*
+ * dedup.h
+ *
+ * Run-length collapsing of repeated identical log records, log_to_file -X.
+ *
+ * A component that is stuck tends to send the same error from the same
+ * place with the same text thousands of times a second.  Records with the
+ * same (eid, pid, fptr, line, mask, payload) received within the window of
+ * the first one are a run:
+ *
+ *   - the first record of the run is written as received
+ *   - the others are counted, not written
+ *   - when the window ends, if there were any, one repeat record is written
+ *
+ * The repeat record has the header of the run (so routes and filters on
+ * mask, eid or fptr still match it) with usec of the last record, and the
+ * payload with the run appended:
+ *
+ *   <payload> [repeated=<records not written> first_usec=<usec> last_usec=<usec>]
+ *
+ * so an incident costs two records per window instead of thousands, and
+ * the first one is on disk (and in the live view) without waiting.
+ *
+ * Only log records (type_lvl L...) are collapsed.  Trace records are
+ * paired and timed by their consumers and packets are binary, they are
+ * never held back.
+ *
+ * Runs are found by a fnv_64a_buf() hash of the key in an open addressing
+ * table of DEDUP_SLOTS, the key is compared in full so a hash collision
+ * never merges different records.  A new record that finds its probe
+ * range full closes the oldest run there early.  Windows are measured in
+ * receive time, so a publisher with a wrong clock is collapsed as well.
+ *
+ * A dedup belongs to one thread, each worker has its own.  Publishers are
+ * sharded to workers, so a publisher's runs are in one table.  Relay
+ * batches (log_to_file -A) go to whichever worker reads the relay socket
+ * first, so a relayed run is split across the workers that received its
+ * batches.  Each of them writes the first record and a repeat record per
+ * window.
+ */
+
+#ifndef _DEDUP_H_
+#define _DEDUP_H_
+
+#include <stdint.h>
+
+#include "log_msg.h"
+
+#define DEDUP_SLOTS        4096   // runs tracked per thread, a power of 2
+#define DEDUP_PROBES          8   // slots looked at for a record
+#define DEDUP_MAX_PAYLOAD  4096   // longer records are never collapsed
+
+#define DEDUP_REPEAT_FMT   " [repeated=%lu first_usec=%lu last_usec=%lu]"
+
+/* Called with each repeat record, the record is valid for the call
+ */
+typedef void (*dedup_emit_fn)(void *arg, const struct Msg_Hdr *lm, const void *payload, uint64_t payload_len);
+
+struct dedup_stats {
+  volatile uint64_t suppressed;  // records counted in a run instead of written
+  volatile uint64_t repeats;     // repeat records written
+  volatile uint64_t evicted;     // runs closed before their window ended, the table was full
+};
+
+struct dedup_run;
+
+struct dedup {
+  uint64_t window_usec;
+  dedup_emit_fn emit;
+  void *emit_arg;
+
+  struct dedup_run *runs;        // DEDUP_SLOTS
+  uint32_t *pending;             // slots of the runs with records not written yet
+  uint32_t  pending_count;
+  uint64_t  next_usec;           // earliest end of a pending run's window
+
+  char     *repeat;              // repeat record payload
+  uint64_t  repeat_cap;
+
+  struct dedup_stats stats;
+};
+
+struct dedup *dedup_new(uint64_t window_usec, dedup_emit_fn emit, void *emit_arg);
+
+/* Runs still open are dropped, dedup_expire() them first
+ */
+void dedup_free(struct dedup *d);
+
+/* Check a record received at now_usec
+ *
+ * Returns 1 if it repeats a run and must not be written, 0 if it is to be
+ * written.  A run closed to make room is emitted first.
+ */
+int dedup_check(struct dedup *d, const struct Msg_Hdr *lm, const void *payload, uint64_t payload_len,
+                uint64_t now_usec);
+
+/* Emit the runs whose window has ended by now_usec, UINT64_MAX for all
+ * (e.g. before the last flush)
+ */
+void dedup_expire(struct dedup *d, uint64_t now_usec);
+
+#endif /* _DEDUP_H_ */
@@ -8,6 +8,7 @@
 #include <nanomsg/nn.h>
 
 #include "context.h"
+#include "discovery.h"
 #include "util.h"
 
 int send_service_description(int sock_fd, struct log_context *g_log,
@@ -66,13 +67,16 @@ int send_service_description(int sock_fd, struct log_context *g_log,
 }
 
 void send_service_descriptions(int sock_fd, int port, struct log_context *g_log){
+  uint64_t process_id = getpid(); // Linux caches this for 2, 3, ... access
+
+  send_service_descriptions_as(sock_fd, port, g_log, process_id, get_program_name());
+}
+
+void send_service_descriptions_as(int sock_fd, int port, struct log_context *g_log,
+                                  int process_id, char *program_name){
   // printf("\n%s ENTER\n", __func__);
   struct ifaddrs *ifaddr, *ifa;
   int family, n;
-  char * program_name;
-  program_name = (char*) get_program_name();
-
-  uint64_t process_id = getpid(); // Linux caches this for 2, 3, ... access
 
   if (getifaddrs(&ifaddr) == -1) {
     perror("getifaddrs");
@@ -2,3 +2,9 @@
 struct log_context;
 
 void send_service_descriptions(int sock_fd, int port, struct log_context *g_log);
+
+/* Advertise a publisher other than this process, e.g. one recreated by log_replay,
+ * g_log gives its prog_hash
+ */
+void send_service_descriptions_as(int sock_fd, int port, struct log_context *g_log,
+                                  int process_id, char *program_name);
@@ -0,0 +1,505 @@
+#define _GNU_SOURCE     /* for O_DIRECT */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+
+#if defined(__linux__) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define HAVE_IO_URING 1
+#else
+#define HAVE_IO_URING 0
+#endif
+
+#ifndef O_DIRECT
+#define O_DIRECT 0  // not supported, the fcntl() below is a no-op
+#endif
+
+#include "disk_writer.h"
+
+struct dw_buf {
+  char    *data;
+  size_t   len;         // bytes appended
+  size_t   write_len;   // bytes submitted, len rounded up to a block with O_DIRECT
+  size_t   done;        // bytes written so far
+  uint64_t offset;      // file offset of data[0]
+  int      in_flight;
+  size_t   carried;     // O_DIRECT, bytes of the previous buffer's last block at the start
+  int      wait_prev;   // ... so the previous buffer must be written first
+
+  struct dw_buf *next_queued;
+};
+
+#if HAVE_IO_URING
+struct dw_ring {
+  int fd;
+
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned *sq_mask;
+  unsigned *sq_array;
+  struct io_uring_sqe *sqes;
+
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned *cq_mask;
+  struct io_uring_cqe *cqes;
+
+  void  *sq_ptr;
+  void  *cq_ptr;
+  size_t sq_size;
+  size_t cq_size;
+  size_t sqes_size;
+};
+#endif
+
+struct disk_writer {
+  int fd;
+  struct disk_writer_config config;
+
+  pthread_mutex_t lock;
+  pthread_cond_t  done_cond;     // a buffer finished writing (thread backend)
+
+  struct dw_buf *bufs;
+  int            cur;            // buffer being filled, buffers are used round robin
+  uint64_t       file_len;       // bytes appended to the file
+
+  // DISK_WRITER_THREADS
+  pthread_t      *threads;
+  pthread_cond_t  queue_cond;
+  struct dw_buf  *queue_head;
+  struct dw_buf  *queue_tail;
+  int             stop;
+
+#if HAVE_IO_URING
+  struct dw_ring ring;
+#endif
+
+  struct disk_writer_stats stats;
+};
+
+/* A buffer is done, successfully or not
+ */
+static void buf_complete(struct disk_writer *w, struct dw_buf *b, int err){
+  if(err){
+    fprintf(stderr, "%s write at offset %lu failed, %lu bytes lost, errno: %s\n",
+            __func__, b->offset + b->done, b->write_len - b->done, strerror(err));
+    w->stats.errors += 1;
+  }
+
+  w->stats.writes += 1;
+  w->stats.bytes  += b->len;
+
+  b->in_flight = 0;
+}
+
+//
+// io_uring backend, raw system calls so there's no liburing dependency
+//
+
+#if HAVE_IO_URING
+
+static int ring_setup(struct dw_ring *r, unsigned entries){
+  struct io_uring_params p;
+
+  memset(&p, 0, sizeof(p));
+  memset(r, 0, sizeof(*r));
+
+  r->fd = syscall(__NR_io_uring_setup, entries, &p);
+  if(r->fd < 0) return -1;
+
+  // IORING_OP_WRITE arrived with the same kernel (5.6) as this feature
+  if(!(p.features & IORING_FEAT_RW_CUR_POS)){
+    close(r->fd);
+    errno = ENOSYS;
+    return -1;
+  }
+
+  r->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  r->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+
+  if(p.features & IORING_FEAT_SINGLE_MMAP){
+    if(r->cq_size > r->sq_size) r->sq_size = r->cq_size;
+    r->cq_size = r->sq_size;
+  }
+
+  r->sq_ptr = mmap(0, r->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+  if(r->sq_ptr == MAP_FAILED) goto fail;
+
+  if(p.features & IORING_FEAT_SINGLE_MMAP){
+    r->cq_ptr = r->sq_ptr;
+  } else {
+    r->cq_ptr = mmap(0, r->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+    if(r->cq_ptr == MAP_FAILED) goto fail;
+  }
+
+  r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+  r->sqes = mmap(0, r->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+  if(r->sqes == MAP_FAILED) goto fail;
+
+  r->sq_head  = (unsigned *)((char *)r->sq_ptr + p.sq_off.head);
+  r->sq_tail  = (unsigned *)((char *)r->sq_ptr + p.sq_off.tail);
+  r->sq_mask  = (unsigned *)((char *)r->sq_ptr + p.sq_off.ring_mask);
+  r->sq_array = (unsigned *)((char *)r->sq_ptr + p.sq_off.array);
+
+  r->cq_head  = (unsigned *)((char *)r->cq_ptr + p.cq_off.head);
+  r->cq_tail  = (unsigned *)((char *)r->cq_ptr + p.cq_off.tail);
+  r->cq_mask  = (unsigned *)((char *)r->cq_ptr + p.cq_off.ring_mask);
+  r->cqes     = (struct io_uring_cqe *)((char *)r->cq_ptr + p.cq_off.cqes);
+
+  return 0;
+
+fail:
+  close(r->fd);
+  return -1;
+}
+
+static void ring_close(struct dw_ring *r){
+  munmap(r->sqes, r->sqes_size);
+  if(r->cq_ptr != r->sq_ptr) munmap(r->cq_ptr, r->cq_size);
+  munmap(r->sq_ptr, r->sq_size);
+  close(r->fd);
+}
+
+/* Queue the unwritten part of a buffer, at most one write per buffer is
+ * outstanding so the submission queue never fills
+ */
+static void ring_submit(struct disk_writer *w, struct dw_buf *b){
+  struct dw_ring *r = &w->ring;
+
+  unsigned tail = *r->sq_tail;
+  unsigned idx  = tail & *r->sq_mask;
+  struct io_uring_sqe *sqe = &r->sqes[idx];
+
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode    = IORING_OP_WRITE;
+  sqe->fd        = w->fd;
+  sqe->addr      = (uint64_t)(uintptr_t)(b->data + b->done);
+  sqe->len       = b->write_len - b->done;
+  sqe->off       = b->offset + b->done;
+  sqe->user_data = b - w->bufs;
+
+  r->sq_array[idx] = idx;
+  __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+  while(syscall(__NR_io_uring_enter, r->fd, 1, 0, 0, NULL, 0) < 0){
+    if(errno != EINTR && errno != EAGAIN && errno != EBUSY){
+      buf_complete(w, b, errno);
+      return;
+    }
+  }
+}
+
+/* Handle completions, if wait block until there's at least one
+ */
+static void ring_reap(struct disk_writer *w, int wait){
+  struct dw_ring *r = &w->ring;
+
+  if(wait) syscall(__NR_io_uring_enter, r->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+
+  unsigned head = *r->cq_head;
+  unsigned tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+
+  while(head != tail){
+    struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+    struct dw_buf *b = &w->bufs[cqe->user_data];
+    int res = cqe->res;
+
+    head++;
+    __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+
+    if((res == -EINTR) || (res == -EAGAIN)){
+      ring_submit(w, b);
+    } else if(res < 0){
+      buf_complete(w, b, -res);
+    } else {
+      b->done += res;
+      if(b->done < b->write_len){
+        ring_submit(w, b);  // short write
+      } else {
+        buf_complete(w, b, 0);
+      }
+    }
+  }
+}
+
+#endif /* HAVE_IO_URING */
+
+//
+// Thread backend, blocking pwrite() on a few threads
+//
+
+static void *write_thread(void *arg){
+  struct disk_writer *w = arg;
+
+  pthread_mutex_lock(&w->lock);
+
+  while(1){
+    while(!w->queue_head && !w->stop) pthread_cond_wait(&w->queue_cond, &w->lock);
+    if(!w->queue_head) break;
+
+    struct dw_buf *b = w->queue_head;
+    w->queue_head = b->next_queued;
+    if(!w->queue_head) w->queue_tail = 0;
+
+    pthread_mutex_unlock(&w->lock);
+
+    int err = 0;
+    while(b->done < b->write_len){
+      ssize_t rc = pwrite(w->fd, b->data + b->done, b->write_len - b->done, b->offset + b->done);
+
+      if(rc < 0){
+        if(errno == EINTR) continue;
+        err = errno;
+        break;
+      }
+
+      b->done += rc;
+    }
+
+    pthread_mutex_lock(&w->lock);
+    buf_complete(w, b, err);
+    pthread_cond_broadcast(&w->done_cond);
+  }
+
+  pthread_mutex_unlock(&w->lock);
+
+  return NULL;
+}
+
+static void queue_submit(struct disk_writer *w, struct dw_buf *b){
+  b->next_queued = 0;
+
+  if(w->queue_tail){
+    w->queue_tail->next_queued = b;
+  } else {
+    w->queue_head = b;
+  }
+  w->queue_tail = b;
+
+  pthread_cond_signal(&w->queue_cond);
+}
+
+//
+// Common, called with w->lock held
+//
+
+static void buf_wait(struct disk_writer *w, struct dw_buf *b){
+  while(b->in_flight){
+#if HAVE_IO_URING
+    if(w->config.backend == DISK_WRITER_URING){
+      ring_reap(w, 1);
+      continue;
+    }
+#endif
+    pthread_cond_wait(&w->done_cond, &w->lock);
+  }
+}
+
+/* Start writing the buffer being filled and move on to the next one
+ */
+static void submit_cur(struct disk_writer *w){
+  struct dw_buf *b = &w->bufs[w->cur];
+  size_t tail = 0;
+
+  if(b->len == 0) return;
+
+  b->write_len = b->len;
+  b->done      = 0;
+
+  if(w->config.direct){
+    b->write_len = (b->len + DISK_WRITER_ALIGN - 1) & ~(size_t)(DISK_WRITER_ALIGN - 1);
+    tail = b->len & (DISK_WRITER_ALIGN - 1);
+    memset(b->data + b->len, 0, b->write_len - b->len);
+  }
+
+  // Rewriting the previous buffer's last block, it must land first
+  if(b->wait_prev) buf_wait(w, &w->bufs[(w->cur + w->config.buffers - 1) % w->config.buffers]);
+
+  b->in_flight = 1;
+
+#if HAVE_IO_URING
+  if(w->config.backend == DISK_WRITER_URING){
+    ring_submit(w, b);
+    ring_reap(w, 0);
+  } else
+#endif
+  {
+    queue_submit(w, b);
+  }
+
+  w->cur = (w->cur + 1) % w->config.buffers;
+
+  struct dw_buf *next = &w->bufs[w->cur];
+
+  if(next->in_flight){
+    w->stats.stalls += 1;
+    buf_wait(w, next);
+  }
+
+  next->len       = 0;
+  next->offset    = b->offset + b->len - tail;
+  next->carried   = 0;
+  next->wait_prev = 0;
+
+  // O_DIRECT offsets stay block aligned, carry the partial block over
+  if(tail){
+    memcpy(next->data, b->data + b->len - tail, tail);
+    next->len       = tail;
+    next->carried   = tail;
+    next->wait_prev = 1;
+  }
+}
+
+struct disk_writer *disk_writer_open(int fd, const struct disk_writer_config *config){
+  struct disk_writer *w = calloc(1, sizeof(*w));
+  int i;
+
+  w->fd     = fd;
+  w->config = *config;
+
+  if(w->config.buffers < 2) w->config.buffers = 2;
+  if(w->config.threads < 1) w->config.threads = DISK_WRITER_POOL_THREADS;
+
+  // Appends continue from the current end of the file
+  off_t pos = lseek(fd, 0, SEEK_CUR);
+  w->file_len = (pos > 0) ? pos : 0;
+
+  if(w->config.direct){
+    if((w->file_len & (DISK_WRITER_ALIGN - 1)) || (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_DIRECT) < 0)){
+      fprintf(stderr, "%s O_DIRECT not available, using buffered writes\n", __func__);
+      w->config.direct = 0;
+    }
+  }
+
+  pthread_mutex_init(&w->lock, NULL);
+  pthread_cond_init(&w->done_cond, NULL);
+  pthread_cond_init(&w->queue_cond, NULL);
+
+  w->bufs = calloc(w->config.buffers, sizeof(w->bufs[0]));
+
+  for(i = 0; i < w->config.buffers; i++){
+    if(posix_memalign((void **)&w->bufs[i].data, DISK_WRITER_ALIGN, DISK_WRITER_BUF_SIZE) != 0){
+      fprintf(stderr, "%s out of memory\n", __func__);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  w->cur = 0;
+  w->bufs[0].offset = w->file_len;
+
+#if HAVE_IO_URING
+  if((w->config.backend == DISK_WRITER_URING) && (ring_setup(&w->ring, w->config.buffers) < 0)){
+    fprintf(stderr, "%s io_uring not available (%s), using pwrite threads\n", __func__, strerror(errno));
+    w->config.backend = DISK_WRITER_THREADS;
+  }
+#else
+  w->config.backend = DISK_WRITER_THREADS;
+#endif
+
+  if(w->config.backend == DISK_WRITER_THREADS){
+    w->threads = calloc(w->config.threads, sizeof(w->threads[0]));
+
+    for(i = 0; i < w->config.threads; i++){
+      pthread_create(&w->threads[i], NULL, write_thread, w);
+    }
+  }
+
+  return w;
+}
+
+uint64_t disk_writer_append(struct disk_writer *w, const void *data, size_t len){
+  const char *p = data;
+
+  pthread_mutex_lock(&w->lock);
+
+  uint64_t offset = w->file_len;
+  w->file_len += len;
+
+  while(len > 0){
+    struct dw_buf *b = &w->bufs[w->cur];
+    size_t n = DISK_WRITER_BUF_SIZE - b->len;
+
+    if(n > len) n = len;
+
+    memcpy(b->data + b->len, p, n);
+    b->len += n;
+    p      += n;
+    len    -= n;
+
+    if(b->len == DISK_WRITER_BUF_SIZE) submit_cur(w);
+  }
+
+  pthread_mutex_unlock(&w->lock);
+
+  return offset;
+}
+
+void disk_writer_flush(struct disk_writer *w){
+  pthread_mutex_lock(&w->lock);
+
+  // A buffer holding only the block carried over (O_DIRECT) was already written
+  struct dw_buf *b = &w->bufs[w->cur];
+  if(b->len > b->carried) submit_cur(w);
+
+  pthread_mutex_unlock(&w->lock);
+}
+
+void disk_writer_close(struct disk_writer *w){
+  int i;
+
+  pthread_mutex_lock(&w->lock);
+
+  if(w->bufs[w->cur].len > w->bufs[w->cur].carried) submit_cur(w);
+
+  for(i = 0; i < w->config.buffers; i++) buf_wait(w, &w->bufs[i]);
+
+  w->stop = 1;
+  pthread_cond_broadcast(&w->queue_cond);
+
+  pthread_mutex_unlock(&w->lock);
+
+  if(w->config.backend == DISK_WRITER_THREADS){
+    for(i = 0; i < w->config.threads; i++) pthread_join(w->threads[i], NULL);
+    free(w->threads);
+  }
+
+#if HAVE_IO_URING
+  if(w->config.backend == DISK_WRITER_URING) ring_close(&w->ring);
+#endif
+
+  // Drop the zero padding of the last O_DIRECT block
+  if(w->config.direct && (ftruncate(w->fd, w->file_len) < 0)){
+    fprintf(stderr, "%s ftruncate failed, errno: %s\n", __func__, strerror(errno));
+  }
+
+  for(i = 0; i < w->config.buffers; i++) free(w->bufs[i].data);
+  free(w->bufs);
+
+  pthread_mutex_destroy(&w->lock);
+  pthread_cond_destroy(&w->done_cond);
+  pthread_cond_destroy(&w->queue_cond);
+
+  free(w);
+}
+
+void disk_writer_get_stats(struct disk_writer *w, struct disk_writer_stats *stats){
+  pthread_mutex_lock(&w->lock);
+  *stats = w->stats;
+  pthread_mutex_unlock(&w->lock);
+}
+
+const char *disk_writer_backend_name(const struct disk_writer *w){
+  if(w->config.backend == DISK_WRITER_URING) return w->config.direct ? "io_uring, O_DIRECT" : "io_uring";
+  return w->config.direct ? "pwrite threads, O_DIRECT" : "pwrite threads";
+}
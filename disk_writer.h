@@ -0,0 +1,76 @@
+
+/*
+ * disk_writer.h
+ *
+ * Asynchronous file writer for log_to_file.
+ *
+ * Output is appended to one large aligned buffer while the previously
+ * filled buffers are being written.  Buffers are written by io_uring, or
+ * by a small pool of pwrite() threads where io_uring isn't available, so
+ * a slow disk only delays the receive path once every buffer is in flight.
+ *
+ * Optionally the file is written with O_DIRECT, bypassing the page cache.
+ * Writes are then whole 4 KByte blocks, a partially filled buffer is
+ * written padded with zeros and its last block is rewritten by the next
+ * buffer.  The file is truncated to its real length when the writer is
+ * closed.
+ */
+
+#ifndef _DISK_WRITER_H_
+#define _DISK_WRITER_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define DISK_WRITER_BUF_SIZE  (4 << 20)  // 4 MBytes
+#define DISK_WRITER_ALIGN     4096       // O_DIRECT block size
+#define DISK_WRITER_BUFFERS   4          // default buffers, 1 filling + in flight
+#define DISK_WRITER_POOL_THREADS 2       // pwrite threads for the fallback backend
+
+enum disk_writer_backend {
+  DISK_WRITER_URING,
+  DISK_WRITER_THREADS
+};
+
+struct disk_writer_config {
+  enum disk_writer_backend backend;
+  int direct;     // write with O_DIRECT
+  int buffers;    // total buffers, at least 2
+  int threads;    // pwrite threads (DISK_WRITER_THREADS backend)
+};
+
+struct disk_writer_stats {
+  uint64_t writes;
+  uint64_t bytes;
+  uint64_t stalls;   // appends that had to wait for a buffer to be written
+  uint64_t errors;
+};
+
+struct disk_writer;
+
+/* Start writing to fd, which must be a regular file
+ *
+ * Falls back to the thread backend if io_uring isn't available and to
+ * buffered writes if O_DIRECT isn't supported by the file system.
+ */
+struct disk_writer *disk_writer_open(int fd, const struct disk_writer_config *config);
+
+/* Append data to the file, safe to call from any thread
+ *
+ * Returns the file offset the data is written at.
+ */
+uint64_t disk_writer_append(struct disk_writer *w, const void *data, size_t len);
+
+/* Start writing the partially filled buffer, e.g. when the receiver is idle
+ */
+void disk_writer_flush(struct disk_writer *w);
+
+/* Write everything, wait for it and release the writer
+ */
+void disk_writer_close(struct disk_writer *w);
+
+void disk_writer_get_stats(struct disk_writer *w, struct disk_writer_stats *stats);
+
+const char *disk_writer_backend_name(const struct disk_writer *w);
+
+#endif /* _DISK_WRITER_H_ */
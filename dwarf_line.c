@@ -0,0 +1,393 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dwarf_line.h"
+
+#define DW_LNS_copy               1
+#define DW_LNS_advance_pc         2
+#define DW_LNS_advance_line       3
+#define DW_LNS_set_file           4
+#define DW_LNS_const_add_pc       8
+#define DW_LNS_fixed_advance_pc   9
+
+#define DW_LNE_end_sequence       1
+#define DW_LNE_set_address        2
+
+#define DW_LNCT_path              1
+#define DW_LNCT_directory_index   2
+
+#define DW_FORM_block2            0x03
+#define DW_FORM_block4            0x04
+#define DW_FORM_data2             0x05
+#define DW_FORM_data4             0x06
+#define DW_FORM_data8             0x07
+#define DW_FORM_string            0x08
+#define DW_FORM_block             0x09
+#define DW_FORM_block1            0x0a
+#define DW_FORM_data1             0x0b
+#define DW_FORM_strp              0x0e
+#define DW_FORM_udata             0x0f
+#define DW_FORM_data16            0x1e
+#define DW_FORM_line_strp         0x1f
+
+#define MAX_DIRS    1024   // per unit, names beyond these are dropped
+#define MAX_FILES   4096
+#define MAX_FORMATS 16
+
+/* Bounds checked reader, any overrun sets err and reads zeros
+ */
+struct reader {
+  const uint8_t *p;
+  const uint8_t *end;
+  int err;
+};
+
+static inline int need(struct reader *r, size_t n){
+  if((size_t)(r->end - r->p) < n){
+    r->err = 1;
+    r->p = r->end;
+    return 0;
+  }
+  return 1;
+}
+
+static uint64_t read_u(struct reader *r, int n){
+  uint64_t v = 0;
+  int i;
+
+  if(!need(r, n)) return 0;
+
+  for(i = 0; i < n; i++) v |= (uint64_t)r->p[i] << (8 * i);  // little endian
+  r->p += n;
+
+  return v;
+}
+
+static uint64_t read_uleb(struct reader *r){
+  uint64_t v = 0;
+  int shift = 0;
+
+  while(need(r, 1)){
+    uint8_t b = *r->p++;
+    if(shift < 64) v |= (uint64_t)(b & 0x7f) << shift;
+    shift += 7;
+    if(!(b & 0x80)) break;
+  }
+
+  return v;
+}
+
+static int64_t read_sleb(struct reader *r){
+  int64_t v = 0;
+  int shift = 0;
+  uint8_t b = 0;
+
+  while(need(r, 1)){
+    b = *r->p++;
+    if(shift < 64) v |= (int64_t)(b & 0x7f) << shift;
+    shift += 7;
+    if(!(b & 0x80)) break;
+  }
+
+  if((shift < 64) && (b & 0x40)) v |= -((int64_t)1 << shift);
+
+  return v;
+}
+
+static const char *read_cstr(struct reader *r){
+  const char *s = (const char *)r->p;
+  const uint8_t *nul = memchr(r->p, 0, r->end - r->p);
+
+  if(!nul){
+    r->err = 1;
+    r->p = r->end;
+    return 0;
+  }
+
+  r->p = nul + 1;
+  return s;
+}
+
+static const char *section_str(const uint8_t *sec, size_t size, uint64_t offset){
+  if(!sec || (offset >= size) || !memchr(sec + offset, 0, size - offset)) return 0;
+  return (const char *)sec + offset;
+}
+
+/* Read one attribute of a DWARF 5 directory or file entry, strings are
+ * returned in *s, numbers in *v
+ */
+static void read_form(struct reader *r, const struct dwarf_sections *sec, uint64_t form, int offset_size,
+                      const char **s, uint64_t *v){
+  *s = 0;
+  *v = 0;
+
+  switch(form){
+    case DW_FORM_string:    *s = read_cstr(r); break;
+    case DW_FORM_line_strp: *s = section_str(sec->line_str, sec->line_str_size, read_u(r, offset_size)); break;
+    case DW_FORM_strp:      *s = section_str(sec->str, sec->str_size, read_u(r, offset_size)); break;
+    case DW_FORM_udata:     *v = read_uleb(r); break;
+    case DW_FORM_data1:     *v = read_u(r, 1); break;
+    case DW_FORM_data2:     *v = read_u(r, 2); break;
+    case DW_FORM_data4:     *v = read_u(r, 4); break;
+    case DW_FORM_data8:     *v = read_u(r, 8); break;
+    case DW_FORM_data16:    if(need(r, 16)) r->p += 16; break;
+    case DW_FORM_block1:    { uint64_t n = read_u(r, 1); if(need(r, n)) r->p += n; break; }
+    case DW_FORM_block2:    { uint64_t n = read_u(r, 2); if(need(r, n)) r->p += n; break; }
+    case DW_FORM_block4:    { uint64_t n = read_u(r, 4); if(need(r, n)) r->p += n; break; }
+    case DW_FORM_block:     { uint64_t n = read_uleb(r); if(need(r, n)) r->p += n; break; }
+    default:                r->err = 1; break;  // e.g. strx, needs .debug_str_offsets
+  }
+}
+
+/* DWARF 5 directory or file name table
+ */
+static int read_entries(struct reader *r, const struct dwarf_sections *sec, int offset_size,
+                        const char **paths, uint64_t *dir_index, int max){
+  uint64_t types[MAX_FORMATS], forms[MAX_FORMATS];
+  uint64_t i, count;
+  int f;
+
+  int formats = read_u(r, 1);
+  if(formats > MAX_FORMATS) return -1;
+
+  for(f = 0; f < formats; f++){
+    types[f] = read_uleb(r);
+    forms[f] = read_uleb(r);
+  }
+
+  count = read_uleb(r);
+
+  for(i = 0; (i < count) && !r->err; i++){
+    const char *path = 0;
+    uint64_t dir = 0;
+
+    for(f = 0; f < formats; f++){
+      const char *s;
+      uint64_t v;
+
+      read_form(r, sec, forms[f], offset_size, &s, &v);
+
+      if(types[f] == DW_LNCT_path) path = s;
+      if(types[f] == DW_LNCT_directory_index) dir = v;
+    }
+
+    if(i < (uint64_t)max){
+      paths[i] = path;
+      if(dir_index) dir_index[i] = dir;
+    }
+  }
+
+  return r->err ? -1 : ((count < (uint64_t)max) ? (int)count : max);
+}
+
+struct unit {
+  int version;
+  int offset_size;
+  int address_size;
+  int min_inst_len;
+  int default_is_stmt;
+  int line_base;
+  int line_range;
+  int opcode_base;
+  const uint8_t *opcode_lengths;
+
+  const char *dirs[MAX_DIRS];
+  int dirs_count;
+
+  const char *files[MAX_FILES];
+  uint64_t file_dirs[MAX_FILES];
+  int files_count;
+};
+
+/* File names are 1 based before DWARF 5, 0 based since
+ */
+static void file_name(const struct unit *u, uint64_t file, const char **dir, const char **name){
+  *dir = 0;
+  *name = 0;
+
+  if(u->version < 5){
+    if(file == 0) return;
+    file -= 1;
+  }
+
+  if(file >= (uint64_t)u->files_count) return;
+
+  *name = u->files[file];
+  if(!*name || ((*name)[0] == '/')) return;
+
+  uint64_t d = u->file_dirs[file];
+
+  // directory 0 is the compilation directory in DWARF 5, unnamed before
+  if(u->version < 5){
+    if((d > 0) && (d <= (uint64_t)u->dirs_count)) *dir = u->dirs[d - 1];
+  } else if(d < (uint64_t)u->dirs_count){
+    *dir = u->dirs[d];
+  }
+}
+
+static int read_header(struct reader *r, const struct dwarf_sections *sec, struct unit *u){
+  u->version = read_u(r, 2);
+  if((u->version < 2) || (u->version > 5)) return -1;
+
+  if(u->version >= 5){
+    u->address_size = read_u(r, 1);
+    read_u(r, 1);  // segment selector size
+  }
+
+  uint64_t header_length = read_u(r, u->offset_size);
+  if(!need(r, header_length)) return -1;
+
+  const uint8_t *program = r->p + header_length;
+
+  u->min_inst_len    = read_u(r, 1);
+  if(u->version >= 4) read_u(r, 1);  // maximum operations per instruction, VLIW only
+  u->default_is_stmt = read_u(r, 1);
+  u->line_base       = (int8_t)read_u(r, 1);
+  u->line_range      = read_u(r, 1);
+  u->opcode_base     = read_u(r, 1);
+
+  if((u->line_range == 0) || (u->opcode_base == 0) || !need(r, u->opcode_base - 1)) return -1;
+
+  u->opcode_lengths = r->p;
+  r->p += u->opcode_base - 1;
+
+  if(u->version >= 5){
+    u->dirs_count  = read_entries(r, sec, u->offset_size, u->dirs, 0, MAX_DIRS);
+    u->files_count = read_entries(r, sec, u->offset_size, u->files, u->file_dirs, MAX_FILES);
+    if((u->dirs_count < 0) || (u->files_count < 0)) return -1;
+  } else {
+    const char *s;
+
+    u->dirs_count = 0;
+    while((s = read_cstr(r)) && s[0]){
+      if(u->dirs_count < MAX_DIRS) u->dirs[u->dirs_count++] = s;
+    }
+
+    u->files_count = 0;
+    while((s = read_cstr(r)) && s[0]){
+      uint64_t dir = read_uleb(r);
+      read_uleb(r);  // modification time
+      read_uleb(r);  // length
+
+      if(u->files_count < MAX_FILES){
+        u->files[u->files_count] = s;
+        u->file_dirs[u->files_count] = dir;
+        u->files_count += 1;
+      }
+    }
+  }
+
+  if(r->err) return -1;
+
+  r->p = program;
+  return 0;
+}
+
+static void run_program(struct reader *r, struct unit *u, dwarf_line_fn fn, void *arg){
+  uint64_t addr = 0, file = 1;
+  int64_t line = 1;
+  const char *dir, *name;
+  int i;
+
+  while((r->p < r->end) && !r->err){
+    uint8_t op = *r->p++;
+
+    if(op >= u->opcode_base){
+      // special opcode, advance address and line and add a row
+      int adjusted = op - u->opcode_base;
+      addr += (uint64_t)(adjusted / u->line_range) * u->min_inst_len;
+      line += u->line_base + (adjusted % u->line_range);
+
+      file_name(u, file, &dir, &name);
+      fn(arg, addr, dir, name, line);
+      continue;
+    }
+
+    switch(op){
+      case 0: {
+        uint64_t len = read_uleb(r);
+        if(!need(r, len) || (len == 0)) return;
+
+        const uint8_t *next = r->p + len;
+        uint8_t sub = *r->p++;
+
+        if(sub == DW_LNE_end_sequence){
+          fn(arg, addr, 0, 0, 0);
+          addr = 0;
+          file = 1;
+          line = 1;
+        } else if((sub == DW_LNE_set_address) && (len - 1 <= sizeof(addr))){
+          addr = read_u(r, len - 1);  // longer is malformed, skipped
+        }
+
+        r->p = next;
+        break;
+      }
+
+      case DW_LNS_copy:
+        file_name(u, file, &dir, &name);
+        fn(arg, addr, dir, name, line);
+        break;
+
+      case DW_LNS_advance_pc:
+        addr += read_uleb(r) * u->min_inst_len;
+        break;
+
+      case DW_LNS_advance_line:
+        line += read_sleb(r);
+        break;
+
+      case DW_LNS_set_file:
+        file = read_uleb(r);
+        break;
+
+      case DW_LNS_const_add_pc:
+        addr += (uint64_t)((255 - u->opcode_base) / u->line_range) * u->min_inst_len;
+        break;
+
+      case DW_LNS_fixed_advance_pc:
+        addr += read_u(r, 2);
+        break;
+
+      default:
+        // other standard opcodes only change state we don't track
+        for(i = 0; i < u->opcode_lengths[op - 1]; i++) read_uleb(r);
+        break;
+    }
+  }
+}
+
+int dwarf_line_decode(const struct dwarf_sections *sections, dwarf_line_fn fn, void *arg){
+  struct reader all = {sections->line, sections->line + sections->line_size, 0};
+  struct unit *u = malloc(sizeof(*u));  // large, keep it off the stack
+  int units = 0;
+
+  while((all.p < all.end) && !all.err){
+    uint64_t length;
+
+    memset(u, 0, sizeof(*u));
+    u->offset_size = 4;
+
+    length = read_u(&all, 4);
+    if(length == 0xffffffff){
+      u->offset_size = 8;
+      length = read_u(&all, 8);
+    }
+
+    if(!need(&all, length)) break;
+
+    struct reader r = {all.p, all.p + length, 0};
+    all.p += length;
+
+    if(read_header(&r, sections, u) < 0) continue;
+
+    run_program(&r, u, fn, arg);
+    units += 1;
+  }
+
+  free(u);
+
+  return units;
+}
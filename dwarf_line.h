@@ -0,0 +1,42 @@
+
+/*
+ * dwarf_line.h
+ *
+ * Decoder for DWARF .debug_line line number programs, versions 2 to 5.
+ *
+ * Just enough of DWARF to map code addresses to source file and line, for
+ * symbolizing the fptr of received records without running addr2line.
+ * Directory and file names are returned as pointers into the sections, so
+ * decoding allocates nothing.
+ */
+
+#ifndef _DWARF_LINE_H_
+#define _DWARF_LINE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct dwarf_sections {
+  const uint8_t *line;      // .debug_line
+  size_t line_size;
+  const uint8_t *line_str;  // .debug_line_str (DWARF 5), or 0
+  size_t line_str_size;
+  const uint8_t *str;       // .debug_str, or 0
+  size_t str_size;
+};
+
+/* Called for every row of the line table
+ *
+ * dir is 0 when name is absolute or has no directory.  line 0 ends a
+ * sequence, there is no line information from addr onwards.
+ */
+typedef void (*dwarf_line_fn)(void *arg, uint64_t addr, const char *dir, const char *name, uint32_t line);
+
+/* Decode every line number program (one per compilation unit)
+ *
+ * Units in a format this decoder doesn't handle are skipped.
+ * Returns the number of units decoded.
+ */
+int dwarf_line_decode(const struct dwarf_sections *sections, dwarf_line_fn fn, void *arg);
+
+#endif /* _DWARF_LINE_H_ */
@@ -0,0 +1,66 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "intern.h"
+#include "fnv_hash.h"
+
+struct intern_entry {
+  const char *lit;
+  const char *lit2;
+  uint64_t    id;
+  uint32_t    uses;
+};
+
+// Per thread so the cache is lock free.  Literals are keyed by address.
+static __thread struct intern_entry intern_cache[INTERN_CACHE_SIZE];
+
+static inline uint32_t intern_slot(const char *lit, const char *lit2){
+  uint64_t k = (uint64_t)lit ^ ((uint64_t)lit2 << 1);
+  k *= 0x9E3779B97F4A7C15ULL;
+  return (uint32_t)(k >> 32) & (INTERN_CACHE_SIZE - 1);
+}
+
+int intern_literal(const char *lit, const char *lit2, uint8_t *payload){
+  struct intern_entry *e = &intern_cache[intern_slot(lit, lit2)];
+
+  payload[0] = INTERN_MARK;
+
+  if((e->lit == lit) && (e->lit2 == lit2) && ((++e->uses % INTERN_REDEFINE_EVERY) != 0)){
+    memcpy(payload + 1, &e->id, sizeof(e->id));
+    return INTERN_REF_LEN;
+  }
+
+  // First use (or periodic resend), send the definition
+  char *text = (char *)payload + INTERN_REF_LEN;
+
+  int len = strlen(lit);
+  if(len >= INTERN_MAX_TEXT) return -1;
+  memcpy(text, lit, len);
+
+  if(lit2){
+    int len2 = strlen(lit2);
+    if((len + 1 + len2) >= INTERN_MAX_TEXT) return -1;
+    text[len++] = ' ';
+    memcpy(text + len, lit2, len2);
+    len += len2;
+  }
+
+  text[len] = 0;
+
+  if((e->lit != lit) || (e->lit2 != lit2)){
+    e->lit  = lit;
+    e->lit2 = lit2;
+    e->id   = fnv_64a_str(text, FNV1A_64_INIT);
+    e->uses = 0;
+  }
+
+  memcpy(payload + 1, &e->id, sizeof(e->id));
+
+  return INTERN_REF_LEN + len + 1;
+}
+
+void intern_unsent(const char *lit, const char *lit2){
+  struct intern_entry *e = &intern_cache[intern_slot(lit, lit2)];
+
+  if((e->lit == lit) && (e->lit2 == lit2)) e->lit = 0;
+}
@@ -0,0 +1,65 @@
+
+/*
+ * intern.h
+ *
+ * String-literal interning for constant trace payloads.
+ *
+ * TRACE_FUNC_ENTER(), TRACE_FUNC_EXIT(), TRACE_BRANCH("...") and LG_ASSERT()
+ * send the same constant strings over and over.  Instead the first send of a
+ * literal carries an id plus the text (a definition) and later sends carry
+ * only the id (a reference).
+ *
+ * Payload formats (in place of the usual 0 terminated string):
+ *
+ *   definition: INTERN_MARK, id (8 bytes), text, 0
+ *   reference:  INTERN_MARK, id (8 bytes)
+ *
+ * id is fnv_64a_str() of the text so it is stable across processes.
+ *
+ * The receiver keeps a per publisher dictionary of definitions.
+ * Definitions are resent every INTERN_REDEFINE_EVERY uses so a receiver that
+ * subscribes late learns the text without the publisher knowing.
+ */
+
+#ifndef _INTERN_H_
+#define _INTERN_H_
+
+#include <stdint.h>
+
+#define INTERN_MARK            0x01 // never the first byte of a printf rendered string
+#define INTERN_REF_LEN         (1 + sizeof(uint64_t))
+#define INTERN_MAX_TEXT        512  // longer literals are sent as plain strings
+#define INTERN_REDEFINE_EVERY  1024
+
+#define INTERN_CACHE_SIZE      256  // per thread, must be a power of 2
+
+/* Render the interned payload for a literal (or a pair of literals joined by
+ * a space) into payload.  Used by log_literal().
+ *
+ * payload must be at least INTERN_REF_LEN + INTERN_MAX_TEXT bytes.
+ *
+ * Returns the payload length or -1 if the literal is too long to intern.
+ */
+int intern_literal(const char *lit, const char *lit2, uint8_t *payload);
+
+/* The definition rendered by intern_literal() was not sent (the send
+ * buffer was full), send it again on the next use rather than references
+ * the receiver can't resolve.
+ */
+void intern_unsent(const char *lit, const char *lit2);
+
+/* Return true if the payload of a non packet message is interned
+ */
+static inline int is_interned_payload(const void *payload, uint64_t payload_len){
+  return (payload_len >= INTERN_REF_LEN) && (*(const uint8_t *)payload == INTERN_MARK);
+}
+
+/* Return the id of an interned payload
+ */
+static inline uint64_t interned_payload_id(const void *payload){
+  uint64_t id;
+  __builtin_memcpy(&id, (const uint8_t *)payload + 1, sizeof(id));
+  return id;
+}
+
+#endif /* _INTERN_H_ */
@@ -0,0 +1,126 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "intern.h"
+#include "intern_dict.h"
+
+struct intern_def {
+  uint64_t prog_hash;
+  uint64_t process_id;
+  uint64_t id;
+  char    *text;       // 0 = empty slot
+  uint64_t text_len;   // including terminating 0
+};
+
+struct intern_dict {
+  struct intern_def *slots;
+  uint64_t size;       // power of 2
+  uint64_t used;
+
+  char unknown[32];
+};
+
+static inline uint64_t intern_def_hash(uint64_t prog_hash, uint64_t process_id, uint64_t id){
+  uint64_t h = id ^ (prog_hash * 0x9E3779B97F4A7C15ULL) ^ (process_id * 0xC2B2AE3D27D4EB4FULL);
+  return h ^ (h >> 29);
+}
+
+static struct intern_def *intern_dict_slot(struct intern_dict *d,
+                                           uint64_t prog_hash, uint64_t process_id, uint64_t id){
+  uint64_t i = intern_def_hash(prog_hash, process_id, id) & (d->size - 1);
+
+  // linear probe, the table is never full
+  while(d->slots[i].text){
+    struct intern_def *e = &d->slots[i];
+    if((e->id == id) && (e->prog_hash == prog_hash) && (e->process_id == process_id)) break;
+    i = (i + 1) & (d->size - 1);
+  }
+
+  return &d->slots[i];
+}
+
+static void intern_dict_resize(struct intern_dict *d, uint64_t size){
+  struct intern_def *old = d->slots;
+  uint64_t old_size = d->size;
+  uint64_t i;
+
+  d->slots = calloc(size, sizeof(d->slots[0]));
+  d->size  = size;
+  d->used  = 0;
+
+  for(i = 0; i < old_size; i++){
+    if(!old[i].text) continue;
+    *intern_dict_slot(d, old[i].prog_hash, old[i].process_id, old[i].id) = old[i];
+    d->used += 1;
+  }
+
+  free(old);
+}
+
+struct intern_dict *intern_dict_new(){
+  struct intern_dict *d = calloc(1, sizeof(*d));
+  intern_dict_resize(d, 1024);
+  return d;
+}
+
+void intern_dict_free(struct intern_dict *d){
+  uint64_t i;
+  for(i = 0; i < d->size; i++) free(d->slots[i].text);
+  free(d->slots);
+  free(d);
+}
+
+const char *intern_dict_resolve(struct intern_dict *d,
+                                uint64_t prog_hash, uint64_t process_id,
+                                const void *payload, uint64_t payload_len,
+                                uint64_t *text_len){
+  uint64_t id = interned_payload_id(payload);
+
+  struct intern_def *e = intern_dict_slot(d, prog_hash, process_id, id);
+
+  if((payload_len > INTERN_REF_LEN) && !e->text){
+    // definition, remember the text
+    if((d->used + 1) * 4 > d->size * 3){
+      intern_dict_resize(d, d->size * 2);
+      e = intern_dict_slot(d, prog_hash, process_id, id);
+    }
+
+    const char *text = (const char *)payload + INTERN_REF_LEN;
+    uint64_t len = strnlen(text, payload_len - INTERN_REF_LEN);
+
+    e->prog_hash  = prog_hash;
+    e->process_id = process_id;
+    e->id         = id;
+    e->text       = malloc(len + 1);
+    e->text_len   = len + 1;
+    memcpy(e->text, text, len);
+    e->text[len]  = 0;
+
+    d->used += 1;
+  }
+
+  if(!e->text){
+    *text_len = snprintf(d->unknown, sizeof(d->unknown), "<interned %016lX>", id) + 1;
+    return d->unknown;
+  }
+
+  *text_len = e->text_len;
+  return e->text;
+}
+
+void intern_dict_purge(struct intern_dict *d, uint64_t prog_hash, uint64_t process_id){
+  uint64_t i;
+
+  for(i = 0; i < d->size; i++){
+    struct intern_def *e = &d->slots[i];
+    if(e->text && (e->prog_hash == prog_hash) && (e->process_id == process_id)){
+      free(e->text);
+      e->text = 0;
+    }
+  }
+
+  // rehash in place so probe chains stay intact
+  intern_dict_resize(d, d->size);
+}
@@ -0,0 +1,38 @@
+
+/*
+ * intern_dict.h
+ *
+ * Receiver side dictionary of interned string literals (see intern.h).
+ *
+ * Definitions are kept per publisher, keyed by (prog_hash, process_id, id).
+ */
+
+#ifndef _INTERN_DICT_H_
+#define _INTERN_DICT_H_
+
+#include <stdint.h>
+
+struct intern_dict;
+
+struct intern_dict *intern_dict_new();
+void intern_dict_free(struct intern_dict *d);
+
+/* Resolve an interned payload to its text.
+ *
+ * Definitions are added to the dictionary.  References to unknown ids
+ * (e.g. the definition was sent before we subscribed) resolve to
+ * "<interned XXXXXXXXXXXXXXXX>" until the definition is resent.
+ *
+ * Returns a 0 terminated string valid until the next call,
+ * *text_len is set to the length including the terminating 0.
+ */
+const char *intern_dict_resolve(struct intern_dict *d,
+                                uint64_t prog_hash, uint64_t process_id,
+                                const void *payload, uint64_t payload_len,
+                                uint64_t *text_len);
+
+/* Forget all definitions from one publisher
+ */
+void intern_dict_purge(struct intern_dict *d, uint64_t prog_hash, uint64_t process_id);
+
+#endif /* _INTERN_DICT_H_ */
@@ -0,0 +1,168 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "json_escape.h"
+
+/* Scalar escaping and runtime dispatch for json_escape().  Vector
+ * kernels are in json_escape_x86.c.
+ */
+
+static const char hex_digits[16] = "0123456789abcdef";
+
+/* Length of the valid UTF-8 sequence at s, 0 if it isn't one
+ * (overlong encodings, surrogates and code points past U+10FFFF are invalid)
+ */
+static size_t utf8_seq_len(const uint8_t *s, size_t len){
+  uint8_t c = s[0];
+
+  if((c >= 0xC2) && (c <= 0xDF)){
+    if((len >= 2) && ((s[1] & 0xC0) == 0x80)) return 2;
+  } else if((c >= 0xE0) && (c <= 0xEF)){
+    uint8_t lo = (c == 0xE0) ? 0xA0 : 0x80;
+    uint8_t hi = (c == 0xED) ? 0x9F : 0xBF;
+    if((len >= 3) && (s[1] >= lo) && (s[1] <= hi) && ((s[2] & 0xC0) == 0x80)) return 3;
+  } else if((c >= 0xF0) && (c <= 0xF4)){
+    uint8_t lo = (c == 0xF0) ? 0x90 : 0x80;
+    uint8_t hi = (c == 0xF4) ? 0x8F : 0xBF;
+    if((len >= 4) && (s[1] >= lo) && (s[1] <= hi) &&
+       ((s[2] & 0xC0) == 0x80) && ((s[3] & 0xC0) == 0x80)) return 4;
+  }
+
+  return 0;
+}
+
+/* Escape the byte (or UTF-8 sequence) at s that needs attention
+ *
+ * Sets *used to the input bytes consumed, returns the chars written.
+ */
+static size_t escape_special(const uint8_t *s, size_t len, char *d, size_t *used){
+  uint8_t c = s[0];
+  size_t n;
+
+  *used = 1;
+
+  switch(c){
+    case '"':  d[0] = '\\'; d[1] = '"';  return 2;
+    case '\\': d[0] = '\\'; d[1] = '\\'; return 2;
+    case '\b': d[0] = '\\'; d[1] = 'b';  return 2;
+    case '\f': d[0] = '\\'; d[1] = 'f';  return 2;
+    case '\n': d[0] = '\\'; d[1] = 'n';  return 2;
+    case '\r': d[0] = '\\'; d[1] = 'r';  return 2;
+    case '\t': d[0] = '\\'; d[1] = 't';  return 2;
+  }
+
+  if(c < 0x20){
+    memcpy(d, "\\u00", 4);
+    d[4] = hex_digits[c >> 4];
+    d[5] = hex_digits[c & 0xf];
+    return 6;
+  }
+
+  if(c < 0x80){
+    d[0] = c;
+    return 1;
+  }
+
+  n = utf8_seq_len(s, len);
+
+  if(n == 0){
+    memcpy(d, "\\ufffd", 6);    // not UTF-8, keep the output valid
+    return 6;
+  }
+
+  memcpy(d, s, n);
+  *used = n;
+  return n;
+}
+
+static inline int needs_escape(uint8_t c){
+  return (c < 0x20) || (c == '"') || (c == '\\') || (c >= 0x80);
+}
+
+size_t json_escape_scalar(const void *src, size_t len, char *dst){
+  const uint8_t *s = (const uint8_t *)src;
+  char *d = dst;
+  size_t i = 0, used;
+
+  while(i < len){
+    if(!needs_escape(s[i])){
+      *d++ = s[i++];
+      continue;
+    }
+
+    d += escape_special(s + i, len - i, d, &used);
+    i += used;
+  }
+
+  return d - dst;
+}
+
+static enum json_escape_impl json_escape_active = JSON_ESCAPE_IMPL_AUTO;
+
+static int json_escape_supported(enum json_escape_impl impl){
+  switch(impl){
+    case JSON_ESCAPE_IMPL_SCALAR:
+      return 1;
+#if defined(__x86_64__) || defined(__i386__)
+    case JSON_ESCAPE_IMPL_SSE2:
+      return __builtin_cpu_supports("sse2");
+    case JSON_ESCAPE_IMPL_AVX2:
+      return __builtin_cpu_supports("avx2");
+#endif
+    default:
+      return 0;
+  }
+}
+
+int json_escape_select(enum json_escape_impl impl){
+  if(impl == JSON_ESCAPE_IMPL_AUTO){
+    impl = json_escape_supported(JSON_ESCAPE_IMPL_AVX2) ? JSON_ESCAPE_IMPL_AVX2 :
+           json_escape_supported(JSON_ESCAPE_IMPL_SSE2) ? JSON_ESCAPE_IMPL_SSE2 :
+                                                          JSON_ESCAPE_IMPL_SCALAR;
+  }
+
+  if(!json_escape_supported(impl)) return 0;
+
+  json_escape_active = impl;
+  return 1;
+}
+
+const char *json_escape_impl_name(enum json_escape_impl impl){
+  switch(impl){
+    case JSON_ESCAPE_IMPL_SCALAR: return "scalar";
+    case JSON_ESCAPE_IMPL_SSE2:   return "sse2";
+    case JSON_ESCAPE_IMPL_AVX2:   return "avx2";
+    default:                      return "auto";
+  }
+}
+
+size_t json_escape(const void *src, size_t len, char *dst){
+  const uint8_t *s = (const uint8_t *)src;
+  size_t i = 0, o = 0, used, span;
+
+  if(json_escape_active == JSON_ESCAPE_IMPL_AUTO) json_escape_select(JSON_ESCAPE_IMPL_AUTO);
+
+  while(i < len){
+    span = 0;
+
+#if defined(__x86_64__) || defined(__i386__)
+    if(json_escape_active == JSON_ESCAPE_IMPL_AVX2) span = json_escape_avx2_span(s + i, len - i, dst + o);
+    if(json_escape_active == JSON_ESCAPE_IMPL_SSE2) span = json_escape_sse2_span(s + i, len - i, dst + o);
+#endif
+
+    i += span;
+    o += span;
+
+    if(i == len) break;
+
+    // Shorter than a block, finish with scalar code
+    if((span == 0) && !needs_escape(s[i])){
+      return o + json_escape_scalar(s + i, len - i, dst + o);
+    }
+
+    o += escape_special(s + i, len - i, dst + o, &used);
+    i += used;
+  }
+
+  return o;
+}
@@ -0,0 +1,56 @@
+
+/*
+ * json_escape.h
+ *
+ * JSON string escaping with runtime cpu dispatch
+ *
+ * json_escape() writes the contents of a JSON string (without the quotes):
+ * '"', '\' and control characters are escaped, valid UTF-8 is copied and
+ * bytes that aren't valid UTF-8 are replaced with �, so the output is
+ * always valid JSON whatever the input.
+ *
+ * Runs of bytes that need no escaping are found and copied 16 (SSE2) or 32
+ * (AVX2) bytes at a time, only the bytes that need attention take the
+ * scalar path.
+ */
+
+#ifndef _JSON_ESCAPE_H_
+#define _JSON_ESCAPE_H_
+
+#include <stddef.h>
+
+enum json_escape_impl {
+  JSON_ESCAPE_IMPL_AUTO = 0,   // best available
+  JSON_ESCAPE_IMPL_SCALAR,
+  JSON_ESCAPE_IMPL_SSE2,
+  JSON_ESCAPE_IMPL_AVX2
+};
+
+/* Upper bound of the escaped length of len bytes, every byte as \u00XX */
+#define json_escaped_max_len(len) ((len) * 6)
+
+/* Escape len bytes from src into dst.
+ * dst must have room for json_escaped_max_len(len) bytes.
+ * Returns the number of chars written, not 0 terminated.
+ */
+size_t json_escape(const void *src, size_t len, char *dst);
+
+/* Select the implementation used by json_escape().
+ * Returns 0 if the implementation is not supported by this cpu.
+ */
+int json_escape_select(enum json_escape_impl impl);
+
+const char *json_escape_impl_name(enum json_escape_impl impl);
+
+/* Implementations (see json_escape.c, json_escape_x86.c)
+ *
+ * Vector kernels copy the leading bytes that need no escaping, whole
+ * blocks at a time, and return how many.  They may store a whole block
+ * past that point, the caller overwrites it.
+ */
+size_t json_escape_scalar(const void *src, size_t len, char *dst);
+
+size_t json_escape_sse2_span(const unsigned char *src, size_t len, char *dst);
+size_t json_escape_avx2_span(const unsigned char *src, size_t len, char *dst);
+
+#endif /* _JSON_ESCAPE_H_ */
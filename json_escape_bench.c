@@ -0,0 +1,242 @@
+/* JSON string escaping throughput benchmark
+ *
+ * Compares json_escape() for each implementation this cpu supports with
+ * memcpy() of the same text, and checks every implementation produces
+ * output identical to the scalar code, for plain ASCII log text and for
+ * text with quotes, control characters, UTF-8 and invalid bytes.
+ *
+ * Also checks that records written by json_out.h are never split by a
+ * flush, with records bigger than the free space in the buffer.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>    /* for getopt */
+#include <time.h>
+
+#include "json_escape.h"
+#include "json_out.h"
+
+static uint64_t now_usec(){
+  struct timespec tv;
+  clock_gettime (CLOCK_MONOTONIC, &tv);
+  return (tv.tv_sec * (uint64_t) 1000000 + tv.tv_nsec / 1000);
+}
+
+static void report(const char *name, uint64_t bytes, uint64_t usec){
+  usec = (usec > 0) ? usec : 1;
+  fprintf(stdout, "    %-28s %8.1f MBytes/sec\n", name, (double)bytes / usec);
+}
+
+/* Printable ASCII, a log message
+ */
+static void fill_plain(char *s, int len){
+  static const char words[] = "connection established to peer, retrying in 5 seconds: state=OK count=42 ";
+  int i;
+  for(i = 0; i < len; i++) s[i] = words[i % (sizeof(words) - 1)];
+}
+
+/* Mostly ASCII with some of everything that needs escaping
+ */
+static void fill_mixed(char *s, int len){
+  static const char *special[] = {"\"", "\\", "\n", "\t", "\x01", "\xc3\xa9", "\xe2\x82\xac", "\xf0\x9f\x98\x80", "\xff", "\xc3"};
+  int i = 0;
+
+  while(i < len){
+    const char *p = ((rand() % 16) == 0) ? special[rand() % 10] : "abcdefgh";
+    int n = strlen(p);
+    if(n > (len - i)) n = len - i;
+    memcpy(s + i, p, n);
+    i += n;
+  }
+}
+
+static int run(const char *what, const char *text, int text_len, int iterations){
+  char *ref = malloc(json_escaped_max_len(text_len));
+  char *out = malloc(json_escaped_max_len(text_len));
+  enum json_escape_impl impl;
+  size_t ref_len, len = 0;
+  uint64_t usec;
+  int i;
+
+  fprintf(stdout, "%s text, %i bytes, %i iterations\n", what, text_len, iterations);
+
+  usec = now_usec();
+  for(i = 0; i < iterations; i++){
+    memcpy(out, text, text_len);
+    __asm__ __volatile__("" : : "r"(out) : "memory");
+  }
+  report("memcpy", (uint64_t)text_len * iterations, now_usec() - usec);
+
+  ref_len = json_escape_scalar(text, text_len, ref);
+
+  for(impl = JSON_ESCAPE_IMPL_SCALAR; impl <= JSON_ESCAPE_IMPL_AVX2; impl++){
+    if(!json_escape_select(impl)){
+      fprintf(stdout, "    %-28s not supported\n", json_escape_impl_name(impl));
+      continue;
+    }
+
+    usec = now_usec();
+    for(i = 0; i < iterations; i++){
+      len = json_escape(text, text_len, out);
+    }
+    report(json_escape_impl_name(impl), (uint64_t)text_len * iterations, now_usec() - usec);
+
+    if((len != ref_len) || memcmp(out, ref, len)){
+      fprintf(stdout, "FAIL %s output differs from the scalar code\n", json_escape_impl_name(impl));
+      return -1;
+    }
+  }
+
+  free(ref);
+  free(out);
+
+  return 0;
+}
+
+struct record_check {
+  uint64_t writes;
+  uint64_t records;         // closing braces written, the text has none
+  uint64_t torn;            // writes that didn't end a record
+};
+
+static void check_write(void *arg, const void *buf, size_t len){
+  struct record_check *rc = arg;
+  const char *p = buf;
+  size_t i;
+
+  rc->writes += 1;
+  for(i = 0; i < len; i++) rc->records += (p[i] == '}');
+
+  // JSON records end with "},\n", JSON Lines with "}\n"
+  int ends = (len >= 2) && (p[len - 1] == '\n') &&
+             ((p[len - 2] == '}') || ((len >= 3) && (p[len - 2] == ',') && (p[len - 3] == '}')));
+  if(!ends) rc->torn += 1;
+}
+
+/* Write log and packet records of growing size, JSON and JSON Lines, through
+ * a buffer smaller than the biggest of them, every write must end a record
+ */
+static int check_records(const char *text, int text_len){
+  struct record_check rc = {0};
+  struct sym_info sym = {"function_name", "src/dir", "file.c", 42};
+  struct Msg_Hdr lm;
+  struct out_buf out;
+  char *payload = malloc(text_len + 1);
+  uint64_t written = 0;
+  int len, lines;
+
+  memset(&lm, 0, sizeof(lm));
+  lm.prog_hash    = 0xACC8B08C0DB32B80ULL;
+  lm.function_ptr = 0x401000;
+  lm.process_id   = 21982;
+
+  out_buf_init(&out, -1, 0, 4096);
+  out.send     = check_write;
+  out.send_arg = &rc;
+
+  for(len = 0; len < text_len; len += 97){
+    memcpy(payload, text, len);
+    payload[len] = 0;
+
+    for(lines = 0; lines < 2; lines++){
+      void (*write_msg)(struct out_buf *, const struct Msg_Hdr *, const void *, uint64_t, const struct sym_info *) =
+        lines ? write_log_msg_jsonl : write_log_msg_json;
+
+      lm.usec += 1;
+      memcpy(lm.type_lvl, "LE      ", 8);
+      write_msg(&out, &lm, payload, len + 1, (len % 2) ? &sym : 0);
+
+      memcpy(lm.type_lvl, "PG      ", 8);
+      write_msg(&out, &lm, payload, len, 0);
+
+      written += 2;
+    }
+  }
+
+  out_buf_free(&out);
+  free(payload);
+
+  fprintf(stdout, "records, %lu written in %lu writes of a 4 KByte buffer\n", written, rc.writes);
+
+  if(rc.torn || (rc.records != written)){
+    fprintf(stdout, "FAIL %lu writes ended mid-record, %lu of %lu records\n", rc.torn, rc.records, written);
+    return -1;
+  }
+
+  return 0;
+}
+
+int main(int argc, char *argv[])
+{
+  struct {
+    int msg_size;
+    int iterations;
+  } config = {
+    .msg_size = 256,
+    .iterations = 1000000
+  };
+
+  int opt, len;
+
+  while ((opt = getopt(argc, argv, "hm:i:")) != -1) {
+    switch (opt) {
+
+      case 'm':
+        config.msg_size = atoi(optarg);
+        break;
+
+      case 'i':
+        config.iterations = atoi(optarg);
+        break;
+
+      case 'h':
+      default: /* '?' */
+        fprintf(stderr, "Usage: %s [-h][-m <bytes>][-i <count>]\n"
+                "-h     help\n"
+                "-m     message size in <bytes> (default 256)\n"
+                "-i     escape each message <count> times (default 1000000)\n",
+                argv[0]);
+        exit(EXIT_FAILURE);
+    }
+  }
+
+  char *text = malloc(config.msg_size);
+
+  fill_plain(text, config.msg_size);
+  if(run("plain", text, config.msg_size, config.iterations) < 0) exit(EXIT_FAILURE);
+
+  fill_mixed(text, config.msg_size);
+  if(run("mixed", text, config.msg_size, config.iterations) < 0) exit(EXIT_FAILURE);
+
+  // every length and alignment around the block sizes
+  for(len = 0; len <= 100; len++){
+    char ref[600], out[600];
+    int impl, start;
+
+    for(start = 0; start + len <= config.msg_size; start += 37){
+      size_t ref_len = json_escape_scalar(text + start, len, ref);
+
+      for(impl = JSON_ESCAPE_IMPL_SSE2; impl <= JSON_ESCAPE_IMPL_AVX2; impl++){
+        if(!json_escape_select(impl)) continue;
+
+        if((json_escape(text + start, len, out) != ref_len) || memcmp(out, ref, ref_len)){
+          fprintf(stdout, "FAIL %s output differs from the scalar code, %i bytes\n", json_escape_impl_name(impl), len);
+          exit(EXIT_FAILURE);
+        }
+      }
+    }
+  }
+
+  // records up to 6000 bytes, escaped up to 6 times that
+  len = (config.msg_size > 6000) ? config.msg_size : 6000;
+  text = realloc(text, len);
+  fill_mixed(text, len);
+  if(check_records(text, len) < 0) exit(EXIT_FAILURE);
+
+  free(text);
+
+  return 0;
+}
@@ -0,0 +1,86 @@
+/* SSE2 and AVX2 kernels for json_escape()
+ *
+ * A block is loaded, copied to the output unconditionally and checked for
+ * bytes that need attention: '"', '\', control characters and bytes
+ * >= 0x80 (the start of UTF-8 sequences).  A signed compare against 0x20
+ * catches both control characters and bytes >= 0x80, so a block costs a
+ * load, a store, three compares and a movemask.
+ *
+ * Kernels only process whole blocks and never read outside the source,
+ * the caller handles the byte that stopped the kernel and the tail.
+ * Compiled with per function target attributes, selected at runtime by
+ * json_escape_select().
+ */
+
+#include <stddef.h>
+
+#include "json_escape.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+#define SSE2 __attribute__((target("sse2")))
+#define AVX2 __attribute__((target("avx2")))
+
+/******* SSE2 ************/
+
+size_t SSE2 json_escape_sse2_span(const unsigned char *src, size_t len, char *dst){
+  const __m128i quote     = _mm_set1_epi8('"');
+  const __m128i backslash = _mm_set1_epi8('\\');
+  const __m128i space     = _mm_set1_epi8(0x20);
+  size_t done = 0;
+
+  while(len - done >= 16){
+    __m128i in = _mm_loadu_si128((const __m128i *)(src + done));
+
+    _mm_storeu_si128((__m128i *)(dst + done), in);
+
+    __m128i special = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(in, quote),
+                                                _mm_cmpeq_epi8(in, backslash)),
+                                   _mm_cmplt_epi8(in, space));
+
+    unsigned mask = _mm_movemask_epi8(special);
+
+    if(mask) return done + __builtin_ctz(mask);
+
+    done += 16;
+  }
+
+  return done;
+}
+
+/******* AVX2 ************/
+
+size_t AVX2 json_escape_avx2_span(const unsigned char *src, size_t len, char *dst){
+  const __m256i quote     = _mm256_set1_epi8('"');
+  const __m256i backslash = _mm256_set1_epi8('\\');
+  const __m256i space     = _mm256_set1_epi8(0x20);
+  size_t done = 0;
+
+  while(len - done >= 32){
+    __m256i in = _mm256_loadu_si256((const __m256i *)(src + done));
+
+    _mm256_storeu_si256((__m256i *)(dst + done), in);
+
+    __m256i special = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(in, quote),
+                                                      _mm256_cmpeq_epi8(in, backslash)),
+                                      _mm256_cmpgt_epi8(space, in));
+
+    unsigned mask = _mm256_movemask_epi8(special);
+
+    if(mask) return done + __builtin_ctz(mask);
+
+    done += 32;
+  }
+
+  // finish with 16 byte blocks
+  return done + json_escape_sse2_span(src + done, len - done, dst + done);
+}
+
+#else  // not x86, scalar only
+
+size_t json_escape_sse2_span(const unsigned char *src, size_t len, char *dst){ return 0; }
+size_t json_escape_avx2_span(const unsigned char *src, size_t len, char *dst){ return 0; }
+
+#endif
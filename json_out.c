@@ -0,0 +1,210 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "json_out.h"
+#include "base64.h"
+#include "json_escape.h"
+#include "util.h"
+
+/* Append s as the contents of a JSON string
+ */
+static inline void out_buf_put_escaped(struct out_buf *out, const void *s, size_t len){
+  char *p = out_buf_reserve(out, json_escaped_max_len(len));
+  out->len += json_escape(s, len, p);
+}
+
+/* Room for the keys and numbers of a record, at least the sum of what
+ * each out_buf_put_lit(), out_buf_put_dec() and out_buf_put_hex() below
+ * reserves
+ */
+#define JSON_REC_FIXED  384
+
+/* The most a string of len bytes takes, as is or escaped
+ */
+static inline size_t str_max_len(size_t len, int escape){
+  return escape ? json_escaped_max_len(len) : len;
+}
+
+/* Make room for the whole record before any of it is written
+ *
+ * Each field reserves its own space as well, a full buffer would be flushed
+ * in the middle of a record: records of workers sharing a file interleave,
+ * rotation splits a record across files.  Once the worst case fits the
+ * field reserves never flush.
+ */
+static inline void reserve_record(struct out_buf *out, const struct Msg_Hdr *lm, const void *payload,
+                                  uint64_t payload_len, const struct sym_info *sym, int escape){
+  size_t n = JSON_REC_FIXED;
+
+  if(sym && sym->func) n += str_max_len(strlen(sym->func), escape);
+  if(sym && sym->file){
+    n += str_max_len(strlen(sym->file), escape);
+    if(sym->dir) n += str_max_len(strlen(sym->dir), escape);
+  }
+
+  if(lm->type_lvl[0] != 'P'){
+    n += str_max_len(strnlen(payload, payload_len), escape);
+  } else {
+    n += base64_encoded_len(payload_len);
+  }
+
+  out_buf_reserve(out, n);
+}
+
+/* Append "dir/file:line", escaped for JSON Lines
+ */
+static void out_buf_put_src(struct out_buf *out, const struct sym_info *sym, int escape){
+  if(sym->dir){
+    if(escape) out_buf_put_escaped(out, sym->dir, strlen(sym->dir)); else out_buf_put_str(out, sym->dir);
+    out_buf_put_lit(out, "/");
+  }
+
+  if(escape) out_buf_put_escaped(out, sym->file, strlen(sym->file)); else out_buf_put_str(out, sym->file);
+  out_buf_put_lit(out, ":");
+  out_buf_put_dec(out, sym->line, 0);
+}
+
+/* Dump the log message to the output buffer in JSON format
+ *
+ * Output is byte for byte what the printf formats below would produce.
+ */
+void write_log_msg_json(struct out_buf *out, const struct Msg_Hdr *lm, const void *payload, uint64_t payload_len,
+                        const struct sym_info *sym){
+
+  reserve_record(out, lm, payload, payload_len, sym, 0);
+
+  out_buf_put_lit(out, "{usec: ");                               // "usec: %li"
+  out_buf_put_dec(out, lm->usec, 0);
+  out_buf_put_lit(out, ", eid: ");                               // ", eid: %lX"
+  out_buf_put_hex(out, lm->prog_hash, 0);
+  out_buf_put_lit(out, ", pid: ");                               // ", pid: %5li"
+  out_buf_put_dec(out, lm->process_id, 5);
+  out_buf_put_lit(out, ", fptr: ");                              // ", fptr: %8lX"
+  out_buf_put_hex(out, lm->function_ptr, 8);
+
+  if(sym && sym->func){
+    out_buf_put_lit(out, ", func: ");                            // ", func: %s"
+    out_buf_put_str(out, sym->func);
+  }
+
+  if(sym && sym->file){
+    out_buf_put_lit(out, ", src: ");                             // ", src: %s/%s:%i"
+    out_buf_put_src(out, sym, 0);
+  }
+
+  out_buf_put_lit(out, ", line: ");                              // ", line: %4li"
+  out_buf_put_dec(out, lm->file_line_number, 4);
+  out_buf_put_lit(out, ", mask: ");                              // ", mask: %.8s"
+  out_buf_put(out, lm->type_lvl, strnlen(lm->type_lvl, sizeof(lm->type_lvl)));
+
+  if(lm->type_lvl[0] != 'P'){
+    // char string payload
+
+    out_buf_put_lit(out, ", str: \"");                           // ", str: \"%s\""
+    out_buf_put(out, payload, strnlen(payload, payload_len));
+    out_buf_put_lit(out, "\"");
+
+  } else {
+    // binary payload (packet), encoded straight into the output buffer
+
+    out_buf_put_lit(out, ", pkt: \"");                           // ", pkt: \"%s\""
+    char *base64_ptr = out_buf_reserve(out, base64_encoded_len(payload_len));
+    out->len += base64_encode(payload, payload_len, base64_ptr);
+    out_buf_put_lit(out, "\"");
+  }
+
+  out_buf_put_lit(out, "},\n");
+}
+
+void write_svc_desc_json(struct out_buf *out, uint64_t timestamp_usec, uint64_t prog_hash, int process_id,
+                         const struct sockaddr_in *addr, const char *program_name, uint64_t name_len){
+  char addr_str[INET_ADDRSTRLEN];
+  inet_ntop(AF_INET, &(addr->sin_addr), addr_str, sizeof(addr_str));
+
+  int port = ntohs(addr->sin_port);
+
+  out_buf_reserve(out, JSON_REC_FIXED + name_len);
+
+  out_buf_put_lit(out, "{usec: ");
+  out_buf_put_dec(out, timestamp_usec, 0);
+  out_buf_put_lit(out, ", eid: ");
+  out_buf_put_hex(out, prog_hash, 0);
+  out_buf_put_lit(out, ", pid: ");
+  out_buf_put_dec(out, process_id, 5);
+  out_buf_put_lit(out, ",  uri: ");
+  out_buf_put_str(out, addr_str);
+  out_buf_put_lit(out, ":");
+  out_buf_put_dec(out, port, 0);
+  out_buf_put_lit(out, ", prog: ");
+  out_buf_put(out, program_name, strnlen(program_name, name_len));
+  out_buf_put_lit(out, "}\n");
+}
+
+void write_log_msg_jsonl(struct out_buf *out, const struct Msg_Hdr *lm, const void *payload, uint64_t payload_len,
+                         const struct sym_info *sym){
+
+  reserve_record(out, lm, payload, payload_len, sym, 1);
+
+  out_buf_put_lit(out, "{\"usec\":");
+  out_buf_put_dec(out, lm->usec, 0);
+  out_buf_put_lit(out, ",\"eid\":\"");
+  out_buf_put_hex(out, lm->prog_hash, 0);
+  out_buf_put_lit(out, "\",\"pid\":");
+  out_buf_put_dec(out, lm->process_id, 0);
+  out_buf_put_lit(out, ",\"fptr\":\"");
+  out_buf_put_hex(out, lm->function_ptr, 0);
+
+  if(sym && sym->func){
+    out_buf_put_lit(out, "\",\"func\":\"");
+    out_buf_put_escaped(out, sym->func, strlen(sym->func));
+  }
+
+  if(sym && sym->file){
+    out_buf_put_lit(out, "\",\"src\":\"");
+    out_buf_put_src(out, sym, 1);
+  }
+
+  out_buf_put_lit(out, "\",\"line\":");
+  out_buf_put_dec(out, lm->file_line_number, 0);
+  out_buf_put_lit(out, ",\"mask\":\"");
+  out_buf_put_escaped(out, lm->type_lvl, strnlen(lm->type_lvl, sizeof(lm->type_lvl)));
+
+  if(lm->type_lvl[0] != 'P'){
+    out_buf_put_lit(out, "\",\"str\":\"");
+    out_buf_put_escaped(out, payload, strnlen(payload, payload_len));
+  } else {
+    // base64 never needs escaping
+    out_buf_put_lit(out, "\",\"pkt\":\"");
+    char *base64_ptr = out_buf_reserve(out, base64_encoded_len(payload_len));
+    out->len += base64_encode(payload, payload_len, base64_ptr);
+  }
+
+  out_buf_put_lit(out, "\"}\n");
+}
+
+void write_svc_desc_jsonl(struct out_buf *out, uint64_t timestamp_usec, uint64_t prog_hash, int process_id,
+                          const struct sockaddr_in *addr, const char *program_name, uint64_t name_len){
+  char addr_str[INET_ADDRSTRLEN];
+  inet_ntop(AF_INET, &(addr->sin_addr), addr_str, sizeof(addr_str));
+
+  out_buf_reserve(out, JSON_REC_FIXED + json_escaped_max_len(name_len));
+
+  out_buf_put_lit(out, "{\"usec\":");
+  out_buf_put_dec(out, timestamp_usec, 0);
+  out_buf_put_lit(out, ",\"eid\":\"");
+  out_buf_put_hex(out, prog_hash, 0);
+  out_buf_put_lit(out, "\",\"pid\":");
+  out_buf_put_dec(out, process_id, 0);
+  out_buf_put_lit(out, ",\"uri\":\"");
+  out_buf_put_str(out, addr_str);
+  out_buf_put_lit(out, ":");
+  out_buf_put_dec(out, ntohs(addr->sin_port), 0);
+  out_buf_put_lit(out, "\",\"prog\":\"");
+  out_buf_put_escaped(out, program_name, strnlen(program_name, name_len));
+  out_buf_put_lit(out, "\"}\n");
+}
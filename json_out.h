@@ -0,0 +1,50 @@
+
+/*
+ * json_out.h
+ *
+ * Serialize received log/trace/pkt messages in the log_to_file JSON format.
+ *
+ * {usec: 1234, eid: ABCD, pid:   123, fptr:   401234, line:   12, mask: LE      , str: "..."},
+ *
+ * or as JSON Lines, one valid JSON object per line (json_escape.h),
+ *
+ * {"usec":1234,"eid":"ABCD","pid":123,"fptr":"401234","line":12,"mask":"LE      ","str":"..."}
+ */
+
+#ifndef _JSON_OUT_H_
+#define _JSON_OUT_H_
+
+#include <stdint.h>
+#include <netinet/in.h>
+
+#include "log_msg.h"
+#include "out_buf.h"
+#include "symbolizer.h"
+
+/* Append one message in JSON format
+ *
+ * payload is a 0 terminated string unless type_lvl[0] == 'P' (packet),
+ * packets are base64 encoded.  sym adds func and src (file:line) fields
+ * after fptr, see symbolizer.h, or is 0.
+ */
+void write_log_msg_json(struct out_buf *out, const struct Msg_Hdr *lm, const void *payload, uint64_t payload_len,
+                        const struct sym_info *sym);
+
+/* Append one service descriptor in JSON format
+ *
+ * {usec: 1234, eid: ABCD, pid:   123,  uri: 10.0.0.1:5555, prog: name}
+ */
+void write_svc_desc_json(struct out_buf *out, uint64_t timestamp_usec, uint64_t prog_hash, int process_id,
+                         const struct sockaddr_in *addr, const char *program_name, uint64_t name_len);
+
+/* As above, JSON Lines
+ *
+ * Strings are escaped, 64 bit ids and addresses are hex strings.
+ */
+void write_log_msg_jsonl(struct out_buf *out, const struct Msg_Hdr *lm, const void *payload, uint64_t payload_len,
+                         const struct sym_info *sym);
+
+void write_svc_desc_jsonl(struct out_buf *out, uint64_t timestamp_usec, uint64_t prog_hash, int process_id,
+                          const struct sockaddr_in *addr, const char *program_name, uint64_t name_len);
+
+#endif /* _JSON_OUT_H_ */
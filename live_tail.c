@@ -0,0 +1,64 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <nanomsg/nn.h>
+#include <nanomsg/pubsub.h>
+
+#include "live_tail.h"
+#include "json_out.h"
+#include "out_buf.h"
+
+struct live_tail *live_tail_open(const char *url, int queue_size){
+  struct live_tail *t = calloc(1, sizeof(*t));
+
+  t->sock = nn_socket(AF_SP, NN_PUB);
+  if(t->sock < 0) goto fail;
+
+  if(queue_size > 0){
+    nn_setsockopt(t->sock, NN_SOL_SOCKET, NN_SNDBUF, &queue_size, sizeof(queue_size));
+  }
+
+  if(nn_bind(t->sock, url) < 0){
+    nn_close(t->sock);
+    goto fail;
+  }
+
+  return t;
+
+fail:
+  free(t);
+  return 0;
+}
+
+void live_tail_close(struct live_tail *t){
+  nn_close(t->sock);
+  free(t);
+}
+
+void live_tail_publish(struct live_tail *t, const struct Msg_Hdr *lm, const void *payload, uint64_t payload_len){
+  static __thread struct out_buf ob;   // the thread's message, fd -1 never writes
+
+  // room for the whole record up front, a full buffer would be discarded
+  size_t bound = LIVE_TAIL_TOPIC_LEN + 512 + payload_len * 6;
+
+  if(ob.cap < bound){
+    free(ob.buf);
+    out_buf_init(&ob, -1, 0, (bound > OUT_BUF_SIZE / 16) ? bound : OUT_BUF_SIZE / 16);
+  }
+
+  ob.len = 0;
+  out_buf_put(&ob, lm->type_lvl, LIVE_TAIL_TOPIC_LEN);
+  write_log_msg_jsonl(&ob, lm, payload, payload_len, 0);
+
+  // PUB never blocks, a consumer with a full queue misses the record
+  if(nn_send(t->sock, ob.buf, ob.len, NN_DONTWAIT) < 0){
+    __atomic_fetch_add(&t->failed, 1, __ATOMIC_RELAXED);
+    return;
+  }
+
+  __atomic_fetch_add(&t->msgs, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&t->bytes, ob.len, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,54 @@
+
+/*
+ * live_tail.h
+ *
+ * Live view of the records as they are received, for dashboards, alerting
+ * and grep tools that would otherwise tail the output files.
+ *
+ * log_to_file -L <url> binds a nanomsg PUB socket, tcp://host:port or
+ * ipc:///path for a Unix socket, and publishes every record as
+ *
+ *   type_lvl (8 bytes, as sent)  JSON Lines record (json_out.h)
+ *
+ * so a consumer subscribes with NN_SUB_SUBSCRIBE on mask prefixes, e.g.
+ * "LE" for errors or "T" for all trace, and nanomsg's prefix match does
+ * the filtering.  The records are JSON with interned strings resolved, in
+ * the order each worker receives them (not -o order).
+ *
+ * Each consumer has its own queue of -Q MBytes (NN_SNDBUF of its pipe).  A
+ * consumer that falls behind loses the records that don't fit its queue,
+ * publishing never waits, so disk writing and the other consumers are not
+ * held up.  See log_tail for a consumer.
+ */
+
+#ifndef _LIVE_TAIL_H_
+#define _LIVE_TAIL_H_
+
+#include <stdint.h>
+
+#include "log_msg.h"
+
+#define LIVE_TAIL_QUEUE_SIZE  (4 << 20)  // default per consumer queue
+#define LIVE_TAIL_TOPIC_LEN   8          // type_lvl
+
+struct live_tail {
+  int sock;             // PUB
+
+  // updated atomically by the workers
+  volatile uint64_t msgs;
+  volatile uint64_t bytes;
+  volatile uint64_t failed;   // nn_send() errors
+};
+
+/* Bind the PUB socket, returns 0 if the url can't be bound
+ */
+struct live_tail *live_tail_open(const char *url, int queue_size);
+void live_tail_close(struct live_tail *t);
+
+/* Publish one record, safe to call from any thread
+ *
+ * payload is a 0 terminated string unless type_lvl[0] == 'P' (packet).
+ */
+void live_tail_publish(struct live_tail *t, const struct Msg_Hdr *lm, const void *payload, uint64_t payload_len);
+
+#endif /* _LIVE_TAIL_H_ */
@@ -0,0 +1,134 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "load_shed.h"
+
+/* Map an 8 char type_lvl string to the class used for shedding
+ *
+ * See logger.h for the level definitions.
+ */
+enum shed_class shed_classify(const char *type_lvl){
+
+  switch(type_lvl[0]){
+    case 'P':
+      return SHED_CLASS_PKT;
+
+    case 'T':
+      if(type_lvl[1] == 'F') return SHED_CLASS_FUNC;
+      if(type_lvl[1] == 'E') return SHED_CLASS_NEVER; // exceptions
+      return SHED_CLASS_INFO;
+
+    case 'L':
+      if(type_lvl[1] == 'I') return SHED_CLASS_INFO;
+      if((type_lvl[1] == 'D') && (type_lvl[2] != 'A')) return SHED_CLASS_INFO;
+      return SHED_CLASS_NEVER; // errors, warnings, asserts, shed reports
+
+    default:
+      return SHED_CLASS_NEVER;
+  }
+}
+
+int shed_admit(struct load_shed *ls, const char *type_lvl){
+  enum shed_class c = shed_classify(type_lvl);
+
+  if(ls->shift[c] == 0) return 1;
+
+  uint32_t mask = (1u << ls->shift[c]) - 1;
+
+  // send the first of every (mask+1) messages in the class
+  if((ls->counter[c]++ & mask) == 0) return 1;
+
+  ls->shed += 1;
+  return 0;
+}
+
+/* Recompute per class sampling factors from the pressure level.
+ *
+ * Pressure is applied to one class at a time, least valuable first.
+ * A class is only shed further once the class before it is at maximum.
+ */
+static void shed_apply_level(struct load_shed *ls){
+  int c;
+  int remaining = ls->level;
+
+  ls->shift[SHED_CLASS_NEVER] = 0;
+
+  for(c = SHED_CLASS_PKT; c > SHED_CLASS_NEVER; c--){
+    int steps = (remaining > SHED_STEPS_PER_CLASS) ? SHED_STEPS_PER_CLASS : remaining;
+    ls->shift[c] = steps;
+    remaining -= steps;
+  }
+}
+
+int shed_account(struct load_shed *ls, int sent, uint64_t usec){
+  int report = 0;
+
+  ls->window_attempts += 1;
+
+  if(!sent){
+    ls->window_failures += 1;
+    ls->dropped += 1;
+  }
+
+  if(ls->window_start_usec == 0) ls->window_start_usec = usec;
+
+  if((usec - ls->window_start_usec) < SHED_WINDOW_USEC) return 0;
+
+  int level = ls->level;
+
+  if(ls->window_failures > 0){
+    // rising pressure, step harder if more than 1 in 8 sends failed
+    level += ((ls->window_failures * 8) > ls->window_attempts) ? 2 : 1;
+    if(level > SHED_MAX_LEVEL) level = SHED_MAX_LEVEL;
+
+  } else if (level > 0) {
+    // a full window without loss, back off one step
+    level -= 1;
+  }
+
+  if(level != ls->level){
+    ls->level = level;
+    shed_apply_level(ls);
+    report = 1;
+  }
+
+  if(((ls->level > 0) || (ls->window_failures > 0)) &&
+     ((usec - ls->last_report_usec) >= SHED_REPORT_USEC)){
+    report = 1;
+  }
+
+  if(report) ls->last_report_usec = usec;
+
+  ls->window_start_usec = usec;
+  ls->window_attempts   = 0;
+  ls->window_failures   = 0;
+
+  return report;
+}
+
+int shed_report(const struct load_shed *ls, char *buf, int buf_len){
+  return snprintf(buf, buf_len,
+                  "level=%i pkt=%u func=%u info=%u dropped=%lu shed=%lu",
+                  ls->level,
+                  1u << ls->shift[SHED_CLASS_PKT],
+                  1u << ls->shift[SHED_CLASS_FUNC],
+                  1u << ls->shift[SHED_CLASS_INFO],
+                  ls->dropped,
+                  ls->shed);
+}
+
+int shed_parse_report(const char *report, int len, int *level, uint64_t *dropped, uint64_t *shed){
+  char buf[128];
+  unsigned pkt, func, info;
+
+  // the payload isn't always terminated
+  if(len >= (int)sizeof(buf)) len = sizeof(buf) - 1;
+  memcpy(buf, report, len);
+  buf[len] = 0;
+
+  if(sscanf(buf, "level=%i pkt=%u func=%u info=%u dropped=%lu shed=%lu",
+            level, &pkt, &func, &info, dropped, shed) != 6) return -1;
+
+  return 0;
+}
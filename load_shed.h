@@ -0,0 +1,86 @@
+
+/*
+ * load_shed.h
+ *
+ * Adaptive load shedding for the log/trace/pkt publisher.
+ *
+ * When the publish socket send buffer is full nn_sendmsg() fails and the
+ * message is lost.  Under sustained overload that loses random bursts of
+ * every message type.
+ *
+ * The shed controller watches the send failure rate and, as pressure rises,
+ * progressively downsamples the least valuable message classes first:
+ *
+ *   packets -> function enter/exit trace -> info/debug
+ *
+ * Errors, warnings, asserts and exceptions are never shed.
+ *
+ * The current sampling factors are reported in-band with LOG_LVL_SHED
+ * messages so the receiver can scale counts back up.
+ */
+
+#ifndef _LOAD_SHED_H_
+#define _LOAD_SHED_H_
+
+#include <stdint.h>
+
+enum shed_class {
+  SHED_CLASS_NEVER = 0, // errors, warnings, asserts... always sent
+  SHED_CLASS_INFO,      // log debug/info, generic trace
+  SHED_CLASS_FUNC,      // function enter/exit trace
+  SHED_CLASS_PKT,       // packet capture
+  SHED_CLASSES
+};
+
+#define SHED_WINDOW_USEC       100000  // evaluate pressure every 100 msec
+#define SHED_REPORT_USEC      1000000  // report factors at least every second while shedding
+#define SHED_STEPS_PER_CLASS        6  // each class is shed to at most 1 in 2^6 messages
+#define SHED_MAX_LEVEL (SHED_STEPS_PER_CLASS * (SHED_CLASSES - 1))
+
+struct load_shed {
+  int level;                         // 0 = no shedding ... SHED_MAX_LEVEL
+
+  uint32_t shift[SHED_CLASSES];      // send 1 in (1 << shift[class]) messages
+  uint32_t counter[SHED_CLASSES];    // messages offered per class
+
+  uint64_t window_start_usec;
+  uint32_t window_attempts;
+  uint32_t window_failures;
+
+  uint64_t last_report_usec;
+
+  uint64_t dropped;                  // messages lost because send buffer was full
+  uint64_t shed;                     // messages discarded by the controller
+};
+
+/* Map an 8 char type_lvl string to the class used for shedding
+ */
+enum shed_class shed_classify(const char *type_lvl);
+
+/* Return true if a message of type_lvl should be formatted and sent.
+ *
+ * Called before any formatting so shed messages cost almost nothing.
+ */
+int shed_admit(struct load_shed *ls, const char *type_lvl);
+
+/* Account for the result of one send attempt.
+ *
+ * Returns true when the sampling factors changed or are due to be
+ * re-reported.  The caller should then send a LOG_LVL_SHED message
+ * rendered with shed_report().
+ */
+int shed_account(struct load_shed *ls, int sent, uint64_t usec);
+
+/* Render the current sampling factors and loss counters as a string
+ *
+ * Format: "level=%i pkt=%u func=%u info=%u dropped=%lu shed=%lu"
+ */
+int shed_report(const struct load_shed *ls, char *buf, int buf_len);
+
+/* Parse a report rendered by shed_report(), for the receiver
+ *
+ * Returns 0 on success, -1 if the report isn't in the expected format.
+ */
+int shed_parse_report(const char *report, int len, int *level, uint64_t *dropped, uint64_t *shed);
+
+#endif /* _LOAD_SHED_H_ */
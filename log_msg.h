@@ -0,0 +1,25 @@
+
+/*
+ * log_msg.h
+ *
+ * Log/trace/pkt message header as decoded by the receiver.
+ * See log_wire.h for the layout on the wire.
+ */
+
+#ifndef _LOG_MSG_H_
+#define _LOG_MSG_H_
+
+#include <stdint.h>
+
+struct Msg_Hdr {
+  char     type_lvl[8];
+  uint64_t prog_hash;
+
+  uint64_t function_ptr;
+  uint64_t process_id;
+  uint64_t file_line_number;
+
+  uint64_t usec;
+};
+
+#endif /* _LOG_MSG_H_ */
@@ -0,0 +1,797 @@
+#define _GNU_SOURCE     /* for memmem */
+
+/* Republish a capture written by log_to_file, with the timing of the capture
+ *
+ * Reads JSON (the legacy format or JSON Lines) and binary segment files,
+ * compressed or not, recreates one publisher per (eid, pid) of the capture
+ * and advertises each to the receiver as a component would.  Records are
+ * then sent in time order with their original inter-arrival times divided by
+ * -x, or as fast as possible with -x 0, so a receiver under test sees the
+ * mix, sizes and bursts of real traffic.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <unistd.h>    /* for getopt */
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <nanomsg/nn.h>
+#include <nanomsg/pubsub.h>
+#include <nanomsg/pipeline.h>
+
+#include "context.h"
+#include "discovery.h"
+#include "util.h"
+#include "log_wire.h"
+#include "segment.h"
+#include "zfile.h"
+#include "base64.h"
+#include "fnv_hash.h"
+
+#define REPLAY_SETTLE_MSEC  1000      // time for the receiver to subscribe before the first record
+#define REPLAY_SPIN_USEC    100       // records due within this are sent without sleeping
+#define ARENA_CHUNK         (4 << 20)
+
+struct replay_rec {
+  struct log_wire_hdr hdr;
+  const char *payload;      // into the mapped file or the arena
+  uint32_t payload_len;
+  uint16_t add_nul;         // JSON strings, sent 0 terminated as liblog does
+  uint32_t pub;
+  uint64_t seq;             // capture order, keeps the sort stable
+};
+
+struct replay_pub {
+  uint64_t prog_hash;
+  uint64_t process_id;
+  char     program_name[256];
+
+  int      sock;
+  struct sockaddr_in addr;
+
+  uint64_t sent;
+  uint64_t dropped;
+};
+
+struct replay {
+  struct replay_rec *recs;
+  uint64_t count;
+  uint64_t cap;
+
+  struct replay_pub *pubs;
+  uint32_t pubs_count;
+  uint32_t pubs_cap;
+  uint32_t *slots;          // open addressing, pub index + 1, 0 = empty
+  uint64_t slots_size;
+
+  char    *arena;           // decoded payloads, chunks live until exit
+  size_t   arena_len;
+  size_t   arena_cap;
+
+  uint64_t bad;             // lines that aren't records
+};
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void request_stop(int sig){
+  (void)sig;
+  stop_requested = 1;
+}
+
+static char *arena_alloc(struct replay *rp, size_t len){
+  if((rp->arena_len + len) > rp->arena_cap){
+    rp->arena_cap = (len > ARENA_CHUNK) ? len : ARENA_CHUNK;
+    rp->arena     = malloc(rp->arena_cap);
+    rp->arena_len = 0;
+  }
+
+  char *p = rp->arena + rp->arena_len;
+  rp->arena_len += len;
+  return p;
+}
+
+static uint64_t pub_slot(struct replay *rp, uint64_t prog_hash, uint64_t process_id){
+  uint64_t key[2] = {prog_hash, process_id};
+  uint64_t i = fnv_64a_buf(key, sizeof(key), FNV1A_64_INIT) & (rp->slots_size - 1);
+
+  while(rp->slots[i]){
+    struct replay_pub *pub = &rp->pubs[rp->slots[i] - 1];
+    if((pub->prog_hash == prog_hash) && (pub->process_id == process_id)) break;
+    i = (i + 1) & (rp->slots_size - 1);
+  }
+
+  return i;
+}
+
+/* The publisher of (prog_hash, process_id), added on first use
+ */
+static struct replay_pub *find_pub(struct replay *rp, uint64_t prog_hash, uint64_t process_id){
+  uint64_t i, j;
+
+  if(((rp->pubs_count + 1) * 2) > rp->slots_size){
+    uint32_t *old = rp->slots;
+    uint64_t old_size = rp->slots_size;
+
+    rp->slots_size = old_size ? (old_size * 2) : 256;
+    rp->slots = calloc(rp->slots_size, sizeof(rp->slots[0]));
+
+    for(j = 0; j < old_size; j++){
+      if(!old[j]) continue;
+      struct replay_pub *pub = &rp->pubs[old[j] - 1];
+      rp->slots[pub_slot(rp, pub->prog_hash, pub->process_id)] = old[j];
+    }
+
+    free(old);
+  }
+
+  i = pub_slot(rp, prog_hash, process_id);
+
+  if(!rp->slots[i]){
+    if(rp->pubs_count == rp->pubs_cap){
+      rp->pubs_cap = rp->pubs_cap ? (rp->pubs_cap * 2) : 64;
+      rp->pubs = realloc(rp->pubs, rp->pubs_cap * sizeof(rp->pubs[0]));
+    }
+
+    struct replay_pub *pub = &rp->pubs[rp->pubs_count++];
+
+    memset(pub, 0, sizeof(*pub));
+    pub->prog_hash  = prog_hash;
+    pub->process_id = process_id;
+    pub->sock       = -1;
+    snprintf(pub->program_name, sizeof(pub->program_name), "replay_%lX", prog_hash);
+
+    rp->slots[i] = rp->pubs_count;
+  }
+
+  return &rp->pubs[rp->slots[i] - 1];
+}
+
+static struct replay_rec *add_rec(struct replay *rp, const char type_lvl[8], size_t type_len,
+                                  uint64_t prog_hash, uint64_t process_id){
+  if(rp->count == rp->cap){
+    rp->cap  = rp->cap ? (rp->cap * 2) : 4096;
+    rp->recs = realloc(rp->recs, rp->cap * sizeof(rp->recs[0]));
+  }
+
+  struct replay_rec *rec = &rp->recs[rp->count];
+
+  memset(rec, 0, sizeof(*rec));
+  memcpy(rec->hdr.type_lvl, type_lvl, (type_len < 8) ? type_len : 8);
+  rec->hdr.prog_hash  = prog_hash;
+  rec->hdr.process_id = process_id;
+  rec->pub = find_pub(rp, prog_hash, process_id) - rp->pubs;
+  rec->seq = rp->count++;
+
+  return rec;
+}
+
+/* The program name from a service descriptor, for the advertisement
+ */
+static void name_pub(struct replay *rp, uint64_t prog_hash, uint64_t process_id, const char *name, size_t len){
+  struct replay_pub *pub = find_pub(rp, prog_hash, process_id);
+
+  while(len && !name[len - 1]) len--;   // segment names may be 0 padded
+  snprintf(pub->program_name, sizeof(pub->program_name), "%.*s", (int)len, name);
+}
+
+/* A packet payload, base64 decoded into the arena
+ */
+static int put_pkt(struct replay *rp, struct replay_rec *rec, const char *b64, size_t len){
+  size_t pkt_len;
+  char *pkt = arena_alloc(rp, base64_decoded_len(len));
+
+  if(base64_decode(b64, len, pkt, &pkt_len) < 0) return -1;
+
+  rec->payload     = pkt;
+  rec->payload_len = pkt_len;
+  return 0;
+}
+
+/* Legacy JSON, one record (which may span lines) at p
+ *
+ *   {usec: %li, eid: %lX, pid: %5li, fptr: %8lX[, func: ..][, src: ..], line: %4li, mask: %.8s, str: "%s"},
+ *   {usec: %li, eid: %lX, pid: %5li,  uri: %s:%i, prog: %s}
+ *
+ * Strings are not escaped, a str ends at the first "},<newline>.
+ * Returns the start of the next record.
+ */
+static const char *parse_json_rec(struct replay *rp, const char *p, const char *end){
+  const char *eol = memchr(p, '\n', end - p);
+  if(!eol) eol = end;
+
+  char *q;
+  uint64_t usec = strtoull(p + 7, &q, 10);
+
+  if(strncmp(q, ", eid: ", 7)) goto bad;
+  uint64_t prog_hash = strtoull(q + 7, &q, 16);
+
+  if(strncmp(q, ", pid: ", 7)) goto bad;
+  uint64_t process_id = strtoull(q + 7, &q, 10);
+
+  if(!strncmp(q, ",  uri: ", 8)){
+    const char *prog = memmem(q, eol - q, ", prog: ", 8);
+    const char *prog_end = eol;
+
+    if(!prog) goto bad;
+    prog += 8;
+    while((prog_end > prog) && (prog_end[-1] == '}')) prog_end--;
+
+    name_pub(rp, prog_hash, process_id, prog, prog_end - prog);
+    return eol + 1;
+  }
+
+  if(strncmp(q, ", fptr: ", 8)) goto bad;
+  uint64_t function_ptr = strtoull(q + 8, &q, 16);
+
+  // func and src are only there with symbols
+  const char *line = memmem(q, eol - q, ", line: ", 8);
+  if(!line) goto bad;
+  uint64_t file_line_number = strtoull(line + 8, &q, 10);
+
+  if(strncmp(q, ", mask: ", 8)) goto bad;
+  const char *mask = q + 8;
+  int k;
+
+  for(k = 0; k <= 8; k++){
+    if((mask + k + 8) > eol) goto bad;
+    if(!memcmp(mask + k, ", str: \"", 8) || !memcmp(mask + k, ", pkt: \"", 8)) break;
+  }
+  if(k > 8) goto bad;
+
+  struct replay_rec *rec = add_rec(rp, mask, k, prog_hash, process_id);
+  const char *value = mask + k + 8;
+
+  rec->hdr.function_ptr     = function_ptr;
+  rec->hdr.file_line_number = file_line_number;
+  rec->hdr.usec             = usec;
+
+  if(mask[k + 2] == 's'){
+    const char *value_end = memmem(value, end - value, "\"},\n", 4);
+    if(!value_end) value_end = memmem(value, end - value, "\"}", 2);
+    if(!value_end){
+      rp->count--;
+      goto bad;
+    }
+
+    rec->payload     = value;
+    rec->payload_len = value_end - value;
+    rec->add_nul     = 1;
+
+    eol = memchr(value_end, '\n', end - value_end);
+    return eol ? (eol + 1) : end;
+  }
+
+  const char *value_end = memchr(value, '"', eol - value);
+
+  if(!value_end || (put_pkt(rp, rec, value, value_end - value) < 0)){
+    rp->count--;
+    goto bad;
+  }
+
+  return eol + 1;
+
+bad:
+  rp->bad += 1;
+  return (eol < end) ? (eol + 1) : end;
+}
+
+/* A JSON string at *pp (after the opening quote), unescaped into the arena
+ * if it has escapes
+ */
+static int json_str(struct replay *rp, const char **pp, const char *eol, const char **s, size_t *len){
+  const char *p = *pp;
+  const char *start = p;
+  int escaped = 0;
+
+  while((p < eol) && (*p != '"')){
+    if(*p == '\\'){
+      escaped = 1;
+      p++;
+    }
+    p++;
+  }
+
+  if(p >= eol) return -1;
+
+  *pp = p + 1;
+  *s   = start;
+  *len = p - start;
+
+  if(!escaped) return 0;
+
+  char *out = arena_alloc(rp, *len);
+  char *o = out;
+
+  for(p = start; p < (start + *len); p++){
+    if(*p != '\\'){
+      *o++ = *p;
+      continue;
+    }
+
+    switch(*++p){
+      case 'b': *o++ = '\b'; break;
+      case 'f': *o++ = '\f'; break;
+      case 'n': *o++ = '\n'; break;
+      case 'r': *o++ = '\r'; break;
+      case 't': *o++ = '\t'; break;
+      case 'u': {
+        // json_escape() only writes \u00XX, for control characters
+        char hex[5] = {0};
+        memcpy(hex, p + 1, ((start + *len) - (p + 1) >= 4) ? 4 : 0);
+        unsigned c = strtoul(hex, 0, 16);
+
+        if(c < 0x80){
+          *o++ = c;
+        } else if(c < 0x800){
+          *o++ = 0xC0 | (c >> 6);
+          *o++ = 0x80 | (c & 0x3F);
+        } else {
+          *o++ = 0xE0 | (c >> 12);
+          *o++ = 0x80 | ((c >> 6) & 0x3F);
+          *o++ = 0x80 | (c & 0x3F);
+        }
+        p += 4;
+        break;
+      }
+      default: *o++ = *p; break;   // \" \\ \/
+    }
+  }
+
+  *s   = out;
+  *len = o - out;
+  return 0;
+}
+
+/* JSON Lines, one record per line at p
+ *
+ * Returns the start of the next line.
+ */
+static const char *parse_jsonl_rec(struct replay *rp, const char *p, const char *end){
+  const char *eol = memchr(p, '\n', end - p);
+  if(!eol) eol = end;
+
+  uint64_t usec = 0, prog_hash = 0, process_id = 0, function_ptr = 0, file_line_number = 0;
+  const char *mask = 0, *str = 0, *pkt = 0, *prog = 0, *key, *value;
+  size_t mask_len = 0, str_len = 0, pkt_len = 0, prog_len = 0, key_len, value_len;
+
+  p++;  // {
+
+  while((p < eol) && (*p == '"')){
+    p++;
+    if(json_str(rp, &p, eol, &key, &key_len) < 0) goto bad;
+    if((p >= eol) || (*p++ != ':')) goto bad;
+
+    if(*p == '"'){
+      p++;
+      if(json_str(rp, &p, eol, &value, &value_len) < 0) goto bad;
+
+      if((key_len == 3) && !memcmp(key, "eid", 3)) prog_hash = strtoull(value, 0, 16);
+      else if((key_len == 4) && !memcmp(key, "fptr", 4)) function_ptr = strtoull(value, 0, 16);
+      else if((key_len == 4) && !memcmp(key, "mask", 4)){ mask = value; mask_len = value_len; }
+      else if((key_len == 3) && !memcmp(key, "str", 3)){ str = value; str_len = value_len; }
+      else if((key_len == 3) && !memcmp(key, "pkt", 3)){ pkt = value; pkt_len = value_len; }
+      else if((key_len == 4) && !memcmp(key, "prog", 4)){ prog = value; prog_len = value_len; }
+    } else {
+      char *q;
+      uint64_t v = strtoull(p, &q, 10);
+
+      if(q == p) goto bad;
+      p = q;
+
+      if((key_len == 4) && !memcmp(key, "usec", 4)) usec = v;
+      else if((key_len == 3) && !memcmp(key, "pid", 3)) process_id = v;
+      else if((key_len == 4) && !memcmp(key, "line", 4)) file_line_number = v;
+    }
+
+    if((p < eol) && (*p == ',')) p++;
+  }
+
+  if(prog){
+    name_pub(rp, prog_hash, process_id, prog, prog_len);
+    return eol + 1;
+  }
+
+  if(!mask || (!str && !pkt)) goto bad;
+
+  struct replay_rec *rec = add_rec(rp, mask, mask_len, prog_hash, process_id);
+
+  rec->hdr.function_ptr     = function_ptr;
+  rec->hdr.file_line_number = file_line_number;
+  rec->hdr.usec             = usec;
+
+  if(str){
+    rec->payload     = str;
+    rec->payload_len = str_len;
+    rec->add_nul     = 1;
+  } else if(put_pkt(rp, rec, pkt, pkt_len) < 0){
+    rp->count--;
+    goto bad;
+  }
+
+  return (eol < end) ? (eol + 1) : end;
+
+bad:
+  rp->bad += 1;
+  return (eol < end) ? (eol + 1) : end;
+}
+
+/* Records of a segment file (log_to_file -b) are used as they are
+ */
+static int load_segments(struct replay *rp, const char *base, uint64_t size){
+  struct seg_reader reader;
+  struct seg_rec rec;
+
+  if(seg_reader_init(&reader, base, size) < 0) return -1;
+
+  while(seg_next(&reader, &rec)){
+    if(rec.type == SEG_REC_MSG){
+      const struct log_wire_hdr *wh = rec.body;
+      struct replay_rec *r = add_rec(rp, wh->type_lvl, sizeof(wh->type_lvl), wh->prog_hash, wh->process_id);
+
+      r->hdr         = *wh;
+      r->payload     = (const char *)(wh + 1);
+      r->payload_len = rec.len - sizeof(*wh);
+
+    } else if((rec.type == SEG_REC_SVC) && !(rec.flags & SEG_SVC_GONE)){
+      const struct seg_svc *svc = rec.body;
+      name_pub(rp, svc->prog_hash, svc->process_id, (const char *)(svc + 1), rec.len - sizeof(*svc));
+    }
+  }
+
+  rp->bad += reader.resyncs + reader.bad_segments;
+  return 0;
+}
+
+/* Load a capture, the file stays mapped, records point into it
+ *
+ * Returns 0 on success
+ */
+int load_file(struct replay *rp, const char *file_name){
+  struct stat st;
+  uint64_t before = rp->count;
+
+  int fd = open(file_name, O_RDONLY);
+  if(fd < 0){
+    fprintf(stderr, "%s: %s\n", file_name, strerror(errno));
+    return -1;
+  }
+
+  if((fstat(fd, &st) < 0) || (st.st_size == 0)){
+    fprintf(stderr, "%s: empty or unreadable\n", file_name);
+    close(fd);
+    return -1;
+  }
+
+  const char *base = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if(base == MAP_FAILED){
+    fprintf(stderr, "%s: mmap failed, %s\n", file_name, strerror(errno));
+    return -1;
+  }
+
+  madvise((void *)base, st.st_size, MADV_SEQUENTIAL);
+
+  // Compressed files (log_to_file -z) are decompressed in memory, and kept
+  struct zfile_reader *zr = calloc(1, sizeof(*zr));
+  const char *data = base;
+  uint64_t size = st.st_size;
+
+  if(zfile_reader_init(zr, base, st.st_size) == 0){
+    data = zfile_load(zr, 0, zr->raw_size);
+    size = zr->raw_size;
+  } else {
+    free(zr);
+  }
+
+  if((size >= 8) && !memcmp(data, SEG_FILE_MAGIC, 8)){
+    if(load_segments(rp, data, size) < 0){
+      fprintf(stderr, "%s: damaged segment file\n", file_name);
+      return -1;
+    }
+  } else {
+    const char *p = data, *end = data + size;
+
+    while(p < end){
+      if(*p != '{'){
+        const char *eol = memchr(p, '\n', end - p);
+        p = eol ? (eol + 1) : end;
+        continue;
+      }
+
+      if(((end - p) > 1) && (p[1] == '"')){
+        p = parse_jsonl_rec(rp, p, end);
+      } else if(((end - p) > 7) && !memcmp(p, "{usec: ", 7)){
+        p = parse_json_rec(rp, p, end);
+      } else {
+        const char *eol = memchr(p, '\n', end - p);
+        p = eol ? (eol + 1) : end;
+        rp->bad += 1;
+      }
+    }
+  }
+
+  fprintf(stderr, "%s: %lu records\n", file_name, rp->count - before);
+
+  return 0;
+}
+
+static int rec_cmp(const void *a, const void *b){
+  const struct replay_rec *ra = a, *rb = b;
+
+  if(ra->hdr.usec != rb->hdr.usec) return (ra->hdr.usec < rb->hdr.usec) ? -1 : 1;
+  return (ra->seq < rb->seq) ? -1 : (ra->seq > rb->seq);
+}
+
+/* Create the PUB socket of every publisher and advertise them to the
+ * receiver at discovery_url
+ *
+ * Returns the discovery socket, or -1.
+ */
+int advertise_pubs(struct replay *rp, const char *discovery_url, int send_buf_size, int settle_msec){
+  uint32_t i;
+  int waited;
+
+  int discovery_fd = nn_socket(AF_SP, NN_PUSH);
+  errno_assert(discovery_fd >= 0);
+
+  if(nn_connect(discovery_fd, discovery_url) < 0){
+    fprintf(stderr, "%s: %s\n", discovery_url, nn_strerror(errno));
+    return -1;
+  }
+
+  for(i = 0; i < rp->pubs_count; i++){
+    struct replay_pub *pub = &rp->pubs[i];
+
+    pub->sock = nn_socket(AF_SP, NN_PUB);
+    if(pub->sock < 0){
+      fprintf(stderr, "publisher %u of %u: %s\n", i + 1, rp->pubs_count, nn_strerror(errno));
+      return -1;
+    }
+
+    if(send_buf_size > 0){
+      nn_setsockopt(pub->sock, NN_SOL_SOCKET, NN_SNDBUF, &send_buf_size, sizeof(send_buf_size));
+    }
+
+    pub->addr = bind_socket(pub->sock);
+  }
+
+  // as liblog, advertise once the receiver is connected
+  for(waited = 0; !is_writeable(discovery_fd) && (waited < settle_msec); waited += 10) usleep(10000);
+
+  for(i = 0; i < rp->pubs_count; i++){
+    struct replay_pub *pub = &rp->pubs[i];
+    struct log_context lc = {.prog_hash = pub->prog_hash};
+
+    send_service_descriptions_as(discovery_fd, ntohs(pub->addr.sin_port), &lc, pub->process_id, pub->program_name);
+  }
+
+  // the receiver subscribes to each publisher, records sent before are lost
+  usleep(settle_msec * 1000);
+
+  return discovery_fd;
+}
+
+static inline void wait_until(uint64_t due_usec){
+  uint64_t now;
+
+  while((now = get_time()) < due_usec){
+    if((due_usec - now) > REPLAY_SPIN_USEC){
+      struct timespec ts = {0, (due_usec - now - REPLAY_SPIN_USEC / 2) * 1000};
+      nanosleep(&ts, 0);
+    }
+  }
+}
+
+static inline void send_rec(struct replay *rp, const struct replay_rec *rec, int keep_time){
+  struct replay_pub *pub = &rp->pubs[rec->pub];
+  struct log_wire_hdr hdr = rec->hdr;
+  struct nn_msghdr msg;
+  struct nn_iovec iov[3];
+  int n = 0;
+
+  // a live publisher stamps records with its clock
+  if(!keep_time) hdr.usec = get_time();
+
+  iov[n].iov_base = &hdr;
+  iov[n].iov_len  = sizeof(hdr);
+  n++;
+
+  iov[n].iov_base = (void *)rec->payload;
+  iov[n].iov_len  = rec->payload_len;
+  n++;
+
+  if(rec->add_nul){
+    iov[n].iov_base = "";
+    iov[n].iov_len  = 1;
+    n++;
+  }
+
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov    = iov;
+  msg.msg_iovlen = n;
+
+  if(nn_sendmsg(pub->sock, &msg, NN_DONTWAIT) < 0){
+    pub->dropped += 1;
+  } else {
+    pub->sent += 1;
+  }
+}
+
+static void report(struct replay *rp, uint64_t start_usec, uint64_t bytes){
+  uint64_t sent = 0, dropped = 0;
+  uint64_t usec = get_time() - start_usec;
+  uint32_t i;
+
+  for(i = 0; i < rp->pubs_count; i++){
+    sent    += rp->pubs[i].sent;
+    dropped += rp->pubs[i].dropped;
+  }
+
+  fprintf(stderr, "%lu records sent, %lu dropped (send buffer full), %lu bytes, %.3f secs, %.0f records/sec\n",
+          sent, dropped, bytes, usec / 1e6, usec ? (sent * 1e6 / usec) : 0.0);
+}
+
+int main(int argc, char *argv[])
+{
+  int opt, i;
+  uint32_t p;
+
+  struct {
+    const char *host;
+    int port;
+    double speed;
+    int loops;
+    int keep_time;
+    int settle_msec;
+    int send_buf_size;
+    int verbose;
+  } config = {
+    .host          = "127.0.0.1",
+    .port          = 50002,
+    .speed         = 1.0,
+    .loops         = 1,
+    .keep_time     = 0,
+    .settle_msec   = REPLAY_SETTLE_MSEC,
+    .send_buf_size = (1<<20) * 20, // as liblog
+    .verbose       = 0
+  };
+
+  struct replay rp = {0};
+
+  while ((opt = getopt(argc, argv, "hvkH:p:x:c:w:b:")) != -1) {
+    switch (opt) {
+
+      case 'v':
+        config.verbose = 1;
+        break;
+
+      case 'k':
+        config.keep_time = 1;
+        break;
+
+      case 'H':
+        config.host = optarg;
+        break;
+
+      case 'p':
+        config.port = atoi(optarg);
+        break;
+
+      case 'x':
+        config.speed = atof(optarg);
+        if(config.speed < 0) config.speed = 0;
+        break;
+
+      case 'c':
+        config.loops = atoi(optarg);
+        break;
+
+      case 'w':
+        config.settle_msec = atoi(optarg);
+        break;
+
+      case 'b':
+        config.send_buf_size = atoi(optarg) << 20;
+        break;
+
+      case 'h':
+      default: /* '?' */
+        fprintf(stderr, "Usage: %s [-h][-v][-k][-H <host>][-p <port>][-x <speed>][-c <loops>][-w <msec>][-b <MBytes>] <file> ...\n"
+                "-h     help\n"
+                "-v     verbose, progress every second\n"
+                "-H     receiver host (default %s)\n"
+                "-p     receiver's listening port (default %i)\n"
+                "-x     replay <speed> times as fast as captured, 0 = as fast as possible (default 1)\n"
+                "-c     replay the capture <loops> times, 0 = until stopped (default 1)\n"
+                "-k     keep the captured timestamps (default the time of sending)\n"
+                "-w     wait <msec> for the receiver to subscribe before sending (default %i)\n"
+                "-b     send buffer of each publisher in MBytes (default %i)\n"
+                "\n"
+                "Files are log_to_file output: JSON, JSON Lines or binary segments, compressed or not.\n",
+                argv[0], config.host, config.port, config.settle_msec, config.send_buf_size >> 20);
+        exit(EXIT_FAILURE);
+    }
+  }
+
+  if(optind >= argc){
+    fprintf(stderr, "%s: no capture given, -h for help\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  for(i = optind; i < argc; i++){
+    if(load_file(&rp, argv[i]) < 0) exit(EXIT_FAILURE);
+  }
+
+  if(rp.count == 0){
+    fprintf(stderr, "no records to replay\n");
+    exit(EXIT_FAILURE);
+  }
+
+  // Records of different publishers (and workers) are interleaved in a capture
+  qsort(rp.recs, rp.count, sizeof(rp.recs[0]), rec_cmp);
+
+  uint64_t first_usec = rp.recs[0].hdr.usec;
+  uint64_t span_usec  = rp.recs[rp.count - 1].hdr.usec - first_usec;
+
+  fprintf(stderr, "%lu records from %u publishers over %.3f secs, %lu lines skipped\n",
+          rp.count, rp.pubs_count, span_usec / 1e6, rp.bad);
+
+  char *discovery_url;
+  asprintf(&discovery_url, "tcp://%s:%i", config.host, config.port);
+
+  int discovery_fd = advertise_pubs(&rp, discovery_url, config.send_buf_size, config.settle_msec);
+  if(discovery_fd < 0) exit(EXIT_FAILURE);
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = request_stop;
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+
+  uint64_t start_usec = get_time();
+  uint64_t report_usec = start_usec;
+  uint64_t bytes = 0;
+  int loop;
+
+  for(loop = 0; !stop_requested && (!config.loops || (loop < config.loops)); loop++){
+    uint64_t loop_usec = get_time();
+    uint64_t n;
+
+    for(n = 0; (n < rp.count) && !stop_requested; n++){
+      const struct replay_rec *rec = &rp.recs[n];
+
+      if(config.speed > 0){
+        wait_until(loop_usec + (uint64_t)((rec->hdr.usec - first_usec) / config.speed));
+      }
+
+      send_rec(&rp, rec, config.keep_time);
+      bytes += sizeof(rec->hdr) + rec->payload_len + rec->add_nul;
+
+      if(config.verbose && ((n & 1023) == 0) && ((get_time() - report_usec) >= 1000000)){
+        report_usec = get_time();
+        report(&rp, start_usec, bytes);
+      }
+    }
+  }
+
+  report(&rp, start_usec, bytes);
+
+  // let the last records leave the send buffers
+  usleep(config.settle_msec * 1000);
+
+  for(p = 0; p < rp.pubs_count; p++) nn_close(rp.pubs[p].sock);
+  nn_close(discovery_fd);
+  free(discovery_url);
+
+  return 0;
+}
@@ -0,0 +1,129 @@
+/* Follow the records log_to_file publishes live with -L, see live_tail.h
+ *
+ * Prints the JSON Lines records whose mask starts with one of the given
+ * prefixes, e.g.
+ *
+ *   log_tail tcp://127.0.0.1:50004 LE LW      # errors and warnings
+ *   log_tail ipc:///tmp/log_tail T            # all trace
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>    /* for getopt */
+
+#include <nanomsg/nn.h>
+#include <nanomsg/pubsub.h>
+
+#include "live_tail.h"
+
+int main(int argc, char *argv[])
+{
+  int opt, i, rc;
+
+  struct {
+    int keep_topic;
+    uint64_t count;
+    int recv_buf_size;
+  } config = {
+    .keep_topic    = 0,
+    .count         = 0,
+    .recv_buf_size = 0
+  };
+
+  while ((opt = getopt(argc, argv, "hmn:r:")) != -1) {
+    switch (opt) {
+
+      case 'm':
+        config.keep_topic = 1;
+        break;
+
+      case 'n':
+        config.count = strtoull(optarg, 0, 0);
+        break;
+
+      case 'r':
+        config.recv_buf_size = atoi(optarg) << 20;
+        break;
+
+      case 'h':
+      default: /* '?' */
+        fprintf(stderr, "Usage: %s [-h][-m][-n <records>][-r <MBytes>] <url> [<prefix>...]\n"
+                "-h     help\n"
+                "-m     print the mask topic (8 characters) before each record\n"
+                "-n     exit after <records>\n"
+                "-r     receive buffer in MBytes (default the system's)\n"
+                "\n"
+                "<url> is the -L of log_to_file, records are printed if their mask starts with a <prefix>\n"
+                "(default all), e.g. LE for errors, L for all logs, T for trace, P for packets.\n",
+                argv[0]);
+        exit(EXIT_FAILURE);
+    }
+  }
+
+  if(optind >= argc){
+    fprintf(stderr, "%s: no url given, -h for help\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  int sock = nn_socket(AF_SP, NN_SUB);
+  if(sock < 0){
+    fprintf(stderr, "nn_socket: %s\n", nn_strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+
+  if(config.recv_buf_size > 0){
+    nn_setsockopt(sock, NN_SOL_SOCKET, NN_RCVBUF, &config.recv_buf_size, sizeof(config.recv_buf_size));
+  }
+
+  // the topic is type_lvl, nanomsg matches subscriptions as prefixes
+  if(optind + 1 >= argc){
+    rc = nn_setsockopt(sock, NN_SUB, NN_SUB_SUBSCRIBE, "", 0);
+  } else {
+    for(i = optind + 1, rc = 0; (i < argc) && (rc >= 0); i++){
+      rc = nn_setsockopt(sock, NN_SUB, NN_SUB_SUBSCRIBE, argv[i], strlen(argv[i]));
+    }
+  }
+
+  if(rc < 0){
+    fprintf(stderr, "subscribe: %s\n", nn_strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+
+  // reconnects in the background while log_to_file restarts
+  if(nn_connect(sock, argv[optind]) < 0){
+    fprintf(stderr, "%s: %s\n", argv[optind], nn_strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+
+  uint64_t received = 0;
+
+  // a live view, e.g. into grep, shouldn't wait for a full stdio buffer
+  setvbuf(stdout, 0, _IOLBF, 0);
+
+  while(!config.count || (received < config.count)){
+    char *msg;
+    int len = nn_recv(sock, &msg, NN_MSG, 0);
+
+    if(len < 0){
+      if(errno == EINTR) continue;
+      fprintf(stderr, "nn_recv: %s\n", nn_strerror(errno));
+      break;
+    }
+
+    if(len > LIVE_TAIL_TOPIC_LEN){
+      int skip = config.keep_topic ? 0 : LIVE_TAIL_TOPIC_LEN;
+      fwrite(msg + skip, 1, len - skip, stdout);
+      received += 1;
+    }
+
+    nn_freemsg(msg);
+  }
+
+  fflush(stdout);
+  nn_close(sock);
+
+  return 0;
+}
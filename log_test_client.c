@@ -299,6 +299,8 @@ int main(int argc, char *argv[])
   fprintf(stderr, "    %s msgs sent               = %d\n", "",   log_context->msg_sent);
   fprintf(stderr, "    %s msgs bytes sent         = %d\n", "header+payload",   log_context->msg_bytes_sent);
   fprintf(stderr, "    %s msgs payload bytes sent = %d\n", "       payload",   log_context->payload_bytes_sent);
+  fprintf(stderr, "    %s msgs dropped            = %lu\n", "  send buffer full", log_context->shed.dropped);
+  fprintf(stderr, "    %s msgs shed               = %lu\n", "    load shedding", log_context->shed.shed);
 
   fprintf(stderr, "    %s tests = %d\n", "  log", tst_count.logging);
   fprintf(stderr, "    %s tests = %d\n", "trace", tst_count.trace);
@@ -9,6 +9,9 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <unistd.h>    /* for getopt */
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
 
 #include <nanomsg/nn.h>
 #include <nanomsg/pubsub.h>
@@ -17,23 +20,35 @@
 #include "logger.h"
 #include "util.h"
 #include "list.h"
-#include "base64.h"
+#include "log_msg.h"
+#include "out_buf.h"
+#include "json_out.h"
+#include "segment.h"
+#include "log_wire.h"
+#include "relay.h"
+#include "tcp_sub.h"
+#include "live_tail.h"
+#include "dedup.h"
+#include "rollup.h"
+#include "pcapng.h"
+#include "disk_writer.h"
+#include "out_file.h"
+#include "zfile.h"
+#include "merge.h"
+#include "pub_registry.h"
+#include "route.h"
+#include "symbolizer.h"
+#include "load_shed.h"
+#include "stats_sink.h"
+#include "json_escape.h"
+#include "intern.h"
+#include "intern_dict.h"
+#include "fnv_hash.h"
 
 // todo log message has fixed size buffer
 
 extern int asprintf(char **strp, const char *fmt, ...);
 
-struct Msg_Hdr {
-  char     type_lvl[8];
-  uint64_t prog_hash;
-
-  uint64_t function_ptr;
-  uint64_t process_id;
-  uint64_t file_line_number;
-
-  uint64_t usec;
-};
-
 
 /* scatter a single buffer into a set of buffers
  *
@@ -110,99 +125,397 @@ struct nn_iovec get_log_msg_header(struct Msg_Hdr *lm, struct nn_iovec msg_iov){
   return payload_iov;
 }
 
-/* Dump the log message to a file in JSON format
+/* Where records are stored: a file (or out_fd) and a format
+ *
+ * Threads format records into private buffers and append whole buffers to
+ * the file (or out_fd under the lock), so records are never interleaved and
+ * records from one publisher stay in order.
+ */
+enum output_format {
+  OUTPUT_JSON,
+  OUTPUT_SEGMENT,   // binary segments, see segment.h
+  OUTPUT_PCAPNG     // packet records as pcapng, see pcapng.h
+};
+
+#define MAX_SINKS  16
+
+struct Sink {
+  int out_fd;              // stdout or /dev/null, -1 = none
+  struct out_file *file;   // output file, 0 = none
+  enum output_format format;
+  int json_lines;          // JSON output as JSON Lines
+  int flush;               // flush after every receive batch, e.g. errors
+  size_t buf_size;         // per thread buffer
+  uint16_t link_type;      // pcapng interfaces
+  struct relay *relay;     // edge: segments go upstream, see relay.h, 0 = no
+  pthread_mutex_t lock;
+};
+
+/* Output shared by all workers
+ *
+ * Records are routed to a sink by type_lvl prefix (and program), see
+ * route.h, records without a route go to the default sink.
+ */
+struct Output {
+  struct Sink sinks[MAX_SINKS];  // [0] = -j, -b, -s or -n
+  int sinks_count;
+  struct route_table *routes;    // 0 = everything to sinks[0]
+  struct merge *merge;           // records are written in time order by the Merger, 0 = as received
+  struct symbolizer *symbols;    // JSON output gets func and src for fptr, 0 = no
+  struct live_tail *tail;        // records are also published as received, see live_tail.h, 0 = no
+  uint64_t repeat_usec;          // collapse repeated log records within this window, see dedup.h, 0 = no
+  struct rollup *rollup;         // per callsite counters collected from the workers, see rollup.h, 0 = no
+};
+
+static inline int sink_stores(const struct Sink *sink){
+  return (sink->out_fd >= 0) || sink->file || sink->relay;
+}
+
+/* A thread's buffers for one sink
  */
-void write_log_msg_to_file(FILE *out_file, const struct Msg_Hdr *lm, const struct nn_iovec *payload_iov){
+struct Sink_Writer {
+  struct Sink *sink;
+  struct out_buf out;
+  struct seg_writer seg;
+  struct pcapng_writer pcap;
+  struct sym_cache *syms;  // the thread's, or 0
+};
+
+static void relay_send_buf(void *relay, const void *buf, size_t len){
+  relay_send(relay, buf, len);
+}
+
+void sink_writer_init(struct Sink_Writer *sw, struct Sink *sink, int id, size_t buf_size, struct sym_cache *syms){
+  sw->sink = sink;
+  sw->syms = syms;
+  // batches are sent by each thread, the relay socket needs no lock
+  out_buf_init(&sw->out, sink->out_fd, sink->relay ? 0 : &sink->lock, buf_size);
+  sw->out.file = sink->file;
+
+  if(sink->relay){
+    sw->out.send     = relay_send_buf;
+    sw->out.send_arg = sink->relay;
+  }
+  seg_writer_init(&sw->seg, &sw->out, id);
+  pcapng_writer_init(&sw->pcap, &sw->out, sink->link_type);
+}
 
-  if(!out_file) return;
+static inline void sink_writer_put(struct Sink_Writer *sw, const struct Msg_Hdr *lm, const void *payload, uint64_t payload_len){
+  if(!sink_stores(sw->sink)) return;
 
-  fprintf(out_file, "{");
-  fprintf(out_file, "usec: %li", lm->usec);
-  fprintf(out_file, ", eid: %lX", lm->prog_hash);
-  fprintf(out_file, ", pid: %5li", lm->process_id);
-  fprintf(out_file, ", fptr: %8lX", lm->function_ptr);
-  fprintf(out_file, ", line: %4li", lm->file_line_number);
-  fprintf(out_file, ", mask: %.8s", lm->type_lvl);
+  if(sw->sink->format == OUTPUT_SEGMENT){
+    seg_put_msg(&sw->seg, lm, payload, payload_len);
+    return;
+  }
+
+  if(sw->sink->format == OUTPUT_PCAPNG){
+    pcapng_put_pkt(&sw->pcap, lm, payload, payload_len);
+    return;
+  }
+
+  const struct sym_info *sym = sw->syms ? sym_cache_lookup(sw->syms, lm->prog_hash, lm->function_ptr) : 0;
 
-  if(lm->type_lvl[0] != 'P'){
-    // char string payload
+  if(sw->sink->json_lines){
+    write_log_msg_jsonl(&sw->out, lm, payload, payload_len, sym);
+  } else {
+    write_log_msg_json(&sw->out, lm, payload, payload_len, sym);
+  }
+}
 
-    fprintf(out_file, ", str: \"%s\"", (char *)payload_iov->iov_base);
+void sink_writer_flush(struct Sink_Writer *sw){
+  if(!sink_stores(sw->sink)) return;
 
+  if(sw->sink->format == OUTPUT_SEGMENT){
+    seg_flush(&sw->seg);
+  } else if(sw->sink->format == OUTPUT_PCAPNG){
+    pcapng_flush(&sw->pcap);
   } else {
-    // binary payload (packet)
+    out_buf_flush(&sw->out);
+  }
 
-    int   base64_len = ((payload_iov->iov_len+6)/3)*4; // 3 bytes into 4 bytes
-    char* base64_ptr = malloc(base64_len);
+  if(sw->sink->file) out_file_flush(sw->sink->file);
+}
+
+/* The sink writer for a record
+ */
+static inline struct Sink_Writer *route_record(struct Output *output, struct Sink_Writer *writers, const struct Msg_Hdr *lm){
+  return &writers[output->routes ? route_lookup(output->routes, lm->type_lvl, lm->prog_hash, 0) : 0];
+}
+
+/* Write a record to its sink, or hand it to the time order merge, and
+ * publish it live
+ *
+ * writers 0 only publishes.
+ */
+static inline void put_record(struct Output *output, struct Sink_Writer *writers, const struct Msg_Hdr *lm,
+                              const void *payload, uint64_t payload_len){
+  if(writers && output->merge){
+    merge_put(output->merge, lm, payload, payload_len);
+  } else if(writers){
+    sink_writer_put(route_record(output, writers, lm), lm, payload, payload_len);
+  }
+
+  if(output->tail) live_tail_publish(output->tail, lm, payload, payload_len);
+}
+
+/* Per worker pipeline stage counters
+ *
+ * Timing every record would cost more than decoding it, stage times are
+ * measured on 1 in STAGE_SAMPLE records and scaled up.
+ */
+#define STAGE_SAMPLE_SHIFT  4
+#define STAGE_SAMPLE_MASK   ((1 << STAGE_SAMPLE_SHIFT) - 1)
+
+struct Stage_Stats {
+  volatile uint64_t msgs;
+  volatile uint64_t bytes;        // as received, headers included
+  volatile uint64_t recv_nsec;    // nn_recv()
+  volatile uint64_t decode_nsec;  // header, interned strings, accounting
+  volatile uint64_t format_nsec;  // JSON or segment record, or the copy into the merge
+};
+
+static inline uint64_t stage_nsec(){
+  struct timespec tv;
+  clock_gettime(CLOCK_MONOTONIC, &tv);
+  return tv.tv_sec * (uint64_t)1000000000 + tv.tv_nsec;
+}
 
-    int rc = base64encode(payload_iov->iov_base, payload_iov->iov_len, base64_ptr, base64_len);
-    errno_assert(rc == 0);
+static inline uint64_t run_msgs(const struct pub_run *run){
+  uint64_t n = 0;
+  int c;
+  for(c = 0; c < SHED_CLASSES; c++) n += run->msgs[c];
+  return n;
+}
+
+/* Account one record to the current run, starting a new run (and adding
+ * the last one to the registry) when the publisher changes
+ */
+static void account_msg(struct pub_registry *publishers, struct pub_run *run, const struct Msg_Hdr *lm,
+                        const void *payload, uint64_t payload_len, uint64_t msg_len, uint64_t now_usec){
+  enum shed_class c = shed_classify(lm->type_lvl);
+
+  if((lm->prog_hash != run->prog_hash) || (lm->process_id != run->process_id)){
+    if(run_msgs(run)) pub_registry_account(publishers, run, now_usec);
+
+    memset(run, 0, sizeof(*run));
+    run->prog_hash  = lm->prog_hash;
+    run->process_id = lm->process_id;
+    run->first_usec = lm->usec;
+  } else if(lm->usec < run->last_usec){
+    run->out_of_order += 1;
+  }
 
-    fprintf(out_file, ", pkt: \"%s\"", base64_ptr);
+  run->msgs[c]  += 1;
+  run->bytes[c] += msg_len;
+  run->last_usec = lm->usec;
 
-    free(base64_ptr);
+  if(memcmp(lm->type_lvl, LOG_LVL_SHED, sizeof(lm->type_lvl)) == 0){
+    run->shed_report = (shed_parse_report(payload, payload_len, &run->shed_level,
+                                          &run->dropped, &run->shed) == 0);
   }
+}
+
+/* One pass of a worker over the messages waiting for it
+ */
+struct Recv_Batch {
+  struct Output       *output;
+  struct Sink_Writer  *writers;
+  struct intern_dict  *literals;
+  struct pub_registry *publishers;
+  struct dedup        *dedup;     // -X, 0 = write every record
+  struct rollup       *rollup;    // -G, 0 = no
+
+  struct pub_run run;
+  uint64_t now_usec;
+  uint64_t sampled;       // stage samples are taken on every STAGE_SAMPLE records
+  int      msg_count;
+  uint64_t bytes, recv_nsec, decode_nsec, format_nsec;
+};
 
-  fprintf(out_file, "},\n");
+static inline void recv_batch_init(struct Recv_Batch *rb, struct Output *output, struct Sink_Writer *writers,
+                                   struct intern_dict *literals, struct pub_registry *publishers,
+                                   struct dedup *dedup, struct rollup *rollup, const struct Stage_Stats *stages){
+  memset(rb, 0, sizeof(*rb));
+  rb->output     = output;
+  rb->writers    = writers;
+  rb->literals   = literals;
+  rb->publishers = publishers;
+  rb->dedup      = dedup;
+  rb->rollup     = rollup;
+  rb->now_usec   = get_time();
+  rb->sampled    = stages->msgs;
 }
 
-int receive_log_msgs(int sock, FILE *out_file){
+static inline int recv_batch_sample(const struct Recv_Batch *rb){
+  return ((rb->sampled + rb->msg_count) & STAGE_SAMPLE_MASK) == 0;
+}
+
+/* Decode one message and store it in the writer for the sink it is routed
+ * to, or hand it to the time order merge, unless it repeats a record
+ *
+ * The message may be released as soon as this returns.
+ */
+static inline void handle_log_msg(struct Recv_Batch *rb, struct nn_iovec msg_iov, int sample){
   struct Msg_Hdr lm ={0};
-  struct nn_iovec msg_iov = {0};
   struct nn_iovec payload_iov = {0};
-  int msg_count = 0;
+  uint64_t t1 = 0, t2 = 0;
+
+  if(sample) t1 = stage_nsec();
+
+  payload_iov = get_log_msg_header(&lm, msg_iov);
 
-  // tight loop here until no more messages available
+  // Constant strings are sent once then referenced by id
+  if((lm.type_lvl[0] != 'P') && is_interned_payload(payload_iov.iov_base, payload_iov.iov_len)){
+    uint64_t text_len;
+    payload_iov.iov_base = (void *)intern_dict_resolve(rb->literals, lm.prog_hash, lm.process_id,
+                                                       payload_iov.iov_base, payload_iov.iov_len,
+                                                       &text_len);
+    payload_iov.iov_len  = text_len;
+  }
+
+  // Messages come in runs from one publisher, the registry is updated once per run
+  if(rb->publishers){
+    account_msg(rb->publishers, &rb->run, &lm, payload_iov.iov_base, payload_iov.iov_len, msg_iov.iov_len,
+                rb->now_usec);
+  }
+
+  // Every record counts, including the repeats collapsed below
+  if(rb->rollup) rollup_add(rb->rollup, &lm, payload_iov.iov_len);
+
+  if(sample) t2 = stage_nsec();
+
+  // Repeats of a record are counted, not written, see dedup.h
+  if(!rb->dedup || !dedup_check(rb->dedup, &lm, payload_iov.iov_base, payload_iov.iov_len, rb->now_usec)){
+    put_record(rb->output, rb->writers, &lm, payload_iov.iov_base, payload_iov.iov_len);
+  }
+
+  if(sample){
+    rb->decode_nsec += t2 - t1;
+    rb->format_nsec += stage_nsec() - t2;
+  }
+
+  rb->bytes     += msg_iov.iov_len;
+  rb->msg_count += 1;
+}
+
+/* Add the last run to the registry and the batch to the worker's stage
+ * times, recv_nsec is already scaled
+ */
+static int recv_batch_done(struct Recv_Batch *rb, struct Stage_Stats *stages, uint64_t recv_nsec){
+  if(rb->publishers && run_msgs(&rb->run)) pub_registry_account(rb->publishers, &rb->run, rb->now_usec);
+
+  stages->msgs        += rb->msg_count;
+  stages->bytes       += rb->bytes;
+  stages->recv_nsec   += recv_nsec;
+  stages->decode_nsec += rb->decode_nsec << STAGE_SAMPLE_SHIFT;
+  stages->format_nsec += rb->format_nsec << STAGE_SAMPLE_SHIFT;
+
+  return rb->msg_count;
+}
+
+/* Receive waiting messages and store them in the writer for the sink they
+ * are routed to, or hand them to the time order merge
+ *
+ * writers 0 only decodes and accounts the messages.
+ *
+ * The traffic of each publisher is added to the registry, which also marks
+ * the publishers as alive.
+ */
+int receive_log_msgs(int sock, struct Output *output, struct Sink_Writer *writers,
+                     struct intern_dict *literals, struct pub_registry *publishers, struct dedup *dedup,
+                     struct rollup *rollup, struct Stage_Stats *stages, int max_msgs){
+  struct Recv_Batch rb;
+  struct nn_iovec msg_iov = {0};
+  uint64_t t0 = 0;
+
+  recv_batch_init(&rb, output, writers, literals, publishers, dedup, rollup, stages);
+
+  // tight loop here until no more messages available (or max_msgs received)
   // don't go back and do a poll for every message
 
-  while(1){
+  while(rb.msg_count < max_msgs){
+    int sample = recv_batch_sample(&rb);
+
+    if(sample) t0 = stage_nsec();
+
     // Receive message in a library allocated buffer
     msg_iov.iov_len  = nn_recv(sock, &msg_iov.iov_base, NN_MSG, NN_DONTWAIT);
 
     if(msg_iov.iov_len == -1 ) break;
 
-    payload_iov = get_log_msg_header(&lm, msg_iov);
+    if(sample) rb.recv_nsec += stage_nsec() - t0;
 
-    write_log_msg_to_file(out_file, &lm, &payload_iov);
+    handle_log_msg(&rb, msg_iov, sample);
 
     nn_freemsg (msg_iov.iov_base);
-    msg_count += 1;
   }
 
-  return msg_count;
+  return recv_batch_done(&rb, stages, rb.recv_nsec << STAGE_SAMPLE_SHIFT);
+}
+
+/* As receive_log_msgs(), from the raw TCP engine (-e, tcp_sub.h)
+ *
+ * Messages are parsed in place in the connection buffers, receive time is
+ * the time spent in read(), all reads are timed.
+ */
+int receive_raw_msgs(struct tcp_sub *ts, struct Output *output, struct Sink_Writer *writers,
+                     struct intern_dict *literals, struct pub_registry *publishers, struct dedup *dedup,
+                     struct rollup *rollup, struct Stage_Stats *stages, int max_msgs){
+  struct Recv_Batch rb;
+  struct nn_iovec msg_iov = {0};
+  uint64_t read_nsec = ts->stats.read_nsec;
+  size_t len;
+
+  recv_batch_init(&rb, output, writers, literals, publishers, dedup, rollup, stages);
+
+  while((rb.msg_count < max_msgs) && tcp_sub_next(ts, &msg_iov.iov_base, &len)){
+    msg_iov.iov_len = len;
+    handle_log_msg(&rb, msg_iov, recv_batch_sample(&rb));
+  }
+
+  return recv_batch_done(&rb, stages, ts->stats.read_nsec - read_nsec);
 }
 
 struct Svc_Desc {
   uint64_t timestamp_usec;
   uint64_t prog_hash;
   struct   sockaddr_in addr;
-  int      eid;
   int      process_id;
   char     program_name[1024];
-  struct list_head mylist;
-  // struct list_head mylist_tmp;
 };
 
-/* Dump the service descriptor to a file in JSON format
+/* Dump the service descriptor to a sink in JSON format, or as a segment record
  */
-void write_svc_desc_to_file(FILE *out_file, const struct Svc_Desc *sd){
-  if(!out_file) return;
-
-  char addr_str[INET_ADDRSTRLEN];
-  inet_ntop(AF_INET, &(sd->addr.sin_addr), addr_str, sizeof(sd->addr));
-
-  int port = ntohs(sd->addr.sin_port);
-
-  fprintf(out_file, "{");
-  fprintf(out_file, "usec: %li", sd->timestamp_usec);
-  fprintf(out_file, ", eid: %lX", sd->prog_hash);
-  fprintf(out_file, ", pid: %5i", sd->process_id);
-  fprintf(out_file, ",  uri: %s:%i", addr_str, port);
-  fprintf(out_file, ", prog: %s", sd->program_name);
-  fprintf(out_file, "}\n");
+void write_svc_desc(struct Sink_Writer *sw, const struct Svc_Desc *sd){
+  uint64_t name_len = strnlen(sd->program_name, sizeof(sd->program_name));
+
+  if(!sink_stores(sw->sink)) return;
+
+  if(sw->sink->format == OUTPUT_SEGMENT){
+    struct seg_svc svc = {
+      .timestamp_usec = sd->timestamp_usec,
+      .prog_hash      = sd->prog_hash,
+      .process_id     = sd->process_id,
+      .addr           = sd->addr
+    };
+
+    seg_put_svc(&sw->seg, &svc, sd->program_name, name_len, 0);
+  } else if(sw->sink->format == OUTPUT_PCAPNG){
+    pcapng_put_svc(&sw->pcap, sd->timestamp_usec, sd->prog_hash, sd->process_id,
+                   &sd->addr, sd->program_name, name_len);
+  } else if(sw->sink->json_lines){
+    write_svc_desc_jsonl(&sw->out, sd->timestamp_usec, sd->prog_hash, sd->process_id,
+                         &sd->addr, sd->program_name, name_len);
+  } else {
+    write_svc_desc_json(&sw->out, sd->timestamp_usec, sd->prog_hash, sd->process_id,
+                        &sd->addr, sd->program_name, name_len);
+  }
 }
 
-struct Svc_Desc receive_service_notification(int sock, FILE *out_file){
+/* Receive a service descriptor and write it to every sink, each sink is a
+ * complete capture
+ */
+struct Svc_Desc receive_service_notification(int sock, struct Sink_Writer *writers, int writers_count){
   struct Svc_Desc sd ={0};
 
   struct nn_msghdr hdr;
@@ -241,225 +554,1712 @@ struct Svc_Desc receive_service_notification(int sock, FILE *out_file){
 
   errno_assert (nbytes >= 0);
 
-  write_svc_desc_to_file(out_file, &sd);
+  for(i = 0; i < writers_count; i++){
+    write_svc_desc(&writers[i], &sd);
+    sink_writer_flush(&writers[i]);
+  }
 
   return sd;
 }
 
-// todo: not sure process_id is valid for kernel tasks???
-// todo: need to make sure if client deactivates and reactives we will
-// re-connect for both kernel and rtp tasks
-int is_srvc_desc_in_list(struct list_head *srv_desc_list, const struct Svc_Desc *sd){
-  int matches = 0;
-  struct Svc_Desc *ptr = NULL;
+/* A service descriptor forwarded by a relay: written to every sink like a
+ * local one, and the publisher is added to the registry (or dropped, when
+ * the relay reports it gone)
+ */
+static void receive_relayed_svc(const struct seg_rec *rec, struct Output *output, struct Sink_Writer *writers,
+                                struct pub_registry *publishers, uint64_t now_usec){
+  const struct seg_svc *svc = rec->body;
+  struct Svc_Desc sd = {0};
+  uint64_t name_len = rec->len - sizeof(*svc);
+  int gone = (rec->flags & SEG_SVC_GONE) != 0;
+  int i;
+
+  if(name_len >= sizeof(sd.program_name)) name_len = sizeof(sd.program_name) - 1;
+
+  sd.timestamp_usec = svc->timestamp_usec;
+  sd.prog_hash      = svc->prog_hash;
+  sd.process_id     = svc->process_id;
+  sd.addr           = svc->addr;
+  memcpy(sd.program_name, svc + 1, name_len);
+
+  if(!gone){
+    for(i = 0; writers && (i < output->sinks_count); i++) write_svc_desc(&writers[i], &sd);
 
-  list_for_each_entry(ptr, srv_desc_list, mylist){
-    matches = ((ptr->prog_hash == sd->prog_hash) && (ptr->process_id == sd->process_id)) ? (matches+1) : matches;
+    if(output->symbols){
+      symbolizer_add_program(output->symbols, sd.prog_hash, sd.program_name, sizeof(sd.program_name));
+    }
   }
 
-  return (matches >= 1);
+  if(publishers){
+    pub_registry_relayed(publishers, sd.prog_hash, sd.process_id, &sd.addr, sd.program_name, name_len,
+                         sd.timestamp_usec, gone, now_usec);
+  }
 }
 
-//
-//
-
-int main(int argc, char *argv[])
-{
+/* Receive waiting relay batches (relay.h), their records take the same path
+ * as the records received from publishers
+ *
+ * Interned strings were resolved by the relay.
+ */
+int receive_relay_batches(int sock, struct Output *output, struct Sink_Writer *writers,
+                          struct pub_registry *publishers, struct dedup *dedup, struct rollup *rollup,
+                          struct Stage_Stats *stages,
+                          struct relay_batch *batch, struct relay_in_stats *relay_in, int max_msgs){
+  struct seg_reader r;
+  struct seg_rec rec;
+  struct Msg_Hdr lm;
+  const void *payload;
+  uint64_t payload_len;
+  int msg_count = 0;
+  uint64_t now_usec = get_time();
+  uint64_t bytes = 0, recv_nsec = 0, format_nsec = 0;
+  struct pub_run run = {0};
   int rc;
 
-  struct {
-    int srv_adv_sock;
-    int sub_sock;
+  while(msg_count < max_msgs){
+    uint64_t t0 = stage_nsec();
 
-    FILE *out_file;
-    char out_file_name[1024];
+    rc = relay_recv(sock, batch, relay_in);
 
-    int listening_port;
-    int sub_recv_buf_size;
- 
-    int verbose;
-    int debug;
-  } ctx = {0, 0, NULL, {0},
-    .listening_port = 50002,
-    .sub_recv_buf_size  = (1<<20) * 20, // Default to 20 MByte
-    //.sub_recv_buf_size  = (1<<20) * 1, // Default to 1 MByte
-    //.sub_recv_buf_size    = 0,             // Don't confuse the vxsim
-    .verbose = 0,
-    .debug = 0
-  };
+    if(rc == 0) break;
+    if(rc < 0) continue;
 
-  int opt, i;
+    uint64_t t1 = stage_nsec();
 
-  while ((opt = getopt(argc, argv, "vndshj:p:")) != -1) {
-    switch (opt) {
+    // a batch is whole segments, without a file header
+    memset(&r, 0, sizeof(r));
+    r.base = batch->records;
+    r.size = batch->len;
+    seg_reader_range(&r, 0, batch->len);
 
-      case 'v':
-        ctx.verbose = 1;
-        break;
+    while(seg_next(&r, &rec)){
+      if(rec.type == SEG_REC_SVC){
+        receive_relayed_svc(&rec, output, writers, publishers, now_usec);
+        continue;
+      }
 
-      case 'd':
-        ctx.debug = 1;
-        break;
+      if(rec.type != SEG_REC_MSG) continue;
 
-      case 'n':
-        ctx.out_file = fopen("/dev/null", "w+");
-        break;
+      seg_msg_decode(&rec, &lm, &payload, &payload_len);
 
-      case 's':
-        ctx.out_file = stdout;
-        break;
+      if(publishers){
+        account_msg(publishers, &run, &lm, payload, payload_len, rec.len, now_usec);
+      }
 
-      case 'j':
-        strcpy(ctx.out_file_name, optarg);
-        ctx.out_file = fopen(optarg, "w+");
-      break;
+      if(rollup) rollup_add(rollup, &lm, payload_len);
 
-      case 'p':
-        ctx.listening_port = atoi(optarg);
-        break;
+      if(!dedup || !dedup_check(dedup, &lm, payload, payload_len, now_usec)){
+        put_record(output, writers, &lm, payload, payload_len);
+      }
 
-      case 'h':
-      default: /* '?' */
-        fprintf(stderr, "Usage: %s [-h][-s][-d][-n][-j <file>][-p <port>], [-r <bytes>]\n"
-                "-h     help\n"
-                "-v     verbose \n"
-                "-d     debug \n"
-                "-j     output json to <file>\n"
-                "-s     output json to stdout\n"
-                "-r     receive buffer size in bytes (default %i bytes, 0 = use system defaults)\n"
-                "-n     output json to /dev/null\n"
-                "-p     listening port <port> (default %i)\n"
-                "\n"
-                "Note: Log/Trace/Pkt Capture messages will be recieved but not parsed or stored unless -j, -s or -n is specified\n",
-                argv[0],
-                ctx.sub_recv_buf_size,
-                ctx.listening_port
-                );
-        exit(EXIT_FAILURE);
+      bytes     += rec.len;
+      msg_count += 1;
     }
+
+    relay_batch_done(batch);
+
+    recv_nsec   += t1 - t0;
+    format_nsec += stage_nsec() - t1;
   }
 
-  fprintf(stderr,
-    "out_file_name: %s\n"
-    "listening_port: %i\n"
-    "sub_recv_buf_size: %i\n"
-    "verbose: %i\n"
-    "debug: %i\n",
-    ctx.out_file_name,
-    ctx.listening_port,
-    ctx.sub_recv_buf_size,
-    ctx.verbose,
-    ctx.debug
-    );
+  if(publishers && run_msgs(&run)) pub_registry_account(publishers, &run, now_usec);
 
-  LIST_HEAD(srv_desc_list);
+  // every batch is timed, they are few
+  stages->msgs        += msg_count;
+  stages->bytes       += bytes;
+  stages->recv_nsec   += recv_nsec;
+  stages->format_nsec += format_nsec;
 
-  // Create and bind socket to receive service advertisements
-  // sent by components that can produce log/trace/pkt capture messages
-  ctx.srv_adv_sock = nn_socket(AF_SP, NN_PULL);
-  errno_assert(ctx.srv_adv_sock >= 0);
+  return msg_count;
+}
 
-  char *listening_address;
-  asprintf(&listening_address, "tcp://0.0.0.0:%i", ctx.listening_port);
-  rc = nn_bind(ctx.srv_adv_sock, listening_address);
-  errno_assert (rc >= 0);
+#define WORKER_BATCH_MSGS     4096      // flush output at least this often
+#define WORKER_POLL_MSEC      1000
+#define MERGER_POLL_MSEC      10
+#define PUB_CHECK_MSEC        1000      // look for dead publishers this often
 
-  // Create socket we can use to subscribe to log/trace/pkt capture messages
-  // from external components capable of producing those messages
-  ctx.sub_sock = nn_socket (AF_SP, NN_SUB);
-  errno_assert (ctx.sub_sock >= 0);
+/* A receive worker owns a subset of the publishers.
+ *
+ * Each worker has its own SUB socket, connected to the publishers sharded
+ * to it, and does receive, decode and format in parallel with the others.
+ * With -e the worker has its own raw TCP engine (tcp_sub.h) instead.
+ */
+struct Worker {
+  int       id;
+  pthread_t thread;
+  int       sub_sock;            // -1 with -e
+  struct tcp_sub *raw;           // -e, 0 otherwise
+
+  struct Output      *output;
+  struct intern_dict *literals;  // publishers never move between workers
+  pthread_mutex_t     literals_lock;  // held while receiving, main purges dead publishers (and with -e
+                                      // connects and drops publishers) under it
+  struct pub_registry *publishers;
+  struct dedup *dedup;             // -X, 0 = no
+  struct rollup *rollup;           // -G, collected by main, 0 = no
+
+  int relay_sock;                  // aggregator: batches from relays, shared by the workers, -1 = none
+  struct relay_batch batch;
+  struct relay_in_stats relay_in;
+
+  struct Sink_Writer writers[MAX_SINKS];
+  struct sym_cache *syms;
+  int store_output;
+
+  volatile int received_msg_count;
+  struct Stage_Stats stages;
+  volatile int stop;
+  int verbose;
+};
 
-  if(ctx.sub_recv_buf_size > 0){
-    rc = nn_setsockopt_checked(ctx.sub_sock, NN_SOL_SOCKET, NN_RCVBUF,
-                               &ctx.sub_recv_buf_size,
-                               sizeof(ctx.sub_recv_buf_size),
-                               ctx.verbose);
+/* Pick the worker for a publisher, a publisher always maps to the same worker
+ */
+int shard_publisher(uint64_t prog_hash, uint64_t process_id, int workers_count){
+  uint64_t key[2] = {prog_hash, process_id};
+  return fnv_64a_buf(key, sizeof(key), FNV1A_64_INIT) % workers_count;
+}
 
-    errno_assert (rc >= 0);
-  }
 
-  rc = nn_setsockopt (ctx.sub_sock, NN_SUB, NN_SUB_SUBSCRIBE, "", 0);
-  errno_assert (rc >= 0);
+void worker_flush(struct Worker *w){
+  int i;
+  for(i = 0; i < w->output->sinks_count; i++) sink_writer_flush(&w->writers[i]);
+}
 
-  fprintf(stderr, "connected, enter message processing loop\n");
+/* A run of repeated records has ended, its repeat record takes the path
+ * of the records
+ */
+static void worker_put_repeat(void *arg, const struct Msg_Hdr *lm, const void *payload, uint64_t payload_len){
+  struct Worker *w = arg;
+  put_record(w->output, w->store_output ? w->writers : NULL, lm, payload, payload_len);
+}
 
-  struct nn_pollfd pfd [2];
-  pfd [0].fd = ctx.sub_sock;
-  pfd [0].events = NN_POLLIN;
-  pfd [1].fd = ctx.srv_adv_sock;
-  pfd [1].events = NN_POLLIN;
+enum worker_ready {
+  WORKER_READY_SUB   = 1,
+  WORKER_READY_RELAY = 2
+};
 
-  int received_msg_count = 0;
+/* Wait for messages from publishers or relays, returns enum worker_ready bits
+ */
+static int worker_wait(struct Worker *w, struct nn_pollfd *pfd, int nfds, int timeout_msec){
+  int ready = 0;
 
-  int seconds_between_stats = ctx.verbose ? 10 : 10;
+  // the relay socket's NN_RCVFD is in the engine's epoll set
+  if(w->raw){
+    int rc = tcp_sub_wait(w->raw, timeout_msec);
 
-  while(1){
-    if(ctx.verbose){
-      fprintf(stderr, "\n\n********* Enter Poll, %i messages so far, ", received_msg_count);
-    }
+    if(rc & TCP_SUB_READY)   ready |= WORKER_READY_SUB;
+    if(rc & TCP_SUB_WATCHED) ready |= WORKER_READY_RELAY;
 
-    rc = nn_poll (pfd, sizeof(pfd)/sizeof(pfd[0]), seconds_between_stats * 1000);
+    return ready;
+  }
 
-    if(ctx.verbose && ctx.debug){
-      for(i=0; i <(sizeof(pfd)/sizeof(pfd[0])); i++){
-        fprintf(stderr, "pfd[%d].revents = %x; ", i, pfd[i].revents);
-      }
-    }
+  if (nn_poll (pfd, nfds, timeout_msec) == -1) {
+    fprintf (stderr, "worker %i nn_poll Error! %s", w->id, nn_strerror(errno));
+    return 0;
+  }
 
-    if (rc == 0) {
-      if(ctx.verbose){
-        fprintf (stderr, "Timeout!");
-      }
-    } else if (rc == -1) {
-      fprintf (stderr, "nn_poll Error! %s", nn_strerror(errno));
-    } else {
+  if (pfd [0].revents & NN_POLLIN) ready |= WORKER_READY_SUB;
+  if ((nfds > 1) && (pfd [1].revents & NN_POLLIN)) ready |= WORKER_READY_RELAY;
 
-      if (pfd [0].revents & NN_POLLIN) {
-        if(ctx.verbose && (received_msg_count == 0)) fprintf(stderr, "**** Received first message\n");
-        received_msg_count += receive_log_msgs(pfd[0].fd, ctx.out_file);
-      }
+  return ready;
+}
 
-      if (pfd [1].revents & NN_POLLIN) {
-        struct Svc_Desc sd = receive_service_notification(pfd[1].fd, ctx.out_file);
+void *worker_main(void *arg){
+  struct Worker *w = arg;
+  struct nn_pollfd pfd [2] = {{0}};
+  int nfds = 1;
+  int ready, i;
 
-        // subscribe to log stream from the actor
-        //   identified in the recieved service descriptor
-        //
-        // don't duplicate subscribe if we are already subscribed
-        //
-        int already_in_list = is_srvc_desc_in_list(&srv_desc_list, &sd);
+  pfd [0].fd = w->sub_sock;
+  pfd [0].events = NN_POLLIN;
+
+  // Relay batches go to whichever worker takes them first
+  if(w->relay_sock >= 0){
+    pfd [1].fd = w->relay_sock;
+    pfd [1].events = NN_POLLIN;
+    nfds = 2;
+  }
 
-        if(!already_in_list){
-          char *url = addr_to_str(sd.addr);
-          int eid = nn_connect (ctx.sub_sock, url);
+  while(!w->stop){
+    ready = worker_wait(w, pfd, nfds, WORKER_POLL_MSEC);
+
+    if (ready) {
+      int first = (w->received_msg_count == 0);
+
+      if (ready & WORKER_READY_SUB) {
+        pthread_mutex_lock(&w->literals_lock);
+        if(w->raw){
+          w->received_msg_count += receive_raw_msgs(w->raw, w->output, w->store_output ? w->writers : NULL,
+                                                    w->literals, w->publishers, w->dedup, w->rollup,
+                                                    &w->stages, WORKER_BATCH_MSGS);
+        } else {
+          w->received_msg_count += receive_log_msgs(pfd[0].fd, w->output, w->store_output ? w->writers : NULL,
+                                                    w->literals, w->publishers, w->dedup, w->rollup,
+                                                    &w->stages, WORKER_BATCH_MSGS);
+        }
+        pthread_mutex_unlock(&w->literals_lock);
+      }
 
-          if(eid >= 0){
-            fprintf(stderr, "***** Pub/Sub Data Stream connected to log client/provider @ %s, eid = %i\n", url, eid);
-            // subscription successfull
+      if (ready & WORKER_READY_RELAY) {
+        w->received_msg_count += receive_relay_batches(w->relay_sock, w->output, w->store_output ? w->writers : NULL,
+                                                       w->publishers, w->dedup, w->rollup, &w->stages,
+                                                       &w->batch, &w->relay_in, WORKER_BATCH_MSGS);
+      }
 
-            // add program hash to list of connected log clients
-            sd.eid = eid;
-            INIT_LIST_HEAD(& sd.mylist);
+      // Runs whose window has ended get their repeat record
+      if(w->dedup) dedup_expire(w->dedup, get_time());
 
-            struct Svc_Desc *ptr_sd = malloc(sizeof(sd));
-            *ptr_sd = sd;
+      if(w->verbose && first && w->received_msg_count) fprintf(stderr, "**** worker %i received first message\n", w->id);
 
-            list_add(&(ptr_sd->mylist), &srv_desc_list);
-          }
-          free(url);
+      // Sinks that want every batch on disk, e.g. errors
+      if(!w->output->merge){
+        for(i = 1; i < w->output->sinks_count; i++){
+          if(w->output->sinks[i].flush) sink_writer_flush(&w->writers[i]);
         }
       }
 
-      if(ctx.verbose){
-        // fprintf(stderr, "\n");
-        // todo: how often???
-        // fflush(NULL);
-      }
+      // Keep receiving while messages are waiting, full buffers are written as they fill
+      if(worker_wait(w, pfd, nfds, 0)) continue;
     }
+
+    // Idle, write out what's buffered
+    if(w->dedup) dedup_expire(w->dedup, get_time());
+    worker_flush(w);
   }
 
-  free(listening_address);
+  if(w->dedup) dedup_expire(w->dedup, UINT64_MAX);
+  worker_flush(w);
+
+  if(w->syms) sym_cache_free(w->syms);
+  relay_batch_free(&w->batch);
+
+  return NULL;
+}
+
+/* Create worker, it's SUB socket (or raw TCP engine) and start it's thread
+ *
+ * relay_sock is the aggregator's socket for relay batches, or -1.
+ */
+void worker_start(struct Worker *w, int id, struct Output *output, struct pub_registry *publishers,
+                  int relay_sock, int raw, int sub_recv_buf_size, int verbose){
+  int rc, i;
+
+  w->id         = id;
+  w->output     = output;
+  w->verbose    = verbose;
+  w->literals   = intern_dict_new();
+  w->publishers = publishers;
+  w->relay_sock = relay_sock;
+  pthread_mutex_init(&w->literals_lock, NULL);
+
+  w->syms = output->symbols ? sym_cache_new(output->symbols) : 0;
+
+  for(i = 0; i < output->sinks_count; i++){
+    sink_writer_init(&w->writers[i], &output->sinks[i], id, output->sinks[i].buf_size, w->syms);
+    w->store_output |= sink_stores(&output->sinks[i]);
+  }
+
+  // Publishers are sharded to workers, so are their runs of repeats. Relay batches go to whichever worker
+  // reads the relay socket, a relayed run is collapsed per worker
+  w->dedup = output->repeat_usec ? dedup_new(output->repeat_usec, worker_put_repeat, w) : 0;
+  w->rollup = output->rollup ? rollup_new() : 0;
+
+  // Talk to the publishers over TCP directly, see tcp_sub.h
+  if(raw){
+    w->sub_sock = -1;
+    w->raw = tcp_sub_new(sub_recv_buf_size);
+    errno_assert (w->raw);
+
+    if(relay_sock >= 0){
+      int fd;
+      size_t fd_len = sizeof(fd);
+
+      rc = nn_getsockopt (relay_sock, NN_SOL_SOCKET, NN_RCVFD, &fd, &fd_len);
+      errno_assert (rc >= 0);
+      rc = tcp_sub_watch(w->raw, fd);
+      errno_assert (rc >= 0);
+    }
+
+    rc = pthread_create(&w->thread, NULL, worker_main, w);
+    errno_assert (rc == 0);
+    return;
+  }
+
+  // Create socket we can use to subscribe to log/trace/pkt capture messages
+  // from external components capable of producing those messages
+  w->sub_sock = nn_socket (AF_SP, NN_SUB);
+  errno_assert (w->sub_sock >= 0);
+
+  if(sub_recv_buf_size > 0){
+    rc = nn_setsockopt_checked(w->sub_sock, NN_SOL_SOCKET, NN_RCVBUF,
+                               &sub_recv_buf_size,
+                               sizeof(sub_recv_buf_size),
+                               verbose);
+
+    errno_assert (rc >= 0);
+  }
+
+  rc = nn_setsockopt (w->sub_sock, NN_SUB, NN_SUB_SUBSCRIBE, "", 0);
+  errno_assert (rc >= 0);
+
+  rc = pthread_create(&w->thread, NULL, worker_main, w);
+  errno_assert (rc == 0);
+}
+
+/* Writes the records of all workers in time order, see merge.h
+ */
+struct Merger {
+  pthread_t thread;
+  struct Output *output;
+
+  struct Sink_Writer writers[MAX_SINKS];
+  struct sym_cache *syms;
+
+  volatile int stop;
+};
+
+void merger_flush(struct Merger *mg){
+  int i;
+  for(i = 0; i < mg->output->sinks_count; i++) sink_writer_flush(&mg->writers[i]);
+}
+
+void *merger_main(void *arg){
+  struct Merger *mg = arg;
+  struct merge_rec *r, *tmp;
+  int count, stop, i;
+
+  while(1){
+    LIST_HEAD(ready);
+
+    // Workers have stopped once stop is set, take everything
+    stop  = mg->stop;
+    count = merge_take(mg->output->merge, get_time(), stop, &ready);
+
+    list_for_each_entry_safe(r, tmp, &ready, list){
+      sink_writer_put(route_record(mg->output, mg->writers, &r->lm), &r->lm, r->payload, r->payload_len);
+      merge_rec_free(r);
+    }
+
+    // Sinks that want every batch on disk, e.g. errors
+    for(i = 1; i < mg->output->sinks_count; i++){
+      if(count && mg->output->sinks[i].flush) sink_writer_flush(&mg->writers[i]);
+    }
+
+    if(count == MERGE_TAKE_BATCH) continue;
+    if(stop) break;
+
+    // Idle, write out what's buffered
+    if(count == 0) merger_flush(mg);
+
+    merge_wait(mg->output->merge, MERGER_POLL_MSEC);
+  }
+
+  merger_flush(mg);
+
+  if(mg->syms) sym_cache_free(mg->syms);
+
+  return NULL;
+}
+
+void merger_start(struct Merger *mg, struct Output *output, int id){
+  int rc, i;
+
+  mg->output = output;
+
+  mg->syms = output->symbols ? sym_cache_new(output->symbols) : 0;
+
+  for(i = 0; i < output->sinks_count; i++){
+    sink_writer_init(&mg->writers[i], &output->sinks[i], id, output->sinks[i].buf_size, mg->syms);
+  }
+
+  rc = pthread_create(&mg->thread, NULL, merger_main, mg);
+  errno_assert (rc == 0);
+}
+
+/* Subscribe to a publisher that advertised itself
+ */
+void add_publisher(struct pub_registry *publishers, struct Worker *workers, int workers_count, const struct Svc_Desc *sd){
+  // don't duplicate subscribe if we are already subscribed
+  struct publisher *pub = pub_registry_add(publishers, sd->prog_hash, sd->process_id, get_time());
+
+  if(!pub) return;
+
+  char *url = addr_to_str(sd->addr);
+  struct Worker *w = &workers[shard_publisher(sd->prog_hash, sd->process_id, workers_count)];
+  int eid;
+
+  if(w->raw){
+    pthread_mutex_lock(&w->literals_lock);
+    eid = tcp_sub_connect(w->raw, &sd->addr);
+    pthread_mutex_unlock(&w->literals_lock);
+  } else {
+    eid = nn_connect (w->sub_sock, url);
+  }
+
+  if(eid >= 0){
+    fprintf(stderr, "***** Pub/Sub Data Stream connected to log client/provider @ %s, eid = %i, worker = %i\n", url, eid, w->id);
+
+    pub->addr   = sd->addr;
+    pub->svc_usec = sd->timestamp_usec;
+    pub->eid    = eid;
+    pub->worker = w->id;
+    snprintf(pub->program_name, sizeof(pub->program_name), "%.*s",
+             (int)strnlen(sd->program_name, sizeof(sd->program_name)), sd->program_name);
+  } else {
+    pub_registry_remove(publishers, pub);  // try again on the next advertisement
+  }
+
+  free(url);
+}
+
+/* Drop the subscription and all state of a publisher that has exited
+ *
+ * An edge reports it to the aggregator through the svc_writers of its relay
+ * sinks.
+ */
+void reap_publisher(struct pub_registry *publishers, struct Worker *workers, struct merge *merge,
+                    struct Sink_Writer *svc_writers, int writers_count, struct publisher *pub){
+  char *url = addr_to_str(pub->addr);
+  int i;
+
+  fprintf(stderr, "***** Pub/Sub Data Stream from %s @ %s gone, eid = %i, worker = %i%s\n", pub->program_name, url,
+          pub->eid, pub->worker, pub->relayed ? ", relayed" : "");
+  free(url);
+
+  // relayed publishers have no subscription here and arrive with their strings resolved
+  if(!pub->relayed){
+    struct Worker *w = &workers[pub->worker];
+
+    if(!w->raw) nn_shutdown(w->sub_sock, pub->eid);
+
+    pthread_mutex_lock(&w->literals_lock);
+    if(w->raw) tcp_sub_shutdown(w->raw, pub->eid);
+    intern_dict_purge(w->literals, pub->prog_hash, pub->process_id);
+    pthread_mutex_unlock(&w->literals_lock);
+  }
+
+  if(merge) merge_forget(merge, pub->prog_hash, pub->process_id);
+
+  for(i = 0; i < writers_count; i++){
+    if(!svc_writers[i].sink->relay) continue;
+
+    struct seg_svc svc = {
+      .timestamp_usec = get_time(),
+      .prog_hash      = pub->prog_hash,
+      .process_id     = pub->process_id,
+      .addr           = pub->addr
+    };
+
+    seg_put_svc(&svc_writers[i].seg, &svc, pub->program_name,
+                strnlen(pub->program_name, sizeof(pub->program_name)), SEG_SVC_GONE);
+    sink_writer_flush(&svc_writers[i]);
+  }
+
+  pub_registry_remove(publishers, pub);
+}
+
+/* Probe the endpoints of publishers that have been silent for idle_usec,
+ * reap the ones that are gone
+ */
+void check_publishers(struct pub_registry *publishers, struct Worker *workers, struct merge *merge,
+                      struct Sink_Writer *svc_writers, int writers_count, uint64_t idle_usec){
+  struct publisher *idle[PUB_PROBE_BATCH];
+  enum pub_probe_result results[PUB_PROBE_BATCH];
+  uint64_t now_usec = get_time();
+  int i, count = 0;
+
+  int found = pub_registry_idle(publishers, now_usec, idle_usec, idle, PUB_PROBE_BATCH);
+
+  // relayed publishers are only here once their relay has reported them gone
+  for(i = 0; i < found; i++){
+    if(idle[i]->relayed){
+      reap_publisher(publishers, workers, merge, svc_writers, writers_count, idle[i]);
+    } else {
+      idle[count++] = idle[i];
+    }
+  }
+
+  if(count == 0) return;
+
+  pub_registry_probe(publishers, idle, count, PUB_PROBE_TIMEOUT_MSEC, results);
+
+  for(i = 0; i < count; i++){
+    switch(results[i]){
+      case PUB_PROBE_ALIVE:
+        pub_registry_touch(publishers, idle[i]->prog_hash, idle[i]->process_id, now_usec);
+        break;
+
+      case PUB_PROBE_TIMEOUT:
+        if(++idle[i]->probe_timeouts < PUB_PROBE_TIMEOUTS) break;
+        /* fall through, the host is gone */
+
+      case PUB_PROBE_DEAD:
+        reap_publisher(publishers, workers, merge, svc_writers, writers_count, idle[i]);
+        break;
+    }
+  }
+}
+
+#define SVC_REC_MAX  2048  // a service descriptor with a registry program name, in any format
+
+/* Copies of the publishers to describe, taken under the registry lock
+ */
+struct Known_Pubs {
+  struct publisher *pubs;
+  int count;
+  int cap;
+};
+
+static void collect_publisher(struct publisher *pub, void *arg){
+  struct Known_Pubs *kp = arg;
+
+  // not subscribed to yet, or reported gone by its relay
+  if(pub->gone || (!pub->relayed && (pub->eid < 0))) return;
+
+  if(kp->count == kp->cap){
+    kp->cap  = kp->cap ? (kp->cap * 2) : 64;
+    kp->pubs = realloc(kp->pubs, kp->cap * sizeof(kp->pubs[0]));
+  }
+  kp->pubs[kp->count++] = *pub;
+}
+
+/* Make the service descriptors of every known publisher the preamble of the
+ * output files, so each file of a rotation starts with them (see
+ * out_file_set_preamble())
+ *
+ * The descriptors are formatted by a sink writer of their own, its buffer
+ * holds all of them and is never written.
+ */
+void update_preambles(struct Output *output, struct pub_registry *publishers, int writer_id){
+  struct Known_Pubs kp = {0};
+  int i, j;
+
+  pub_registry_for_each(publishers, collect_publisher, &kp);
+
+  for(i = 0; i < output->sinks_count; i++){
+    struct Sink *sink = &output->sinks[i];
+    struct Sink_Writer sw;
+    struct seg_idx_entry *entries = 0;
+    int count = 0;
+
+    if(!sink->file) continue;
+
+    sink_writer_init(&sw, sink, writer_id, (kp.count + 1) * SVC_REC_MAX, 0);
+    sw.out.file = 0;
+    sw.out.fd   = -1;
+    sw.out.lock = 0;
+
+    for(j = 0; j < kp.count; j++){
+      const struct publisher *pub = &kp.pubs[j];
+      struct Svc_Desc sd = {
+        .timestamp_usec = pub->svc_usec,
+        .prog_hash      = pub->prog_hash,
+        .addr           = pub->addr,
+        .process_id     = pub->process_id
+      };
+
+      snprintf(sd.program_name, sizeof(sd.program_name), "%s", pub->program_name);
+      write_svc_desc(&sw, &sd);
+    }
+
+    if(sink->format == OUTPUT_SEGMENT) count = seg_close(&sw.seg, &entries);
+
+    out_file_set_preamble(sink->file, sw.out.buf, sw.out.len, entries, count);
+
+    free(sw.seg.blocks);
+    out_buf_free(&sw.out);
+  }
+
+  free(kp.pubs);
+}
+
+/* Statistics snapshot, one JSON document, see stats_sink.h
+ */
+struct Stats_Doc {
+  FILE *fp;
+  uint64_t now_usec;
+  int count;
+};
+
+static const char *class_names[SHED_CLASSES] = {"error", "info", "func", "pkt"};
+
+static void write_class_counts(FILE *fp, const char *name, const uint64_t *counts){
+  int c;
+
+  fprintf(fp, "\"%s\":{", name);
+  for(c = 0; c < SHED_CLASSES; c++){
+    fprintf(fp, "%s\"%s\":%lu", c ? "," : "", class_names[c], counts[c]);
+  }
+  fprintf(fp, "}");
+}
+
+static void write_publisher_stats(struct publisher *pub, void *arg){
+  struct Stats_Doc *doc = arg;
+  char name[sizeof(pub->program_name) * 6];
+  uint64_t msgs = 0;
+  double rate = 0;
+  int c;
+
+  for(c = 0; c < SHED_CLASSES; c++) msgs += pub->msgs[c];
+
+  // messages/sec since the last snapshot
+  if(pub->rate_usec && (doc->now_usec > pub->rate_usec)){
+    rate = (double)(msgs - pub->rate_msgs) * 1000000 / (doc->now_usec - pub->rate_usec);
+  }
+  pub->rate_msgs = msgs;
+  pub->rate_usec = doc->now_usec;
+
+  size_t name_len = json_escape(pub->program_name, strnlen(pub->program_name, sizeof(pub->program_name)), name);
+  char *url = addr_to_str(pub->addr);
+
+  fprintf(doc->fp, "%s{\"prog_hash\":\"0x%lx\",\"process_id\":%lu,\"program\":\"%.*s\",\"url\":\"%s\",\"worker\":%i,",
+          doc->count++ ? "," : "", pub->prog_hash, pub->process_id, (int)name_len, name, url, pub->worker);
+  write_class_counts(doc->fp, "msgs", pub->msgs);
+  fprintf(doc->fp, ",");
+  write_class_counts(doc->fp, "bytes", pub->bytes);
+  fprintf(doc->fp, ",\"rate\":%.1f,\"idle_usec\":%lu,\"out_of_order\":%lu,"
+          "\"shed_level\":%i,\"dropped\":%lu,\"shed\":%lu,\"loss_events\":%lu,\"relayed\":%s}",
+          rate, doc->now_usec - pub->seen_usec, pub->out_of_order,
+          pub->shed_level, pub->dropped, pub->shed, pub->loss_events, pub->relayed ? "true" : "false");
+
+  free(url);
+}
+
+/* Add up the write counters of a thread's sink writers, per sink
+ */
+static void add_write_stats(const struct Sink_Writer *writers, int count,
+                            uint64_t *writes, uint64_t *written, uint64_t *write_nsec){
+  int i;
+
+  for(i = 0; i < count; i++){
+    writes[i]     += writers[i].out.writes;
+    written[i]    += writers[i].out.written;
+    write_nsec[i] += writers[i].out.write_nsec;
+  }
+}
+
+/* Counters of the raw TCP engines (-e) of all workers
+ */
+static void raw_recv_stats(struct Worker *workers, int workers_count, struct tcp_sub_stats *raw){
+  int i;
+
+  for(i = 0; i < workers_count; i++){
+    const struct tcp_sub_stats *ws = &workers[i].raw->stats;
+
+    raw->connections += ws->connections;
+    raw->wakeups     += ws->wakeups;
+    raw->reads       += ws->reads;
+    raw->read_nsec   += ws->read_nsec;
+    raw->bytes       += ws->bytes;
+    raw->msgs        += ws->msgs;
+    raw->connects    += ws->connects;
+    raw->disconnects += ws->disconnects;
+    raw->bad         += ws->bad;
+  }
+}
+
+/* Counters of the repeat collapsing (-X) of all workers
+ */
+static void dedup_stats(struct Worker *workers, int workers_count, struct dedup_stats *dd){
+  int i;
+
+  for(i = 0; i < workers_count; i++){
+    const struct dedup_stats *ws = &workers[i].dedup->stats;
+
+    dd->suppressed += ws->suppressed;
+    dd->repeats    += ws->repeats;
+    dd->evicted    += ws->evicted;
+  }
+}
+
+/* Publish a snapshot of the per stage, per sink and per publisher counters
+ *
+ * Counters are totals since start, rates are over the last snapshot.
+ */
+void publish_stats(struct stats_sink *sink, struct Worker *workers, int workers_count, struct Merger *merger,
+                   struct Output *output, struct pub_registry *publishers, uint64_t start_usec){
+  struct Stats_Doc doc = {.now_usec = get_time()};
+  struct Stage_Stats total = {0};
+  uint64_t writes[MAX_SINKS] = {0}, written[MAX_SINKS] = {0}, write_nsec[MAX_SINKS] = {0};
+  uint64_t all_writes = 0, all_written = 0, all_write_nsec = 0;
+  struct timespec wall;
+  char *buf = 0;
+  size_t len = 0;
+  int i;
+
+  doc.fp = open_memstream(&buf, &len);
+  clock_gettime(CLOCK_REALTIME, &wall);
+
+  fprintf(doc.fp, "{\"time_usec\":%lu,\"uptime_usec\":%lu,\"workers\":[",
+          wall.tv_sec * 1000000UL + wall.tv_nsec / 1000, doc.now_usec - start_usec);
+
+  for(i = 0; i < workers_count; i++){
+    struct Worker *w = &workers[i];
+    uint64_t w_writes[MAX_SINKS] = {0}, w_written[MAX_SINKS] = {0}, w_write_nsec[MAX_SINKS] = {0};
+    uint64_t sum_writes = 0, sum_write_nsec = 0;
+    int k;
+
+    add_write_stats(w->writers, output->sinks_count, w_writes, w_written, w_write_nsec);
+
+    for(k = 0; k < output->sinks_count; k++){
+      sum_writes     += w_writes[k];
+      sum_write_nsec += w_write_nsec[k];
+    }
+
+    fprintf(doc.fp, "%s{\"worker\":%i,\"msgs\":%lu,\"bytes\":%lu,\"receive_nsec\":%lu,\"decode_nsec\":%lu,"
+            "\"format_nsec\":%lu,\"writes\":%lu,\"write_nsec\":%lu}",
+            i ? "," : "", w->id, w->stages.msgs, w->stages.bytes, w->stages.recv_nsec, w->stages.decode_nsec,
+            w->stages.format_nsec, sum_writes, sum_write_nsec);
+
+    total.msgs        += w->stages.msgs;
+    total.bytes       += w->stages.bytes;
+    total.recv_nsec   += w->stages.recv_nsec;
+    total.decode_nsec += w->stages.decode_nsec;
+    total.format_nsec += w->stages.format_nsec;
+    add_write_stats(w->writers, output->sinks_count, writes, written, write_nsec);
+  }
+
+  if(output->merge) add_write_stats(merger->writers, output->sinks_count, writes, written, write_nsec);
+
+  for(i = 0; i < output->sinks_count; i++){
+    all_writes     += writes[i];
+    all_written    += written[i];
+    all_write_nsec += write_nsec[i];
+  }
+
+  fprintf(doc.fp, "],\"stages\":{\"receive\":{\"msgs\":%lu,\"bytes\":%lu,\"nsec\":%lu},"
+          "\"decode\":{\"nsec\":%lu},\"format\":{\"nsec\":%lu},"
+          "\"write\":{\"writes\":%lu,\"bytes\":%lu,\"nsec\":%lu}}",
+          total.msgs, total.bytes, total.recv_nsec, total.decode_nsec, total.format_nsec,
+          all_writes, all_written, all_write_nsec);
+
+  fprintf(doc.fp, ",\"sinks\":[");
+
+  for(i = 0; i < output->sinks_count; i++){
+    fprintf(doc.fp, "%s{\"sink\":%i,\"writes\":%lu,\"bytes\":%lu,\"write_nsec\":%lu",
+            i ? "," : "", i, writes[i], written[i], write_nsec[i]);
+
+    if(output->sinks[i].file){
+      struct out_file_stats fs;
+      out_file_get_stats(output->sinks[i].file, &fs);
+      fprintf(doc.fp, ",\"file\":{\"files\":%lu,\"bytes\":%lu,\"disk_bytes\":%lu,\"writes\":%lu,\"stalls\":%lu,\"errors\":%lu}",
+              fs.files, fs.bytes, fs.disk_bytes, fs.writer.writes, fs.writer.stalls, fs.writer.errors);
+    }
+
+    if(output->sinks[i].relay){
+      struct relay *r = output->sinks[i].relay;
+      fprintf(doc.fp, ",\"relay\":{\"batches\":%lu,\"raw_bytes\":%lu,\"bytes\":%lu,\"dropped\":%lu}",
+              r->batches, r->raw_bytes, r->sent_bytes, r->dropped);
+    }
+
+    fprintf(doc.fp, "}");
+  }
+
+  fprintf(doc.fp, "]");
+
+  if(output->merge){
+    struct merge_stats ms;
+    merge_get_stats(output->merge, &ms);
+    fprintf(doc.fp, ",\"merge\":{\"merged\":%lu,\"buffered\":%lu,\"buffered_bytes\":%lu,\"late\":%lu,"
+            "\"forced\":%lu,\"waits\":%lu}",
+            ms.merged, ms.buffered, ms.buffered_bytes, ms.late, ms.forced, ms.waits);
+  }
+
+  if(workers_count && (workers[0].relay_sock >= 0)){
+    struct relay_in_stats in = {0};
+
+    for(i = 0; i < workers_count; i++){
+      in.batches += workers[i].relay_in.batches;
+      in.bytes   += workers[i].relay_in.bytes;
+      in.bad     += workers[i].relay_in.bad;
+    }
+
+    fprintf(doc.fp, ",\"relay_in\":{\"batches\":%lu,\"bytes\":%lu,\"bad\":%lu}", in.batches, in.bytes, in.bad);
+  }
+
+  if(output->tail){
+    struct live_tail *t = output->tail;
+    fprintf(doc.fp, ",\"tail\":{\"msgs\":%lu,\"bytes\":%lu,\"failed\":%lu}", t->msgs, t->bytes, t->failed);
+  }
+
+  if(workers_count && workers[0].raw){
+    struct tcp_sub_stats raw = {0};
+
+    raw_recv_stats(workers, workers_count, &raw);
+    fprintf(doc.fp, ",\"raw_recv\":{\"connections\":%lu,\"connects\":%lu,\"disconnects\":%lu,\"bad\":%lu,"
+            "\"wakeups\":%lu,\"reads\":%lu,\"bytes\":%lu,\"msgs\":%lu,\"read_nsec\":%lu}",
+            raw.connections, raw.connects, raw.disconnects, raw.bad, raw.wakeups, raw.reads, raw.bytes, raw.msgs,
+            raw.read_nsec);
+  }
+
+  if(output->repeat_usec){
+    struct dedup_stats dd = {0};
+
+    dedup_stats(workers, workers_count, &dd);
+    fprintf(doc.fp, ",\"dedup\":{\"suppressed\":%lu,\"repeats\":%lu,\"evicted\":%lu}",
+            dd.suppressed, dd.repeats, dd.evicted);
+  }
+
+  if(output->rollup){
+    uint64_t grows = output->rollup->stats.grows;
+
+    for(i = 0; i < workers_count; i++) grows += workers[i].rollup->stats.grows;
+
+    fprintf(doc.fp, ",\"rollup\":{\"callsites\":%lu,\"grows\":%lu}", output->rollup->stats.keys, grows);
+  }
+
+  struct pub_registry_stats ps;
+  pub_registry_get_stats(publishers, &ps);
+  fprintf(doc.fp, ",\"registry\":{\"publishers\":%lu,\"added\":%lu,\"reaped\":%lu,\"probes\":%lu,\"unknown_msgs\":%lu}",
+          ps.publishers, ps.added, ps.reaped, ps.probes, ps.unknown_msgs);
+
+  fprintf(doc.fp, ",\"publishers\":[");
+  pub_registry_for_each(publishers, write_publisher_stats, &doc);
+  fprintf(doc.fp, "]}\n");
+
+  fclose(doc.fp);
+
+  stats_sink_publish(sink, buf, len);
+  free(buf);
+}
+
+/* Collect the workers' per callsite counts of the interval that started at
+ * time_usec (wall clock) and append them to the rollup file
+ */
+static void write_rollup(struct Output *output, struct Worker *workers, int workers_count, struct out_buf *out,
+                         uint64_t time_usec, int secs){
+  int i;
+
+  for(i = 0; i < workers_count; i++) rollup_collect(output->rollup, workers[i].rollup);
+
+  rollup_write(output->rollup, out, time_usec, secs);
+  out_buf_flush(out);
+  out_file_flush(out->file);
+}
+
+static inline uint64_t wall_usec(){
+  struct timespec wall;
+  clock_gettime(CLOCK_REALTIME, &wall);
+  return wall.tv_sec * 1000000UL + wall.tv_nsec / 1000;
+}
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void request_stop(int sig){
+  (void)sig;
+  stop_requested = 1;
+}
+
+/* A -S sink, see parse_route()
+ */
+struct Sink_Config {
+  char file_name[1024];
+  enum output_format format;
+  int json_lines;
+  int flush;
+  size_t buf_size;
+  uint16_t link_type;
+  struct out_file_config file_config;  // rotation and retention, the writer is set up as for -j / -b
+};
+
+/* Parse a route "<prefixes>[@<eid>]=<format>:<file>[,<option>...]" and add
+ * it to the routing table
+ *
+ *   prefixes  comma separated type_lvl prefixes, e.g. LE,LW or T, * = all
+ *   eid       only records from the program with this prog_hash, hex
+ *   format    j = JSON, l = JSON Lines, b = binary segments,
+ *             p = pcapng (packet records only, e.g. P=p:pkt.pcapng)
+ *   options   R<MBytes>, T<secs>, k<files>, K<MBytes> as -R, -T, -k, -K,
+ *             f = flush after every receive batch, B<KBytes> buffer per thread,
+ *             L<linktype> pcapng link type of the packets (default 1, Ethernet),
+ *             z<threads> compress as -z
+ *
+ * Returns 0, or -1 if the route is malformed.
+ */
+int parse_route(const char *spec, struct route_table *routes, int sink, struct Sink_Config *config){
+  char *copy = strdup(spec);
+  char *save, *prefix, *opt, *next, *end;
+  uint64_t prog_hash = 0;
+  int any_prog = 1;
+  int rc = -1;
+
+  memset(config, 0, sizeof(*config));
+  config->buf_size  = OUT_BUF_SIZE;
+  config->link_type = PCAPNG_LINKTYPE_ETHERNET;
+
+  char *target = strchr(copy, '=');
+  if(!target) goto done;
+  *target++ = 0;
+
+  switch(target[0]){
+    case 'j': config->format = OUTPUT_JSON; break;
+    case 'l': config->format = OUTPUT_JSON; config->json_lines = 1; break;
+    case 'b': config->format = OUTPUT_SEGMENT; break;
+    case 'p': config->format = OUTPUT_PCAPNG; break;
+    default: goto done;
+  }
+
+  if(target[1] != ':') goto done;
+
+  // file name, then options
+  opt = strchr(target + 2, ',');
+  if(opt) *opt++ = 0;
+
+  snprintf(config->file_name, sizeof(config->file_name), "%s", target + 2);
+  if(!config->file_name[0]) goto done;
+
+  for(; opt && *opt; opt = next){
+    next = strchr(opt, ',');
+    if(next) *next++ = 0;
+
+    switch(opt[0]){
+      case 'R': config->file_config.rotate_bytes = strtoull(opt + 1, 0, 0) << 20; break;
+      case 'T': config->file_config.rotate_usec  = strtoull(opt + 1, 0, 0) * 1000000; break;
+      case 'k': config->file_config.keep_files   = atoi(opt + 1); break;
+      case 'K': config->file_config.keep_bytes   = strtoull(opt + 1, 0, 0) << 20; break;
+      case 'f': config->flush = 1; break;
+      case 'B': config->buf_size = strtoull(opt + 1, 0, 0) << 10; break;
+      case 'L': config->link_type = atoi(opt + 1); break;
+      case 'z': config->file_config.compress_threads = atoi(opt + 1); break;
+      default: goto done;
+    }
+  }
+
+  if(config->buf_size < 4096) config->buf_size = 4096;
+
+  char *at = strchr(copy, '@');
+  if(at){
+    *at++ = 0;
+    prog_hash = strtoull(at, &end, 16);  // hex as every output prints it, 0x optional
+    if((end == at) || *end) goto done;
+    any_prog = 0;
+  }
+
+  for(prefix = strtok_r(copy, ",", &save); prefix; prefix = strtok_r(NULL, ",", &save)){
+    if(route_table_add(routes, strcmp(prefix, "*") ? prefix : "", any_prog, prog_hash, sink) < 0) goto done;
+  }
+
+  rc = 0;
+
+done:
+  free(copy);
+  return rc;
+}
+
+//
+//
+
+int main(int argc, char *argv[])
+{
+  int rc;
+
+  struct {
+    int srv_adv_sock;
+
+    int  out_fd;
+    char out_file_name[1024];
+    enum output_format out_format;
+
+    int listening_port;
+    int sub_recv_buf_size;
+    int raw_recv;           // -e, see tcp_sub.h
+ 
+    int verbose;
+    int debug;
+
+    int workers_count;
+    struct Worker *workers;
+    struct Output output;
+
+    struct out_file_config file_config;
+
+    int json_lines;
+
+    uint64_t idle_usec;
+    struct pub_registry *publishers;
+
+    int ordered;
+    struct merge_config merge_config;
+    struct Merger merger;
+
+    const char *stats_file_name;
+    const char *stats_socket_path;
+    int stats_secs;
+    struct stats_sink *stats;
+
+    struct route_table *routes;
+    struct Sink_Config sink_configs[MAX_SINKS];  // [1..] -S sinks
+    int routes_count;
+
+    const char *symbol_path;
+
+    const char *upstream;   // edge, see relay.h
+    int relay_compress;
+    int relay_port;         // aggregator
+    int relay_sock;
+
+    const char *tail_url;   // see live_tail.h
+    int tail_queue_size;
+
+    const char *rollup_file_name;  // see rollup.h
+    int rollup_secs;
+    struct out_buf rollup_out;
+  } ctx = {0, -1, {0}, OUTPUT_JSON,
+    .listening_port = 50002,
+    .sub_recv_buf_size  = (1<<20) * 20, // Default to 20 MByte
+    //.sub_recv_buf_size  = (1<<20) * 1, // Default to 1 MByte
+    //.sub_recv_buf_size    = 0,             // Don't confuse the vxsim
+    .verbose = 0,
+    .debug = 0,
+    .workers_count = 1,
+    .idle_usec = 30 * 1000000ULL,
+    .stats_secs = 10,
+    .relay_sock = -1,
+    .tail_queue_size = LIVE_TAIL_QUEUE_SIZE,
+    .rollup_secs = ROLLUP_SECS,
+    .merge_config = {
+      .lateness_usec = 1000000,
+      .max_bytes     = MERGE_MAX_BYTES
+    },
+    .file_config = {
+      .async = 1,
+      .writer = {
+        .backend = DISK_WRITER_URING,
+        .direct  = 0,
+        .buffers = DISK_WRITER_BUFFERS,
+        .threads = DISK_WRITER_POOL_THREADS
+      }
+    }
+  };
+
+  int opt, i;
+
+  while ((opt = getopt(argc, argv, "vndshlcej:b:p:w:a:q:DR:T:k:K:o:M:I:t:u:i:S:y:z:U:A:L:Q:X:G:g:")) != -1) {
+    switch (opt) {
+
+      case 'v':
+        ctx.verbose = 1;
+        break;
+
+      case 'd':
+        ctx.debug = 1;
+        break;
+
+      case 'n':
+        ctx.out_fd = open("/dev/null", O_RDWR);
+        break;
+
+      case 's':
+        ctx.out_fd = STDOUT_FILENO;
+        break;
+
+      case 'j':
+        snprintf(ctx.out_file_name, sizeof(ctx.out_file_name), "%s", optarg);
+        ctx.out_format = OUTPUT_JSON;
+      break;
+
+      case 'l':
+        ctx.json_lines = 1;
+        break;
+
+      case 'b':
+        snprintf(ctx.out_file_name, sizeof(ctx.out_file_name), "%s", optarg);
+        ctx.out_format = OUTPUT_SEGMENT;
+      break;
+
+      case 'R':
+        ctx.file_config.rotate_bytes = strtoull(optarg, 0, 0) << 20;
+        break;
+
+      case 'T':
+        ctx.file_config.rotate_usec = strtoull(optarg, 0, 0) * 1000000;
+        break;
+
+      case 'k':
+        ctx.file_config.keep_files = atoi(optarg);
+        break;
+
+      case 'K':
+        ctx.file_config.keep_bytes = strtoull(optarg, 0, 0) << 20;
+        break;
+
+      case 'p':
+        ctx.listening_port = atoi(optarg);
+        break;
+
+      case 'w':
+        ctx.workers_count = atoi(optarg);
+        if(ctx.workers_count < 1) ctx.workers_count = 1;
+        break;
+
+      case 'a':
+        if(strcmp(optarg, "sync") == 0){
+          ctx.file_config.async = 0;
+        } else if(strcmp(optarg, "threads") == 0){
+          ctx.file_config.writer.backend = DISK_WRITER_THREADS;
+        } else {
+          ctx.file_config.writer.backend = DISK_WRITER_URING;
+        }
+        break;
+
+      case 'q':
+        ctx.file_config.writer.buffers = atoi(optarg);
+        if(ctx.file_config.writer.buffers < 2) ctx.file_config.writer.buffers = 2;
+        break;
+
+      case 'D':
+        ctx.file_config.writer.direct = 1;
+        break;
+
+      case 'z':
+        ctx.file_config.compress_threads = atoi(optarg);
+        if(ctx.file_config.compress_threads < 1) ctx.file_config.compress_threads = 1;
+        break;
+
+      case 'o':
+        ctx.ordered = 1;
+        ctx.merge_config.lateness_usec = strtoull(optarg, 0, 0) * 1000;
+        break;
+
+      case 'M':
+        ctx.merge_config.max_bytes = strtoull(optarg, 0, 0) << 20;
+        if(!ctx.merge_config.max_bytes) ctx.merge_config.max_bytes = MERGE_MAX_BYTES;
+        break;
+
+      case 'I':
+        ctx.idle_usec = strtoull(optarg, 0, 0) * 1000000;
+        break;
+
+      case 't':
+        ctx.stats_file_name = optarg;
+        break;
+
+      case 'u':
+        ctx.stats_socket_path = optarg;
+        break;
+
+      case 'i':
+        ctx.stats_secs = atoi(optarg);
+        if(ctx.stats_secs < 1) ctx.stats_secs = 1;
+        break;
+
+      case 'S':
+        if(!ctx.routes) ctx.routes = route_table_new();
+
+        if((ctx.routes_count + 1 >= MAX_SINKS) ||
+           (parse_route(optarg, ctx.routes, ctx.routes_count + 1, &ctx.sink_configs[ctx.routes_count + 1]) < 0)){
+          fprintf(stderr, "bad or too many routes: -S %s\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+
+        ctx.routes_count += 1;
+        break;
+
+      case 'y':
+        ctx.symbol_path = optarg;
+        break;
+
+      case 'U':
+        ctx.upstream = optarg;
+        break;
+
+      case 'c':
+        ctx.relay_compress = 1;
+        break;
+
+      case 'A':
+        ctx.relay_port = atoi(optarg);
+        break;
+
+      case 'e':
+        ctx.raw_recv = 1;
+        break;
+
+      case 'L':
+        ctx.tail_url = optarg;
+        break;
+
+      case 'Q':
+        ctx.tail_queue_size = atoi(optarg) << 20;
+        break;
+
+      case 'X':
+        ctx.output.repeat_usec = strtoull(optarg, 0, 0) * 1000;
+        break;
+
+      case 'G':
+        ctx.rollup_file_name = optarg;
+        break;
+
+      case 'g':
+        ctx.rollup_secs = atoi(optarg);
+        if(ctx.rollup_secs < 1) ctx.rollup_secs = 1;
+        break;
+
+      case 'h':
+      default: /* '?' */
+        fprintf(stderr, "Usage: %s [-h][-s][-d][-n][-l][-j <file>][-b <file>][-p <port>], [-r <bytes>][-w <workers>][-a <writer>][-q <buffers>][-D][-z <threads>]\n"
+                "          [-R <MBytes>][-T <secs>][-k <files>][-K <MBytes>][-o <msec>][-M <MBytes>][-I <secs>]\n"
+                "          [-t <file>][-u <path>][-i <secs>][-S <route>]...[-y <dirs>][-U <host:port>][-c][-A <port>][-e]\n"
+                "          [-L <url>][-Q <MBytes>][-X <msec>][-G <file>][-g <secs>]\n"
+                "-h     help\n"
+                "-v     verbose \n"
+                "-d     debug \n"
+                "-j     output json to <file>\n"
+                "-b     output binary segments to <file> and an index to <file>.idx, see seg_to_json and seg_query\n"
+                "-s     output json to stdout\n"
+                "-r     receive buffer size in bytes (default %i bytes, 0 = use system defaults)\n"
+                "-n     output json to /dev/null\n"
+                "-l     output JSON Lines, one valid JSON object per line (default the legacy format)\n"
+                "-p     listening port <port> (default %i)\n"
+                "-w     receive with <workers> threads, publishers are sharded across workers (default 1)\n"
+                "-e     receive over TCP with epoll and per publisher buffers instead of nanomsg SUB sockets\n"
+                "-a     write files with <writer>: uring, threads (pwrite thread pool) or sync (default uring)\n"
+                "-q     <buffers> of %i MBytes for async writes, filling + in flight (default %i)\n"
+                "-D     write files with O_DIRECT, bypassing the page cache\n"
+                "-z     compress files in %i KByte blocks with <threads> threads, see zfile_cat\n"
+                "-R     start a new file every <MBytes>, files are named by their start time\n"
+                "-T     start a new file every <secs>\n"
+                "-k     keep at most <files> closed files, the oldest are deleted (default keep all)\n"
+                "-K     keep at most <MBytes> of closed files\n"
+                "-o     write records in time order, waiting up to <msec> for records from slower publishers\n"
+                "-M     buffer at most <MBytes> of records for -o (default %i)\n"
+                "-I     check publishers silent for <secs> and drop the ones that have exited (default 30, 0 = never)\n"
+                "-t     write statistics to <file> as one JSON document, replaced every -i seconds\n"
+                "-u     serve statistics on the Unix socket <path>, each connection gets the latest JSON document\n"
+                "-i     statistics every <secs> (default 10)\n"
+                "-S     route records to another file, <prefixes>[@<eid>]=<format>:<file>[,<option>...]\n"
+                "         prefixes: type_lvl prefixes, e.g. LE,LW or T or P, * = all, the longest match wins\n"
+                "         eid: only records from the program with this prog_hash, in hex as output\n"
+                "         format: j = json, l = JSON Lines, b = binary segments, p = pcapng (P records)\n"
+                "         options: R<MBytes>, T<secs>, k<files>, K<MBytes> as -R -T -k -K,\n"
+                "                  f = flush every batch, B<KBytes> buffer per thread, L<linktype> for pcapng,\n"
+                "                  z<threads> compress as -z\n"
+                "         records without a route go to -j, -b, -s or -n (up to %i routes)\n"
+                "-y     add func and src (file:line) of fptr to JSON output, executables are found in <dirs>, : separated\n"
+                "-U     relay: send records without a route, unformatted, to the log_to_file at <host:port> (its -A),\n"
+                "         in batches of %i KBytes per worker, instead of -j, -b, -s or -n\n"
+                "-c     compress the batches sent with -U\n"
+                "-A     aggregate: receive batches from relays on <port>\n"
+                "-L     publish records live as JSON Lines on <url> (tcp://host:port or ipc:///path), topic type_lvl,\n"
+                "         see log_tail\n"
+                "-Q     queue at most <MBytes> for each -L consumer, a slower consumer misses records (default %i)\n"
+                "-X     collapse log records repeated within <msec>: the first is written, the others are counted\n"
+                "         in one record written when the window ends, see dedup.h\n"
+                "-G     write record counts per callsite (eid, fptr, line, mask) to <file> every -g seconds, with or\n"
+                "         without -j, -b, -s or -n, see rollup.h\n"
+                "-g     rollup interval in <secs> (default %i)\n"
+                "\n"
+                "Note: Log/Trace/Pkt Capture messages will be recieved but not parsed or stored unless -j, -b, -s or -n is specified\n",
+                argv[0],
+                ctx.sub_recv_buf_size,
+                ctx.listening_port,
+                DISK_WRITER_BUF_SIZE >> 20,
+                DISK_WRITER_BUFFERS,
+                ZFILE_BLOCK_SIZE >> 10,
+                MERGE_MAX_BYTES >> 20,
+                MAX_SINKS - 1,
+                RELAY_BATCH_SIZE >> 10,
+                LIVE_TAIL_QUEUE_SIZE >> 20,
+                ROLLUP_SECS
+                );
+        exit(EXIT_FAILURE);
+    }
+  }
+
+  if(ctx.upstream && (ctx.out_file_name[0] || (ctx.out_fd >= 0))){
+    fprintf(stderr, "-U sends records upstream, it can't be combined with -j, -b, -s or -n\n");
+    exit(EXIT_FAILURE);
+  }
+
+  fprintf(stderr,
+    "out_file_name: %s\n"
+    "listening_port: %i\n"
+    "sub_recv_buf_size: %i\n"
+    "verbose: %i\n"
+    "debug: %i\n"
+    "workers: %i\n",
+    ctx.out_file_name,
+    ctx.listening_port,
+    ctx.sub_recv_buf_size,
+    ctx.verbose,
+    ctx.debug,
+    ctx.workers_count
+    );
+
+  // Publishers we are subscribed to
+  ctx.publishers = pub_registry_new();
+
+  // Create and bind socket to receive service advertisements
+  // sent by components that can produce log/trace/pkt capture messages
+  ctx.srv_adv_sock = nn_socket(AF_SP, NN_PULL);
+  errno_assert(ctx.srv_adv_sock >= 0);
+
+  char *listening_address;
+  asprintf(&listening_address, "tcp://0.0.0.0:%i", ctx.listening_port);
+  rc = nn_bind(ctx.srv_adv_sock, listening_address);
+  errno_assert (rc >= 0);
+
+  // Aggregator, relays on other hosts send their batches here, see relay.h
+  if(ctx.relay_port){
+    ctx.relay_sock = relay_listen(ctx.relay_port, ctx.sub_recv_buf_size);
+    errno_assert (ctx.relay_sock >= 0);
+
+    fprintf(stderr, "receiving relay batches on port %i\n", ctx.relay_port);
+  }
+
+  // Consumers of the live view subscribe here
+  if(ctx.tail_url){
+    ctx.output.tail = live_tail_open(ctx.tail_url, ctx.tail_queue_size);
+
+    if(!ctx.output.tail){
+      fprintf(stderr, "-L %s: %s\n", ctx.tail_url, nn_strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+
+    fprintf(stderr, "publishing records on %s\n", ctx.tail_url);
+  }
+
+  // Start the workers that receive log/trace/pkt capture messages
+  struct Sink *sink = &ctx.output.sinks[0];
+
+  sink->out_fd     = ctx.out_fd;
+  sink->format     = ctx.out_format;
+  sink->json_lines = ctx.json_lines;
+  sink->buf_size   = OUT_BUF_SIZE;
+
+  // Segment files get a sparse time/publisher index, see seg_index.h
+  // Files are written asynchronously so the disk doesn't stall receiving
+  if(ctx.out_file_name[0]){
+    ctx.file_config.name    = ctx.out_file_name;
+    ctx.file_config.segment = (ctx.out_format == OUTPUT_SEGMENT);
+
+    sink->file = out_file_open(&ctx.file_config);
+    errno_assert(sink->file);
+
+    fprintf(stderr, "writer: %s, %i buffers\n", out_file_writer_name(sink->file), ctx.file_config.writer.buffers);
+  } else if(ctx.out_format == OUTPUT_SEGMENT){
+    sink->format = OUTPUT_JSON;
+  }
+
+  // An edge formats nothing, records without a route go upstream as segments
+  if(ctx.upstream){
+    char *url = 0;
+
+    if(strstr(ctx.upstream, "://")){
+      url = strdup(ctx.upstream);
+    } else {
+      asprintf(&url, "tcp://%s", ctx.upstream);
+    }
+
+    sink->format   = OUTPUT_SEGMENT;
+    sink->buf_size = RELAY_BATCH_SIZE;
+    sink->relay    = relay_open(url, ctx.relay_compress);
+
+    if(!sink->relay){
+      fprintf(stderr, "can't relay to %s: %s\n", url, nn_strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+
+    fprintf(stderr, "relay: %s%s\n", url, ctx.relay_compress ? ", compressed" : "");
+    free(url);
+  }
+
+  // Routed sinks, each with its own file, format and I/O policy
+  for(i = 1; i <= ctx.routes_count; i++){
+    struct Sink_Config *sc = &ctx.sink_configs[i];
+
+    sink = &ctx.output.sinks[i];
+    sink->out_fd     = -1;
+    sink->format     = sc->format;
+    sink->json_lines = sc->json_lines;
+    sink->flush      = sc->flush;
+    sink->buf_size   = sc->buf_size;
+    sink->link_type  = sc->link_type;
+
+    sc->file_config.name    = sc->file_name;
+    sc->file_config.segment = (sc->format == OUTPUT_SEGMENT);
+    sc->file_config.async   = ctx.file_config.async;
+    sc->file_config.writer  = ctx.file_config.writer;
+
+    sink->file = out_file_open(&sc->file_config);
+    errno_assert(sink->file);
+
+    fprintf(stderr, "route %i: %s\n", i, sc->file_name);
+  }
+
+  ctx.output.sinks_count = ctx.routes_count + 1;
+  ctx.output.routes      = ctx.routes;
+
+  // Per callsite counts, written by this thread as another output file
+  if(ctx.rollup_file_name){
+    struct out_file_config rollup_config = ctx.file_config;
+
+    rollup_config.name    = ctx.rollup_file_name;
+    rollup_config.segment = 0;
+
+    out_buf_init(&ctx.rollup_out, -1, 0, OUT_BUF_SIZE);
+    ctx.rollup_out.file = out_file_open(&rollup_config);
+    errno_assert(ctx.rollup_out.file);
+
+    ctx.output.rollup = rollup_new();
+
+    fprintf(stderr, "rollup: %s every %i secs\n", ctx.rollup_file_name, ctx.rollup_secs);
+  }
+
+  // Symbols of each program are loaded when it advertises, see symbolizer.h
+  if(ctx.symbol_path) ctx.output.symbols = symbolizer_new(ctx.symbol_path);
+
+  int store_output = 0;
+
+  for(i = 0; i < ctx.output.sinks_count; i++){
+    pthread_mutex_init(&ctx.output.sinks[i].lock, NULL);
+    store_output |= sink_stores(&ctx.output.sinks[i]);
+  }
+
+  // Service descriptors are written from this thread
+  struct Sink_Writer svc_writers[MAX_SINKS];
+
+  for(i = 0; i < ctx.output.sinks_count; i++){
+    sink_writer_init(&svc_writers[i], &ctx.output.sinks[i], ctx.workers_count, 4096, 0);
+  }
+
+  // Workers hand records to the merge, one thread writes them in time order
+
+  if(ctx.ordered && store_output){
+    ctx.output.merge = merge_new(&ctx.merge_config);
+    merger_start(&ctx.merger, &ctx.output, ctx.workers_count + 1);
+  }
+
+  ctx.workers = calloc(ctx.workers_count, sizeof(ctx.workers[0]));
+
+  for(i = 0; i < ctx.workers_count; i++){
+    worker_start(&ctx.workers[i], i, &ctx.output, ctx.publishers, ctx.relay_sock, ctx.raw_recv,
+                 ctx.sub_recv_buf_size, ctx.verbose);
+  }
+
+  fprintf(stderr, "connected, enter message processing loop\n");
+
+  struct nn_pollfd pfd [1];
+  pfd [0].fd = ctx.srv_adv_sock;
+  pfd [0].events = NN_POLLIN;
+
+  int received_msg_count = 0;
+
+  uint64_t start_usec = get_time();
+  uint64_t stats_usec = 0, check_usec = start_usec;
+  uint64_t rollup_usec = start_usec, rollup_wall_usec = wall_usec();
+  uint64_t pub_changes = 0;  // publishers added + reaped, when the preambles were updated
+
+  // Statistics for monitoring, see stats_sink.h
+  if(ctx.stats_file_name || ctx.stats_socket_path){
+    ctx.stats = stats_sink_open(ctx.stats_file_name, ctx.stats_socket_path);
+    errno_assert(ctx.stats);
+  }
+
+  // Stop on SIGINT / SIGTERM so buffered output reaches the file
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = request_stop;
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+
+  while(!stop_requested){
+    uint64_t now_usec = get_time();
+
+    if((ctx.verbose || ctx.stats) && ((now_usec - stats_usec) >= (ctx.stats_secs * 1000000ULL))){
+      stats_usec = now_usec;
+
+      if(ctx.stats){
+        publish_stats(ctx.stats, ctx.workers, ctx.workers_count, &ctx.merger, &ctx.output, ctx.publishers, start_usec);
+      }
+
+      if(ctx.verbose){
+        for(i = 0, received_msg_count = 0; i < ctx.workers_count; i++){
+          received_msg_count += ctx.workers[i].received_msg_count;
+        }
+        fprintf(stderr, "\n\n********* Enter Poll, %i messages so far, ", received_msg_count);
+
+        for(i = 0; i < ctx.output.sinks_count; i++){
+          if(!ctx.output.sinks[i].file) continue;
+
+          struct out_file_stats fs;
+          out_file_get_stats(ctx.output.sinks[i].file, &fs);
+          fprintf(stderr, "sink %i: %lu files, %lu bytes (%lu on disk), %lu writes, %lu stalls, %lu errors, ",
+                  i, fs.files, fs.bytes, fs.disk_bytes, fs.writer.writes, fs.writer.stalls, fs.writer.errors);
+        }
+
+        if(ctx.raw_recv){
+          struct tcp_sub_stats raw = {0};
+          raw_recv_stats(ctx.workers, ctx.workers_count, &raw);
+          fprintf(stderr, "raw receive %lu msgs in %lu reads, %lu wakeups, %lu connections, %lu disconnects, ",
+                  raw.msgs, raw.reads, raw.wakeups, raw.connections, raw.disconnects);
+        }
+
+        if(ctx.output.repeat_usec){
+          struct dedup_stats dd = {0};
+          dedup_stats(ctx.workers, ctx.workers_count, &dd);
+          fprintf(stderr, "collapsed %lu repeated records into %lu, %lu runs closed early, ",
+                  dd.suppressed, dd.repeats, dd.evicted);
+        }
+
+        if(ctx.output.tail){
+          struct live_tail *t = ctx.output.tail;
+          fprintf(stderr, "published %lu records, %lu bytes, %lu failed, ", t->msgs, t->bytes, t->failed);
+        }
+
+        if(ctx.output.sinks[0].relay){
+          struct relay *r = ctx.output.sinks[0].relay;
+          fprintf(stderr, "relayed %lu batches, %lu bytes (%lu raw), %lu dropped, ",
+                  r->batches, r->sent_bytes, r->raw_bytes, r->dropped);
+        }
+
+        if(ctx.output.merge){
+          struct merge_stats ms;
+          merge_get_stats(ctx.output.merge, &ms);
+          fprintf(stderr, "merged %lu, buffered %lu (%lu bytes), late %lu, forced %lu, waits %lu, ",
+                  ms.merged, ms.buffered, ms.buffered_bytes, ms.late, ms.forced, ms.waits);
+        }
+
+        if(ctx.output.rollup){
+          fprintf(stderr, "%lu callsites rolled up, ", ctx.output.rollup->stats.keys);
+        }
+
+        struct pub_registry_stats ps;
+        pub_registry_get_stats(ctx.publishers, &ps);
+        fprintf(stderr, "%lu publishers, %lu added, %lu reaped, %lu probes, ",
+                ps.publishers, ps.added, ps.reaped, ps.probes);
+      }
+    }
+
+    if(ctx.output.rollup && ((now_usec - rollup_usec) >= (ctx.rollup_secs * 1000000ULL))){
+      write_rollup(&ctx.output, ctx.workers, ctx.workers_count, &ctx.rollup_out, rollup_wall_usec, ctx.rollup_secs);
+      rollup_usec      += ctx.rollup_secs * 1000000ULL;
+      rollup_wall_usec += ctx.rollup_secs * 1000000ULL;
+    }
+
+    if(ctx.idle_usec && ((now_usec - check_usec) >= (PUB_CHECK_MSEC * 1000ULL))){
+      check_usec = now_usec;
+      check_publishers(ctx.publishers, ctx.workers, ctx.output.merge, svc_writers, ctx.output.sinks_count, ctx.idle_usec);
+    }
+
+    rc = nn_poll (pfd, sizeof(pfd)/sizeof(pfd[0]), PUB_CHECK_MSEC);
+
+    if(ctx.verbose && ctx.debug){
+      for(i=0; i <(sizeof(pfd)/sizeof(pfd[0])); i++){
+        fprintf(stderr, "pfd[%d].revents = %x; ", i, pfd[i].revents);
+      }
+    }
+
+    if (rc == 0) {
+      if(ctx.verbose && ctx.debug){
+        fprintf (stderr, "Timeout!");
+      }
+    } else if (rc == -1) {
+      if(errno != EINTR) fprintf (stderr, "nn_poll Error! %s", nn_strerror(errno));
+    } else {
+
+      if (pfd [0].revents & NN_POLLIN) {
+        struct Svc_Desc sd = receive_service_notification(pfd[0].fd, svc_writers, ctx.output.sinks_count);
+
+        if(ctx.output.symbols){
+          symbolizer_add_program(ctx.output.symbols, sd.prog_hash, sd.program_name, sizeof(sd.program_name));
+        }
+
+        // subscribe to log stream from the actor
+        //   identified in the recieved service descriptor
+        //
+        add_publisher(ctx.publishers, ctx.workers, ctx.workers_count, &sd);
+      }
+
+      if(ctx.verbose){
+        // fprintf(stderr, "\n");
+        // todo: how often???
+        // fflush(NULL);
+      }
+    }
+
+    // Each new output file starts with the descriptors of the publishers known then
+    struct pub_registry_stats rs;
+    pub_registry_get_stats(ctx.publishers, &rs);
+
+    if(store_output && ((rs.added + rs.reaped) != pub_changes)){
+      pub_changes = rs.added + rs.reaped;
+      update_preambles(&ctx.output, ctx.publishers, ctx.workers_count);
+    }
+  }
+
+  free(listening_address);
+
+  fprintf(stderr, "stopping, writing buffered output\n");
+
+  for(i = 0; i < ctx.workers_count; i++){
+    ctx.workers[i].stop = 1;
+  }
+
+  for(i = 0; i < ctx.workers_count; i++){
+    pthread_join(ctx.workers[i].thread, NULL);
+    if(!ctx.workers[i].raw) nn_close (ctx.workers[i].sub_sock);
+  }
+
+  if(ctx.relay_sock >= 0) nn_close(ctx.relay_sock);
+
+  if(ctx.output.merge){
+    struct merge_stats ms;
+
+    ctx.merger.stop = 1;
+    merge_wake(ctx.output.merge);
+    pthread_join(ctx.merger.thread, NULL);
+
+    merge_get_stats(ctx.output.merge, &ms);
+    fprintf(stderr, "merged %lu records from %lu publishers, %lu late, %lu released early to bound memory\n",
+            ms.merged, ms.publishers, ms.late, ms.forced);
+  }
+
+  // The last, partial, interval
+  if(ctx.output.rollup){
+    int secs = (get_time() - rollup_usec + 999999) / 1000000;
+    write_rollup(&ctx.output, ctx.workers, ctx.workers_count, &ctx.rollup_out, rollup_wall_usec, secs ? secs : 1);
+
+    // every record counted must have been written exactly once
+    uint64_t counted = 0;
+    for(i = 0; i < ctx.workers_count; i++) counted += ctx.workers[i].rollup->stats.records;
+
+    if(counted != ctx.output.rollup->stats.records){
+      fprintf(stderr, "rollup: %lu records counted but %lu written\n", counted, ctx.output.rollup->stats.records);
+    }
+  }
+
+  // Final counters
+  if(ctx.stats){
+    publish_stats(ctx.stats, ctx.workers, ctx.workers_count, &ctx.merger, &ctx.output, ctx.publishers, start_usec);
+    stats_sink_close(ctx.stats);
+  }
+
+  if(ctx.output.merge) merge_free(ctx.output.merge);
+
+  for(i = 0; i < ctx.workers_count; i++){
+    if(ctx.workers[i].raw) tcp_sub_free(ctx.workers[i].raw);
+    if(ctx.workers[i].dedup) dedup_free(ctx.workers[i].dedup);
+    if(ctx.workers[i].rollup) rollup_free(ctx.workers[i].rollup);
+  }
+
+  for(i = 0; i < ctx.output.sinks_count; i++){
+    if(ctx.output.sinks[i].file) out_file_close(ctx.output.sinks[i].file);
+  }
+
+  if(ctx.output.sinks[0].relay) relay_close(ctx.output.sinks[0].relay);
+  if(ctx.output.tail) live_tail_close(ctx.output.tail);
+
+  if(ctx.output.rollup){
+    out_file_close(ctx.rollup_out.file);
+    out_buf_free(&ctx.rollup_out);
+    rollup_free(ctx.output.rollup);
+  }
+
+  if(ctx.routes) route_table_free(ctx.routes);
+  if(ctx.output.symbols) symbolizer_free(ctx.output.symbols);
 
-  nn_close (ctx.sub_sock);
+  pub_registry_free(ctx.publishers);
 }
 
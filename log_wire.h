@@ -0,0 +1,27 @@
+
+/*
+ * log_wire.h
+ *
+ * Log/trace/pkt message header as sent on the wire.
+ * Every message is this fixed size header immediately followed by the payload.
+ *
+ * Fields are in host byte order.
+ */
+
+#ifndef _LOG_WIRE_H_
+#define _LOG_WIRE_H_
+
+#include <stdint.h>
+
+struct log_wire_hdr {
+  char     type_lvl[8];      // LOG_LVL_DEBUG, TRACE_LVL_FUNC_ENTER, etc.
+  uint64_t prog_hash;        // eid
+  uint64_t process_id;       // pid
+  uint64_t function_ptr;     // fptr
+  uint64_t file_line_number; // line
+  uint64_t usec;             // timestamp
+};
+
+#define LOG_WIRE_HDR_LEN (sizeof(struct log_wire_hdr))
+
+#endif /* _LOG_WIRE_H_ */
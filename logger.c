@@ -9,8 +9,28 @@
 #include "context.h"
 
 #include "logger.h"
+#include "intern.h"
+#include "msg_arena.h"
 #include "util.h"
 
+static void send_shed_report(struct log_context *g_log);
+
+/* Update counters after a send attempt
+ */
+static void account_log_msg(struct log_context *g_log, int bytes, uint64_t payload_len, uint64_t usec){
+  g_log->msg_sent += 1;
+
+  if(bytes > 0){
+    g_log->msg_bytes_sent += bytes;
+    g_log->payload_bytes_sent += payload_len;
+  }
+
+  // Send buffer full, adjust shedding and report the new sampling factors in-band
+  if(shed_account(&g_log->shed, (bytes > 0), usec)){
+    send_shed_report(g_log);
+  }
+}
+
 int send_log_msg(
     struct log_context *g_log,
     const char *type_lvl,      // LOG_LVL_DEBUG, TRACE_LVL_FUNC, etc.
@@ -63,11 +83,7 @@ int send_log_msg(
 
   int bytes = nn_sendmsg(g_log->pub_fd, &hdr, g_log->pub_sendmsg_flags);
 
-  g_log->msg_sent += 1;
-  g_log->msg_bytes_sent += bytes;
-  g_log->payload_bytes_sent += pkt_len;
-
-  if(bytes <= 0) printf("log message not sent, bytes = %i\n", bytes);
+  account_log_msg(g_log, bytes, pkt_len, usec);
 
   if(0){
     printf("\n%s SENT\n", __func__);
@@ -77,6 +93,50 @@ int send_log_msg(
   return bytes;
 }
 
+/* Send a message built in place in an arena block.
+ *
+ * The payload is already in block->payload.  The header is filled in here
+ * and header + payload go to nanomsg as one contiguous buffer.
+ */
+int send_log_block(
+    struct log_context *g_log,
+    struct msg_block *block,
+    const char *type_lvl,      // LOG_LVL_DEBUG, TRACE_LVL_FUNC, etc.
+    uint64_t function_ptr,
+    uint64_t file_line_number,
+    uint64_t payload_len
+    )
+{
+  uint64_t usec = get_time();
+
+  memcpy(block->hdr.type_lvl, type_lvl, sizeof(block->hdr.type_lvl));
+  block->hdr.prog_hash        = g_log->prog_hash;
+  block->hdr.process_id       = getpid(); // Linux caches this for 2, 3, ... access
+  block->hdr.function_ptr     = function_ptr;
+  block->hdr.file_line_number = file_line_number;
+  block->hdr.usec             = usec;
+
+  int bytes = nn_send(g_log->pub_fd, block, LOG_WIRE_HDR_LEN + payload_len, g_log->pub_sendmsg_flags);
+
+  account_log_msg(g_log, bytes, payload_len, usec);
+
+  return bytes;
+}
+
+/* Send the current load shedding factors and loss counters.
+ *
+ * LOG_LVL_SHED is never shed itself.
+ */
+static void send_shed_report(struct log_context *g_log){
+  char report[128];
+
+  int len = shed_report(&g_log->shed, report, sizeof(report));
+
+  if(g_log->verbose) printf("%s %s\n", __func__, report);
+
+  send_log_msg(g_log, LOG_LVL_SHED, 0, 0, report, len+1);
+}
+
 /*
 uint64_t send_program_info(struct log_context *g_log){
   const char *type_lvl  = LOG_LVL_EXEC_NAME;
@@ -121,10 +181,32 @@ void log_printf(const char* type_lvl, int file_line_number, const char *fmt, ...
   const uint64_t function_ptr = (const uint64_t)__builtin_return_address(0);
   struct log_context *ctx = get_log_context();
 
-  // Render string
+  // Under send buffer pressure, drop before spending cycles on formatting
+  if(!shed_admit(&ctx->shed, type_lvl)) return;
+
   va_list ap;
+  int len;
+
+  // Render string in place in an arena block, no malloc
+  struct msg_block *block = msg_arena_get();
+
+  if(lg_fast(block != NULL)){
+    va_start (ap, fmt);
+    len = vsnprintf(block->payload, sizeof(block->payload), fmt, ap);
+    va_end(ap);
+
+    if(lg_fast((len >= 0) && ((size_t)len < sizeof(block->payload)))){
+      send_log_block(ctx, block, type_lvl, function_ptr, file_line_number, len+1);
+      msg_arena_put();
+      return;
+    }
+
+    msg_arena_put();
+  }
+
+  // Too long for a block (or nested logging used every block), render on the heap
   va_start (ap, fmt);
-  int len = vasprintf(&s, (fmt), ap);
+  len = vasprintf(&s, (fmt), ap);
   va_end(ap);
 
   len += 1; // account for terminating 0 in string
@@ -138,6 +220,46 @@ void log_printf(const char* type_lvl, int file_line_number, const char *fmt, ...
   return;
 }
 
+/* send a constant string to the log and trace system.
+ *
+ * type_lvl         - 8 char string for identfying and filtering messages
+ * file_line_number - line number in source file
+ * lit              - string literal (must not change for the life of the process)
+ * lit2             - optional second literal appended after a space, or 0
+ */
+// constant payloads are interned (see intern.h)
+// the text is sent once, after that only an 8 byte id is sent
+//
+void log_literal(const char* type_lvl, int file_line_number, const char *lit, const char *lit2){
+  char *s;
+
+  const uint64_t function_ptr = (const uint64_t)__builtin_return_address(0);
+  struct log_context *ctx = get_log_context();
+
+  if(!shed_admit(&ctx->shed, type_lvl)) return;
+
+  struct msg_block *block = msg_arena_get();
+
+  int len = lg_fast(block != NULL) ? intern_literal(lit, lit2, (uint8_t *)block->payload) : -1;
+
+  if(lg_fast(len >= 0)){
+    int sent = send_log_block(ctx, block, type_lvl, function_ptr, file_line_number, len);
+
+    // a dropped definition is sent again, not left to the periodic resend
+    if(lg_slow(sent < 0) && ((size_t)len > INTERN_REF_LEN)) intern_unsent(lit, lit2);
+
+    msg_arena_put();
+    return;
+  }
+
+  if(block) msg_arena_put();
+
+  // too long to intern (or no block free), send as a plain string
+  len = lit2 ? asprintf(&s, "%s %s", lit, lit2) : asprintf(&s, "%s", lit);
+  send_log_msg(ctx, type_lvl, function_ptr, file_line_number, s, len+1);
+  free(s);
+}
+
 /* send a raw packet to the log and trace system.
  *
  * type_lvl - 8 char string for identfying and filtering messages
@@ -164,6 +286,8 @@ void log_pkt(const char* type_lvl, const char* pkt_id, void *pkt, int pkt_len){
   const uint64_t function_ptr = (const uint64_t)__builtin_return_address(0);
   struct log_context *ctx = get_log_context();
 
+  if(!shed_admit(&ctx->shed, type_lvl)) return;
+
   // todo: include pkt_id in message
   send_log_msg(ctx, type_lvl, function_ptr, 0, pkt, pkt_len);
 
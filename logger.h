@@ -50,6 +50,14 @@
 
 #define LOG_LVL_EXEC_NAME     "EN      "
 
+/* Load shedding report, payload is the string from shed_report()
+ * "level=%i pkt=%u func=%u info=%u dropped=%lu shed=%lu"
+ *
+ * pkt/func/info are the current sampling factors (1 in n messages sent).
+ * Receivers multiply counts of the matching class by the factor.
+ */
+#define LOG_LVL_SHED          "LS      "
+
 
 /* printf and send a log or trace mesage to the log and trace system.
  *
@@ -65,6 +73,19 @@
  */
 void log_printf(const char* type_lvl, int file_line_number, const char *fmt, ...);
 
+/* send a constant string to the log and trace system.
+ *
+ * type_lvl         - 8 char string for identfying and filtering messages
+ * file_line_number - line number in source file
+ * lit              - string literal (must not change for the life of the process)
+ * lit2             - optional second literal appended after a space, or 0
+ *
+ * notes:
+ * - The text is only sent the first time (see intern.h), later messages
+ *   carry an 8 byte id in place of the text.
+ */
+void log_literal(const char* type_lvl, int file_line_number, const char *lit, const char *lit2);
+
 /* send a raw packet to the log and trace system.
  *
  * type_lvl - 8 char string for identfying and filtering messages
@@ -90,20 +111,25 @@ void log_pkt(const char* type_lvl, const char* pkt_id, void *pkt, int pkt_len);
 #define LG_ERROR(fmt, ...) \
     log_printf(LOG_LVL_ERROR, __LINE__, fmt, ##__VA_ARGS__);
 
+// Constant assert messages are interned, runtime messages are formatted
 #define LG_ASSERT(a_condition, a_message_Ptr) \
-    if(!(a_condition)){ log_printf(LOG_LVL_DEBUG_ASSERT, __LINE__, "%s %s", #a_condition, a_message_Ptr);}
+    if(!(a_condition)){ __builtin_constant_p(a_message_Ptr) ? \
+      log_literal(LOG_LVL_DEBUG_ASSERT, __LINE__, #a_condition, a_message_Ptr) : \
+      log_printf(LOG_LVL_DEBUG_ASSERT, __LINE__, "%s %s", #a_condition, a_message_Ptr);}
 
 
 /******* Tracing ************/
 
 #define TRACE_FUNC_ENTER() \
-    log_printf(TRACE_LVL_FUNC_ENTER, __LINE__, __FUNCTION__);
+    log_literal(TRACE_LVL_FUNC_ENTER, __LINE__, __FUNCTION__, 0);
 
 #define TRACE_FUNC_EXIT() \
-    log_printf(TRACE_LVL_FUNC_EXIT, __LINE__, __FUNCTION__);
+    log_literal(TRACE_LVL_FUNC_EXIT, __LINE__, __FUNCTION__, 0);
 
 #define TRACE_BRANCH(a_msg)\
-    log_printf(TRACE_LVL_BRANCH, __LINE__, a_msg);
+    (__builtin_constant_p(a_msg) ? \
+      log_literal(TRACE_LVL_BRANCH, __LINE__, a_msg, 0) : \
+      log_printf(TRACE_LVL_BRANCH, __LINE__, a_msg));
 
 #define TRACE_INFO(fmt, ...)\
     log_printf(TRACE_LVL_INFO, __LINE__, fmt, ##__VA_ARGS__);
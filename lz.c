@@ -0,0 +1,182 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "lz.h"
+
+#define MIN_MATCH      4
+#define LAST_LITERALS  5     // the block ends with at least this many literals
+#define MF_LIMIT       12    // no match starts in the last 12 bytes
+#define MAX_OFFSET     65535
+
+static inline uint32_t read32(const uint8_t *p){ uint32_t v; memcpy(&v, p, 4); return v; }
+static inline uint64_t read64(const uint8_t *p){ uint64_t v; memcpy(&v, p, 8); return v; }
+
+static inline uint32_t lz_hash(uint32_t v){
+  return (v * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+/* Length of a 4 bit length field with its 255 extension bytes
+ */
+static inline uint8_t *put_len(uint8_t *op, size_t len){
+  while(len >= 255){
+    *op++ = 255;
+    len  -= 255;
+  }
+  *op++ = len;
+  return op;
+}
+
+size_t lz_compress(const void *src, size_t len, void *dst, size_t cap, void *work){
+  const uint8_t *base   = src;
+  const uint8_t *ip     = base;
+  const uint8_t *anchor = base;
+  const uint8_t *end    = base + len;
+  uint8_t *op   = dst;
+  uint8_t *oend = op + cap;
+  uint32_t *table = work;
+  size_t lit;
+
+  if(len > MF_LIMIT){
+    const uint8_t *mf_limit    = end - MF_LIMIT;
+    const uint8_t *match_limit = end - LAST_LITERALS;
+
+    memset(table, 0, LZ_WORK_SIZE);
+    ip++;
+
+    while(ip < mf_limit){
+      uint32_t seq = read32(ip);
+      uint32_t h = lz_hash(seq);
+      const uint8_t *ref = base + table[h];
+
+      table[h] = ip - base;
+
+      if(((ip - ref) > MAX_OFFSET) || (read32(ref) != seq)){
+        // step faster through data that doesn't compress
+        ip += 1 + ((ip - anchor) >> 6);
+        continue;
+      }
+
+      while((ip > anchor) && (ref > base) && (ip[-1] == ref[-1])){
+        ip--;
+        ref--;
+      }
+
+      // extend the match 8 bytes at a time
+      const uint8_t *p = ip + MIN_MATCH;
+      const uint8_t *q = ref + MIN_MATCH;
+
+      while(p + 8 <= match_limit){
+        uint64_t diff = read64(p) ^ read64(q);
+        if(diff){
+          p += __builtin_ctzll(diff) >> 3;
+          goto matched;
+        }
+        p += 8;
+        q += 8;
+      }
+      while((p < match_limit) && (*p == *q)){
+        p++;
+        q++;
+      }
+
+    matched:
+      lit = ip - anchor;
+      size_t match_len = p - ip - MIN_MATCH;
+
+      if((oend - op) < (ptrdiff_t)(1 + lit + (lit / 255) + 1 + 2 + (match_len / 255) + 1 + LAST_LITERALS + 1)) return 0;
+
+      uint8_t *token = op++;
+
+      *token = ((lit >= 15) ? 15 : lit) << 4;
+      if(lit >= 15) op = put_len(op, lit - 15);
+      memcpy(op, anchor, lit);
+      op += lit;
+
+      uint16_t offset = ip - ref;
+      memcpy(op, &offset, 2);   // little endian hosts
+      op += 2;
+
+      *token |= (match_len >= 15) ? 15 : match_len;
+      if(match_len >= 15) op = put_len(op, match_len - 15);
+
+      ip = anchor = p;
+
+      // the position before the match end helps the next search
+      if(ip < mf_limit) table[lz_hash(read32(ip - 2))] = ip - 2 - base;
+    }
+  }
+
+  // last literals
+  lit = end - anchor;
+  if((oend - op) < (ptrdiff_t)(1 + lit + (lit / 255) + 1)) return 0;
+
+  *op++ = ((lit >= 15) ? 15 : lit) << 4;
+  if(lit >= 15) op = put_len(op, lit - 15);
+  memcpy(op, anchor, lit);
+  op += lit;
+
+  return op - (uint8_t *)dst;
+}
+
+int64_t lz_decompress(const void *src, size_t len, void *dst, size_t cap){
+  const uint8_t *ip   = src;
+  const uint8_t *iend = ip + len;
+  uint8_t *op   = dst;
+  uint8_t *oend = op + cap;
+  size_t lit, match_len, i;
+  uint8_t b;
+
+  while(ip < iend){
+    uint8_t token = *ip++;
+
+    lit = token >> 4;
+    if(lit == 15){
+      do {
+        if(ip >= iend) return -1;
+        b = *ip++;
+        lit += b;
+      } while(b == 255);
+    }
+
+    if((lit > (size_t)(iend - ip)) || (lit > (size_t)(oend - op))) return -1;
+
+    memcpy(op, ip, lit);
+    op += lit;
+    ip += lit;
+
+    if(ip == iend) break;   // the last sequence has no match
+
+    if((iend - ip) < 2) return -1;
+
+    size_t offset = ip[0] | (ip[1] << 8);
+    ip += 2;
+
+    if((offset == 0) || (offset > (size_t)(op - (uint8_t *)dst))) return -1;
+
+    match_len = token & 15;
+    if(match_len == 15){
+      do {
+        if(ip >= iend) return -1;
+        b = *ip++;
+        match_len += b;
+      } while(b == 255);
+    }
+    match_len += MIN_MATCH;
+
+    if(match_len > (size_t)(oend - op)) return -1;
+
+    const uint8_t *match = op - offset;
+
+    if(offset >= 8){
+      // 8 byte copies never read bytes they haven't written yet
+      for(i = 0; i + 8 <= match_len; i += 8) memcpy(op + i, match + i, 8);
+      for(; i < match_len; i++) op[i] = match[i];
+    } else {
+      for(i = 0; i < match_len; i++) op[i] = match[i];
+    }
+
+    op += match_len;
+  }
+
+  return op - (uint8_t *)dst;
+}
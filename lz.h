@@ -0,0 +1,39 @@
+
+/*
+ * lz.h
+ *
+ * Fast LZ77 block codec for compressed output files (zfile.h).
+ *
+ * The compressed format is the LZ4 block format: sequences of a token,
+ * literals and a 16 bit match offset, the last 5 bytes are always
+ * literals.  Matches are found with a single hash table of 4 byte
+ * sequences and extended 8 bytes at a time, so log text compresses
+ * several times at hundreds of MBytes/sec per core.
+ */
+
+#ifndef _LZ_H_
+#define _LZ_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define LZ_HASH_BITS   14
+#define LZ_WORK_SIZE   (sizeof(uint32_t) << LZ_HASH_BITS)   // bytes of work memory for lz_compress()
+
+/* Worst case compressed size of len bytes
+ */
+#define LZ_BOUND(len)  ((len) + ((len) / 255) + 16)
+
+/* Compress len bytes (at most 2 GBytes), work is LZ_WORK_SIZE bytes
+ *
+ * Returns the compressed length, or 0 if it would exceed cap.
+ */
+size_t lz_compress(const void *src, size_t len, void *dst, size_t cap, void *work);
+
+/* Decompress a block, never writes more than cap bytes
+ *
+ * Returns the decompressed length, or -1 if the block is malformed.
+ */
+int64_t lz_decompress(const void *src, size_t len, void *dst, size_t cap);
+
+#endif /* _LZ_H_ */
@@ -0,0 +1,366 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "merge.h"
+#include "pub_table.h"
+
+/* Records from one publisher, oldest first
+ */
+struct merge_stream {
+  uint64_t prog_hash;       // the key comes first, see pub_table.h
+  uint64_t process_id;
+  struct list_head recs;
+  uint64_t last_usec;       // newest record received
+  int      heap_pos;        // -1 = empty, not in the heap
+  int      gone;            // publisher exited, delete once empty
+};
+
+struct merge {
+  struct merge_config config;
+  uint64_t high_water;      // take records before the watermark past this
+
+  pthread_mutex_t lock;
+  pthread_cond_t  ready;    // merge_wait()
+  pthread_cond_t  room;     // merge_put() waiting for the merge to drain
+  int             room_waiters;
+
+  // Streams by publisher, see pub_table.h
+  void   **slots;
+  uint64_t size;            // power of 2
+  uint64_t used;
+
+  // Non-empty streams, min-heap on the head record (usec, seq)
+  struct merge_stream **heap;
+  int heap_count;
+
+  uint64_t seq;
+  uint64_t max_usec;        // newest record seen
+  uint64_t taken_usec;      // newest record taken, older records are late
+
+  uint64_t seen_seq;        // seq at the last merge_take() that saw new records
+  uint64_t input_usec;      // time of that merge_take()
+
+  struct merge_stats stats;
+};
+
+static uint64_t stream_slot(struct merge *m, uint64_t prog_hash, uint64_t process_id){
+  return pub_table_slot(m->slots, m->size, prog_hash, process_id);
+}
+
+static void streams_resize(struct merge *m, uint64_t size){
+  void   **old = m->slots;
+  uint64_t old_size = m->size;
+  uint64_t i;
+
+  m->slots = calloc(size, sizeof(m->slots[0]));
+  m->size  = size;
+
+  for(i = 0; i < old_size; i++){
+    struct merge_stream *s = old[i];
+    if(s) m->slots[stream_slot(m, s->prog_hash, s->process_id)] = s;
+  }
+
+  free(old);
+
+  // Every stream can be in the heap at once
+  m->heap = realloc(m->heap, size * sizeof(m->heap[0]));
+}
+
+/* Delete an empty stream from the table
+ */
+static void stream_delete(struct merge *m, struct merge_stream *s){
+  pub_table_delete(m->slots, m->size, stream_slot(m, s->prog_hash, s->process_id));
+
+  m->used -= 1;
+  free(s);
+}
+
+static struct merge_stream *get_stream(struct merge *m, uint64_t prog_hash, uint64_t process_id){
+  uint64_t i = stream_slot(m, prog_hash, process_id);
+  struct merge_stream *s = m->slots[i];
+
+  if(s){
+    s->gone = 0;   // the publisher is back
+    return s;
+  }
+
+  s = calloc(1, sizeof(*s));
+  s->prog_hash  = prog_hash;
+  s->process_id = process_id;
+  s->heap_pos   = -1;
+  INIT_LIST_HEAD(&s->recs);
+
+  m->slots[i] = s;
+  m->used += 1;
+  m->stats.publishers += 1;
+
+  if((m->used * 2) > m->size) streams_resize(m, m->size * 2);
+
+  return s;
+}
+
+/* Heap of streams ordered by their oldest record
+ */
+static inline struct merge_rec *stream_head(struct merge_stream *s){
+  return list_first_entry(&s->recs, struct merge_rec, list);
+}
+
+static inline int heap_less(struct merge_stream *a, struct merge_stream *b){
+  struct merge_rec *ra = stream_head(a);
+  struct merge_rec *rb = stream_head(b);
+
+  if(ra->lm.usec != rb->lm.usec) return ra->lm.usec < rb->lm.usec;
+  return ra->seq < rb->seq;
+}
+
+static inline void heap_set(struct merge *m, int i, struct merge_stream *s){
+  m->heap[i] = s;
+  s->heap_pos = i;
+}
+
+static void heap_sift_up(struct merge *m, int i){
+  struct merge_stream *s = m->heap[i];
+
+  while(i > 0){
+    int parent = (i - 1) / 2;
+    if(!heap_less(s, m->heap[parent])) break;
+    heap_set(m, i, m->heap[parent]);
+    i = parent;
+  }
+
+  heap_set(m, i, s);
+}
+
+static void heap_sift_down(struct merge *m, int i){
+  struct merge_stream *s = m->heap[i];
+
+  while(1){
+    int child = (i * 2) + 1;
+    if(child >= m->heap_count) break;
+    if(((child + 1) < m->heap_count) && heap_less(m->heap[child + 1], m->heap[child])) child += 1;
+    if(!heap_less(m->heap[child], s)) break;
+    heap_set(m, i, m->heap[child]);
+    i = child;
+  }
+
+  heap_set(m, i, s);
+}
+
+static void heap_remove_top(struct merge *m){
+  m->heap[0]->heap_pos = -1;
+  m->heap_count -= 1;
+
+  if(m->heap_count > 0){
+    heap_set(m, 0, m->heap[m->heap_count]);
+    heap_sift_down(m, 0);
+  }
+}
+
+/* Oldest record any publisher could still send without being late
+ */
+static uint64_t watermark(struct merge *m){
+  uint64_t wm = UINT64_MAX;
+  uint64_t i;
+
+  for(i = 0; i < m->size; i++){
+    struct merge_stream *s = m->slots[i];
+    if(s && !s->gone && (s->last_usec < wm)) wm = s->last_usec;
+  }
+
+  // Don't wait longer than the lateness bound for idle publishers
+  if(m->max_usec > m->config.lateness_usec){
+    uint64_t bound = m->max_usec - m->config.lateness_usec;
+    if((wm == UINT64_MAX) || (wm < bound)) wm = bound;
+  }
+
+  return wm;
+}
+
+struct merge *merge_new(const struct merge_config *config){
+  struct merge *m = calloc(1, sizeof(*m));
+
+  m->config = *config;
+  if(!m->config.max_bytes) m->config.max_bytes = MERGE_MAX_BYTES;
+  m->high_water = (m->config.max_bytes / 4) * 3;
+
+  pthread_mutex_init(&m->lock, NULL);
+  pthread_cond_init(&m->ready, NULL);
+  pthread_cond_init(&m->room, NULL);
+
+  streams_resize(m, 64);
+
+  return m;
+}
+
+void merge_free(struct merge *m){
+  struct merge_rec *r, *tmp;
+  uint64_t i;
+
+  for(i = 0; i < m->size; i++){
+    struct merge_stream *s = m->slots[i];
+    if(!s) continue;
+    list_for_each_entry_safe(r, tmp, &s->recs, list) free(r);
+    free(s);
+  }
+
+  pthread_mutex_destroy(&m->lock);
+  pthread_cond_destroy(&m->ready);
+  pthread_cond_destroy(&m->room);
+
+  free(m->slots);
+  free(m->heap);
+  free(m);
+}
+
+void merge_put(struct merge *m, const struct Msg_Hdr *lm, const void *payload, uint64_t payload_len){
+  uint64_t bytes = sizeof(struct merge_rec) + payload_len;
+  struct merge_rec *r = malloc(bytes);
+  struct list_head *pos;
+
+  r->lm          = *lm;
+  r->bytes       = bytes;
+  r->payload_len = payload_len;
+  memcpy(r->payload, payload, payload_len);
+
+  pthread_mutex_lock(&m->lock);
+
+  // Full, let the merge release the oldest records
+  if((m->stats.buffered_bytes + bytes) > m->config.max_bytes){
+    m->stats.waits += 1;
+
+    while((m->stats.buffered_bytes > 0) && ((m->stats.buffered_bytes + bytes) > m->config.max_bytes)){
+      m->room_waiters += 1;
+      pthread_cond_signal(&m->ready);
+      pthread_cond_wait(&m->room, &m->lock);
+      m->room_waiters -= 1;
+    }
+  }
+
+  struct merge_stream *s = get_stream(m, lm->prog_hash, lm->process_id);
+
+  r->seq = m->seq++;
+
+  if(lm->usec < m->taken_usec) m->stats.late += 1;
+
+  // Streams are in order, search back from the newest for the odd exception
+  for(pos = s->recs.prev; pos != &s->recs; pos = pos->prev){
+    if(list_entry(pos, struct merge_rec, list)->lm.usec <= lm->usec) break;
+  }
+  list_add(&r->list, pos);
+
+  if(s->heap_pos < 0){
+    heap_set(m, m->heap_count++, s);
+    heap_sift_up(m, s->heap_pos);
+  } else if(pos == &s->recs){
+    heap_sift_up(m, s->heap_pos);   // new head is older
+  }
+
+  if(lm->usec > s->last_usec) s->last_usec = lm->usec;
+  if(lm->usec > m->max_usec)  m->max_usec  = lm->usec;
+
+  m->stats.buffered       += 1;
+  m->stats.buffered_bytes += bytes;
+
+  pthread_mutex_unlock(&m->lock);
+}
+
+int merge_take(struct merge *m, uint64_t now_usec, int all, struct list_head *out){
+  int count = 0;
+
+  pthread_mutex_lock(&m->lock);
+
+  // Nothing new for the lateness bound, nobody is going to send older records
+  if(m->seen_seq != m->seq){
+    m->seen_seq   = m->seq;
+    m->input_usec = now_usec;
+  } else if((now_usec - m->input_usec) >= m->config.lateness_usec){
+    all = 1;
+  }
+
+  uint64_t wm = watermark(m);
+
+  while((count < MERGE_TAKE_BATCH) && (m->heap_count > 0)){
+    struct merge_stream *s = m->heap[0];
+    struct merge_rec *r = stream_head(s);
+
+    if(!all && (r->lm.usec > wm)){
+      if((m->stats.buffered_bytes <= m->high_water) && !m->room_waiters) break;
+      m->stats.forced += 1;
+    }
+
+    list_move_tail(&r->list, out);
+
+    if(list_empty(&s->recs)){
+      heap_remove_top(m);
+      if(s->gone) stream_delete(m, s);
+    } else {
+      heap_sift_down(m, 0);
+    }
+
+    if(r->lm.usec > m->taken_usec) m->taken_usec = r->lm.usec;
+
+    m->stats.buffered       -= 1;
+    m->stats.buffered_bytes -= r->bytes;
+    m->stats.merged         += 1;
+    count += 1;
+  }
+
+  if(count && m->room_waiters) pthread_cond_broadcast(&m->room);
+
+  pthread_mutex_unlock(&m->lock);
+
+  return count;
+}
+
+void merge_forget(struct merge *m, uint64_t prog_hash, uint64_t process_id){
+  pthread_mutex_lock(&m->lock);
+
+  struct merge_stream *s = m->slots[stream_slot(m, prog_hash, process_id)];
+
+  if(s){
+    if(list_empty(&s->recs)){
+      stream_delete(m, s);
+    } else {
+      s->gone = 1;   // its records are still written in order
+    }
+  }
+
+  pthread_mutex_unlock(&m->lock);
+}
+
+void merge_rec_free(struct merge_rec *r){
+  free(r);
+}
+
+void merge_wait(struct merge *m, int msec){
+  struct timespec until;
+
+  clock_gettime(CLOCK_REALTIME, &until);
+  until.tv_sec  += msec / 1000;
+  until.tv_nsec += (msec % 1000) * 1000000L;
+  if(until.tv_nsec >= 1000000000L){
+    until.tv_sec  += 1;
+    until.tv_nsec -= 1000000000L;
+  }
+
+  pthread_mutex_lock(&m->lock);
+  if(!m->room_waiters) pthread_cond_timedwait(&m->ready, &m->lock, &until);
+  pthread_mutex_unlock(&m->lock);
+}
+
+void merge_wake(struct merge *m){
+  pthread_mutex_lock(&m->lock);
+  pthread_cond_broadcast(&m->ready);
+  pthread_mutex_unlock(&m->lock);
+}
+
+void merge_get_stats(struct merge *m, struct merge_stats *stats){
+  pthread_mutex_lock(&m->lock);
+  *stats = m->stats;
+  pthread_mutex_unlock(&m->lock);
+}
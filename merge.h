@@ -0,0 +1,96 @@
+
+/*
+ * merge.h
+ *
+ * Time order merge of the record streams from all publishers.
+ *
+ * Records from one publisher (prog_hash, process_id) arrive in usec order,
+ * records from different publishers arrive in whatever order nn_recv
+ * returns them.  Workers add records to a per publisher stream, the merge
+ * takes the oldest stream head from a min-heap once no publisher can still
+ * send anything older.
+ *
+ * That point (the watermark) is the oldest last record of any publisher,
+ * but never more than the lateness bound behind the newest record seen, so
+ * an idle publisher delays output by at most the lateness bound.  When no
+ * records have arrived for the lateness bound everything is released.
+ *
+ * A record older than what has already been written is late, it is
+ * written as soon as possible (out of order) and counted.
+ *
+ * Memory is bounded, past the high water mark the oldest records are
+ * released before the watermark and adding records waits for room.
+ */
+
+#ifndef _MERGE_H_
+#define _MERGE_H_
+
+#include <stdint.h>
+
+#include "log_msg.h"
+#include "list.h"
+
+#define MERGE_MAX_BYTES   (64 << 20)  // default buffered record bytes
+#define MERGE_TAKE_BATCH  4096        // records per merge_take()
+
+struct merge_config {
+  uint64_t lateness_usec;   // hold records this long for slower publishers
+  uint64_t max_bytes;       // buffered record bytes, 0 = MERGE_MAX_BYTES
+};
+
+struct merge_stats {
+  uint64_t publishers;
+  uint64_t buffered;        // records waiting
+  uint64_t buffered_bytes;
+  uint64_t merged;          // records taken in order
+  uint64_t late;            // records older than records already taken
+  uint64_t forced;          // records taken before the watermark to bound memory
+  uint64_t waits;           // merge_put() calls that waited for room
+};
+
+/* A buffered record, header and payload as received
+ */
+struct merge_rec {
+  struct list_head list;    // stream order, then the merge_take() chain
+  uint64_t seq;             // arrival order, breaks usec ties
+  uint64_t bytes;
+  struct Msg_Hdr lm;
+  uint64_t payload_len;
+  char payload[];
+};
+
+struct merge;
+
+struct merge *merge_new(const struct merge_config *config);
+void merge_free(struct merge *m);
+
+/* Copy a record into its publisher's stream, safe to call from any thread
+ *
+ * Waits while the merge is full.
+ */
+void merge_put(struct merge *m, const struct Msg_Hdr *lm, const void *payload, uint64_t payload_len);
+
+/* Move the records that are ready, oldest first, to out (at most
+ * MERGE_TAKE_BATCH).  all releases every buffered record, e.g. at exit.
+ *
+ * Returns the number of records, release them with merge_rec_free().
+ */
+int merge_take(struct merge *m, uint64_t now_usec, int all, struct list_head *out);
+
+void merge_rec_free(struct merge_rec *r);
+
+/* The publisher has exited, stop waiting for it and free its stream
+ */
+void merge_forget(struct merge *m, uint64_t prog_hash, uint64_t process_id);
+
+/* Wait up to msec for records to be added
+ */
+void merge_wait(struct merge *m, int msec);
+
+/* Wake merge_wait(), e.g. to stop
+ */
+void merge_wake(struct merge *m);
+
+void merge_get_stats(struct merge *m, struct merge_stats *stats);
+
+#endif /* _MERGE_H_ */
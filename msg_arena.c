@@ -0,0 +1,150 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "msg_arena.h"
+
+#define MSG_ARENA_SLAB_BLOCKS (MSG_ARENA_SLAB_SIZE / MSG_ARENA_BLOCK_SIZE)
+
+/* Process wide slab of blocks
+ */
+static struct {
+  pthread_once_t   once;
+  pthread_mutex_t  lock;
+  pthread_key_t    thread_exit_key;
+
+  int              huge_pages;
+
+  char            *base;     // 0 if the slab could not be mapped
+  struct msg_block *free_blocks[MSG_ARENA_SLAB_BLOCKS];
+  int              free_count;
+} slab = {
+  .once = PTHREAD_ONCE_INIT,
+  .lock = PTHREAD_MUTEX_INITIALIZER,
+  .huge_pages = 0,
+  .base = 0,
+  .free_count = 0
+};
+
+/* Blocks owned by one thread, handed out LIFO
+ */
+struct msg_arena_thread {
+  struct msg_block *blocks[MSG_ARENA_THREAD_BLOCKS];
+  int count;
+  int in_use;
+};
+
+static __thread struct msg_arena_thread thread_blocks;
+
+static int is_slab_block(struct msg_block *block){
+  return slab.base &&
+         ((char *)block >= slab.base) &&
+         ((char *)block < (slab.base + MSG_ARENA_SLAB_SIZE));
+}
+
+/* Thread exit, return blocks to the slab
+ */
+static void msg_arena_thread_exit(void *arg){
+  struct msg_arena_thread *t = arg;
+  int i;
+
+  pthread_mutex_lock(&slab.lock);
+
+  for(i = 0; i < t->count; i++){
+    if(is_slab_block(t->blocks[i])){
+      slab.free_blocks[slab.free_count++] = t->blocks[i];
+    } else {
+      free(t->blocks[i]);
+    }
+    t->blocks[i] = 0;
+  }
+
+  pthread_mutex_unlock(&slab.lock);
+
+  t->count  = 0;
+  t->in_use = 0;
+}
+
+static void *map_slab(int huge_pages){
+  void *p = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+  if(huge_pages){
+    p = mmap(0, MSG_ARENA_SLAB_SIZE, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  }
+#endif
+
+  if(p == MAP_FAILED){
+    p = mmap(0, MSG_ARENA_SLAB_SIZE, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+#ifdef MADV_HUGEPAGE
+    // No reserved huge pages, ask for transparent huge pages instead
+    if(huge_pages && (p != MAP_FAILED)) madvise(p, MSG_ARENA_SLAB_SIZE, MADV_HUGEPAGE);
+#endif
+  }
+
+  return (p == MAP_FAILED) ? 0 : p;
+}
+
+static void msg_arena_init(){
+  int i;
+
+  pthread_key_create(&slab.thread_exit_key, msg_arena_thread_exit);
+
+  slab.base = map_slab(slab.huge_pages);
+  if(!slab.base) return; // every thread falls back to malloc'd blocks
+
+  // Touch every page now rather than on the logging path
+  memset(slab.base, 0, MSG_ARENA_SLAB_SIZE);
+
+  for(i = MSG_ARENA_SLAB_BLOCKS - 1; i >= 0; i--){
+    slab.free_blocks[slab.free_count++] = (struct msg_block *)(slab.base + i * MSG_ARENA_BLOCK_SIZE);
+  }
+}
+
+/* First message from this thread, take blocks from the slab
+ */
+static void msg_arena_thread_attach(struct msg_arena_thread *t){
+
+  pthread_once(&slab.once, msg_arena_init);
+
+  pthread_mutex_lock(&slab.lock);
+  while((t->count < MSG_ARENA_THREAD_BLOCKS) && (slab.free_count > 0)){
+    t->blocks[t->count++] = slab.free_blocks[--slab.free_count];
+  }
+  pthread_mutex_unlock(&slab.lock);
+
+  // Slab exhausted, more threads than blocks
+  while(t->count < MSG_ARENA_THREAD_BLOCKS){
+    struct msg_block *block = malloc(sizeof(*block));
+    if(!block) break;
+    t->blocks[t->count++] = block;
+  }
+
+  pthread_setspecific(slab.thread_exit_key, t);
+}
+
+void msg_arena_huge_pages(int enable){
+  slab.huge_pages = enable;
+}
+
+struct msg_block *msg_arena_get(){
+  struct msg_arena_thread *t = &thread_blocks;
+
+  if(__builtin_expect(t->count == 0, 0)) msg_arena_thread_attach(t);
+
+  if(t->in_use >= t->count) return 0;
+
+  return t->blocks[t->in_use++];
+}
+
+void msg_arena_put(){
+  struct msg_arena_thread *t = &thread_blocks;
+
+  // last in first out, see msg_arena.h
+  t->in_use -= 1;
+}
@@ -0,0 +1,56 @@
+
+/*
+ * msg_arena.h
+ *
+ * Preallocated arena of fixed size blocks for building outgoing messages.
+ *
+ * Messages are built in place (header + payload) in a block and handed to
+ * nanomsg in a single contiguous send, so the logging path never calls
+ * malloc.
+ *
+ * Blocks are carved from one process wide slab, optionally backed by huge
+ * pages.  Each thread takes MSG_ARENA_THREAD_BLOCKS blocks the first time it
+ * logs and returns them when it exits, so the slab lock is only taken at
+ * thread start and exit.
+ */
+
+#ifndef _MSG_ARENA_H_
+#define _MSG_ARENA_H_
+
+#include <stdint.h>
+
+#include "log_wire.h"
+
+#define MSG_ARENA_BLOCK_SIZE    4096        // header + payload
+#define MSG_ARENA_SLAB_SIZE     (2 << 20)   // one 2 MByte huge page
+#define MSG_ARENA_THREAD_BLOCKS 4           // allows nested logging (e.g. from signal handlers)
+
+#define MSG_ARENA_PAYLOAD_SIZE  (MSG_ARENA_BLOCK_SIZE - LOG_WIRE_HDR_LEN)
+
+struct msg_block {
+  struct log_wire_hdr hdr;
+  char payload[MSG_ARENA_PAYLOAD_SIZE];
+};
+
+/* Use huge pages for the slab if available (default off).
+ * Must be called before the first message is logged.
+ */
+void msg_arena_huge_pages(int enable);
+
+/* Get a block owned by the calling thread
+ *
+ * Blocks are a per thread stack: a block must be put back before any block
+ * got before it, as nested logging (a signal handler) does naturally.
+ *
+ * Returns 0 if all of this thread's blocks are in use
+ */
+struct msg_block *msg_arena_get();
+
+/* Return the block most recently got from msg_arena_get() by this thread
+ *
+ * Only the count of blocks in use is kept, so putting blocks back out of
+ * order hands a block that is still in use to the next msg_arena_get().
+ */
+void msg_arena_put();
+
+#endif /* _MSG_ARENA_H_ */
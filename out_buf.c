@@ -0,0 +1,93 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "out_buf.h"
+#include "out_file.h"
+
+void out_buf_init(struct out_buf *ob, int fd, pthread_mutex_t *lock, size_t cap){
+  ob->cap  = cap ? cap : OUT_BUF_SIZE;
+  ob->buf  = malloc(ob->cap);
+  ob->len  = 0;
+  ob->fd   = fd;
+  ob->lock = lock;
+  ob->file = 0;
+  ob->send = 0;
+  ob->send_arg = 0;
+
+  ob->writes     = 0;
+  ob->written    = 0;
+  ob->write_nsec = 0;
+}
+
+void out_buf_free(struct out_buf *ob){
+  out_buf_flush(ob);
+  free(ob->buf);
+  ob->buf = NULL;
+  ob->cap = 0;
+}
+
+static uint64_t write_time_nsec(){
+  struct timespec tv;
+  clock_gettime(CLOCK_MONOTONIC, &tv);
+  return tv.tv_sec * (uint64_t)1000000000 + tv.tv_nsec;
+}
+
+int64_t out_buf_write(struct out_buf *ob){
+  int64_t offset = -1;
+  size_t done = 0;
+  uint64_t start = write_time_nsec();
+
+  if(ob->send){
+    ob->send(ob->send_arg, ob->buf, ob->len);
+
+  } else if(ob->file){
+    offset = out_file_write(ob->file, ob->buf, ob->len, 0, 0);
+
+  } else if(ob->fd >= 0){
+    offset = lseek(ob->fd, 0, SEEK_CUR);
+
+    while(done < ob->len){
+      ssize_t rc = write(ob->fd, ob->buf + done, ob->len - done);
+
+      if(rc < 0){
+        if(errno == EINTR) continue;
+        fprintf(stderr, "%s write failed, %lu bytes lost, errno: %s\n", __func__, ob->len - done, strerror(errno));
+        break;
+      }
+
+      done += rc;
+    }
+  }
+
+  ob->writes     += 1;
+  ob->written    += ob->len;
+  ob->write_nsec += write_time_nsec() - start;
+
+  ob->len = 0;
+
+  return offset;
+}
+
+void out_buf_flush(struct out_buf *ob){
+  if(ob->len == 0) return;
+
+  if(ob->lock) pthread_mutex_lock(ob->lock);
+  out_buf_write(ob);
+  if(ob->lock) pthread_mutex_unlock(ob->lock);
+}
+
+void out_buf_grow(struct out_buf *ob, size_t n){
+  out_buf_flush(ob);
+
+  // A single record bigger than the buffer (e.g. a huge packet)
+  if(n > ob->cap){
+    ob->cap = n;
+    ob->buf = realloc(ob->buf, ob->cap);
+  }
+}
@@ -0,0 +1,166 @@
+
+/*
+ * out_buf.h
+ *
+ * Large output buffer with hand rolled formatting for the receiver.
+ *
+ * Records are serialized straight into the buffer, integers are encoded
+ * without printf format parsing or stdio locking, and a full buffer is
+ * handed to the file with a single write().
+ */
+
+#ifndef _OUT_BUF_H_
+#define _OUT_BUF_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+struct out_file;
+
+#define OUT_BUF_SIZE (1<<20)  // default buffer size, 1 MByte
+
+struct out_buf {
+  char   *buf;
+  size_t  len;
+  size_t  cap;
+
+  int              fd;    // -1 = discard
+  pthread_mutex_t *lock;  // serializes writes to a shared fd, or 0
+
+  struct out_file *file;  // write to a (rotating) output file instead of fd, or 0
+
+  // hand each buffer to send(send_arg, ...) instead, e.g. a relay (relay.h), or 0
+  void (*send)(void *arg, const void *buf, size_t len);
+  void  *send_arg;
+
+  // written by the owning thread, read racily for statistics
+  volatile uint64_t writes;
+  volatile uint64_t written;     // bytes
+  volatile uint64_t write_nsec;  // time in out_buf_write()
+};
+
+void out_buf_init(struct out_buf *ob, int fd, pthread_mutex_t *lock, size_t cap);
+void out_buf_free(struct out_buf *ob);
+
+/* Write the buffered bytes to the file with one write() and empty the buffer
+ */
+void out_buf_flush(struct out_buf *ob);
+
+/* As out_buf_flush, for callers already holding ob->lock
+ *
+ * Returns the file offset the buffer was written at (-1 if unknown).
+ */
+int64_t out_buf_write(struct out_buf *ob);
+
+/* Make room for n more bytes, flushing (or growing for huge records) as needed
+ *
+ * A flush writes everything appended so far, writers reserve a whole record
+ * before appending its first byte so that a write never ends mid-record.
+ */
+void out_buf_grow(struct out_buf *ob, size_t n);
+
+static inline char *out_buf_reserve(struct out_buf *ob, size_t n){
+  if(__builtin_expect((ob->len + n) > ob->cap, 0)) out_buf_grow(ob, n);
+  return ob->buf + ob->len;
+}
+
+static inline void out_buf_put(struct out_buf *ob, const void *p, size_t n){
+  memcpy(out_buf_reserve(ob, n), p, n);
+  ob->len += n;
+}
+
+/* Append a constant string, the length is computed at compile time */
+#define out_buf_put_lit(ob, lit) out_buf_put((ob), (lit), sizeof(lit) - 1)
+
+static inline void out_buf_put_str(struct out_buf *ob, const char *s){
+  out_buf_put(ob, s, strlen(s));
+}
+
+/* Number of decimal digits in v (1 for 0)
+ */
+static inline int dec_digits(uint64_t v){
+  static const uint64_t pow10[20] = {
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL,
+    100000000ULL, 1000000000ULL, 10000000000ULL, 100000000000ULL, 1000000000000ULL,
+    10000000000000ULL, 100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+    100000000000000000ULL, 1000000000000000000ULL, 10000000000000000000ULL
+  };
+
+  // ~log10 from the bit length, then correct by one
+  // (v | 1 never crosses a power of 10 and makes 0 one digit)
+  v |= 1;
+  int bits = 64 - __builtin_clzll(v);
+  int d = (bits * 1233) >> 12;
+  return d + 1 - (v < pow10[d]);
+}
+
+/* Encode v as decimal, right aligned in width columns (printf "%*lu")
+ * Returns bytes written.
+ */
+static inline int encode_dec(char *p, uint64_t v, int negative, int width){
+  static const char digit_pairs[201] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+  int digits = dec_digits(v);
+  int len = digits + negative;
+  int pad = (width > len) ? (width - len) : 0;
+
+  memset(p, ' ', pad);
+  p += pad;
+
+  if(negative) *p++ = '-';
+
+  char *q = p + digits;
+
+  while(v >= 100){
+    unsigned i = (v % 100) * 2;
+    v /= 100;
+    q -= 2;
+    q[0] = digit_pairs[i];
+    q[1] = digit_pairs[i + 1];
+  }
+
+  if(v >= 10){
+    q -= 2;
+    q[0] = digit_pairs[v * 2];
+    q[1] = digit_pairs[v * 2 + 1];
+  } else {
+    *--q = '0' + v;
+  }
+
+  return pad + len;
+}
+
+/* Append v as signed decimal (printf "%*li")
+ */
+static inline void out_buf_put_dec(struct out_buf *ob, int64_t v, int width){
+  char *p = out_buf_reserve(ob, 20 + 1 + width);
+  uint64_t mag = (v < 0) ? (0 - (uint64_t)v) : (uint64_t)v;
+  ob->len += encode_dec(p, mag, (v < 0), width);
+}
+
+/* Append v as upper case hex (printf "%*lX")
+ */
+static inline void out_buf_put_hex(struct out_buf *ob, uint64_t v, int width){
+  static const char hex_digits[16] = "0123456789ABCDEF";
+
+  char *p = out_buf_reserve(ob, 16 + width);
+  int digits = (64 - __builtin_clzll(v | 1) + 3) >> 2;
+  int pad = (width > digits) ? (width - digits) : 0;
+  int i;
+
+  memset(p, ' ', pad);
+  p += pad;
+
+  for(i = digits - 1; i >= 0; i--){
+    p[i] = hex_digits[v & 0xf];
+    v >>= 4;
+  }
+
+  ob->len += pad + digits;
+}
+
+#endif /* _OUT_BUF_H_ */
@@ -0,0 +1,598 @@
+#define _GNU_SOURCE     /* for fallocate */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <glob.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "out_file.h"
+#include "segment.h"
+#include "zfile.h"
+
+/* One file of the rotation
+ */
+struct out_part {
+  char     name[1100];       // temporary name until renamed
+  char     final_name[1100]; // timestamped name, "" once renamed
+
+  int      fd;
+  struct disk_writer *writer;   // 0 = write()
+  struct seg_index   *index;
+  struct zfile_writer *z;       // compressing, 0 = no
+
+  uint64_t bytes;               // uncompressed
+  volatile uint64_t disk_bytes;
+  uint64_t hdr_bytes;
+  uint64_t prealloc;
+  uint64_t start_usec;
+
+  struct out_part *next_finalize;
+};
+
+struct retained_file {
+  char     name[1100];
+  uint64_t bytes;
+};
+
+struct out_file {
+  struct out_file_config config;
+  char     name[1024];
+  int      rotating;
+
+  char     stem[1024];       // name split around the extension, "log" ".json"
+  char     ext[64];
+  uint64_t temp_seq;
+
+  pthread_mutex_t  lock;     // write path
+  struct out_part *cur;
+
+  // Written after the header of each new file, guarded by lock
+  char    *preamble;
+  size_t   preamble_len;
+  struct seg_idx_entry *preamble_entries;  // offsets relative to preamble
+  int      preamble_count;
+
+  struct zfile_pool *zpool;  // compression threads, 0 = no compression
+
+  // Background thread, state below guarded by bg_lock
+  pthread_t        thread;
+  pthread_mutex_t  bg_lock;
+  pthread_cond_t   bg_cond;
+  struct out_part *next;       // open and preallocated
+  struct out_part *rename;     // new current file to rename
+  struct out_part *finalize;   // previous files to close
+  int              stop;
+
+  // Closed files, oldest first (background thread only)
+  struct retained_file *files;
+  int      files_count;
+  int      files_cap;
+  uint64_t files_bytes;
+
+  struct out_file_stats stats;
+};
+
+static uint64_t wall_usec(){
+  struct timespec tv;
+  clock_gettime(CLOCK_REALTIME, &tv);
+  return tv.tv_sec * (uint64_t)1000000 + tv.tv_nsec / 1000;
+}
+
+static void split_name(struct out_file *f){
+  const char *slash = strrchr(f->name, '/');
+  const char *dot   = strrchr(f->name, '.');
+
+  if(!dot || (slash && (dot < slash)) || (dot == f->name) || (strlen(dot) >= sizeof(f->ext))){
+    dot = f->name + strlen(f->name);
+  }
+
+  snprintf(f->stem, sizeof(f->stem), "%.*s", (int)(dot - f->name), f->name);
+  snprintf(f->ext,  sizeof(f->ext),  "%s", dot);
+}
+
+/* log.json -> log.20261019-101500.123456.json
+ */
+static void timestamped_name(struct out_file *f, uint64_t usec, char *name, size_t size){
+  time_t secs = usec / 1000000;
+  struct tm tm;
+  char when[32];
+
+  gmtime_r(&secs, &tm);
+  strftime(when, sizeof(when), "%Y%m%d-%H%M%S", &tm);
+  snprintf(name, size, "%s.%s.%06lu%s", f->stem, when, usec % 1000000, f->ext);
+}
+
+static int is_timestamped_name(struct out_file *f, const char *name){
+  unsigned date, time_of_day, usec;
+  char end;
+  size_t stem_len = strlen(f->stem);
+  size_t ext_len  = strlen(f->ext);
+  size_t len      = strlen(name);
+
+  if((len != (stem_len + 23 + ext_len)) || strncmp(name, f->stem, stem_len)) return 0;
+  if(strcmp(name + len - ext_len, f->ext)) return 0;
+
+  return sscanf(name + stem_len, ".%8u-%6u.%6u%c", &date, &time_of_day, &usec, &end) >= 3;
+}
+
+static void part_write_disk(struct out_part *p, const void *buf, size_t len){
+  const char *data = buf;
+  size_t done = 0;
+
+  if(p->writer){
+    disk_writer_append(p->writer, buf, len);
+  } else {
+    while(done < len){
+      ssize_t rc = write(p->fd, data + done, len - done);
+
+      if(rc < 0){
+        if(errno == EINTR) continue;
+        fprintf(stderr, "%s write failed, %lu bytes lost, errno: %s\n", __func__, len - done, strerror(errno));
+        break;
+      }
+
+      done += rc;
+    }
+  }
+
+  p->disk_bytes += len;
+}
+
+/* Compressed blocks, in order from the compression threads
+ */
+static void part_write_compressed(void *arg, const void *buf, size_t len){
+  part_write_disk(arg, buf, len);
+}
+
+static void part_write(struct out_part *p, const void *buf, size_t len){
+  if(p->z){
+    zfile_writer_append(p->z, buf, len);
+  } else {
+    part_write_disk(p, buf, len);
+  }
+
+  p->bytes += len;
+}
+
+/* Open a file and its index, preallocate it and start its writer
+ *
+ * This is the slow part of starting a file, done ahead of time.
+ */
+static struct out_part *prepare_part(struct out_file *f, const char *name){
+  struct out_part *p = calloc(1, sizeof(*p));
+
+  snprintf(p->name, sizeof(p->name), "%s", name);
+
+  p->fd = open(p->name, O_RDWR | O_CREAT | O_TRUNC, 0666);
+  if(p->fd < 0){
+    fprintf(stderr, "%s: %s\n", p->name, strerror(errno));
+    free(p);
+    return 0;
+  }
+
+  if(f->rotating){
+    p->prealloc = f->config.rotate_bytes ? f->config.rotate_bytes : OUT_FILE_PREALLOC;
+
+    // Reserve the blocks now, the file size is unchanged so readers don't see zeros
+    if(fallocate(p->fd, FALLOC_FL_KEEP_SIZE, 0, p->prealloc) < 0) p->prealloc = 0;
+  }
+
+  if(f->config.segment) p->index = seg_index_create(p->name);
+  if(f->config.async)   p->writer = disk_writer_open(p->fd, &f->config.writer);
+
+  return p;
+}
+
+/* The file becomes the current file
+ */
+static void activate_part(struct out_file *f, struct out_part *p){
+  p->start_usec = wall_usec();
+
+  if(f->rotating) timestamped_name(f, p->start_usec, p->final_name, sizeof(p->final_name));
+
+  if(f->zpool) p->z = zfile_writer_open(f->zpool, part_write_compressed, p, p->start_usec);
+
+  if(f->config.segment){
+    struct seg_file_hdr fh;
+    seg_file_hdr_init(&fh, p->start_usec);
+    part_write(p, &fh, sizeof(fh));
+  }
+
+  if(f->preamble_len){
+    uint64_t offset = p->bytes;
+    int i;
+
+    part_write(p, f->preamble, f->preamble_len);
+    f->stats.bytes += f->preamble_len;
+
+    if(p->index && (f->preamble_count > 0)){
+      struct seg_idx_entry *entries = malloc(f->preamble_count * sizeof(*entries));
+
+      for(i = 0; i < f->preamble_count; i++){
+        entries[i] = f->preamble_entries[i];
+        entries[i].offset += offset;
+      }
+      seg_index_append(p->index, entries, f->preamble_count);
+      free(entries);
+    }
+  }
+
+  // a file holding only the preamble has nothing in it yet
+  p->hdr_bytes = p->bytes;
+}
+
+static void rename_part(struct out_part *p){
+  char from[1200], to[1200];
+
+  if(!p->final_name[0]) return;
+
+  if(rename(p->name, p->final_name) < 0){
+    fprintf(stderr, "rename %s -> %s failed, errno: %s\n", p->name, p->final_name, strerror(errno));
+  } else if(p->index){
+    snprintf(from, sizeof(from), "%s.idx", p->name);
+    snprintf(to,   sizeof(to),   "%s.idx", p->final_name);
+    rename(from, to);
+  }
+
+  snprintf(p->name, sizeof(p->name), "%s", p->final_name);
+  p->final_name[0] = 0;
+}
+
+static void delete_file(const char *name){
+  char idx_name[1200];
+
+  unlink(name);
+  snprintf(idx_name, sizeof(idx_name), "%s.idx", name);
+  unlink(idx_name);
+}
+
+static void retain_file(struct out_file *f, const char *name, uint64_t bytes){
+  if(f->files_count == f->files_cap){
+    f->files_cap = f->files_cap ? (f->files_cap * 2) : 64;
+    f->files = realloc(f->files, f->files_cap * sizeof(f->files[0]));
+  }
+
+  struct retained_file *r = &f->files[f->files_count++];
+  snprintf(r->name, sizeof(r->name), "%s", name);
+  r->bytes = bytes;
+
+  f->files_bytes += bytes;
+}
+
+/* Delete the oldest closed files beyond the limits
+ */
+static void apply_retention(struct out_file *f){
+  int deleted = 0;
+
+  while((f->files_count > 0) &&
+        ((f->config.keep_files && (f->files_count > f->config.keep_files)) ||
+         (f->config.keep_bytes && (f->files_bytes > f->config.keep_bytes)))){
+
+    delete_file(f->files[deleted].name);
+    f->files_bytes -= f->files[deleted].bytes;
+    f->files_count -= 1;
+    deleted += 1;
+  }
+
+  if(deleted){
+    memmove(f->files, f->files + deleted, f->files_count * sizeof(f->files[0]));
+    f->stats.deleted += deleted;
+  }
+}
+
+/* Files from earlier runs count towards retention
+ */
+static void find_retained_files(struct out_file *f){
+  char pattern[1200];
+  glob_t g;
+  size_t i;
+  struct stat st;
+
+  snprintf(pattern, sizeof(pattern), "%s.*%s", f->stem, f->ext);
+
+  if(glob(pattern, 0, NULL, &g) != 0) return;
+
+  // glob sorts names, timestamped names sort oldest first
+  for(i = 0; i < g.gl_pathc; i++){
+    if(is_timestamped_name(f, g.gl_pathv[i]) && (stat(g.gl_pathv[i], &st) == 0)){
+      retain_file(f, g.gl_pathv[i], st.st_size);
+    }
+  }
+
+  globfree(&g);
+}
+
+/* Wait for the file's writes, give back unused preallocation and close it
+ */
+static void finalize_part(struct out_file *f, struct out_part *p){
+  rename_part(p);
+
+  if(p->z) zfile_writer_close(p->z);
+  if(p->writer) disk_writer_close(p->writer);
+
+  if(p->prealloc && (ftruncate(p->fd, p->disk_bytes) < 0)){
+    fprintf(stderr, "%s ftruncate failed, errno: %s\n", p->name, strerror(errno));
+  }
+
+  if(p->index) seg_index_close(p->index);
+  close(p->fd);
+
+  if(f->rotating && (p->bytes == p->hdr_bytes)){
+    delete_file(p->name);  // nothing was written after the last rotation
+  } else if(f->rotating){
+    retain_file(f, p->name, p->disk_bytes);
+    apply_retention(f);
+  }
+
+  pthread_mutex_lock(&f->lock);
+  f->stats.disk_bytes += p->disk_bytes;
+  pthread_mutex_unlock(&f->lock);
+
+  free(p);
+}
+
+static void temp_name(struct out_file *f, char *name, size_t size){
+  snprintf(name, size, "%s.next%lu", f->name, f->temp_seq++);
+}
+
+/* Start the next file, f->lock held
+ */
+static void rotate(struct out_file *f){
+  char name[1100];
+
+  pthread_mutex_lock(&f->bg_lock);
+  struct out_part *p = f->next;
+  f->next = 0;
+  pthread_mutex_unlock(&f->bg_lock);
+
+  if(!p){
+    // The background thread hasn't caught up, open it here
+    pthread_mutex_lock(&f->bg_lock);
+    temp_name(f, name, sizeof(name));
+    pthread_mutex_unlock(&f->bg_lock);
+
+    p = prepare_part(f, name);
+    f->stats.late_opens += 1;
+
+    if(!p) return;  // keep writing the current file
+  }
+
+  activate_part(f, p);
+
+  struct out_part *prev = f->cur;
+  f->cur = p;
+  f->stats.files += 1;
+
+  pthread_mutex_lock(&f->bg_lock);
+  prev->next_finalize = f->finalize;
+  f->finalize = prev;
+  f->rename   = p;
+  pthread_cond_signal(&f->bg_cond);
+  pthread_mutex_unlock(&f->bg_lock);
+}
+
+static int rotation_due(struct out_file *f, size_t len, uint64_t now){
+  struct out_part *p = f->cur;
+
+  if(p->bytes == p->hdr_bytes) return 0;  // nothing in it yet
+
+  // compressed files rotate by their size on disk
+  uint64_t size = p->z ? zfile_writer_file_bytes(p->z) : p->bytes;
+
+  if(f->config.rotate_bytes && ((size + len) > f->config.rotate_bytes)) return 1;
+  if(f->config.rotate_usec && ((now - p->start_usec) >= f->config.rotate_usec)) return 1;
+
+  return 0;
+}
+
+static void *out_file_thread(void *arg){
+  struct out_file *f = arg;
+  char name[1100];
+
+  pthread_mutex_lock(&f->bg_lock);
+
+  while(1){
+    if(f->rename){
+      struct out_part *p = f->rename;
+      f->rename = 0;
+      pthread_mutex_unlock(&f->bg_lock);
+      rename_part(p);
+      pthread_mutex_lock(&f->bg_lock);
+      continue;
+    }
+
+    if(f->finalize){
+      // oldest first
+      struct out_part **pp = &f->finalize;
+      while((*pp)->next_finalize) pp = &(*pp)->next_finalize;
+      struct out_part *p = *pp;
+      *pp = 0;
+
+      pthread_mutex_unlock(&f->bg_lock);
+      finalize_part(f, p);
+      pthread_mutex_lock(&f->bg_lock);
+      continue;
+    }
+
+    if(f->stop) break;
+
+    if(!f->next){
+      temp_name(f, name, sizeof(name));
+      pthread_mutex_unlock(&f->bg_lock);
+      struct out_part *p = prepare_part(f, name);
+      pthread_mutex_lock(&f->bg_lock);
+      f->next = p;
+      if(p) continue;
+    }
+
+    struct timespec until;
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_sec += 1;
+    pthread_cond_timedwait(&f->bg_cond, &f->bg_lock, &until);
+
+    // Rotate by time even when nothing is being written
+    if(f->config.rotate_usec && !f->stop){
+      pthread_mutex_unlock(&f->bg_lock);
+      pthread_mutex_lock(&f->lock);
+      if(rotation_due(f, 0, wall_usec())) rotate(f);
+      pthread_mutex_unlock(&f->lock);
+      pthread_mutex_lock(&f->bg_lock);
+    }
+  }
+
+  pthread_mutex_unlock(&f->bg_lock);
+
+  return NULL;
+}
+
+struct out_file *out_file_open(const struct out_file_config *config){
+  struct out_file *f = calloc(1, sizeof(*f));
+  char name[1100];
+
+  f->config = *config;
+  snprintf(f->name, sizeof(f->name), "%s", config->name);
+  f->config.name = f->name;
+  f->rotating = (config->rotate_bytes || config->rotate_usec);
+
+  split_name(f);
+
+  pthread_mutex_init(&f->lock, NULL);
+  pthread_mutex_init(&f->bg_lock, NULL);
+  pthread_cond_init(&f->bg_cond, NULL);
+
+  if(f->rotating){
+    temp_name(f, name, sizeof(name));
+  } else {
+    snprintf(name, sizeof(name), "%s", f->name);
+  }
+
+  f->cur = prepare_part(f, name);
+  if(!f->cur){
+    free(f);
+    return 0;
+  }
+
+  if(config->compress_threads > 0){
+    f->zpool = zfile_pool_new(config->compress_threads,
+                              config->compress_block ? config->compress_block : ZFILE_BLOCK_SIZE);
+  }
+
+  activate_part(f, f->cur);
+  f->stats.files = 1;
+
+  if(f->rotating){
+    // before the rename, the file being written is retained when it is closed
+    find_retained_files(f);
+    rename_part(f->cur);
+    apply_retention(f);
+
+    pthread_create(&f->thread, NULL, out_file_thread, f);
+  }
+
+  return f;
+}
+
+int64_t out_file_write(struct out_file *f, const void *buf, size_t len,
+                       struct seg_idx_entry *entries, int count){
+  int i;
+
+  pthread_mutex_lock(&f->lock);
+
+  if(f->rotating && rotation_due(f, len, wall_usec())) rotate(f);
+
+  struct out_part *p = f->cur;
+  int64_t offset = p->bytes;
+
+  part_write(p, buf, len);
+  f->stats.bytes += len;
+
+  if(p->index && (count > 0)){
+    for(i = 0; i < count; i++) entries[i].offset += offset;
+    seg_index_append(p->index, entries, count);
+  }
+
+  pthread_mutex_unlock(&f->lock);
+
+  return offset;
+}
+
+void out_file_set_preamble(struct out_file *f, const void *buf, size_t len,
+                           const struct seg_idx_entry *entries, int count){
+  pthread_mutex_lock(&f->lock);
+
+  f->preamble = realloc(f->preamble, len);
+  memcpy(f->preamble, buf, len);
+  f->preamble_len = len;
+
+  f->preamble_entries = realloc(f->preamble_entries, count * sizeof(*entries));
+  memcpy(f->preamble_entries, entries, count * sizeof(*entries));
+  f->preamble_count = count;
+
+  pthread_mutex_unlock(&f->lock);
+}
+
+void out_file_flush(struct out_file *f){
+  pthread_mutex_lock(&f->lock);
+  if(f->cur->z) zfile_writer_flush(f->cur->z);
+  if(f->cur->writer) disk_writer_flush(f->cur->writer);
+  pthread_mutex_unlock(&f->lock);
+}
+
+void out_file_close(struct out_file *f){
+  if(f->rotating){
+    pthread_mutex_lock(&f->bg_lock);
+    f->stop = 1;
+    pthread_cond_signal(&f->bg_cond);
+    pthread_mutex_unlock(&f->bg_lock);
+
+    pthread_join(f->thread, NULL);
+
+    // Unused preallocated file
+    if(f->next){
+      if(f->next->writer) disk_writer_close(f->next->writer);
+      if(f->next->index) seg_index_close(f->next->index);
+      close(f->next->fd);
+      delete_file(f->next->name);
+      free(f->next);
+    }
+  }
+
+  finalize_part(f, f->cur);
+
+  if(f->zpool) zfile_pool_free(f->zpool);
+
+  pthread_mutex_destroy(&f->lock);
+  pthread_mutex_destroy(&f->bg_lock);
+  pthread_cond_destroy(&f->bg_cond);
+
+  free(f->preamble);
+  free(f->preamble_entries);
+  free(f->files);
+  free(f);
+}
+
+void out_file_get_stats(struct out_file *f, struct out_file_stats *stats){
+  pthread_mutex_lock(&f->lock);
+
+  *stats = f->stats;
+  stats->disk_bytes += f->cur->disk_bytes;
+
+  if(f->cur->writer){
+    disk_writer_get_stats(f->cur->writer, &stats->writer);
+  } else {
+    memset(&stats->writer, 0, sizeof(stats->writer));
+  }
+
+  pthread_mutex_unlock(&f->lock);
+}
+
+const char *out_file_writer_name(struct out_file *f){
+  return f->cur->writer ? disk_writer_backend_name(f->cur->writer) : "write()";
+}
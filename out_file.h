@@ -0,0 +1,101 @@
+
+/*
+ * out_file.h
+ *
+ * log_to_file output file, optionally rotated by size or time.
+ *
+ * Without rotation output goes to the named file.  With rotation every file
+ * is named by the time it was started,
+ *
+ *   log.json -> log.20261019-101500.123456.json
+ *
+ * A background thread keeps the next file open and preallocated, so
+ * rotating is only swapping pointers on the write path.  The same thread
+ * renames the new file, finalizes the previous one (waits for its writes,
+ * gives back the unused preallocation, closes it) and deletes the oldest
+ * files beyond the retention limits.
+ *
+ * Each file has its own disk_writer (async writes) and, for segment
+ * output, its own file header and index.
+ *
+ * Optionally files are compressed (zfile.h) by a pool of threads, offsets
+ * and segment indexes still refer to the uncompressed stream.
+ */
+
+#ifndef _OUT_FILE_H_
+#define _OUT_FILE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "disk_writer.h"
+#include "seg_index.h"
+
+#define OUT_FILE_PREALLOC  (256 << 20)  // preallocation when rotating by time only
+
+struct out_file_config {
+  const char *name;
+
+  int      segment;       // binary segment output, files get a header and an index
+
+  uint64_t rotate_bytes;  // start a new file at this size, 0 = no limit
+  uint64_t rotate_usec;   // start a new file after this long, 0 = no limit
+
+  int      keep_files;    // delete the oldest files beyond this many, 0 = keep all
+  uint64_t keep_bytes;    // delete the oldest files beyond this many bytes, 0 = keep all
+
+  int      async;         // write with a disk_writer
+  struct disk_writer_config writer;
+
+  int      compress_threads;  // compress with this many threads, 0 = don't compress
+  size_t   compress_block;    // uncompressed block size, 0 = ZFILE_BLOCK_SIZE
+};
+
+struct out_file_stats {
+  uint64_t files;         // rotations + 1
+  uint64_t bytes;
+  uint64_t disk_bytes;    // after compression
+  uint64_t late_opens;    // rotations that had to open the next file on the write path
+  uint64_t deleted;       // files removed by retention
+  struct disk_writer_stats writer;  // current file
+};
+
+struct out_file;
+
+/* Create the first file (and prepare the next if rotating), 0 on failure
+ */
+struct out_file *out_file_open(const struct out_file_config *config);
+
+/* Append whole records, rotating first if the current file is full or old
+ *
+ * Segment output passes the index entries of the records in buf, offsets
+ * relative to buf.  Safe to call from any thread.
+ *
+ * Returns the offset buf was written at in the current file.
+ */
+int64_t out_file_write(struct out_file *f, const void *buf, size_t len,
+                       struct seg_idx_entry *entries, int count);
+
+/* Records written again at the start of every later file, right after
+ * its header, replacing the ones set before
+ *
+ * log_to_file keeps the service descriptors of the known publishers here,
+ * so each file of a rotation names the programs of its records.  Segment
+ * output passes the index entries of the records, offsets relative to buf.
+ */
+void out_file_set_preamble(struct out_file *f, const void *buf, size_t len,
+                           const struct seg_idx_entry *entries, int count);
+
+/* Start writing what the async writer has buffered
+ */
+void out_file_flush(struct out_file *f);
+
+/* Finalize every file and stop the background thread
+ */
+void out_file_close(struct out_file *f);
+
+void out_file_get_stats(struct out_file *f, struct out_file_stats *stats);
+
+const char *out_file_writer_name(struct out_file *f);
+
+#endif /* _OUT_FILE_H_ */
@@ -0,0 +1,203 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "pcapng.h"
+
+#define BT_SHB  0x0A0D0D0A
+#define BT_IDB  0x00000001
+#define BT_EPB  0x00000006
+
+#define BYTE_ORDER_MAGIC  0x1A2B3C4D
+
+#define OPT_ENDOFOPT      0
+#define OPT_COMMENT       1
+#define OPT_SHB_USERAPPL  4
+#define OPT_IF_NAME       2
+#define OPT_IF_DESCRIPTION 3
+
+#define PAD4(n)   (((n) + 3) & ~(uint64_t)3)
+
+#define SHB_MAX   64    // SHB with the user application option
+#define IDB_MAX   96    // IDB with name and description
+#define EPB_LEN(len)  (32 + PAD4(len))
+
+static const char user_appl[] = "log_to_file";
+
+void pcapng_writer_init(struct pcapng_writer *pw, struct out_buf *out, uint16_t link_type){
+  memset(pw, 0, sizeof(*pw));
+  pw->out = out;
+  pw->link_type = link_type;
+}
+
+static inline char *put_u16(char *p, uint16_t v){ memcpy(p, &v, 2); return p + 2; }
+static inline char *put_u32(char *p, uint32_t v){ memcpy(p, &v, 4); return p + 4; }
+
+/* Option, value padded to 4 bytes
+ */
+static char *put_opt(char *p, uint16_t code, const void *value, uint16_t len){
+  p = put_u16(p, code);
+  p = put_u16(p, len);
+  memcpy(p, value, len);
+  memset(p + len, 0, PAD4(len) - len);
+  return p + PAD4(len);
+}
+
+/* Fill in the total length at both ends of the block starting at start
+ */
+static void end_block(struct out_buf *out, char *start, char *end){
+  uint32_t len = end + 4 - start;
+  memcpy(start + 4, &len, 4);
+  memcpy(end, &len, 4);
+  out->len += len;
+}
+
+/* Section header, comment may be 0
+ */
+static void put_shb(struct out_buf *out, const char *comment, uint16_t comment_len){
+  char *start = out_buf_reserve(out, SHB_MAX + PAD4(comment_len) + 4);
+  char *p = start;
+
+  p = put_u32(p, BT_SHB);
+  p = put_u32(p, 0);
+  p = put_u32(p, BYTE_ORDER_MAGIC);
+  p = put_u16(p, 1);                   // version 1.0
+  p = put_u16(p, 0);
+  memset(p, 0xff, 8);                  // section length not given
+  p += 8;
+
+  p = put_opt(p, OPT_SHB_USERAPPL, user_appl, sizeof(user_appl) - 1);
+  if(comment_len) p = put_opt(p, OPT_COMMENT, comment, comment_len);
+  p = put_opt(p, OPT_ENDOFOPT, 0, 0);
+
+  end_block(out, start, p);
+}
+
+static void put_idb(struct pcapng_writer *pw, const struct pcapng_if *pif){
+  char *start = out_buf_reserve(pw->out, IDB_MAX);
+  char *p = start;
+  char name[48];
+  int desc_len = strnlen(pif->type_lvl, sizeof(pif->type_lvl));
+
+  // trailing blanks of the type_lvl aren't part of the name
+  while((desc_len > 0) && (pif->type_lvl[desc_len - 1] == ' ')) desc_len--;
+
+  int name_len = snprintf(name, sizeof(name), "%lX:%lu", pif->prog_hash, pif->process_id);
+
+  p = put_u32(p, BT_IDB);
+  p = put_u32(p, 0);
+  p = put_u16(p, pw->link_type);
+  p = put_u16(p, 0);
+  p = put_u32(p, 0);                   // no snap length
+
+  p = put_opt(p, OPT_IF_NAME, name, name_len);
+  if(desc_len) p = put_opt(p, OPT_IF_DESCRIPTION, pif->type_lvl, desc_len);
+  p = put_opt(p, OPT_ENDOFOPT, 0, 0);
+
+  end_block(pw->out, start, p);
+}
+
+/* Make room for a packet of len bytes in the open section, starting a
+ * section when none is open
+ *
+ * A section never spans buffers, when the packet doesn't fit the section is
+ * written and the packet starts the next one.
+ */
+static void section_reserve(struct pcapng_writer *pw, uint64_t len){
+  uint64_t needed = IDB_MAX + EPB_LEN(len);
+
+  if(pw->open && (((pw->out->len + needed) > pw->out->cap) || (pw->ifs_count == PCAPNG_MAX_IFS))){
+    pcapng_flush(pw);
+  }
+
+  if(!pw->open){
+    // only whole sections are buffered, safe to flush (or grow for a huge packet)
+    out_buf_reserve(pw->out, SHB_MAX + needed);
+    put_shb(pw->out, 0, 0);
+
+    pw->open      = 1;
+    pw->ifs_count = 0;
+    pw->last_if   = 0;
+  }
+}
+
+/* Interface id of the record's publisher and type_lvl in the open section
+ */
+static uint32_t section_if(struct pcapng_writer *pw, const struct Msg_Hdr *lm){
+  struct pcapng_if *pif = &pw->ifs[pw->last_if];
+  int i;
+
+  if((pw->last_if < pw->ifs_count) && (pif->prog_hash == lm->prog_hash) &&
+     (pif->process_id == lm->process_id) && !memcmp(pif->type_lvl, lm->type_lvl, sizeof(pif->type_lvl))){
+    return pw->last_if;
+  }
+
+  for(i = 0; i < pw->ifs_count; i++){
+    pif = &pw->ifs[i];
+    if((pif->prog_hash == lm->prog_hash) && (pif->process_id == lm->process_id) &&
+       !memcmp(pif->type_lvl, lm->type_lvl, sizeof(pif->type_lvl))) break;
+  }
+
+  if(i == pw->ifs_count){
+    pif = &pw->ifs[pw->ifs_count++];
+    pif->prog_hash  = lm->prog_hash;
+    pif->process_id = lm->process_id;
+    memcpy(pif->type_lvl, lm->type_lvl, sizeof(pif->type_lvl));
+
+    put_idb(pw, pif);
+  }
+
+  pw->last_if = i;
+  return i;
+}
+
+void pcapng_put_pkt(struct pcapng_writer *pw, const struct Msg_Hdr *lm, const void *payload, uint64_t payload_len){
+  if((lm->type_lvl[0] != 'P') || (payload_len > UINT32_MAX - 64)){
+    pw->skipped += 1;
+    return;
+  }
+
+  section_reserve(pw, payload_len);
+
+  uint32_t if_id = section_if(pw, lm);
+
+  char *start = pw->out->buf + pw->out->len;
+  char *p = start;
+
+  p = put_u32(p, BT_EPB);
+  p = put_u32(p, 0);
+  p = put_u32(p, if_id);
+  p = put_u32(p, lm->usec >> 32);
+  p = put_u32(p, lm->usec);
+  p = put_u32(p, payload_len);         // captured
+  p = put_u32(p, payload_len);         // original
+  memcpy(p, payload, payload_len);
+  memset(p + payload_len, 0, PAD4(payload_len) - payload_len);
+  p += PAD4(payload_len);
+
+  end_block(pw->out, start, p);
+
+  pw->packets += 1;
+}
+
+void pcapng_put_svc(struct pcapng_writer *pw, uint64_t usec, uint64_t prog_hash, uint64_t process_id,
+                    const struct sockaddr_in *addr, const char *program_name, uint64_t name_len){
+  char comment[1200];
+  char ip[INET_ADDRSTRLEN];
+
+  inet_ntop(AF_INET, &addr->sin_addr, ip, sizeof(ip));
+
+  int len = snprintf(comment, sizeof(comment), "usec: %lu, eid: %lX, pid: %lu, uri: %s:%u, prog: %.*s",
+                     usec, prog_hash, process_id, ip, ntohs(addr->sin_port), (int)name_len, program_name);
+  if(len >= (int)sizeof(comment)) len = sizeof(comment) - 1;
+
+  if(pw->open) pcapng_flush(pw);
+
+  put_shb(pw->out, comment, len);
+}
+
+void pcapng_flush(struct pcapng_writer *pw){
+  pw->open = 0;
+  out_buf_flush(pw->out);
+}
@@ -0,0 +1,76 @@
+
+/*
+ * pcapng.h
+ *
+ * pcapng output for packet capture ("P") records, readable by Wireshark,
+ * tshark, mergecap etc. without decoding base64 first.
+ *
+ * Like segments (segment.h), what one writer buffers between writes to the
+ * file is self contained: a section, starting with a Section Header Block,
+ * then an Interface Description Block for each (publisher, type_lvl) the
+ * buffer has packets from, and an Enhanced Packet Block per packet:
+ *
+ *   SHB, IDB, EPB, EPB, IDB, EPB, ...
+ *   SHB, IDB, EPB, ...
+ *
+ * so sections from different writers can be appended to the file in any
+ * order and a rotated file starts with a section.  Interfaces are named
+ * "<eid>:<pid>" with the type_lvl as description, the packet timestamp is
+ * the record's usec (the default microsecond resolution), and the payload
+ * is written as received.
+ *
+ * A service descriptor is written as a section without packets whose
+ * comment maps the eid to the program name.
+ *
+ * Blocks are in host byte order, readers use the SHB byte order magic.
+ */
+
+#ifndef _PCAPNG_H_
+#define _PCAPNG_H_
+
+#include <stdint.h>
+#include <netinet/in.h>
+
+#include "log_msg.h"
+#include "out_buf.h"
+
+#define PCAPNG_LINKTYPE_ETHERNET  1
+#define PCAPNG_MAX_IFS            64   // interfaces per section, a new section starts beyond
+
+struct pcapng_if {
+  uint64_t prog_hash;
+  uint64_t process_id;
+  char     type_lvl[8];
+};
+
+/* Writer, formats packets into an out_buf a section at a time
+ */
+struct pcapng_writer {
+  struct out_buf *out;
+  uint16_t link_type;
+
+  int      open;                          // section started in out
+  struct pcapng_if ifs[PCAPNG_MAX_IFS];   // interfaces of the open section, id = index
+  int      ifs_count;
+  int      last_if;                       // most records come in runs from one publisher
+
+  uint64_t packets;
+  uint64_t skipped;                       // records routed here that aren't packets
+};
+
+void pcapng_writer_init(struct pcapng_writer *pw, struct out_buf *out, uint16_t link_type);
+
+/* Append a packet record, other records are counted and skipped
+ */
+void pcapng_put_pkt(struct pcapng_writer *pw, const struct Msg_Hdr *lm, const void *payload, uint64_t payload_len);
+
+/* Append a section recording the program behind an eid
+ */
+void pcapng_put_svc(struct pcapng_writer *pw, uint64_t usec, uint64_t prog_hash, uint64_t process_id,
+                    const struct sockaddr_in *addr, const char *program_name, uint64_t name_len);
+
+/* Close the open section and write it to the file
+ */
+void pcapng_flush(struct pcapng_writer *pw);
+
+#endif /* _PCAPNG_H_ */
@@ -0,0 +1,290 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "pub_registry.h"
+#include "pub_table.h"
+
+static uint64_t pub_slot(struct pub_registry *reg, uint64_t prog_hash, uint64_t process_id){
+  return pub_table_slot(reg->slots, reg->size, prog_hash, process_id);
+}
+
+static void pub_registry_resize(struct pub_registry *reg, uint64_t size){
+  void   **old = reg->slots;
+  uint64_t old_size = reg->size;
+  uint64_t i;
+
+  reg->slots = calloc(size, sizeof(reg->slots[0]));
+  reg->size  = size;
+
+  for(i = 0; i < old_size; i++){
+    struct publisher *pub = old[i];
+    if(pub) reg->slots[pub_slot(reg, pub->prog_hash, pub->process_id)] = pub;
+  }
+
+  free(old);
+}
+
+struct pub_registry *pub_registry_new(){
+  struct pub_registry *reg = calloc(1, sizeof(*reg));
+
+  pthread_mutex_init(&reg->lock, NULL);
+  pub_registry_resize(reg, 256);
+
+  return reg;
+}
+
+void pub_registry_free(struct pub_registry *reg){
+  uint64_t i;
+
+  for(i = 0; i < reg->size; i++) free(reg->slots[i]);
+
+  pthread_mutex_destroy(&reg->lock);
+  free(reg->slots);
+  free(reg);
+}
+
+/* New entry in the empty slot i, with the lock held
+ */
+static struct publisher *pub_insert(struct pub_registry *reg, uint64_t i, uint64_t prog_hash, uint64_t process_id,
+                                    uint64_t now_usec){
+  struct publisher *pub = calloc(1, sizeof(*pub));
+
+  pub->prog_hash  = prog_hash;
+  pub->process_id = process_id;
+  pub->eid        = -1;
+  pub->added_usec = now_usec;
+  pub->seen_usec  = now_usec;
+
+  reg->slots[i] = pub;
+  reg->stats.publishers += 1;
+  reg->stats.added      += 1;
+
+  if((reg->stats.publishers * 2) > reg->size) pub_registry_resize(reg, reg->size * 2);
+
+  return pub;
+}
+
+struct publisher *pub_registry_add(struct pub_registry *reg, uint64_t prog_hash, uint64_t process_id, uint64_t now_usec){
+  struct publisher *pub = 0;
+
+  pthread_mutex_lock(&reg->lock);
+
+  uint64_t i = pub_slot(reg, prog_hash, process_id);
+
+  if(!reg->slots[i]) pub = pub_insert(reg, i, prog_hash, process_id, now_usec);
+
+  pthread_mutex_unlock(&reg->lock);
+
+  return pub;
+}
+
+void pub_registry_relayed(struct pub_registry *reg, uint64_t prog_hash, uint64_t process_id,
+                          const struct sockaddr_in *addr, const char *program_name, size_t name_len,
+                          uint64_t svc_usec, int gone, uint64_t now_usec){
+  pthread_mutex_lock(&reg->lock);
+
+  uint64_t i = pub_slot(reg, prog_hash, process_id);
+  struct publisher *pub = reg->slots[i];
+
+  if(!pub && !gone){
+    pub = pub_insert(reg, i, prog_hash, process_id, now_usec);
+    pub->addr    = *addr;
+    pub->svc_usec = svc_usec;
+    pub->worker  = -1;
+    pub->relayed = 1;
+    snprintf(pub->program_name, sizeof(pub->program_name), "%.*s", (int)name_len, program_name);
+  } else if(pub && pub->relayed && gone){
+    pub->gone = 1;
+  }
+
+  pthread_mutex_unlock(&reg->lock);
+}
+
+struct publisher *pub_registry_find(struct pub_registry *reg, uint64_t prog_hash, uint64_t process_id){
+  pthread_mutex_lock(&reg->lock);
+  struct publisher *pub = reg->slots[pub_slot(reg, prog_hash, process_id)];
+  pthread_mutex_unlock(&reg->lock);
+
+  return pub;
+}
+
+void pub_registry_touch(struct pub_registry *reg, uint64_t prog_hash, uint64_t process_id, uint64_t now_usec){
+  pthread_mutex_lock(&reg->lock);
+
+  struct publisher *pub = reg->slots[pub_slot(reg, prog_hash, process_id)];
+  if(pub){
+    pub->seen_usec = now_usec;
+    pub->probe_timeouts = 0;
+  }
+
+  pthread_mutex_unlock(&reg->lock);
+}
+
+void pub_registry_account(struct pub_registry *reg, const struct pub_run *run, uint64_t now_usec){
+  int c;
+
+  pthread_mutex_lock(&reg->lock);
+
+  struct publisher *pub = reg->slots[pub_slot(reg, run->prog_hash, run->process_id)];
+
+  if(!pub){
+    for(c = 0; c < SHED_CLASSES; c++) reg->stats.unknown_msgs += run->msgs[c];
+    pthread_mutex_unlock(&reg->lock);
+    return;
+  }
+
+  pub->seen_usec = now_usec;
+  pub->probe_timeouts = 0;
+
+  for(c = 0; c < SHED_CLASSES; c++){
+    pub->msgs[c]  += run->msgs[c];
+    pub->bytes[c] += run->bytes[c];
+  }
+
+  // the run itself, and where it joins the records before it
+  pub->out_of_order += run->out_of_order;
+  if(run->first_usec < pub->last_usec) pub->out_of_order += 1;
+  pub->last_usec = run->last_usec;
+
+  if(run->shed_report){
+    if(run->dropped > pub->dropped) pub->loss_events += 1;
+
+    pub->shed_level = run->shed_level;
+    pub->dropped    = run->dropped;
+    pub->shed       = run->shed;
+  }
+
+  pthread_mutex_unlock(&reg->lock);
+}
+
+void pub_registry_for_each(struct pub_registry *reg, void (*fn)(struct publisher *pub, void *arg), void *arg){
+  uint64_t i;
+
+  pthread_mutex_lock(&reg->lock);
+
+  for(i = 0; i < reg->size; i++){
+    if(reg->slots[i]) fn(reg->slots[i], arg);
+  }
+
+  pthread_mutex_unlock(&reg->lock);
+}
+
+void pub_registry_remove(struct pub_registry *reg, struct publisher *pub){
+  pthread_mutex_lock(&reg->lock);
+
+  pub_table_delete(reg->slots, reg->size, pub_slot(reg, pub->prog_hash, pub->process_id));
+
+  reg->stats.publishers -= 1;
+  reg->stats.reaped     += 1;
+
+  pthread_mutex_unlock(&reg->lock);
+
+  free(pub);
+}
+
+int pub_registry_idle(struct pub_registry *reg, uint64_t now_usec, uint64_t idle_usec,
+                      struct publisher **idle, int max){
+  int count = 0;
+  uint64_t i;
+
+  pthread_mutex_lock(&reg->lock);
+
+  for(i = 0; (i < reg->size) && (count < max); i++){
+    struct publisher *pub = reg->slots[i];
+    if(!pub) continue;
+
+    // relayed publishers are dropped when their relay says so
+    if(pub->relayed ? pub->gone : ((now_usec - pub->seen_usec) >= idle_usec)) idle[count++] = pub;
+  }
+
+  pthread_mutex_unlock(&reg->lock);
+
+  return count;
+}
+
+static uint64_t probe_time_msec(){
+  struct timespec tv;
+  clock_gettime(CLOCK_MONOTONIC, &tv);
+  return tv.tv_sec * (uint64_t)1000 + tv.tv_nsec / 1000000;
+}
+
+void pub_registry_probe(struct pub_registry *reg, struct publisher **pubs, int count,
+                        int timeout_msec, enum pub_probe_result *results){
+  struct pollfd pfd[PUB_PROBE_BATCH];
+  int i, pending = 0, err;
+  socklen_t len;
+
+  if(count > PUB_PROBE_BATCH) count = PUB_PROBE_BATCH;
+
+  // Start all connects, most complete or fail immediately on a LAN
+  for(i = 0; i < count; i++){
+    results[i] = PUB_PROBE_TIMEOUT;
+    pfd[i].fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    pfd[i].events = POLLOUT;
+    pfd[i].revents = 0;
+
+    if(pfd[i].fd < 0) continue;
+
+    if(connect(pfd[i].fd, (const struct sockaddr *)&pubs[i]->addr, sizeof(pubs[i]->addr)) == 0){
+      results[i] = PUB_PROBE_ALIVE;
+    } else if(errno == EINPROGRESS){
+      pending += 1;
+      continue;
+    } else if((errno == ECONNREFUSED) || (errno == EHOSTUNREACH) || (errno == ENETUNREACH)){
+      results[i] = PUB_PROBE_DEAD;
+    }
+
+    close(pfd[i].fd);
+    pfd[i].fd = -1;
+  }
+
+  uint64_t deadline = probe_time_msec() + timeout_msec;
+
+  while(pending > 0){
+    uint64_t now = probe_time_msec();
+    if(now >= deadline) break;
+
+    if(poll(pfd, count, deadline - now) <= 0) continue;
+
+    for(i = 0; i < count; i++){
+      if((pfd[i].fd < 0) || !pfd[i].revents) continue;
+
+      err = 0;
+      len = sizeof(err);
+      getsockopt(pfd[i].fd, SOL_SOCKET, SO_ERROR, &err, &len);
+
+      if(err == 0){
+        results[i] = PUB_PROBE_ALIVE;
+      } else if((err == ECONNREFUSED) || (err == EHOSTUNREACH) || (err == ENETUNREACH)){
+        results[i] = PUB_PROBE_DEAD;
+      }
+
+      close(pfd[i].fd);
+      pfd[i].fd = -1;
+      pending -= 1;
+    }
+  }
+
+  for(i = 0; i < count; i++){
+    if(pfd[i].fd >= 0) close(pfd[i].fd);
+  }
+
+  pthread_mutex_lock(&reg->lock);
+  reg->stats.probes += count;
+  pthread_mutex_unlock(&reg->lock);
+}
+
+void pub_registry_get_stats(struct pub_registry *reg, struct pub_registry_stats *stats){
+  pthread_mutex_lock(&reg->lock);
+  *stats = reg->stats;
+  pthread_mutex_unlock(&reg->lock);
+}
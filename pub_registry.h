@@ -0,0 +1,163 @@
+
+/*
+ * pub_registry.h
+ *
+ * Publishers log_to_file is subscribed to, keyed by (prog_hash, process_id).
+ *
+ * Entries are added when a service descriptor is received and touched by
+ * the workers whenever records arrive, so the registry knows when each
+ * publisher was last heard from.
+ *
+ * Publishers only advertise once, silence alone doesn't mean a publisher
+ * has gone.  Publishers that are idle for a while are probed with a TCP
+ * connect to their endpoint: a refused (or unreachable) connection, or
+ * several probes in a row timing out, means the publisher has exited and
+ * the receiver can drop its subscription and free its state.
+ *
+ * Publishers on other hosts that reach an aggregator through a relay
+ * (relay.h) are added from the records that the relay forwards.  They can't
+ * be probed from here; they are dropped when their relay reports them gone.
+ *
+ * Workers also account the traffic of each publisher: records and bytes
+ * by class (see load_shed.h), records arriving out of time order, and the
+ * loss the publisher reports in-band with its load shed reports (the wire
+ * has no sequence numbers, so loss can't be seen on the receive side).
+ */
+
+#ifndef _PUB_REGISTRY_H_
+#define _PUB_REGISTRY_H_
+
+#include <stdint.h>
+#include <pthread.h>
+#include <netinet/in.h>
+
+#include "load_shed.h"
+
+#define PUB_PROBE_TIMEOUT_MSEC  200
+#define PUB_PROBE_BATCH         64   // endpoints probed at once
+#define PUB_PROBE_TIMEOUTS      3    // probes in a row timing out before a publisher is dead
+
+struct publisher {
+  uint64_t prog_hash;        // the key comes first, see pub_table.h
+  uint64_t process_id;
+
+  struct sockaddr_in addr;   // pub endpoint
+  char     program_name[64];
+  uint64_t svc_usec;         // timestamp of its service descriptor
+  int      eid;              // nanomsg endpoint id of the subscription
+  int      worker;           // -1 if relayed
+  int      relayed;          // known through a relay, not subscribed to
+  int      gone;             // the relay reported it has exited
+
+  uint64_t added_usec;       // local monotonic time
+  volatile uint64_t seen_usec;
+  int      probe_timeouts;
+
+  // Traffic, updated under the lock by pub_registry_account()
+  uint64_t msgs[SHED_CLASSES];
+  uint64_t bytes[SHED_CLASSES];
+  uint64_t last_usec;        // publisher timestamp of the last record
+  uint64_t out_of_order;     // records older than the record before
+  int      shed_level;       // from the latest load shed report
+  uint64_t dropped;          // records lost to a full send buffer, as reported
+  uint64_t shed;             // records sampled away by load shedding, as reported
+  uint64_t loss_events;      // reports where dropped went up, gaps in the stream
+
+  uint64_t rate_msgs;        // totals at the last rate sample
+  uint64_t rate_usec;
+};
+
+/* Traffic of a run of records from one publisher, accumulated by a worker
+ * without the lock
+ */
+struct pub_run {
+  uint64_t prog_hash;
+  uint64_t process_id;
+
+  uint64_t msgs[SHED_CLASSES];
+  uint64_t bytes[SHED_CLASSES];
+  uint64_t first_usec;
+  uint64_t last_usec;
+  uint64_t out_of_order;
+
+  int      shed_report;      // a load shed report was received
+  int      shed_level;
+  uint64_t dropped;
+  uint64_t shed;
+};
+
+struct pub_registry_stats {
+  uint64_t publishers;
+  uint64_t added;
+  uint64_t reaped;
+  uint64_t probes;
+  uint64_t unknown_msgs;     // records from publishers that never advertised
+};
+
+struct pub_registry {
+  pthread_mutex_t lock;
+
+  void   **slots;            // struct publisher *, see pub_table.h
+  uint64_t size;             // power of 2
+
+  struct pub_registry_stats stats;
+};
+
+enum pub_probe_result {
+  PUB_PROBE_ALIVE,
+  PUB_PROBE_DEAD,            // connection refused or unreachable
+  PUB_PROBE_TIMEOUT
+};
+
+struct pub_registry *pub_registry_new();
+void pub_registry_free(struct pub_registry *reg);
+
+/* Add a publisher, returns 0 if it's already registered
+ *
+ * The caller fills in the endpoint fields of the new entry.
+ */
+struct publisher *pub_registry_add(struct pub_registry *reg, uint64_t prog_hash, uint64_t process_id, uint64_t now_usec);
+
+/* Add a publisher known through a relay, or mark it gone, safe to call from
+ * any thread
+ */
+void pub_registry_relayed(struct pub_registry *reg, uint64_t prog_hash, uint64_t process_id,
+                          const struct sockaddr_in *addr, const char *program_name, size_t name_len,
+                          uint64_t svc_usec, int gone, uint64_t now_usec);
+
+struct publisher *pub_registry_find(struct pub_registry *reg, uint64_t prog_hash, uint64_t process_id);
+
+/* The publisher is known to be alive, safe to call from any thread
+ */
+void pub_registry_touch(struct pub_registry *reg, uint64_t prog_hash, uint64_t process_id, uint64_t now_usec);
+
+/* Add a run of records to the publisher's counters and mark it as alive,
+ * safe to call from any thread
+ */
+void pub_registry_account(struct pub_registry *reg, const struct pub_run *run, uint64_t now_usec);
+
+/* Call fn for every publisher with the lock held
+ */
+void pub_registry_for_each(struct pub_registry *reg, void (*fn)(struct publisher *pub, void *arg), void *arg);
+
+/* Remove and free the entry
+ *
+ * Entries are only added and removed by one thread, which may use entry
+ * pointers without holding the lock.
+ */
+void pub_registry_remove(struct pub_registry *reg, struct publisher *pub);
+
+/* Collect up to max publishers that have been silent for idle_usec, and
+ * relayed publishers reported gone
+ */
+int pub_registry_idle(struct pub_registry *reg, uint64_t now_usec, uint64_t idle_usec,
+                      struct publisher **idle, int max);
+
+/* Probe the endpoints of count publishers at once, waiting up to timeout_msec
+ */
+void pub_registry_probe(struct pub_registry *reg, struct publisher **pubs, int count,
+                        int timeout_msec, enum pub_probe_result *results);
+
+void pub_registry_get_stats(struct pub_registry *reg, struct pub_registry_stats *stats);
+
+#endif /* _PUB_REGISTRY_H_ */
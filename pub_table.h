@@ -0,0 +1,69 @@
+/*
+ * pub_table.h
+ *
+ * Open addressing table keyed by publisher (prog_hash, process_id), used by
+ * the publisher registry (pub_registry.h) and the time order merge
+ * (merge.h).
+ *
+ * Slots hold pointers to entries whose first two fields are the key, see
+ * struct pub_key, 0 = empty.  The table size is a power of 2 and the owner
+ * grows it before it is half full, so probing always ends at an empty slot.
+ * Deleting moves later entries of the probe chain back into the hole, there
+ * are no tombstones.
+ */
+
+#ifndef _PUB_TABLE_H_
+#define _PUB_TABLE_H_
+
+#include <stdint.h>
+
+struct pub_key {
+  uint64_t prog_hash;
+  uint64_t process_id;
+};
+
+static inline uint64_t pub_table_hash(uint64_t prog_hash, uint64_t process_id){
+  uint64_t h = (prog_hash * 0x9E3779B97F4A7C15ULL) ^ (process_id * 0xC2B2AE3D27D4EB4FULL);
+  return h ^ (h >> 29);
+}
+
+/* Slot of the entry with the key, or the empty slot it would go in
+ */
+static inline uint64_t pub_table_slot(void **slots, uint64_t size, uint64_t prog_hash, uint64_t process_id){
+  uint64_t i = pub_table_hash(prog_hash, process_id) & (size - 1);
+
+  // linear probe, the table is never full
+  while(slots[i]){
+    const struct pub_key *k = slots[i];
+    if((k->prog_hash == prog_hash) && (k->process_id == process_id)) break;
+    i = (i + 1) & (size - 1);
+  }
+
+  return i;
+}
+
+/* Empty slot i, the entry itself is the caller's
+ */
+static inline void pub_table_delete(void **slots, uint64_t size, uint64_t i){
+  uint64_t j = i;
+
+  // Backward shift deletion, move later entries of the probe chain into the hole
+  slots[i] = 0;
+
+  while(1){
+    j = (j + 1) & (size - 1);
+    if(!slots[j]) break;
+
+    const struct pub_key *k = slots[j];
+    uint64_t home = pub_table_hash(k->prog_hash, k->process_id) & (size - 1);
+
+    // j stays if its home is cyclically in (i, j]
+    if(((j > i) && (home > i) && (home <= j)) || ((j < i) && ((home > i) || (home <= j)))) continue;
+
+    slots[i] = slots[j];
+    slots[j] = 0;
+    i = j;
+  }
+}
+
+#endif /* _PUB_TABLE_H_ */
@@ -0,0 +1,181 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <nanomsg/nn.h>
+#include <nanomsg/pipeline.h>
+
+#include "relay.h"
+#include "lz.h"
+
+struct relay *relay_open(const char *url, int compress){
+  int timeout = RELAY_SEND_TIMEOUT_MSEC;
+
+  struct relay *r = calloc(1, sizeof(*r));
+  r->compress = compress;
+
+  r->sock = nn_socket(AF_SP, NN_PUSH);
+  if(r->sock < 0) goto fail;
+
+  nn_setsockopt(r->sock, NN_SOL_SOCKET, NN_SNDTIMEO, &timeout, sizeof(timeout));
+
+  // connects in the background, and again whenever the aggregator restarts
+  if(nn_connect(r->sock, url) < 0){
+    nn_close(r->sock);
+    goto fail;
+  }
+
+  return r;
+
+fail:
+  free(r);
+  return 0;
+}
+
+void relay_close(struct relay *r){
+  nn_close(r->sock);
+  free(r);
+}
+
+int relay_send(struct relay *r, const void *buf, size_t len){
+  static __thread uint32_t work[LZ_WORK_SIZE / sizeof(uint32_t)];
+  static __thread char  *comp;        // the thread's compressed batch
+  static __thread size_t comp_cap;
+
+  struct relay_hdr hdr = {.magic = RELAY_MAGIC, .raw_len = len};
+  struct nn_msghdr msg;
+  struct nn_iovec iov[2];
+  size_t body_len = 0;
+
+  // the aggregator wouldn't take it
+  if(len > RELAY_MAX_BATCH){
+    __atomic_fetch_add(&r->dropped, 1, __ATOMIC_RELAXED);
+    return -1;
+  }
+
+  iov[1].iov_base = (void *)buf;
+  iov[1].iov_len  = len;
+
+  if(r->compress){
+    if(comp_cap < LZ_BOUND(len)){
+      comp_cap = LZ_BOUND(len);
+      free(comp);
+      comp = malloc(comp_cap);
+    }
+
+    // segments that don't compress go as they are
+    body_len = lz_compress(buf, len, comp, comp_cap, work);
+
+    if(body_len){
+      hdr.flags |= RELAY_LZ;
+      iov[1].iov_base = comp;
+      iov[1].iov_len  = body_len;
+    }
+  }
+
+  iov[0].iov_base = &hdr;
+  iov[0].iov_len  = sizeof(hdr);
+
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov    = iov;
+  msg.msg_iovlen = 2;
+
+  int bytes = nn_sendmsg(r->sock, &msg, 0);
+
+  if(bytes < 0){
+    __atomic_fetch_add(&r->dropped, 1, __ATOMIC_RELAXED);
+    return -1;
+  }
+
+  __atomic_fetch_add(&r->batches, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&r->raw_bytes, len, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&r->sent_bytes, bytes, __ATOMIC_RELAXED);
+
+  return 0;
+}
+
+int relay_listen(int port, int recv_buf_size){
+  int max_size = sizeof(struct relay_hdr) + LZ_BOUND(RELAY_MAX_BATCH);
+  char url[64];
+
+  int sock = nn_socket(AF_SP, NN_PULL);
+  if(sock < 0) return -1;
+
+  nn_setsockopt(sock, NN_SOL_SOCKET, NN_RCVMAXSIZE, &max_size, sizeof(max_size));
+
+  if(recv_buf_size > 0){
+    nn_setsockopt(sock, NN_SOL_SOCKET, NN_RCVBUF, &recv_buf_size, sizeof(recv_buf_size));
+  }
+
+  snprintf(url, sizeof(url), "tcp://0.0.0.0:%i", port);
+
+  if(nn_bind(sock, url) < 0){
+    nn_close(sock);
+    return -1;
+  }
+
+  return sock;
+}
+
+int relay_recv(int sock, struct relay_batch *b, struct relay_in_stats *stats){
+  int len = nn_recv(sock, &b->msg, NN_MSG, NN_DONTWAIT);
+
+  if(len < 0){
+    b->msg = 0;
+    return 0;
+  }
+
+  const struct relay_hdr *hdr = b->msg;
+  uint64_t body_len = len - sizeof(*hdr);
+
+  stats->batches += 1;
+  stats->bytes   += len;
+
+  if((len < (int)sizeof(*hdr)) || (hdr->magic != RELAY_MAGIC)) goto bad;
+
+  // raw_len is the sender's word, don't allocate more than an edge sends
+  if(hdr->raw_len > RELAY_MAX_BATCH) goto bad;
+
+  if(hdr->flags & RELAY_LZ){
+    if(b->cap < hdr->raw_len){
+      free(b->buf);
+      b->buf = malloc(hdr->raw_len);
+      b->cap = b->buf ? hdr->raw_len : 0;
+
+      if(!b->buf) goto bad;
+    }
+
+    if(lz_decompress(hdr + 1, body_len, b->buf, hdr->raw_len) != hdr->raw_len) goto bad;
+
+    b->records = b->buf;
+  } else {
+    if(body_len != hdr->raw_len) goto bad;
+
+    b->records = (const char *)(hdr + 1);
+  }
+
+  b->len = hdr->raw_len;
+
+  return 1;
+
+bad:
+  stats->bad += 1;
+  relay_batch_done(b);
+  return -1;
+}
+
+void relay_batch_done(struct relay_batch *b){
+  if(b->msg) nn_freemsg(b->msg);
+  b->msg = 0;
+  b->records = 0;
+  b->len = 0;
+}
+
+void relay_batch_free(struct relay_batch *b){
+  relay_batch_done(b);
+  free(b->buf);
+  b->buf = 0;
+  b->cap = 0;
+}
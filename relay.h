@@ -0,0 +1,109 @@
+
+/*
+ * relay.h
+ *
+ * Relay mode, a log_to_file on each host forwards raw records to a
+ * central log_to_file (the aggregator), so publishers only need to reach
+ * their own host and the formatting is done in one place.
+ *
+ * The edge (log_to_file -U) subscribes to the publishers that advertise to
+ * it as usual, but instead of formatting records it buffers them as binary
+ * segments (segment.h) with the interned strings already resolved, and
+ * sends each buffer upstream as one batch, lz compressed with -c.  Service
+ * descriptors travel in the batches as SVC records, and publishers the edge
+ * reaps are reported with SEG_SVC_GONE.
+ *
+ *   relay_hdr
+ *   segments, raw_len bytes (lz.h block if RELAY_LZ)
+ *
+ * The aggregator (log_to_file -A) binds one PULL socket shared by all its
+ * workers, a batch is taken by whichever worker is free and its records go
+ * through the normal path (routes, -o merge, sinks).  Records of one
+ * publisher are in order within a batch, use -o for time order across
+ * batches.
+ *
+ * A batch is sent with a timeout, while the aggregator is unreachable the
+ * edge drops batches (and counts them) rather than stall its publishers.
+ */
+
+#ifndef _RELAY_H_
+#define _RELAY_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define RELAY_MAGIC            0x31594C52U  // "RLY1"
+#define RELAY_BATCH_SIZE       (256 << 10)  // default edge buffer per thread
+#define RELAY_MAX_BATCH        (16 * RELAY_BATCH_SIZE)  // a huge record grows a buffer up to this, larger batches are dropped
+#define RELAY_SEND_TIMEOUT_MSEC 1000
+
+enum relay_flags {
+  RELAY_LZ = 1          // records are an lz block
+};
+
+struct relay_hdr {
+  uint32_t magic;       // RELAY_MAGIC
+  uint32_t flags;
+  uint32_t raw_len;     // bytes of segments
+  uint32_t reserved;    // keeps the records 8 byte aligned
+};
+
+/* Edge, the upstream connection, shared by all threads of the edge
+ */
+struct relay {
+  int sock;             // PUSH connected to the aggregator
+  int compress;
+
+  // updated atomically by the sending threads
+  volatile uint64_t batches;
+  volatile uint64_t raw_bytes;
+  volatile uint64_t sent_bytes;  // headers included
+  volatile uint64_t dropped;     // batches
+};
+
+/* Connect to the aggregator at url, e.g. tcp://host:50003
+ *
+ * Returns 0 if the url is malformed.
+ */
+struct relay *relay_open(const char *url, int compress);
+void relay_close(struct relay *r);
+
+/* Send len bytes of whole segments as one batch, safe to call from any thread
+ *
+ * Returns 0, or -1 if the batch was dropped (unreachable, or larger than
+ * RELAY_MAX_BATCH).
+ */
+int relay_send(struct relay *r, const void *buf, size_t len);
+
+/* Aggregator, a PULL socket bound to port
+ */
+int relay_listen(int port, int recv_buf_size);
+
+/* A received batch, the buffer is kept across batches
+ */
+struct relay_batch {
+  void       *msg;      // as received
+  char       *buf;      // decompressed records
+  size_t      cap;
+
+  const char *records;  // 8 byte aligned segments
+  uint64_t    len;
+};
+
+struct relay_in_stats {
+  volatile uint64_t batches;
+  volatile uint64_t bytes;       // as received
+  volatile uint64_t bad;         // malformed, too large or no memory for it, dropped
+};
+
+/* Receive a batch if one is waiting
+ *
+ * Returns 1 with the records in b, 0 if nothing is waiting, or -1 if a
+ * batch was dropped: malformed, over RELAY_MAX_BATCH, or its records
+ * couldn't be allocated.  relay_batch_done() releases the message.
+ */
+int relay_recv(int sock, struct relay_batch *b, struct relay_in_stats *stats);
+void relay_batch_done(struct relay_batch *b);
+void relay_batch_free(struct relay_batch *b);
+
+#endif /* _RELAY_H_ */
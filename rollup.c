@@ -0,0 +1,243 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "rollup.h"
+
+static inline uint64_t rollup_hash(const struct rollup_entry *k){
+  uint64_t mask;
+  memcpy(&mask, k->type_lvl, sizeof(mask));
+
+  uint64_t h = (k->prog_hash * 0x9E3779B97F4A7C15ULL) ^ (k->function_ptr * 0xC2B2AE3D27D4EB4FULL) ^
+               (k->file_line_number * 0x165667B19E3779F9ULL) ^ (mask * 0xD6E8FEB86659FD93ULL);
+  h ^= h >> 29;
+
+  return h ? h : 1;  // 0 marks a free slot
+}
+
+static inline int rollup_matches(const struct rollup_entry *e, const struct rollup_entry *k){
+  return (e->hash == k->hash) &&
+         (e->function_ptr == k->function_ptr) &&
+         (e->file_line_number == k->file_line_number) &&
+         (e->prog_hash == k->prog_hash) &&
+         (memcmp(e->type_lvl, k->type_lvl, sizeof(k->type_lvl)) == 0);
+}
+
+/* The entry for k, or the free slot it would go in
+ */
+static inline struct rollup_entry *table_slot(const struct rollup_table *t, const struct rollup_entry *k){
+  uint64_t i = k->hash & (t->size - 1);
+
+  // linear probe, the table is never full
+  while(t->slots[i].hash && !rollup_matches(&t->slots[i], k)) i = (i + 1) & (t->size - 1);
+
+  return &t->slots[i];
+}
+
+static void table_init(struct rollup_table *t, uint64_t size){
+  t->slots = calloc(size, sizeof(t->slots[0]));
+  t->size  = size;
+  t->used  = 0;
+}
+
+struct rollup *rollup_new(){
+  struct rollup *r = calloc(1, sizeof(*r));
+
+  table_init(&r->cur, ROLLUP_INIT_SLOTS);
+  pthread_mutex_init(&r->lock, NULL);
+
+  return r;
+}
+
+void rollup_free(struct rollup *r){
+  free(r->cur.slots);
+  free(r->old.slots);
+  pthread_mutex_destroy(&r->lock);
+  free(r);
+}
+
+/* Move up to n slots of the old table, called with the lock held
+ */
+static void migrate(struct rollup *r, uint64_t n){
+  while(n-- && (r->migrate_pos < r->old.size)){
+    struct rollup_entry *e = &r->old.slots[r->migrate_pos++];
+
+    if(!e->hash) continue;
+
+    *table_slot(&r->cur, e) = *e;
+    r->cur.used += 1;
+
+    // the counts move with the entry, rollup_collect() walks both tables.
+    // The old slot keeps its hash, later entries are probed through it
+    e->count = 0;
+    e->bytes = 0;
+  }
+
+  if(r->migrate_pos == r->old.size){
+    free(r->old.slots);
+    memset(&r->old, 0, sizeof(r->old));
+    r->gen += 1;
+  }
+}
+
+/* Add the callsite k, which is in neither table, called with the lock held
+ */
+static struct rollup_entry *insert(struct rollup *r, const struct rollup_entry *k){
+  if((r->cur.used + 1) > (r->cur.size / 4 * 3)){
+    // only if callsites come faster than the move, normally done long before
+    if(r->old.slots) migrate(r, r->old.size);
+
+    r->old = r->cur;
+    r->migrate_pos = 0;
+    table_init(&r->cur, r->old.size * 2);
+
+    r->gen += 1;
+    r->stats.grows += 1;
+  }
+
+  struct rollup_entry *e = table_slot(&r->cur, k);
+
+  memset(e, 0, sizeof(*e));
+  e->prog_hash        = k->prog_hash;
+  e->function_ptr     = k->function_ptr;
+  e->file_line_number = k->file_line_number;
+  memcpy(e->type_lvl, k->type_lvl, sizeof(e->type_lvl));
+  e->hash             = k->hash;
+
+  r->cur.used   += 1;
+  r->stats.keys += 1;
+
+  return e;
+}
+
+/* The entry of callsite k, added if new, by the owning thread
+ */
+static struct rollup_entry *rollup_get(struct rollup *r, const struct rollup_entry *k){
+  struct rollup_entry *e;
+
+  if(r->old.slots){
+    pthread_mutex_lock(&r->lock);
+    migrate(r, ROLLUP_MIGRATE);
+    pthread_mutex_unlock(&r->lock);
+  }
+
+  // only this thread changes the tables, looking without the lock is safe
+  e = table_slot(&r->cur, k);
+  if(e->hash) return e;
+
+  if(r->old.slots){
+    e = table_slot(&r->old, k);
+    if(e->hash) return e;
+  }
+
+  pthread_mutex_lock(&r->lock);
+  e = insert(r, k);
+  pthread_mutex_unlock(&r->lock);
+
+  return e;
+}
+
+void rollup_add(struct rollup *r, const struct Msg_Hdr *lm, uint64_t payload_len){
+  struct rollup_entry k;
+
+  k.prog_hash        = lm->prog_hash;
+  k.function_ptr     = lm->function_ptr;
+  k.file_line_number = lm->file_line_number;
+  memcpy(k.type_lvl, lm->type_lvl, sizeof(k.type_lvl));
+  k.hash             = rollup_hash(&k);
+
+  struct rollup_entry *e = rollup_get(r, &k);
+
+  // rollup_collect() takes the counts from another thread
+  __atomic_fetch_add(&e->count, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&e->bytes, payload_len, __ATOMIC_RELAXED);
+
+  r->stats.records += 1;
+}
+
+void rollup_collect(struct rollup *dst, struct rollup *src){
+  uint64_t pos = 0, gen;
+
+  pthread_mutex_lock(&src->lock);
+  gen = src->gen;
+
+  for(;;){
+    uint64_t total = src->old.size + src->cur.size;
+    uint64_t end = (pos + ROLLUP_COLLECT < total) ? pos + ROLLUP_COLLECT : total;
+
+    for(; pos < end; pos++){
+      struct rollup_entry *e = (pos < src->old.size) ? &src->old.slots[pos] : &src->cur.slots[pos - src->old.size];
+
+      if(!e->hash || !__atomic_load_n(&e->count, __ATOMIC_RELAXED)) continue;
+
+      uint64_t count = __atomic_exchange_n(&e->count, 0, __ATOMIC_RELAXED);
+      uint64_t bytes = __atomic_exchange_n(&e->bytes, 0, __ATOMIC_RELAXED);
+
+      struct rollup_entry *d = rollup_get(dst, e);
+      d->count += count;
+      d->bytes += bytes;
+
+      dst->stats.records += count;
+    }
+
+    pthread_mutex_unlock(&src->lock);
+
+    if(pos >= total) break;
+
+    // let the worker add callsites between chunks
+    pthread_mutex_lock(&src->lock);
+
+    // the tables were swapped or freed, start over, counts taken are 0 now
+    if(src->gen != gen){
+      gen = src->gen;
+      pos = 0;
+    }
+  }
+}
+
+static uint64_t write_table(struct rollup_table *t, struct out_buf *out, uint64_t time_usec, int secs){
+  uint64_t i, lines = 0;
+
+  for(i = 0; i < t->size; i++){
+    struct rollup_entry *e = &t->slots[i];
+
+    if(!e->hash || !e->count) continue;
+
+    size_t mask_len = strnlen(e->type_lvl, sizeof(e->type_lvl));
+    while(mask_len && (e->type_lvl[mask_len - 1] == ' ')) mask_len--;
+
+    out_buf_put_dec(out, time_usec, 0);
+    out_buf_put_lit(out, "\t");
+    out_buf_put_dec(out, secs, 0);
+    out_buf_put_lit(out, "\t");
+    out_buf_put_hex(out, e->prog_hash, 0);
+    out_buf_put_lit(out, "\t");
+    out_buf_put_hex(out, e->function_ptr, 0);
+    out_buf_put_lit(out, "\t");
+    out_buf_put_dec(out, e->file_line_number, 0);
+    out_buf_put_lit(out, "\t");
+    out_buf_put(out, e->type_lvl, mask_len);
+    out_buf_put_lit(out, "\t");
+    out_buf_put_dec(out, e->count, 0);
+    out_buf_put_lit(out, "\t");
+    out_buf_put_dec(out, e->bytes, 0);
+    out_buf_put_lit(out, "\n");
+
+    e->count = 0;
+    e->bytes = 0;
+    lines += 1;
+  }
+
+  return lines;
+}
+
+uint64_t rollup_write(struct rollup *r, struct out_buf *out, uint64_t time_usec, int secs){
+  uint64_t lines = 0;
+
+  if(r->old.slots) lines += write_table(&r->old, out, time_usec, secs);
+  lines += write_table(&r->cur, out, time_usec, secs);
+
+  return lines;
+}
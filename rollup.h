@@ -0,0 +1,101 @@
+
+/*
+ * rollup.h
+ *
+ * Per callsite counters, log_to_file -G, for "how often does X happen and
+ * how is it trending" without keeping every record.
+ *
+ * Records are counted by (eid, fptr, line, mask) as they are received,
+ * before -X collapsing, and every -g seconds the counts of the interval
+ * are appended to the rollup file, one tab separated line per callsite
+ * that had records:
+ *
+ *   time_usec  secs  eid  fptr  line  mask  count  bytes
+ *
+ * time_usec is the start of the interval (wall clock, as the statistics),
+ * eid and fptr are hex, mask has its padding removed and bytes are
+ * payload bytes.  Records count in the interval they are received in.
+ * The file is written as the other outputs are, so it can rotate (-R, -T)
+ * and be compressed (-z).
+ *
+ * Each worker counts into its own table, the main thread collects them
+ * into one table per interval and writes it.  A table is open addressing
+ * with linear probing, entries are never removed (callsites are finite).
+ * It doubles at 3/4 full, without a pause: the new table starts empty
+ * (calloc, pages are zeroed by the kernel as they are touched) and the
+ * entries of the old one are moved ROLLUP_MIGRATE slots at a time on each
+ * record counted, lookups look in both until the move is done.
+ *
+ * The worker finds and counts existing callsites without locking, counts
+ * are atomic.  Adding a callsite or moving entries takes the table's lock,
+ * which rollup_collect() takes a chunk of slots at a time.
+ */
+
+#ifndef _ROLLUP_H_
+#define _ROLLUP_H_
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "log_msg.h"
+#include "out_buf.h"
+
+#define ROLLUP_SECS          10            // default interval
+#define ROLLUP_INIT_SLOTS    (1 << 12)     // a power of 2
+#define ROLLUP_MIGRATE       64            // old slots moved per record while growing
+#define ROLLUP_COLLECT       (1 << 16)     // slots collected per lock
+
+struct rollup_entry {
+  uint64_t hash;            // 0 = free
+  uint64_t prog_hash;
+  uint64_t function_ptr;
+  uint64_t file_line_number;
+  char     type_lvl[8];
+
+  volatile uint64_t count;
+  volatile uint64_t bytes;
+};
+
+struct rollup_table {
+  struct rollup_entry *slots;
+  uint64_t size;            // power of 2
+  uint64_t used;
+};
+
+struct rollup_stats {
+  volatile uint64_t keys;
+  volatile uint64_t grows;
+  volatile uint64_t records;  // counted, or collected into a table collected into
+};
+
+struct rollup {
+  struct rollup_table cur;
+  struct rollup_table old;  // being moved into cur, slots 0 = not growing
+  uint64_t migrate_pos;     // next old slot to move
+  uint64_t gen;             // structure changes, restarts rollup_collect()
+
+  pthread_mutex_t lock;     // structure changes vs rollup_collect()
+
+  struct rollup_stats stats;
+};
+
+struct rollup *rollup_new();
+void rollup_free(struct rollup *r);
+
+/* Count one record of payload_len bytes, by the table's owning thread
+ */
+void rollup_add(struct rollup *r, const struct Msg_Hdr *lm, uint64_t payload_len);
+
+/* Move the counts of src (another thread's table) to dst, src keeps its
+ * callsites with counts of 0
+ */
+void rollup_collect(struct rollup *dst, struct rollup *src);
+
+/* Append the callsites of dst with counts to out, as lines of the interval
+ * that started at time_usec, and reset the counts
+ *
+ * Returns the number of lines.
+ */
+uint64_t rollup_write(struct rollup *r, struct out_buf *out, uint64_t time_usec, int secs);
+
+#endif /* _ROLLUP_H_ */
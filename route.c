@@ -0,0 +1,74 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "route.h"
+
+static int route_node_new(struct route_table *rt){
+  if(rt->count == rt->cap){
+    rt->cap   = rt->cap ? rt->cap * 2 : 16;
+    rt->nodes = realloc(rt->nodes, rt->cap * sizeof(rt->nodes[0]));
+  }
+
+  struct route_node *n = &rt->nodes[rt->count];
+  memset(n, 0, sizeof(*n));
+  n->sink = -1;
+
+  return rt->count++;
+}
+
+struct route_table *route_table_new(){
+  struct route_table *rt = calloc(1, sizeof(*rt));
+
+  route_node_new(rt);
+
+  return rt;
+}
+
+void route_table_free(struct route_table *rt){
+  free(rt->nodes);
+  free(rt);
+}
+
+int route_table_add(struct route_table *rt, const char *prefix, int any_prog, uint64_t prog_hash, int sink){
+  size_t len = strlen(prefix);
+  int node = 0;
+  size_t d;
+
+  if(len > ROUTE_TYPE_LVL_LEN) return -1;
+
+  for(d = 0; d < len; d++){
+    unsigned char c = prefix[d];
+
+    if(!rt->nodes[node].child[c]){
+      if(rt->count > UINT16_MAX) return -1;
+
+      // may move the nodes
+      int next = route_node_new(rt);
+      rt->nodes[node].child[c] = next;
+    }
+
+    node = rt->nodes[node].child[c];
+  }
+
+  struct route_node *n = &rt->nodes[node];
+
+  if(any_prog){
+    if(n->sink >= 0) return -1;
+    n->sink = sink;
+    return 0;
+  }
+
+  int i;
+  for(i = 0; i < n->prog_count; i++){
+    if(n->prog_hash[i] == prog_hash) return -1;
+  }
+
+  if(n->prog_count == ROUTE_PROG_ROUTES) return -1;
+
+  n->prog_hash[n->prog_count] = prog_hash;
+  n->prog_sink[n->prog_count] = sink;
+  n->prog_count += 1;
+
+  return 0;
+}
@@ -0,0 +1,77 @@
+
+/*
+ * route.h
+ *
+ * Routing of records to output sinks by type_lvl prefix and, optionally,
+ * program (eid = prog_hash), e.g. errors to a small file flushed often,
+ * trace to a large rotating store and packets to their own file.
+ *
+ * Routes are compiled into a trie over the 8 byte type_lvl when they are
+ * added, each node has a 256 entry child table, so classifying a record
+ * is at most 8 table loads.  The longest matching prefix wins, and a route
+ * for the record's program wins over a route for any program with the
+ * same prefix.
+ */
+
+#ifndef _ROUTE_H_
+#define _ROUTE_H_
+
+#include <stdint.h>
+
+#define ROUTE_TYPE_LVL_LEN  8
+#define ROUTE_PROG_ROUTES   8   // program specific routes per prefix
+
+struct route_node {
+  uint16_t child[256];      // node index, 0 = none (the root is never a child)
+  int      sink;            // route for any program, -1 = none
+
+  int      prog_count;
+  uint64_t prog_hash[ROUTE_PROG_ROUTES];
+  int      prog_sink[ROUTE_PROG_ROUTES];
+};
+
+struct route_table {
+  struct route_node *nodes;  // [0] = root, the empty prefix
+  int count;
+  int cap;
+};
+
+struct route_table *route_table_new();
+void route_table_free(struct route_table *rt);
+
+/* Route records whose type_lvl starts with prefix ("" = all records) to
+ * sink, for any program or only for prog_hash
+ *
+ * Returns 0, or -1 if the prefix is too long or the route exists.
+ */
+int route_table_add(struct route_table *rt, const char *prefix, int any_prog, uint64_t prog_hash, int sink);
+
+/* The sink for a record, default_sink if no route matches
+ */
+static inline int route_lookup(const struct route_table *rt, const char *type_lvl, uint64_t prog_hash, int default_sink){
+  const struct route_node *n = &rt->nodes[0];
+  int sink = default_sink;
+  int i, d;
+
+  for(d = 0; ; d++){
+    if(n->sink >= 0) sink = n->sink;
+
+    for(i = 0; i < n->prog_count; i++){
+      if(n->prog_hash[i] == prog_hash){
+        sink = n->prog_sink[i];
+        break;
+      }
+    }
+
+    if(d == ROUTE_TYPE_LVL_LEN) break;
+
+    uint16_t next = n->child[(unsigned char)type_lvl[d]];
+    if(!next) break;
+
+    n = &rt->nodes[next];
+  }
+
+  return sink;
+}
+
+#endif /* _ROUTE_H_ */
@@ -0,0 +1,137 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "seg_index.h"
+
+enum {
+  KEY_EID  = 1,
+  KEY_PID  = 2,
+  KEY_MASK = 3
+};
+
+// splitmix64 finalizer, spreads the key over all 64 bits for the bloom filter
+static inline uint64_t mix(uint64_t k){
+  k ^= k >> 30;
+  k *= 0xBF58476D1CE4E5B9ULL;
+  k ^= k >> 27;
+  k *= 0x94D049BB133111EBULL;
+  return k ^ (k >> 31);
+}
+
+uint64_t seg_idx_key_eid(uint64_t prog_hash){
+  return mix(prog_hash ^ KEY_EID);
+}
+
+uint64_t seg_idx_key_pid(uint64_t prog_hash, uint64_t process_id){
+  return mix(mix(prog_hash ^ KEY_PID) ^ process_id);
+}
+
+uint64_t seg_idx_key_mask(const char *mask, int prefix_len){
+  uint64_t m = 0;
+  memcpy(&m, mask, prefix_len);
+  return mix(mix(m) ^ ((uint64_t)prefix_len << 8) ^ KEY_MASK);
+}
+
+/* Mask length without trailing padding, "LE      " is 2
+ */
+static int mask_len(const char type_lvl[8]){
+  int len = 8;
+  while((len > 0) && ((type_lvl[len - 1] == ' ') || (type_lvl[len - 1] == 0))) len--;
+  return len;
+}
+
+void seg_idx_add_msg(uint64_t *bloom, uint64_t prog_hash, uint64_t process_id, const char type_lvl[8]){
+  int i, len;
+
+  seg_idx_bloom_add(bloom, seg_idx_key_eid(prog_hash));
+  seg_idx_bloom_add(bloom, seg_idx_key_pid(prog_hash, process_id));
+
+  if(!type_lvl) return;  // service descriptor
+
+  for(i = 1, len = mask_len(type_lvl); i <= len; i++){
+    seg_idx_bloom_add(bloom, seg_idx_key_mask(type_lvl, i));
+  }
+}
+
+struct seg_index *seg_index_create(const char *seg_file_name){
+  struct seg_idx_hdr hdr = {.version = SEG_IDX_VERSION, .entry_len = sizeof(struct seg_idx_entry)};
+  char idx_file_name[1100];
+
+  snprintf(idx_file_name, sizeof(idx_file_name), "%s.idx", seg_file_name);
+
+  int fd = open(idx_file_name, O_RDWR | O_CREAT | O_TRUNC, 0666);
+  if(fd < 0){
+    fprintf(stderr, "%s: %s, no index will be written\n", idx_file_name, strerror(errno));
+    return 0;
+  }
+
+  memcpy(hdr.magic, SEG_IDX_MAGIC, sizeof(hdr.magic));
+
+  if(write(fd, &hdr, sizeof(hdr)) != sizeof(hdr)){
+    close(fd);
+    return 0;
+  }
+
+  struct seg_index *idx = calloc(1, sizeof(*idx));
+  idx->fd = fd;
+
+  return idx;
+}
+
+void seg_index_append(struct seg_index *idx, const struct seg_idx_entry *entries, int count){
+  const char *p = (const char *)entries;
+  size_t len = count * sizeof(*entries);
+
+  while(len > 0){
+    ssize_t rc = write(idx->fd, p, len);
+
+    if(rc < 0){
+      if(errno == EINTR) continue;
+      fprintf(stderr, "%s write failed, %i index entries lost, errno: %s\n", __func__, count, strerror(errno));
+      break;
+    }
+
+    p   += rc;
+    len -= rc;
+  }
+}
+
+void seg_index_close(struct seg_index *idx){
+  close(idx->fd);
+  free(idx);
+}
+
+int seg_idx_entry_may_match(const struct seg_idx_entry *e, const struct seg_query *q){
+  if(e->max_usec < q->from_usec) return 0;
+  if(q->to_usec && (e->min_usec > q->to_usec)) return 0;
+
+  if(q->prog_hash){
+    uint64_t key = q->process_id ? seg_idx_key_pid(q->prog_hash, q->process_id)
+                                 : seg_idx_key_eid(q->prog_hash);
+    if(!seg_idx_bloom_test(e->bloom, key)) return 0;
+  }
+
+  if(q->mask_len && !seg_idx_bloom_test(e->bloom, seg_idx_key_mask(q->mask, q->mask_len))) return 0;
+
+  return 1;
+}
+
+int seg_query_match(const struct seg_query *q, uint64_t usec, uint64_t prog_hash, uint64_t process_id, const char type_lvl[8]){
+  if(usec < q->from_usec) return 0;
+  if(q->to_usec && (usec > q->to_usec)) return 0;
+
+  if(q->prog_hash && (prog_hash != q->prog_hash)) return 0;
+  if(q->prog_hash && q->process_id && (process_id != q->process_id)) return 0;
+
+  if(q->mask_len){
+    if(!type_lvl) return 0;  // service descriptors have no mask
+    if(memcmp(type_lvl, q->mask, q->mask_len) != 0) return 0;
+  }
+
+  return 1;
+}
@@ -0,0 +1,106 @@
+
+/*
+ * seg_index.h
+ *
+ * Sparse index written alongside a segment file (segment.h), <file>.idx
+ *
+ * One entry per block, a block is the run of records between two sync
+ * markers (at most ~SEG_SYNC_INTERVAL bytes).  An entry holds the block's
+ * file offset, length and usec range plus a small bloom filter over the
+ * publishers (prog_hash, prog_hash + process_id) and mask prefixes of the
+ * records in the block.
+ *
+ * Entries are appended in file order as segments are written, a query reads
+ * the entries and only touches the blocks that may match.
+ */
+
+#ifndef _SEG_INDEX_H_
+#define _SEG_INDEX_H_
+
+#include <stdint.h>
+
+#define SEG_IDX_MAGIC   "SLTIDX01"
+#define SEG_IDX_VERSION 1
+
+#define SEG_IDX_BLOOM_WORDS 4   // 256 bit bloom filter per block
+
+struct seg_idx_hdr {
+  char     magic[8];        // SEG_IDX_MAGIC
+  uint32_t version;
+  uint32_t entry_len;       // sizeof(struct seg_idx_entry)
+};
+
+struct seg_idx_entry {
+  uint64_t offset;          // of the block's first record in the segment file
+  uint32_t len;             // block bytes
+  uint32_t rec_count;       // message and service records
+  uint64_t min_usec;
+  uint64_t max_usec;
+  uint64_t bloom[SEG_IDX_BLOOM_WORDS];
+};
+
+/* Index keys, a record adds its publisher, its process and each
+ * prefix of its mask (trailing spaces ignored)
+ */
+uint64_t seg_idx_key_eid(uint64_t prog_hash);
+uint64_t seg_idx_key_pid(uint64_t prog_hash, uint64_t process_id);
+uint64_t seg_idx_key_mask(const char *mask, int prefix_len);
+
+static inline void seg_idx_bloom_add(uint64_t *bloom, uint64_t key){
+  int i;
+  for(i = 0; i < 3; i++, key >>= 8){
+    bloom[(key >> 6) & (SEG_IDX_BLOOM_WORDS - 1)] |= (1ULL << (key & 63));
+  }
+}
+
+static inline int seg_idx_bloom_test(const uint64_t *bloom, uint64_t key){
+  int i;
+  for(i = 0; i < 3; i++, key >>= 8){
+    if(!(bloom[(key >> 6) & (SEG_IDX_BLOOM_WORDS - 1)] & (1ULL << (key & 63)))) return 0;
+  }
+  return 1;
+}
+
+/* Add a message's keys to a block's bloom filter
+ */
+void seg_idx_add_msg(uint64_t *bloom, uint64_t prog_hash, uint64_t process_id, const char type_lvl[8]);
+
+/* Index file being written by log_to_file, shared by all writers
+ *
+ * Appends happen with the segment file lock held so entries are in the
+ * same order as the blocks they describe.
+ */
+struct seg_index {
+  int fd;
+};
+
+/* Create <file_name>.idx and write its header, returns 0 if it couldn't be created
+ */
+struct seg_index *seg_index_create(const char *seg_file_name);
+
+void seg_index_append(struct seg_index *idx, const struct seg_idx_entry *entries, int count);
+
+void seg_index_close(struct seg_index *idx);
+
+/* Query
+ *
+ * Fields left 0 match everything.
+ */
+struct seg_query {
+  uint64_t from_usec;
+  uint64_t to_usec;         // 0 = no upper bound
+  uint64_t prog_hash;
+  uint64_t process_id;      // only used with prog_hash
+  char     mask[8];         // mask prefix
+  int      mask_len;
+};
+
+/* Could the block hold records matching the query
+ */
+int seg_idx_entry_may_match(const struct seg_idx_entry *e, const struct seg_query *q);
+
+/* Does a record match the query
+ */
+int seg_query_match(const struct seg_query *q, uint64_t usec, uint64_t prog_hash, uint64_t process_id, const char type_lvl[8]);
+
+#endif /* _SEG_INDEX_H_ */
@@ -0,0 +1,275 @@
+/* Query a segment file written by "log_to_file -b" by time, publisher and mask
+ *
+ * The sparse index (<file>.idx) is used to read only the blocks that may
+ * hold matching records, matches are written in the log_to_file JSON format.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>    /* for getopt */
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+
+#include "segment.h"
+#include "seg_index.h"
+#include "json_out.h"
+#include "out_buf.h"
+#include "zfile.h"
+
+struct mapped_file {
+  void    *base;
+  uint64_t size;
+};
+
+static int map_file(const char *file_name, struct mapped_file *mf){
+  struct stat st;
+
+  mf->base = 0;
+  mf->size = 0;
+
+  int fd = open(file_name, O_RDONLY);
+  if(fd < 0) return -1;
+
+  if((fstat(fd, &st) < 0) || (st.st_size == 0)){
+    close(fd);
+    return -1;
+  }
+
+  mf->base = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if(mf->base == MAP_FAILED){
+    mf->base = 0;
+    return -1;
+  }
+
+  mf->size = st.st_size;
+  return 0;
+}
+
+static void unmap_file(struct mapped_file *mf){
+  if(mf->base) munmap(mf->base, mf->size);
+}
+
+struct query_stats {
+  uint64_t blocks;
+  uint64_t blocks_read;
+  uint64_t bytes_read;
+  uint64_t matches;
+};
+
+/* Write the matching records from the reader's range
+ */
+static void query_records(struct seg_reader *r, const struct seg_query *q, struct out_buf *out, int json_lines,
+                          struct query_stats *stats){
+  struct seg_rec rec;
+
+  while(seg_next(r, &rec)){
+    if(rec.type == SEG_REC_MSG){
+      struct Msg_Hdr lm;
+      const void *payload;
+      uint64_t payload_len;
+
+      seg_msg_decode(&rec, &lm, &payload, &payload_len);
+
+      if(!seg_query_match(q, lm.usec, lm.prog_hash, lm.process_id, lm.type_lvl)) continue;
+
+      if(json_lines){
+        write_log_msg_jsonl(out, &lm, payload, payload_len, 0);
+      } else {
+        write_log_msg_json(out, &lm, payload, payload_len, 0);
+      }
+      stats->matches += 1;
+
+    } else if(rec.type == SEG_REC_SVC){
+      const struct seg_svc *svc = rec.body;
+
+      if(!seg_query_match(q, svc->timestamp_usec, svc->prog_hash, svc->process_id, 0)) continue;
+
+      if(json_lines){
+        write_svc_desc_jsonl(out, svc->timestamp_usec, svc->prog_hash, svc->process_id,
+                             &svc->addr, (const char *)(svc + 1), rec.len - sizeof(*svc));
+      } else {
+        write_svc_desc_json(out, svc->timestamp_usec, svc->prog_hash, svc->process_id,
+                            &svc->addr, (const char *)(svc + 1), rec.len - sizeof(*svc));
+      }
+      stats->matches += 1;
+    }
+  }
+}
+
+/* Use the index, returns -1 if it's missing or not usable
+ */
+static int query_indexed(struct seg_reader *r, const struct mapped_file *idx, struct zfile_reader *zr,
+                         const struct seg_query *q, struct out_buf *out, int json_lines,
+                         struct query_stats *stats){
+  const struct seg_idx_hdr *hdr = idx->base;
+
+  if(!idx->base || (idx->size < sizeof(*hdr))) return -1;
+  if(memcmp(hdr->magic, SEG_IDX_MAGIC, sizeof(hdr->magic)) != 0) return -1;
+  if((hdr->version != SEG_IDX_VERSION) || (hdr->entry_len != sizeof(struct seg_idx_entry))) return -1;
+
+  const struct seg_idx_entry *e   = (const void *)(hdr + 1);
+  const struct seg_idx_entry *end = e + ((idx->size - sizeof(*hdr)) / sizeof(*e));
+
+  madvise((void *)r->base, r->size, MADV_RANDOM);
+
+  for(; e < end; e++){
+    stats->blocks += 1;
+
+    if(!seg_idx_entry_may_match(e, q)) continue;
+
+    stats->blocks_read += 1;
+    stats->bytes_read  += e->len;
+
+    // only the compressed blocks holding the index block are decompressed
+    if(zr) zfile_load(zr, e->offset, e->len);
+
+    seg_reader_range(r, e->offset, e->len);
+    query_records(r, q, out, json_lines, stats);
+  }
+
+  return 0;
+}
+
+int main(int argc, char *argv[])
+{
+  int opt;
+  int verbose   = 0;
+  int use_index = 1;
+  int json_lines = 0;
+  int out_fd    = STDOUT_FILENO;
+
+  struct seg_query q = {0};
+  struct query_stats stats = {0};
+
+  while ((opt = getopt(argc, argv, "hvlxf:t:e:p:m:o:")) != -1) {
+    switch (opt) {
+
+      case 'v':
+        verbose = 1;
+        break;
+
+      case 'l':
+        json_lines = 1;
+        break;
+
+      case 'x':
+        use_index = 0;
+        break;
+
+      case 'f':
+        q.from_usec = strtoull(optarg, 0, 0);
+        break;
+
+      case 't':
+        q.to_usec = strtoull(optarg, 0, 0);
+        break;
+
+      case 'e':
+        q.prog_hash = strtoull(optarg, 0, 16);
+        break;
+
+      case 'p':
+        q.process_id = strtoull(optarg, 0, 0);
+        break;
+
+      case 'm':
+        q.mask_len = strnlen(optarg, sizeof(q.mask));
+        memcpy(q.mask, optarg, q.mask_len);
+        break;
+
+      case 'o':
+        out_fd = open(optarg, O_RDWR | O_CREAT | O_TRUNC, 0666);
+        if(out_fd < 0){
+          fprintf(stderr, "%s: %s\n", optarg, strerror(errno));
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      case 'h':
+      default: /* '?' */
+        fprintf(stderr, "Usage: %s [-h][-v][-l][-x][-f <usec>][-t <usec>][-e <eid>][-p <pid>][-m <mask>][-o <file>] <segment file>\n"
+                "-h     help\n"
+                "-v     verbose, report blocks read\n"
+                "-l     output JSON Lines, one valid JSON object per line\n"
+                "-x     don't use the index, scan the whole file\n"
+                "-f     records from <usec>\n"
+                "-t     records up to <usec>\n"
+                "-e     records from publisher <eid> (hex, as in the json output)\n"
+                "-p     records from process <pid> (with -e)\n"
+                "-m     records whose mask starts with <mask>, e.g. -m L or -m TF\n"
+                "-o     output json to <file> (default stdout)\n",
+                argv[0]);
+        exit(EXIT_FAILURE);
+    }
+  }
+
+  if(optind >= argc){
+    fprintf(stderr, "%s: no segment file given, -h for help\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  const char *seg_file_name = argv[optind];
+  char idx_file_name[1100];
+  snprintf(idx_file_name, sizeof(idx_file_name), "%s.idx", seg_file_name);
+
+  struct mapped_file seg, idx;
+  struct seg_reader reader;
+  struct zfile_reader zr;
+  int compressed = 0;
+
+  if(map_file(seg_file_name, &seg) < 0){
+    fprintf(stderr, "%s: not a readable log_to_file segment file\n", seg_file_name);
+    exit(EXIT_FAILURE);
+  }
+
+  // Compressed files (log_to_file -z), the index refers to the uncompressed stream
+  const char *segs = seg.base;
+  uint64_t segs_size = seg.size;
+
+  if(zfile_reader_init(&zr, seg.base, seg.size) == 0){
+    compressed = 1;
+    segs = zfile_load(&zr, 0, sizeof(struct seg_file_hdr));
+    segs_size = zr.raw_size;
+  }
+
+  if(seg_reader_init(&reader, segs, segs_size) < 0){
+    fprintf(stderr, "%s: not a readable log_to_file segment file\n", seg_file_name);
+    exit(EXIT_FAILURE);
+  }
+
+  if(use_index) map_file(idx_file_name, &idx);
+
+  struct out_buf out;
+  out_buf_init(&out, out_fd, NULL, OUT_BUF_SIZE);
+
+  if(!use_index || (query_indexed(&reader, &idx, compressed ? &zr : 0, &q, &out, json_lines, &stats) < 0)){
+    if(use_index) fprintf(stderr, "%s: missing or unusable, scanning the whole file\n", idx_file_name);
+
+    madvise(seg.base, seg.size, MADV_SEQUENTIAL);
+    if(compressed) zfile_load(&zr, 0, zr.raw_size);
+    stats.bytes_read = segs_size;
+    query_records(&reader, &q, &out, json_lines, &stats);
+  }
+
+  out_buf_free(&out);
+
+  if(verbose){
+    fprintf(stderr, "%lu matches, read %lu of %lu indexed blocks, %lu of %lu bytes\n",
+            stats.matches, stats.blocks_read, stats.blocks, stats.bytes_read, segs_size);
+    if(compressed) fprintf(stderr, "decompressed %lu of %lu blocks\n", zr.loads, zr.count);
+  }
+
+  if(compressed) zfile_reader_free(&zr);
+
+  if(use_index) unmap_file(&idx);
+  unmap_file(&seg);
+
+  return EXIT_SUCCESS;
+}
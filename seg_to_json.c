@@ -0,0 +1,211 @@
+/* Render binary segment files written by "log_to_file -b" in the log_to_file JSON format
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>    /* for getopt */
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+
+#include "segment.h"
+#include "json_out.h"
+#include "out_buf.h"
+#include "symbolizer.h"
+#include "zfile.h"
+
+struct convert_stats {
+  uint64_t msgs;
+  uint64_t svcs;
+  uint64_t segments;
+};
+
+/* Convert one segment file, returns 0 on success
+ */
+int convert_file(const char *file_name, struct out_buf *out, int json_lines,
+                 struct symbolizer *symbols, struct sym_cache *syms, struct convert_stats *stats, int verbose){
+  struct seg_reader reader;
+  struct seg_rec rec;
+  struct stat st;
+
+  int fd = open(file_name, O_RDONLY);
+  if(fd < 0){
+    fprintf(stderr, "%s: %s\n", file_name, strerror(errno));
+    return -1;
+  }
+
+  if((fstat(fd, &st) < 0) || (st.st_size == 0)){
+    fprintf(stderr, "%s: empty or unreadable\n", file_name);
+    close(fd);
+    return -1;
+  }
+
+  void *base = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if(base == MAP_FAILED){
+    fprintf(stderr, "%s: mmap failed, %s\n", file_name, strerror(errno));
+    return -1;
+  }
+
+  madvise(base, st.st_size, MADV_SEQUENTIAL);
+
+  // Compressed files (log_to_file -z) are decompressed in memory
+  struct zfile_reader zr;
+  const char *segs = base;
+  uint64_t segs_size = st.st_size;
+  int compressed = (zfile_reader_init(&zr, base, st.st_size) == 0);
+
+  if(compressed){
+    segs = zfile_load(&zr, 0, zr.raw_size);
+    segs_size = zr.raw_size;
+  }
+
+  if(seg_reader_init(&reader, segs, segs_size) < 0){
+    fprintf(stderr, "%s: not a log_to_file segment file\n", file_name);
+    if(compressed) zfile_reader_free(&zr);
+    munmap(base, st.st_size);
+    return -1;
+  }
+
+  while(seg_next(&reader, &rec)){
+    switch(rec.type){
+
+      case SEG_REC_MSG: {
+        struct Msg_Hdr lm;
+        const void *payload;
+        uint64_t payload_len;
+
+        seg_msg_decode(&rec, &lm, &payload, &payload_len);
+
+        const struct sym_info *sym = syms ? sym_cache_lookup(syms, lm.prog_hash, lm.function_ptr) : 0;
+
+        if(json_lines){
+          write_log_msg_jsonl(out, &lm, payload, payload_len, sym);
+        } else {
+          write_log_msg_json(out, &lm, payload, payload_len, sym);
+        }
+        stats->msgs += 1;
+        break;
+      }
+
+      case SEG_REC_SVC: {
+        const struct seg_svc *svc = rec.body;
+
+        if(symbols){
+          symbolizer_add_program(symbols, svc->prog_hash, (const char *)(svc + 1), rec.len - sizeof(*svc));
+        }
+
+        if(json_lines){
+          write_svc_desc_jsonl(out, svc->timestamp_usec, svc->prog_hash, svc->process_id,
+                               &svc->addr, (const char *)(svc + 1), rec.len - sizeof(*svc));
+        } else {
+          write_svc_desc_json(out, svc->timestamp_usec, svc->prog_hash, svc->process_id,
+                              &svc->addr, (const char *)(svc + 1), rec.len - sizeof(*svc));
+        }
+        stats->svcs += 1;
+        break;
+      }
+
+      case SEG_REC_FOOTER:
+        stats->segments += 1;
+        break;
+
+      default:
+        break;
+    }
+  }
+
+  if(reader.resyncs || reader.bad_segments || verbose){
+    fprintf(stderr, "%s: %lu damaged regions skipped, %lu segments failed checksum\n",
+            file_name, reader.resyncs, reader.bad_segments);
+  }
+
+  if(compressed){
+    if(zr.bad_blocks) fprintf(stderr, "%s: %lu damaged compressed blocks skipped\n", file_name, zr.bad_blocks);
+    zfile_reader_free(&zr);
+  }
+
+  munmap(base, st.st_size);
+
+  return 0;
+}
+
+int main(int argc, char *argv[])
+{
+  int opt, i;
+  int verbose = 0;
+  int json_lines = 0;
+  int out_fd  = STDOUT_FILENO;
+  int errors  = 0;
+
+  struct convert_stats stats = {0};
+  struct symbolizer *symbols = 0;
+  struct sym_cache *syms = 0;
+
+  while ((opt = getopt(argc, argv, "hvlo:y:")) != -1) {
+    switch (opt) {
+
+      case 'v':
+        verbose = 1;
+        break;
+
+      case 'l':
+        json_lines = 1;
+        break;
+
+      case 'o':
+        out_fd = open(optarg, O_RDWR | O_CREAT | O_TRUNC, 0666);
+        if(out_fd < 0){
+          fprintf(stderr, "%s: %s\n", optarg, strerror(errno));
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      case 'y':
+        if(!symbols) symbols = symbolizer_new(optarg);
+        break;
+
+      case 'h':
+      default: /* '?' */
+        fprintf(stderr, "Usage: %s [-h][-v][-l][-o <file>][-y <dirs>] <segment file> ...\n"
+                "-h     help\n"
+                "-v     verbose \n"
+                "-l     output JSON Lines, one valid JSON object per line\n"
+                "-o     output json to <file> (default stdout)\n"
+                "-y     add func and src (file:line) of fptr, executables are found in <dirs>, : separated\n",
+                argv[0]);
+        exit(EXIT_FAILURE);
+    }
+  }
+
+  if(optind >= argc){
+    fprintf(stderr, "%s: no segment file given, -h for help\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  struct out_buf out;
+  out_buf_init(&out, out_fd, NULL, OUT_BUF_SIZE);
+
+  if(symbols) syms = sym_cache_new(symbols);
+
+  for(i = optind; i < argc; i++){
+    if(convert_file(argv[i], &out, json_lines, symbols, syms, &stats, verbose) < 0) errors += 1;
+  }
+
+  out_buf_free(&out);
+
+  if(syms) sym_cache_free(syms);
+  if(symbols) symbolizer_free(symbols);
+
+  if(verbose){
+    fprintf(stderr, "%lu messages, %lu service descriptors, %lu segments\n",
+            stats.msgs, stats.svcs, stats.segments);
+  }
+
+  return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,351 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "segment.h"
+#include "log_wire.h"
+
+#define SEG_SYNC_REC_LEN   SEG_REC_LEN(sizeof(struct seg_sync))
+#define SEG_FOOTER_REC_LEN SEG_REC_LEN(sizeof(struct seg_footer))
+
+void seg_writer_init(struct seg_writer *sw, struct out_buf *out, uint32_t id){
+  memset(sw, 0, sizeof(*sw));
+  sw->out = out;
+  sw->id  = id;
+  sw->indexed = (out->file != 0);
+}
+
+void seg_file_hdr_init(struct seg_file_hdr *fh, uint64_t create_usec){
+  memset(fh, 0, sizeof(*fh));
+  memcpy(fh->magic, SEG_FILE_MAGIC, sizeof(fh->magic));
+
+  fh->version       = SEG_VERSION;
+  fh->hdr_len       = sizeof(struct seg_file_hdr);
+  fh->create_usec   = create_usec;
+  fh->sync_interval = SEG_SYNC_INTERVAL;
+}
+
+/* Append one record, the caller has made room for it
+ */
+static void put_rec(struct out_buf *out, uint16_t type, uint16_t flags,
+                    const void *body, uint64_t body_len,
+                    const void *body2, uint64_t body2_len){
+  uint64_t len = body_len + body2_len;
+  struct seg_rec_hdr rh = {.len = len, .type = type, .flags = flags};
+
+  char *p = out->buf + out->len;
+
+  memcpy(p, &rh, sizeof(rh));
+  p += sizeof(rh);
+  memcpy(p, body, body_len);
+  if(body2_len) memcpy(p + body_len, body2, body2_len);
+  memset(p + len, 0, SEG_ALIGN(len) - len);
+
+  out->len += SEG_REC_LEN(len);
+}
+
+/* Each sync marker starts a new index block
+ */
+static void start_block(struct seg_writer *sw){
+  if(sw->blocks_count == sw->blocks_cap){
+    sw->blocks_cap = sw->blocks_cap ? (sw->blocks_cap * 2) : 32;
+    sw->blocks = realloc(sw->blocks, sw->blocks_cap * sizeof(sw->blocks[0]));
+  }
+
+  struct seg_idx_entry *b = &sw->blocks[sw->blocks_count++];
+
+  memset(b, 0, sizeof(*b));
+  b->offset   = sw->out->len;
+  b->min_usec = UINT64_MAX;
+}
+
+static void put_sync(struct seg_writer *sw){
+  struct seg_sync sync = {.magic = SEG_SYNC_MAGIC, .rec_index = sw->rec_index};
+
+  if(sw->indexed) start_block(sw);
+
+  sw->last_sync = sw->out->len;
+  put_rec(sw->out, SEG_REC_SYNC, 0, &sync, sizeof(sync), 0, 0);
+  sw->rec_index += 1;
+}
+
+/* Make room for a record of rec_len bytes in the open segment
+ *
+ * A segment never spans buffers, when the record doesn't fit the segment is
+ * closed and written and the record starts the next one.
+ */
+static void seg_reserve(struct seg_writer *sw, uint64_t rec_len){
+  struct out_buf *out = sw->out;
+  uint64_t needed = rec_len + (2 * SEG_SYNC_REC_LEN) + SEG_FOOTER_REC_LEN;
+
+  if(sw->open && ((out->len + needed) > out->cap)) seg_flush(sw);
+
+  if(!sw->open){
+    // only whole segments are buffered, safe to flush (or grow for a huge record)
+    out_buf_reserve(out, needed);
+
+    sw->open       = 1;
+    sw->seg_start  = out->len;
+    sw->rec_index  = 0;
+    sw->rec_count  = 0;
+    sw->first_usec = 0;
+    sw->min_usec   = UINT64_MAX;
+    sw->max_usec   = 0;
+    sw->blocks_count = 0;
+
+    put_sync(sw);
+  } else if((out->len - sw->last_sync) >= SEG_SYNC_INTERVAL){
+    put_sync(sw);
+  }
+}
+
+static void seg_account(struct seg_writer *sw, uint64_t usec,
+                        uint64_t prog_hash, uint64_t process_id, const char *type_lvl){
+  if(sw->rec_count == 0) sw->first_usec = usec;
+  if(usec < sw->min_usec) sw->min_usec = usec;
+  if(usec > sw->max_usec) sw->max_usec = usec;
+
+  sw->rec_count += 1;
+  sw->rec_index += 1;
+
+  if(sw->indexed){
+    struct seg_idx_entry *b = &sw->blocks[sw->blocks_count - 1];
+
+    if(usec < b->min_usec) b->min_usec = usec;
+    if(usec > b->max_usec) b->max_usec = usec;
+    b->rec_count += 1;
+
+    seg_idx_add_msg(b->bloom, prog_hash, process_id, type_lvl);
+  }
+}
+
+void seg_put_msg(struct seg_writer *sw, const struct Msg_Hdr *lm, const void *payload, uint64_t payload_len){
+  struct log_wire_hdr wh;
+
+  memcpy(wh.type_lvl, lm->type_lvl, sizeof(wh.type_lvl));
+  wh.prog_hash        = lm->prog_hash;
+  wh.process_id       = lm->process_id;
+  wh.function_ptr     = lm->function_ptr;
+  wh.file_line_number = lm->file_line_number;
+  wh.usec             = lm->usec;
+
+  seg_reserve(sw, SEG_REC_LEN(sizeof(wh) + payload_len));
+  put_rec(sw->out, SEG_REC_MSG, 0, &wh, sizeof(wh), payload, payload_len);
+  seg_account(sw, lm->usec, lm->prog_hash, lm->process_id, lm->type_lvl);
+}
+
+void seg_put_svc(struct seg_writer *sw, const struct seg_svc *svc, const char *program_name, uint64_t name_len,
+                 uint16_t flags){
+  seg_reserve(sw, SEG_REC_LEN(sizeof(*svc) + name_len));
+  put_rec(sw->out, SEG_REC_SVC, flags, svc, sizeof(*svc), program_name, name_len);
+  seg_account(sw, svc->timestamp_usec, svc->prog_hash, svc->process_id, 0);
+}
+
+/* Index entries of the closed segment, the trailing block without records
+ * is dropped
+ */
+static int finish_blocks(struct seg_writer *sw){
+  struct out_buf *out = sw->out;
+  int i, count = 0;
+
+  for(i = 0; i < sw->blocks_count; i++){
+    struct seg_idx_entry *b = &sw->blocks[i];
+    uint64_t end = (i + 1 < sw->blocks_count) ? sw->blocks[i + 1].offset : out->len;
+
+    if(b->rec_count == 0) continue;  // sync marker just before the footer
+
+    b->len = end - b->offset;
+    sw->blocks[count++] = *b;
+  }
+
+  sw->blocks_count = 0;
+
+  return count;
+}
+
+/* Write the segment and its index entries, the file adds the segment's
+ * offset to the entries
+ */
+static void write_indexed(struct seg_writer *sw){
+  struct out_buf *out = sw->out;
+  int count = finish_blocks(sw);
+
+  out_file_write(out->file, out->buf, out->len, sw->blocks, count);
+  out->len = 0;
+}
+
+static void put_footer(struct seg_writer *sw){
+  struct out_buf *out = sw->out;
+  struct seg_footer footer = {
+    .magic      = SEG_SYNC_MAGIC,
+    .writer     = sw->id,
+    .rec_count  = sw->rec_count,
+    .first_usec = sw->first_usec,
+    .min_usec   = sw->min_usec,
+    .max_usec   = sw->max_usec,
+    .seg_len    = out->len - sw->seg_start
+  };
+
+  footer.checksum = seg_checksum(out->buf + sw->seg_start, footer.seg_len);
+
+  put_rec(out, SEG_REC_FOOTER, 0, &footer, sizeof(footer), 0, 0);
+  sw->open = 0;
+}
+
+void seg_flush(struct seg_writer *sw){
+  struct out_buf *out = sw->out;
+
+  if(sw->open){
+    put_footer(sw);
+
+    if(out->file){
+      write_indexed(sw);
+      return;
+    }
+  }
+
+  out_buf_flush(out);
+}
+
+int seg_close(struct seg_writer *sw, struct seg_idx_entry **entries){
+  if(!sw->open) return 0;
+
+  put_footer(sw);
+
+  *entries = sw->blocks;
+  return finish_blocks(sw);
+}
+
+/* Word at a time FNV style hash, segments are always a multiple of 8 bytes
+ */
+uint64_t seg_checksum(const void *buf, uint64_t len){
+  const char *p = buf;
+  uint64_t h = 0xcbf29ce484222325ULL;
+  uint64_t i, w;
+
+  for(i = 0; (i + 8) <= len; i += 8){
+    memcpy(&w, p + i, sizeof(w));
+    h = (h ^ w) * 0x100000001b3ULL;
+    h ^= h >> 29;
+  }
+
+  return h;
+}
+
+int seg_reader_init(struct seg_reader *r, const void *base, uint64_t size){
+  const struct seg_file_hdr *fh = base;
+
+  memset(r, 0, sizeof(*r));
+  r->base = base;
+  r->size = size;
+
+  if(size < sizeof(*fh)) return -1;
+  if(memcmp(fh->magic, SEG_FILE_MAGIC, sizeof(fh->magic)) != 0) return -1;
+  if((fh->version != SEG_VERSION) || (fh->hdr_len < sizeof(*fh)) || (fh->hdr_len > size)) return -1;
+
+  r->pos = SEG_ALIGN(fh->hdr_len);
+  r->end = size;
+
+  return 0;
+}
+
+void seg_reader_range(struct seg_reader *r, uint64_t offset, uint64_t len){
+  r->pos       = offset;
+  r->end       = ((offset + len) < r->size) ? (offset + len) : r->size;
+  r->seg_start = 0;
+}
+
+static int is_sync_rec(const struct seg_rec_hdr *rh){
+  const struct seg_sync *sync = (const void *)(rh + 1);
+  return (rh->type == SEG_REC_SYNC) && (rh->len == sizeof(*sync)) && (sync->magic == SEG_SYNC_MAGIC);
+}
+
+/* Is there a well formed record at pos
+ */
+static int is_valid_rec(const struct seg_reader *r, uint64_t pos){
+  if((pos + sizeof(struct seg_rec_hdr)) > r->end) return 0;
+
+  const struct seg_rec_hdr *rh = (const void *)(r->base + pos);
+
+  if((pos + SEG_REC_LEN(rh->len)) > r->end) return 0;
+
+  switch(rh->type){
+    case SEG_REC_MSG:    return rh->len >= sizeof(struct log_wire_hdr);
+    case SEG_REC_SVC:    return rh->len >= sizeof(struct seg_svc);
+    case SEG_REC_SYNC:   return is_sync_rec(rh);
+    case SEG_REC_FOOTER: return (rh->len == sizeof(struct seg_footer)) &&
+                                (((const struct seg_footer *)(rh + 1))->magic == SEG_SYNC_MAGIC);
+    default:             return 0;
+  }
+}
+
+/* Damaged or truncated data at r->pos, skip to the next SYNC record
+ */
+static int seg_resync(struct seg_reader *r){
+  uint64_t pos;
+
+  for(pos = r->pos + 8; (pos + SEG_SYNC_REC_LEN) <= r->end; pos += 8){
+    const struct seg_rec_hdr *rh = (const void *)(r->base + pos);
+
+    if(is_sync_rec(rh)){
+      r->pos       = pos;
+      r->seg_start = 0;  // can't check the footer of a damaged segment
+      r->resyncs  += 1;
+      return 1;
+    }
+  }
+
+  r->pos = r->end;
+  return 0;
+}
+
+int seg_next(struct seg_reader *r, struct seg_rec *rec){
+
+  if((r->pos + sizeof(struct seg_rec_hdr)) > r->end) return 0;
+
+  if(!is_valid_rec(r, r->pos) && !seg_resync(r)) return 0;
+
+  const struct seg_rec_hdr *rh = (const void *)(r->base + r->pos);
+
+  rec->type   = rh->type;
+  rec->flags  = rh->flags;
+  rec->len    = rh->len;
+  rec->body   = rh + 1;
+  rec->offset = r->pos;
+
+  if(rh->type == SEG_REC_SYNC){
+    const struct seg_sync *sync = rec->body;
+    if(sync->rec_index == 0) r->seg_start = (const char *)rh;
+
+  } else if(rh->type == SEG_REC_FOOTER){
+    const struct seg_footer *footer = rec->body;
+
+    if(r->seg_start){
+      uint64_t seg_len = (const char *)rh - r->seg_start;
+
+      if((seg_len != footer->seg_len) || (seg_checksum(r->seg_start, seg_len) != footer->checksum)){
+        r->bad_segments += 1;
+      }
+    }
+
+    r->seg_start = 0;
+  }
+
+  r->pos += SEG_REC_LEN(rh->len);
+
+  return 1;
+}
+
+void seg_msg_decode(const struct seg_rec *rec, struct Msg_Hdr *lm, const void **payload, uint64_t *payload_len){
+  const struct log_wire_hdr *wh = rec->body;
+
+  memcpy(lm->type_lvl, wh->type_lvl, sizeof(lm->type_lvl));
+  lm->prog_hash        = wh->prog_hash;
+  lm->process_id       = wh->process_id;
+  lm->function_ptr     = wh->function_ptr;
+  lm->file_line_number = wh->file_line_number;
+  lm->usec             = wh->usec;
+
+  *payload     = wh + 1;
+  *payload_len = rec->len - sizeof(*wh);
+}
@@ -0,0 +1,192 @@
+
+/*
+ * segment.h
+ *
+ * Binary on-disk format for log_to_file, an alternative to JSON output.
+ *
+ * A file is a file header followed by append-only segments:
+ *
+ *   seg_file_hdr
+ *   segment: SYNC, record, record, ..., SYNC, record, ..., FOOTER
+ *   segment: SYNC, record, ..., FOOTER
+ *   ...
+ *
+ * Every record is a seg_rec_hdr followed by len bytes of body, padded with
+ * zeros to a multiple of 8 bytes so bodies are aligned when the file is
+ * mapped.  A message record body is the raw wire header (log_wire.h)
+ * followed by the payload, so writing a message is a memcpy.
+ *
+ * A segment is what one writer buffers between writes to the file, segments
+ * from different writers are never interleaved.  SYNC records start every
+ * segment and are repeated every SEG_SYNC_INTERVAL bytes so a reader can
+ * find the next record boundary after a damaged or truncated region.  The
+ * FOOTER summarizes the segment and carries a checksum of its bytes.
+ *
+ * Fields are in host byte order (as on the wire).
+ */
+
+#ifndef _SEGMENT_H_
+#define _SEGMENT_H_
+
+#include <stdint.h>
+#include <netinet/in.h>
+
+#include "log_msg.h"
+#include "out_buf.h"
+#include "seg_index.h"
+#include "out_file.h"
+
+#define SEG_FILE_MAGIC    "SLTSEG01"
+#define SEG_VERSION       1
+
+#define SEG_SYNC_MAGIC    0x434E59532D544C53ULL  // "SLT-SYNC"
+#define SEG_SYNC_INTERVAL (64 * 1024)
+
+enum seg_rec_type {
+  SEG_REC_MSG    = 1,  // log_wire_hdr + payload
+  SEG_REC_SVC    = 2,  // seg_svc + program name
+  SEG_REC_SYNC   = 3,  // seg_sync
+  SEG_REC_FOOTER = 4   // seg_footer
+};
+
+struct seg_file_hdr {
+  char     magic[8];        // SEG_FILE_MAGIC
+  uint32_t version;
+  uint32_t hdr_len;         // sizeof(struct seg_file_hdr), records start here
+  uint64_t create_usec;
+  uint32_t sync_interval;
+  uint32_t reserved;
+};
+
+struct seg_rec_hdr {
+  uint32_t len;             // body bytes, not including padding
+  uint16_t type;            // enum seg_rec_type
+  uint16_t flags;           // enum seg_svc_flags for SEG_REC_SVC, else 0
+};
+
+enum seg_svc_flags {
+  SEG_SVC_GONE = 1          // the publisher has exited, sent by relays (relay.h)
+};
+
+#define SEG_ALIGN(n)      (((n) + 7) & ~(uint64_t)7)
+#define SEG_REC_LEN(len)  (sizeof(struct seg_rec_hdr) + SEG_ALIGN(len))
+
+struct seg_sync {
+  uint64_t magic;           // SEG_SYNC_MAGIC
+  uint64_t rec_index;       // records before this one in the segment
+};
+
+/* Service descriptor, the program name follows (not 0 terminated)
+ */
+struct seg_svc {
+  uint64_t timestamp_usec;
+  uint64_t prog_hash;
+  uint64_t process_id;
+  struct sockaddr_in addr;
+};
+
+struct seg_footer {
+  uint64_t magic;           // SEG_SYNC_MAGIC
+  uint32_t writer;          // worker id that wrote the segment
+  uint32_t rec_count;       // message and service records
+  uint64_t first_usec;
+  uint64_t min_usec;
+  uint64_t max_usec;
+  uint64_t seg_len;         // bytes from the opening SYNC up to this record
+  uint64_t checksum;        // seg_checksum() of those bytes
+};
+
+/* Writer, formats records into an out_buf a segment at a time
+ */
+struct seg_writer {
+  struct out_buf *out;
+  uint32_t id;
+
+  int      open;            // segment started in out
+  size_t   seg_start;       // offset of the segment in out->buf
+  size_t   last_sync;
+  uint32_t rec_index;       // all records, including SYNC
+  uint32_t rec_count;
+  uint64_t first_usec;
+  uint64_t min_usec;
+  uint64_t max_usec;
+
+  int      indexed;         // keep index blocks, set when writing to an out_file
+  struct seg_idx_entry *blocks;   // blocks of the open segment, offsets into out->buf
+  int      blocks_count;
+  int      blocks_cap;
+};
+
+void seg_writer_init(struct seg_writer *sw, struct out_buf *out, uint32_t id);
+
+/* File header, once at the start of the file
+ */
+void seg_file_hdr_init(struct seg_file_hdr *fh, uint64_t create_usec);
+
+/* Append one message, the header is stored as it was on the wire
+ */
+void seg_put_msg(struct seg_writer *sw, const struct Msg_Hdr *lm, const void *payload, uint64_t payload_len);
+
+/* Append a service descriptor, flags are enum seg_svc_flags
+ */
+void seg_put_svc(struct seg_writer *sw, const struct seg_svc *svc, const char *program_name, uint64_t name_len,
+                 uint16_t flags);
+
+/* Close the open segment with its footer and write it to the file,
+ * with its index entries when writing to an out_file
+ */
+void seg_flush(struct seg_writer *sw);
+
+/* Close the open segment with its footer but leave it in the buffer, for
+ * records the caller writes itself (see out_file_set_preamble())
+ *
+ * Returns the count of index entries, *entries points at the writer's,
+ * offsets into out->buf.  The writer must have been set to indexed.
+ */
+int seg_close(struct seg_writer *sw, struct seg_idx_entry **entries);
+
+uint64_t seg_checksum(const void *buf, uint64_t len);
+
+/* Reader over a file mapped in memory
+ */
+struct seg_reader {
+  const char *base;
+  uint64_t    size;
+  uint64_t    pos;
+
+  uint64_t    end;          // stop at this offset, normally size
+
+  const char *seg_start;    // opening SYNC of the current segment
+  uint64_t    resyncs;      // damaged regions skipped
+  uint64_t    bad_segments; // footer checksum mismatches
+};
+
+struct seg_rec {
+  uint16_t    type;
+  uint16_t    flags;
+  uint32_t    len;
+  const void *body;
+  uint64_t    offset;       // of the record header in the file
+};
+
+/* Check the file header and position the reader at the first record
+ *
+ * Returns 0 on success, -1 if this is not a segment file.
+ */
+int seg_reader_init(struct seg_reader *r, const void *base, uint64_t size);
+
+/* Read only the records in [offset, offset + len), e.g. one indexed block
+ */
+void seg_reader_range(struct seg_reader *r, uint64_t offset, uint64_t len);
+
+/* Next record (any type), footers are checked as they are passed.
+ *
+ * Returns 1 and fills rec, or 0 at end of file.
+ */
+int seg_next(struct seg_reader *r, struct seg_rec *rec);
+
+/* Split a message record into decoded header and payload
+ */
+void seg_msg_decode(const struct seg_rec *rec, struct Msg_Hdr *lm, const void **payload, uint64_t *payload_len);
+
+#endif /* _SEGMENT_H_ */
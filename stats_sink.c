@@ -0,0 +1,200 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "stats_sink.h"
+
+#define STATS_SINK_POLL_MSEC 500
+
+struct stats_sink {
+  char *file_name;
+  char *tmp_name;
+
+  char *socket_path;
+  int   listen_fd;
+  pthread_t thread;
+  volatile int stop;
+
+  pthread_mutex_t lock;   // the snapshot
+  char   *doc;
+  size_t  len;
+
+  char   *copy;           // the snapshot being sent, server thread only
+  size_t  copy_cap;
+};
+
+static void write_file(struct stats_sink *s, const char *doc, size_t len){
+  size_t done = 0;
+
+  int fd = open(s->tmp_name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+  if(fd < 0){
+    fprintf(stderr, "%s can't create %s, errno: %s\n", __func__, s->tmp_name, strerror(errno));
+    return;
+  }
+
+  while(done < len){
+    ssize_t rc = write(fd, doc + done, len - done);
+
+    if(rc < 0){
+      if(errno == EINTR) continue;
+      fprintf(stderr, "%s write to %s failed, errno: %s\n", __func__, s->tmp_name, strerror(errno));
+      break;
+    }
+
+    done += rc;
+  }
+
+  close(fd);
+
+  if((done == len) && (rename(s->tmp_name, s->file_name) < 0)){
+    fprintf(stderr, "%s can't rename %s, errno: %s\n", __func__, s->tmp_name, strerror(errno));
+  }
+}
+
+/* Send the snapshot to a client, the client may go away at any time
+ *
+ * A copy is sent, a slow client doesn't hold up the next publish.
+ */
+static void serve_client(struct stats_sink *s, int fd){
+  struct timeval tv = {
+    .tv_sec  = STATS_SINK_SEND_TIMEOUT_MSEC / 1000,
+    .tv_usec = (STATS_SINK_SEND_TIMEOUT_MSEC % 1000) * 1000
+  };
+  size_t len, done = 0;
+
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+  pthread_mutex_lock(&s->lock);
+
+  len = s->len;
+  if(len > s->copy_cap){
+    s->copy_cap = len;
+    s->copy = realloc(s->copy, s->copy_cap);
+  }
+  if(len) memcpy(s->copy, s->doc, len);
+
+  pthread_mutex_unlock(&s->lock);
+
+  while(done < len){
+    ssize_t rc = send(fd, s->copy + done, len - done, MSG_NOSIGNAL);
+
+    if(rc < 0){
+      if(errno == EINTR) continue;
+      break;
+    }
+
+    done += rc;
+  }
+
+  close(fd);
+}
+
+static void *stats_sink_thread(void *arg){
+  struct stats_sink *s = arg;
+  struct pollfd pfd = {.fd = s->listen_fd, .events = POLLIN};
+
+  while(!s->stop){
+    if(poll(&pfd, 1, STATS_SINK_POLL_MSEC) <= 0) continue;
+
+    int fd = accept(s->listen_fd, NULL, NULL);
+    if(fd >= 0) serve_client(s, fd);
+  }
+
+  return NULL;
+}
+
+static int listen_unix(const char *path){
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+
+  if(strlen(path) >= sizeof(addr.sun_path)){
+    fprintf(stderr, "%s socket path too long: %s\n", __func__, path);
+    return -1;
+  }
+
+  strcpy(addr.sun_path, path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if(fd < 0) return -1;
+
+  // a socket left behind by an earlier run
+  unlink(path);
+
+  if((bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) || (listen(fd, 16) < 0)){
+    fprintf(stderr, "%s can't listen on %s, errno: %s\n", __func__, path, strerror(errno));
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+struct stats_sink *stats_sink_open(const char *file_name, const char *socket_path){
+  struct stats_sink *s = calloc(1, sizeof(*s));
+
+  s->listen_fd = -1;
+  pthread_mutex_init(&s->lock, NULL);
+
+  if(file_name){
+    s->file_name = strdup(file_name);
+    s->tmp_name  = malloc(strlen(file_name) + 5);
+    sprintf(s->tmp_name, "%s.tmp", file_name);
+  }
+
+  if(socket_path){
+    s->listen_fd = listen_unix(socket_path);
+
+    if(s->listen_fd < 0){
+      stats_sink_close(s);
+      return 0;
+    }
+
+    s->socket_path = strdup(socket_path);
+    pthread_create(&s->thread, NULL, stats_sink_thread, s);
+  }
+
+  return s;
+}
+
+void stats_sink_close(struct stats_sink *s){
+  if(s->socket_path){
+    s->stop = 1;
+    pthread_join(s->thread, NULL);
+
+    unlink(s->socket_path);
+    free(s->socket_path);
+  }
+
+  if(s->listen_fd >= 0) close(s->listen_fd);
+
+  pthread_mutex_destroy(&s->lock);
+
+  free(s->file_name);
+  free(s->tmp_name);
+  free(s->doc);
+  free(s->copy);
+  free(s);
+}
+
+void stats_sink_publish(struct stats_sink *s, const char *doc, size_t len){
+  if(s->file_name) write_file(s, doc, len);
+
+  if(s->socket_path){
+    char *copy = malloc(len);
+    memcpy(copy, doc, len);
+
+    pthread_mutex_lock(&s->lock);
+    free(s->doc);
+    s->doc = copy;
+    s->len = len;
+    pthread_mutex_unlock(&s->lock);
+  }
+}
@@ -0,0 +1,32 @@
+
+/*
+ * stats_sink.h
+ *
+ * Where log_to_file publishes its statistics.
+ *
+ * Each snapshot is one JSON document.  The stats file always holds the
+ * latest snapshot, it's replaced atomically (write a temporary file then
+ * rename) so a reader never sees a partial document.  Clients connecting
+ * to the Unix socket get the latest snapshot and the connection is closed,
+ * e.g. socat - UNIX-CONNECT:<path>
+ */
+
+#ifndef _STATS_SINK_H_
+#define _STATS_SINK_H_
+
+#include <stddef.h>
+
+#define STATS_SINK_SEND_TIMEOUT_MSEC  1000  // give up on clients that don't read
+
+struct stats_sink;
+
+/* Either name may be 0, returns 0 if the socket can't be created
+ */
+struct stats_sink *stats_sink_open(const char *file_name, const char *socket_path);
+void stats_sink_close(struct stats_sink *s);
+
+/* Replace the snapshot
+ */
+void stats_sink_publish(struct stats_sink *s, const char *doc, size_t len);
+
+#endif /* _STATS_SINK_H_ */
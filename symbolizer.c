@@ -0,0 +1,431 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <elf.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "symbolizer.h"
+#include "dwarf_line.h"
+
+#define SYM_MAX_DIRS  64
+
+struct sym_func {
+  uint64_t addr;
+  uint64_t end;
+  const char *name;
+};
+
+struct sym_line {
+  uint64_t addr;
+  const char *dir;
+  const char *file;
+  uint32_t line;       // 0 = end of a sequence
+  uint32_t order;      // rows at one address keep their order
+};
+
+/* Symbols of one executable, immutable once loaded
+ */
+struct sym_image {
+  uint64_t prog_hash;
+
+  void  *map;          // the file, names point into it
+  size_t map_size;
+
+  struct sym_func *funcs;
+  size_t funcs_count;
+
+  struct sym_line *lines;
+  size_t lines_count;
+  size_t lines_cap;
+
+  int    pie;          // position independent, found but not loaded
+};
+
+struct symbolizer {
+  pthread_mutex_t lock;
+
+  char *dirs[SYM_MAX_DIRS];
+  int   dirs_count;
+
+  struct sym_image **images;  // one per program, empty if the executable wasn't found
+  int images_count;
+  int images_cap;
+
+  volatile uint64_t generation;  // programs added, caches drop misses when it changes
+};
+
+/******* loading ************/
+
+static int cmp_func(const void *a, const void *b){
+  const struct sym_func *x = a, *y = b;
+  return (x->addr > y->addr) - (x->addr < y->addr);
+}
+
+static int cmp_line(const void *a, const void *b){
+  const struct sym_line *x = a, *y = b;
+  if(x->addr != y->addr) return (x->addr > y->addr) ? 1 : -1;
+  return (x->order > y->order) - (x->order < y->order);
+}
+
+static void add_line(void *arg, uint64_t addr, const char *dir, const char *file, uint32_t line){
+  struct sym_image *img = arg;
+
+  if(img->lines_count == img->lines_cap){
+    img->lines_cap = img->lines_cap ? img->lines_cap * 2 : 4096;
+    img->lines = realloc(img->lines, img->lines_cap * sizeof(img->lines[0]));
+  }
+
+  struct sym_line *l = &img->lines[img->lines_count];
+  l->addr  = addr;
+  l->dir   = dir;
+  l->file  = file;
+  l->line  = line;
+  l->order = img->lines_count++;
+}
+
+static const Elf64_Shdr *find_section(const uint8_t *base, size_t size, const Elf64_Ehdr *eh, const char *name){
+  const Elf64_Shdr *sh = (const Elf64_Shdr *)(base + eh->e_shoff);
+  const Elf64_Shdr *names = &sh[eh->e_shstrndx];
+  int i;
+
+  for(i = 0; i < eh->e_shnum; i++){
+    if(sh[i].sh_name >= names->sh_size) continue;
+    if(strcmp((const char *)base + names->sh_offset + sh[i].sh_name, name)) continue;
+
+    // compressed debug sections would need zlib
+    if((sh[i].sh_type == SHT_NOBITS) || (sh[i].sh_flags & SHF_COMPRESSED)) return 0;
+    if((sh[i].sh_offset > size) || (sh[i].sh_size > size - sh[i].sh_offset)) return 0;
+
+    return &sh[i];
+  }
+
+  return 0;
+}
+
+static void load_funcs(struct sym_image *img, const uint8_t *base, size_t size, const Elf64_Ehdr *eh){
+  const Elf64_Shdr *symtab = find_section(base, size, eh, ".symtab");
+  if(!symtab) symtab = find_section(base, size, eh, ".dynsym");
+  if(!symtab || (symtab->sh_link >= eh->e_shnum)) return;
+
+  const Elf64_Shdr *strtab = &((const Elf64_Shdr *)(base + eh->e_shoff))[symtab->sh_link];
+  if((strtab->sh_offset > size) || (strtab->sh_size > size - strtab->sh_offset)) return;
+
+  const Elf64_Sym *syms = (const Elf64_Sym *)(base + symtab->sh_offset);
+  size_t count = symtab->sh_size / sizeof(Elf64_Sym);
+  size_t i;
+
+  img->funcs = malloc(count * sizeof(img->funcs[0]));
+
+  for(i = 0; i < count; i++){
+    if((ELF64_ST_TYPE(syms[i].st_info) != STT_FUNC) || (syms[i].st_shndx == SHN_UNDEF) || !syms[i].st_value) continue;
+    if(syms[i].st_name >= strtab->sh_size) continue;
+
+    struct sym_func *f = &img->funcs[img->funcs_count++];
+    f->addr = syms[i].st_value;
+    f->end  = syms[i].st_value + syms[i].st_size;
+    f->name = (const char *)base + strtab->sh_offset + syms[i].st_name;
+  }
+
+  qsort(img->funcs, img->funcs_count, sizeof(img->funcs[0]), cmp_func);
+
+  // functions without a size end where the next one starts
+  for(i = 0; i < img->funcs_count; i++){
+    if(img->funcs[i].end > img->funcs[i].addr) continue;
+    img->funcs[i].end = (i + 1 < img->funcs_count) ? img->funcs[i + 1].addr : img->funcs[i].addr + 1;
+  }
+}
+
+static void load_lines(struct sym_image *img, const uint8_t *base, size_t size, const Elf64_Ehdr *eh){
+  const Elf64_Shdr *line     = find_section(base, size, eh, ".debug_line");
+  const Elf64_Shdr *line_str = find_section(base, size, eh, ".debug_line_str");
+  const Elf64_Shdr *str      = find_section(base, size, eh, ".debug_str");
+
+  if(!line) return;
+
+  struct dwarf_sections sections = {
+    .line          = base + line->sh_offset,
+    .line_size     = line->sh_size,
+    .line_str      = line_str ? base + line_str->sh_offset : 0,
+    .line_str_size = line_str ? line_str->sh_size : 0,
+    .str           = str ? base + str->sh_offset : 0,
+    .str_size      = str ? str->sh_size : 0
+  };
+
+  dwarf_line_decode(&sections, add_line, img);
+
+  qsort(img->lines, img->lines_count, sizeof(img->lines[0]), cmp_line);
+}
+
+static int load_image(struct sym_image *img, const char *path){
+  struct stat st;
+
+  int fd = open(path, O_RDONLY);
+  if(fd < 0) return -1;
+
+  if((fstat(fd, &st) < 0) || ((uint64_t)st.st_size < sizeof(Elf64_Ehdr))){
+    close(fd);
+    return -1;
+  }
+
+  void *map = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if(map == MAP_FAILED) return -1;
+
+  const uint8_t *base = map;
+  const Elf64_Ehdr *eh = map;
+  size_t size = st.st_size;
+
+  if(memcmp(eh->e_ident, ELFMAG, SELFMAG) || (eh->e_ident[EI_CLASS] != ELFCLASS64) ||
+     (eh->e_ident[EI_DATA] != ELFDATA2LSB) || (eh->e_shentsize != sizeof(Elf64_Shdr)) ||
+     (eh->e_shoff > size) || ((uint64_t)eh->e_shnum * sizeof(Elf64_Shdr) > size - eh->e_shoff) ||
+     (eh->e_shstrndx >= eh->e_shnum)){
+    munmap(map, size);
+    return -1;
+  }
+
+  // Symbols are link time addresses, a PIE runs at a load address publishers don't send
+  if(eh->e_type == ET_DYN){
+    munmap(map, size);
+    img->pie = 1;
+    return -1;
+  }
+
+  img->map = map;
+  img->map_size = size;
+
+  load_funcs(img, base, size, eh);
+  load_lines(img, base, size, eh);
+
+  return (img->funcs_count || img->lines_count) ? 0 : -1;
+}
+
+/******* lookup ************/
+
+static void resolve(const struct sym_image *img, uint64_t addr, struct sym_info *info){
+  size_t lo, hi;
+
+  memset(info, 0, sizeof(*info));
+
+  // last function starting at or before addr
+  for(lo = 0, hi = img->funcs_count; lo < hi; ){
+    size_t mid = (lo + hi) / 2;
+    if(img->funcs[mid].addr <= addr) lo = mid + 1; else hi = mid;
+  }
+
+  if(lo && (addr < img->funcs[lo - 1].end)) info->func = img->funcs[lo - 1].name;
+
+  // last line table row at or before addr
+  for(lo = 0, hi = img->lines_count; lo < hi; ){
+    size_t mid = (lo + hi) / 2;
+    if(img->lines[mid].addr <= addr) lo = mid + 1; else hi = mid;
+  }
+
+  if(lo && img->lines[lo - 1].line){
+    info->dir  = img->lines[lo - 1].dir;
+    info->file = img->lines[lo - 1].file;
+    info->line = img->lines[lo - 1].line;
+  }
+}
+
+static struct sym_image *find_image(struct symbolizer *s, uint64_t prog_hash){
+  int i;
+
+  for(i = 0; i < s->images_count; i++){
+    if(s->images[i]->prog_hash == prog_hash) return s->images[i];
+  }
+
+  return 0;
+}
+
+/******* symbolizer ************/
+
+struct symbolizer *symbolizer_new(const char *search_path){
+  struct symbolizer *s = calloc(1, sizeof(*s));
+  char *copy = strdup(search_path ? search_path : "");
+  char *save, *dir;
+
+  pthread_mutex_init(&s->lock, NULL);
+
+  for(dir = strtok_r(copy, ":", &save); dir && (s->dirs_count < SYM_MAX_DIRS); dir = strtok_r(NULL, ":", &save)){
+    s->dirs[s->dirs_count++] = strdup(dir);
+  }
+
+  free(copy);
+
+  return s;
+}
+
+void symbolizer_free(struct symbolizer *s){
+  int i;
+
+  for(i = 0; i < s->images_count; i++){
+    struct sym_image *img = s->images[i];
+    if(img->map) munmap(img->map, img->map_size);
+    free(img->funcs);
+    free(img->lines);
+    free(img);
+  }
+
+  for(i = 0; i < s->dirs_count; i++) free(s->dirs[i]);
+
+  pthread_mutex_destroy(&s->lock);
+  free(s->images);
+  free(s);
+}
+
+int symbolizer_add_program(struct symbolizer *s, uint64_t prog_hash, const char *program_name, size_t name_len){
+  char name[1024], path[2048];
+  int i, rc = -1;
+
+  snprintf(name, sizeof(name), "%.*s", (int)strnlen(program_name, name_len), program_name);
+
+  pthread_mutex_lock(&s->lock);
+
+  struct sym_image *img = find_image(s, prog_hash);
+
+  if(img){
+    rc = (img->funcs_count || img->lines_count) ? 0 : -1;
+    pthread_mutex_unlock(&s->lock);
+    return rc;
+  }
+
+  img = calloc(1, sizeof(*img));
+  img->prog_hash = prog_hash;
+
+  // a path as sent, then the name in each search directory
+  if(strchr(name, '/')) rc = load_image(img, name);
+
+  const char *base_name = strrchr(name, '/') ? strrchr(name, '/') + 1 : name;
+
+  for(i = 0; (rc < 0) && !img->pie && (i < s->dirs_count); i++){
+    snprintf(path, sizeof(path), "%s/%s", s->dirs[i], base_name);
+    rc = load_image(img, path);
+  }
+
+  if(img->pie){
+    fprintf(stderr, "symbols for %s: not loaded, position independent executable (link with -no-pie)\n", name);
+  } else {
+    fprintf(stderr, "symbols for %s: %s, %lu functions, %lu lines\n", name, (rc == 0) ? "loaded" : "not found",
+            img->funcs_count, img->lines_count);
+  }
+
+  if(s->images_count == s->images_cap){
+    s->images_cap = s->images_cap ? s->images_cap * 2 : 16;
+    s->images = realloc(s->images, s->images_cap * sizeof(s->images[0]));
+  }
+
+  s->images[s->images_count++] = img;
+  s->generation += 1;
+
+  pthread_mutex_unlock(&s->lock);
+
+  return rc;
+}
+
+/******* per thread cache ************/
+
+struct sym_cache_entry {
+  uint64_t prog_hash;
+  uint64_t fptr;
+  int      used;
+  struct sym_info info;
+};
+
+struct sym_cache {
+  struct symbolizer *s;
+  uint64_t generation;
+
+  struct sym_cache_entry *slots;  // open addressing
+  uint64_t size;                  // power of 2
+  uint64_t count;
+};
+
+static void sym_cache_reset(struct sym_cache *c, uint64_t size){
+  free(c->slots);
+  c->slots = calloc(size, sizeof(c->slots[0]));
+  c->size  = size;
+  c->count = 0;
+}
+
+static inline uint64_t sym_hash(uint64_t prog_hash, uint64_t fptr){
+  uint64_t h = (fptr * 0x9E3779B97F4A7C15ULL) ^ prog_hash;
+  return h ^ (h >> 31);
+}
+
+static struct sym_cache_entry *sym_cache_slot(struct sym_cache *c, uint64_t prog_hash, uint64_t fptr){
+  uint64_t i = sym_hash(prog_hash, fptr) & (c->size - 1);
+
+  while(c->slots[i].used && ((c->slots[i].fptr != fptr) || (c->slots[i].prog_hash != prog_hash))){
+    i = (i + 1) & (c->size - 1);
+  }
+
+  return &c->slots[i];
+}
+
+struct sym_cache *sym_cache_new(struct symbolizer *s){
+  struct sym_cache *c = calloc(1, sizeof(*c));
+
+  c->s = s;
+  sym_cache_reset(c, 1024);
+
+  return c;
+}
+
+void sym_cache_free(struct sym_cache *c){
+  free(c->slots);
+  free(c);
+}
+
+const struct sym_info *sym_cache_lookup(struct sym_cache *c, uint64_t prog_hash, uint64_t fptr){
+  // misses for programs added since may resolve now
+  if(c->generation != c->s->generation){
+    c->generation = c->s->generation;
+    sym_cache_reset(c, c->size);
+  }
+
+  struct sym_cache_entry *e = sym_cache_slot(c, prog_hash, fptr);
+
+  if(!e->used){
+    if((c->count + 1) * 2 > c->size){
+      struct sym_cache_entry *old = c->slots;
+      uint64_t i, old_size = c->size;
+
+      c->slots = 0;
+      sym_cache_reset(c, old_size * 2);
+
+      for(i = 0; i < old_size; i++){
+        if(!old[i].used) continue;
+        *sym_cache_slot(c, old[i].prog_hash, old[i].fptr) = old[i];
+        c->count += 1;
+      }
+
+      free(old);
+      e = sym_cache_slot(c, prog_hash, fptr);
+    }
+
+    pthread_mutex_lock(&c->s->lock);
+    struct sym_image *img = find_image(c->s, prog_hash);
+    pthread_mutex_unlock(&c->s->lock);
+
+    e->prog_hash = prog_hash;
+    e->fptr      = fptr;
+    e->used      = 1;
+    c->count    += 1;
+
+    // images never change once added
+    if(img && fptr){
+      resolve(img, fptr - 1, &e->info);
+    } else {
+      memset(&e->info, 0, sizeof(e->info));
+    }
+  }
+
+  return (e->info.func || e->info.file) ? &e->info : 0;
+}
@@ -0,0 +1,59 @@
+
+/*
+ * symbolizer.h
+ *
+ * Receiver side symbolization of fptr: the function and the source
+ * file:line of the code that logged a record, instead of running addr2line
+ * by hand on every fptr.
+ *
+ * Each program (eid = prog_hash) is mapped to its executable, found on a
+ * search path by the name in its service descriptor.  The ELF symbol table
+ * and the DWARF line table (dwarf_line.h) are loaded once into sorted
+ * address tables, after that resolving an fptr is a lookup in the calling
+ * thread's cache, and a binary search the first time an fptr is seen.
+ *
+ * fptr is a return address, the call is the instruction before it, so
+ * fptr - 1 is looked up.  Addresses are matched as link time addresses,
+ * position independent executables would need their load address, which
+ * publishers don't send, so they are reported and not loaded.
+ */
+
+#ifndef _SYMBOLIZER_H_
+#define _SYMBOLIZER_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct sym_info {
+  const char *func;   // 0 = unknown
+  const char *dir;    // source directory, 0 = none
+  const char *file;   // source file, 0 = unknown
+  uint32_t    line;
+};
+
+struct symbolizer;
+struct sym_cache;
+
+/* search_path: colon separated directories holding the executables
+ */
+struct symbolizer *symbolizer_new(const char *search_path);
+void symbolizer_free(struct symbolizer *s);
+
+/* Load the executable of a program, once per prog_hash, safe to call from
+ * any thread
+ *
+ * Returns 0 if the program's symbols are loaded, -1 if the executable wasn't
+ * found, has no symbols or is position independent.
+ */
+int symbolizer_add_program(struct symbolizer *s, uint64_t prog_hash, const char *program_name, size_t name_len);
+
+/* A thread's cache of resolved fptrs
+ */
+struct sym_cache *sym_cache_new(struct symbolizer *s);
+void sym_cache_free(struct sym_cache *c);
+
+/* Returns 0 when nothing is known about fptr
+ */
+const struct sym_info *sym_cache_lookup(struct sym_cache *c, uint64_t prog_hash, uint64_t fptr);
+
+#endif /* _SYMBOLIZER_H_ */
@@ -0,0 +1,402 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <endian.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+
+#include "tcp_sub.h"
+#include "util.h"
+
+#define WATCH_KEY  UINT64_MAX   // epoll data of the watched fd
+
+enum conn_state {
+  CONN_CONNECTING,      // waiting for connect() to complete
+  CONN_HANDSHAKE,       // our header is sent, waiting for the publisher's
+  CONN_ACTIVE,
+  CONN_WAITING,         // closed, reconnect at retry_usec
+  CONN_CLOSED           // shut down, freed by the receiving thread
+};
+
+struct tcp_sub_conn {
+  int      fd;
+  int      state;
+  int      eid;
+  uint32_t gen;
+  struct sockaddr_in addr;
+  uint64_t retry_usec;
+  int      drained;     // the last read took all the kernel had
+
+  char    *buf;
+  size_t   cap;
+  size_t   len;         // bytes received
+  size_t   pos;         // parsed up to here
+
+  struct tcp_sub_conn *next_closed;
+};
+
+static const uint8_t sp_sub_hdr[8] = {0x00, 'S', 'P', 0x00, 0x00, 0x21, 0x00, 0x00};
+static const uint8_t sp_pub_hdr[8] = {0x00, 'S', 'P', 0x00, 0x00, 0x20, 0x00, 0x00};
+
+static inline uint64_t conn_key(const struct tcp_sub_conn *c){
+  return ((uint64_t)c->gen << 32) | (uint32_t)c->eid;
+}
+
+static inline uint64_t now_nsec(){
+  struct timespec tv;
+  clock_gettime(CLOCK_MONOTONIC, &tv);
+  return tv.tv_sec * (uint64_t)1000000000 + tv.tv_nsec;
+}
+
+/* Close the connection and try again after TCP_SUB_RECONNECT_MSEC
+ */
+static void conn_retry(struct tcp_sub *ts, struct tcp_sub_conn *c){
+  if((c->state == CONN_HANDSHAKE) || (c->state == CONN_ACTIVE)) ts->stats.disconnects += 1;
+
+  if(c->fd >= 0) close(c->fd);   // also leaves the epoll set
+
+  c->fd    = -1;
+  c->state = CONN_WAITING;
+  c->len   = 0;
+  c->pos   = 0;
+  c->retry_usec = get_time() + TCP_SUB_RECONNECT_MSEC * 1000;
+
+  if(__atomic_fetch_add(&ts->waiting, 1, __ATOMIC_RELAXED) == 0) ts->retry_usec = c->retry_usec;
+  if(c->retry_usec < ts->retry_usec) ts->retry_usec = c->retry_usec;
+
+  if(ts->cur == c) ts->cur = 0;
+}
+
+static void conn_open(struct tcp_sub *ts, struct tcp_sub_conn *c){
+  struct epoll_event ev = {.events = EPOLLOUT, .data.u64 = conn_key(c)};
+
+  c->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if(c->fd < 0) goto retry;
+
+  if(ts->recv_buf_size > 0){
+    setsockopt(c->fd, SOL_SOCKET, SO_RCVBUF, &ts->recv_buf_size, sizeof(ts->recv_buf_size));
+  }
+
+  // connected or refused, EPOLLOUT says when
+  if((connect(c->fd, (struct sockaddr *)&c->addr, sizeof(c->addr)) < 0) && (errno != EINPROGRESS)) goto retry;
+  if(epoll_ctl(ts->epoll_fd, EPOLL_CTL_ADD, c->fd, &ev) < 0) goto retry;
+
+  c->state = CONN_CONNECTING;
+  return;
+
+retry:
+  conn_retry(ts, c);
+}
+
+/* connect() has completed, send our header
+ */
+static void conn_connected(struct tcp_sub *ts, struct tcp_sub_conn *c){
+  struct epoll_event ev = {.events = EPOLLIN, .data.u64 = conn_key(c)};
+  socklen_t len = sizeof(int);
+  int err = 0;
+
+  if((getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0) || err ||
+     (write(c->fd, sp_sub_hdr, sizeof(sp_sub_hdr)) != sizeof(sp_sub_hdr)) ||
+     (epoll_ctl(ts->epoll_fd, EPOLL_CTL_MOD, c->fd, &ev) < 0)){
+    conn_retry(ts, c);
+    return;
+  }
+
+  c->state = CONN_HANDSHAKE;
+}
+
+/* Take the next whole record out of the buffer
+ *
+ * Returns 1, or 0 if more must be read first (or the connection was dropped).
+ */
+static inline int conn_parse(struct tcp_sub *ts, struct tcp_sub_conn *c, void **msg, size_t *len){
+  uint64_t size;
+
+  if(c->state == CONN_HANDSHAKE){
+    if((c->len - c->pos) < sizeof(sp_pub_hdr)) return 0;
+
+    if(memcmp(c->buf + c->pos, sp_pub_hdr, sizeof(sp_pub_hdr))){
+      ts->stats.bad += 1;   // not a PUB socket
+      conn_retry(ts, c);
+      return 0;
+    }
+
+    c->pos  += sizeof(sp_pub_hdr);
+    c->state = CONN_ACTIVE;
+    ts->stats.connects += 1;
+  }
+
+  if((c->len - c->pos) < sizeof(size)) return 0;
+
+  memcpy(&size, c->buf + c->pos, sizeof(size));
+  size = be64toh(size);
+
+  if(size > TCP_SUB_MAX_MSG){
+    ts->stats.bad += 1;     // as nanomsg, drop the connection
+    conn_retry(ts, c);
+    return 0;
+  }
+
+  if((c->len - c->pos - sizeof(size)) < size) return 0;
+
+  *msg = c->buf + c->pos + sizeof(size);
+  *len = size;
+
+  c->pos += sizeof(size) + size;
+  ts->stats.msgs += 1;
+
+  return 1;
+}
+
+/* Read as much as the buffer holds
+ *
+ * Returns the bytes read, 0 if there was nothing (or the connection was
+ * dropped).
+ */
+static int conn_read(struct tcp_sub *ts, struct tcp_sub_conn *c){
+  uint64_t size;
+
+  // records before pos have been taken, keep the partial one
+  if(c->pos){
+    memmove(c->buf, c->buf + c->pos, c->len - c->pos);
+    c->len -= c->pos;
+    c->pos  = 0;
+  }
+
+  // a record bigger than the buffer, conn_parse() has checked its size
+  if((c->state == CONN_ACTIVE) && (c->len >= sizeof(size))){
+    memcpy(&size, c->buf, sizeof(size));
+    size = be64toh(size) + sizeof(size);
+
+    if(size > c->cap){
+      while(c->cap < size) c->cap *= 2;
+      c->buf = realloc(c->buf, c->cap);
+    }
+  }
+
+  size_t want = c->cap - c->len;
+  uint64_t t0 = now_nsec();
+  ssize_t n = read(c->fd, c->buf + c->len, want);
+
+  ts->stats.reads     += 1;
+  ts->stats.read_nsec += now_nsec() - t0;
+
+  if(n > 0){
+    c->len += n;
+    c->drained = ((size_t)n < want);
+    ts->stats.bytes += n;
+    return n;
+  }
+
+  if((n < 0) && ((errno == EAGAIN) || (errno == EINTR))){
+    c->drained = 1;
+    return 0;
+  }
+
+  // closed by the publisher, or failed
+  conn_retry(ts, c);
+  return 0;
+}
+
+static struct tcp_sub_conn *conn_find(struct tcp_sub *ts, uint64_t key){
+  uint32_t eid = key;
+
+  if((eid >= (uint32_t)ts->conns_cap) || !ts->conns[eid]) return 0;
+  if(ts->conns[eid]->gen != (key >> 32)) return 0;   // an event for a connection shut down since
+
+  return ts->conns[eid];
+}
+
+static void reconnect_due(struct tcp_sub *ts){
+  uint64_t now_usec = get_time();
+  int eid;
+
+  if(now_usec < ts->retry_usec) return;
+
+  ts->retry_usec = UINT64_MAX;
+
+  for(eid = 0; eid < ts->conns_cap; eid++){
+    struct tcp_sub_conn *c = ts->conns[eid];
+
+    if(!c || (c->state != CONN_WAITING)) continue;
+
+    if(c->retry_usec <= now_usec){
+      __atomic_fetch_sub(&ts->waiting, 1, __ATOMIC_RELAXED);
+      conn_open(ts, c);
+    } else if(c->retry_usec < ts->retry_usec){
+      ts->retry_usec = c->retry_usec;
+    }
+  }
+}
+
+struct tcp_sub *tcp_sub_new(int recv_buf_size){
+  struct tcp_sub *ts = calloc(1, sizeof(*ts));
+
+  ts->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if(ts->epoll_fd < 0){
+    free(ts);
+    return 0;
+  }
+
+  ts->recv_buf_size = recv_buf_size;
+  ts->watch_fd      = -1;
+  ts->retry_usec    = UINT64_MAX;
+
+  return ts;
+}
+
+void tcp_sub_free(struct tcp_sub *ts){
+  int eid;
+
+  for(eid = 0; eid < ts->conns_cap; eid++){
+    if(ts->conns[eid]) tcp_sub_shutdown(ts, eid);
+  }
+
+  while(ts->closed){
+    struct tcp_sub_conn *c = ts->closed;
+    ts->closed = c->next_closed;
+    free(c->buf);
+    free(c);
+  }
+
+  close(ts->epoll_fd);
+  free(ts->conns);
+  free(ts);
+}
+
+int tcp_sub_watch(struct tcp_sub *ts, int fd){
+  struct epoll_event ev = {.events = EPOLLIN, .data.u64 = WATCH_KEY};
+
+  ts->watch_fd = fd;
+  return epoll_ctl(ts->epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+int tcp_sub_connect(struct tcp_sub *ts, const struct sockaddr_in *addr){
+  int eid;
+
+  for(eid = 0; (eid < ts->conns_cap) && ts->conns[eid]; eid++);
+
+  if(eid == ts->conns_cap){
+    int cap = ts->conns_cap ? (ts->conns_cap * 2) : 64;
+
+    ts->conns = realloc(ts->conns, cap * sizeof(ts->conns[0]));
+    memset(ts->conns + ts->conns_cap, 0, (cap - ts->conns_cap) * sizeof(ts->conns[0]));
+    ts->conns_cap = cap;
+  }
+
+  struct tcp_sub_conn *c = calloc(1, sizeof(*c));
+
+  c->fd   = -1;
+  c->eid  = eid;
+  c->gen  = ++ts->gen;
+  c->addr = *addr;
+  c->cap  = TCP_SUB_BUF_SIZE;
+  c->buf  = malloc(c->cap);
+
+  ts->conns[eid] = c;
+  ts->stats.connections += 1;
+
+  conn_open(ts, c);
+
+  return eid;
+}
+
+void tcp_sub_shutdown(struct tcp_sub *ts, int eid){
+  if((eid < 0) || (eid >= ts->conns_cap) || !ts->conns[eid]) return;
+
+  struct tcp_sub_conn *c = ts->conns[eid];
+
+  ts->conns[eid] = 0;
+  ts->stats.connections -= 1;
+
+  if(c->state == CONN_WAITING) __atomic_fetch_sub(&ts->waiting, 1, __ATOMIC_RELAXED);
+  if(c->fd >= 0) close(c->fd);
+
+  // the receiving thread may be parsing it, it frees it on its next tcp_sub_next()
+  c->fd    = -1;
+  c->state = CONN_CLOSED;
+  c->next_closed = ts->closed;
+  ts->closed = c;
+}
+
+int tcp_sub_wait(struct tcp_sub *ts, int timeout_msec){
+  int waiting = __atomic_load_n(&ts->waiting, __ATOMIC_RELAXED);
+  int ready = 0;
+  int i, n;
+
+  // tcp_sub_next() stopped before the end of the last events
+  if(ts->cur || (ts->events_next < ts->events_count)) return TCP_SUB_READY;
+
+  if(waiting && ((timeout_msec < 0) || (timeout_msec > TCP_SUB_RECONNECT_MSEC))) timeout_msec = TCP_SUB_RECONNECT_MSEC;
+
+  n = epoll_wait(ts->epoll_fd, ts->events, TCP_SUB_EVENTS, timeout_msec);
+  if(n < 0) n = 0;   // EINTR
+
+  for(i = 0; i < n; i++){
+    if(ts->events[i].data.u64 != WATCH_KEY) continue;
+
+    ready |= TCP_SUB_WATCHED;
+    ts->events[i--] = ts->events[--n];
+  }
+
+  ts->events_count = n;
+  ts->events_next  = 0;
+
+  if(n){
+    ready |= TCP_SUB_READY;
+    ts->stats.wakeups += 1;
+  }
+
+  // tcp_sub_next() retries the connections that are due
+  if(waiting) ready |= TCP_SUB_READY;
+
+  return ready;
+}
+
+int tcp_sub_next(struct tcp_sub *ts, void **msg, size_t *len){
+  struct tcp_sub_conn *c;
+
+  if(ts->cur && (ts->cur->state == CONN_CLOSED)) ts->cur = 0;
+
+  while(ts->closed){
+    c = ts->closed;
+    ts->closed = c->next_closed;
+    free(c->buf);
+    free(c);
+  }
+
+  while(1){
+    if((c = ts->cur)){
+      if(conn_parse(ts, c, msg, len)) return 1;
+
+      // a short read means the socket is empty, epoll will say when there's more
+      if(ts->cur && !c->drained && conn_read(ts, c)) continue;
+
+      ts->cur = 0;
+      continue;
+    }
+
+    if(ts->events_next >= ts->events_count) break;
+
+    struct epoll_event *ev = &ts->events[ts->events_next++];
+
+    c = conn_find(ts, ev->data.u64);
+    if(!c) continue;
+
+    if(c->state == CONN_CONNECTING){
+      conn_connected(ts, c);
+    } else if((c->state == CONN_HANDSHAKE) || (c->state == CONN_ACTIVE)){
+      c->drained = 0;
+      ts->cur = c;
+    }
+  }
+
+  if(__atomic_load_n(&ts->waiting, __ATOMIC_RELAXED)) reconnect_due(ts);
+
+  return 0;
+}
@@ -0,0 +1,121 @@
+
+/*
+ * tcp_sub.h
+ *
+ * Receive engine for log_to_file -e, the SUB side of nanomsg's TCP
+ * transport spoken directly over epoll instead of through a nanomsg SUB
+ * socket.
+ *
+ * nanomsg copies every message into a buffer of its own, hands it over
+ * with one nn_recv() each, and moves it between its worker threads and the
+ * caller's on the way.  Here each publisher connection has a receive buffer
+ * that is filled with one read() of as much as the kernel has, and records
+ * are parsed out of it in place: a read per buffer full instead of a
+ * receive and an allocation per record.
+ *
+ * The wire, as nanomsg writes it (the SP over TCP mapping):
+ *
+ *   both sides  8 byte header  0x00 'S' 'P' 0x00, protocol (16 bits), 0x0000
+ *   publisher   frames         size (64 bits), size bytes of message
+ *
+ * integers big endian, the protocol is NN_PUB (0x20) or NN_SUB (0x21).
+ * Subscriptions are filtered on the receive side, a SUB never sends after
+ * its header.
+ *
+ * As nn_connect() a connection that fails or is closed is retried every
+ * TCP_SUB_RECONNECT_MSEC until tcp_sub_shutdown(); publishers that have
+ * exited are found and dropped by the registry probes (pub_registry.h).
+ *
+ * The engine belongs to one thread, which waits and receives.  Another
+ * thread may connect and shut down connections while holding the lock the
+ * receiving thread holds around tcp_sub_next().
+ */
+
+#ifndef _TCP_SUB_H_
+#define _TCP_SUB_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+
+#define TCP_SUB_BUF_SIZE        (64 << 10)  // per connection, grows for bigger records
+#define TCP_SUB_MAX_MSG         (1 << 20)   // as nanomsg's default NN_RCVMAXSIZE
+#define TCP_SUB_RECONNECT_MSEC  100         // as nanomsg's default NN_RECONNECT_IVL
+#define TCP_SUB_EVENTS          256         // connections taken from one epoll_wait()
+
+enum tcp_sub_ready {
+  TCP_SUB_READY   = 1,  // tcp_sub_next() has records or connections to service
+  TCP_SUB_WATCHED = 2   // the fd given to tcp_sub_watch() is readable
+};
+
+struct tcp_sub_stats {
+  volatile uint64_t connections;  // open or retrying
+  volatile uint64_t wakeups;      // epoll_wait() calls that returned events
+  volatile uint64_t reads;
+  volatile uint64_t read_nsec;
+  volatile uint64_t bytes;
+  volatile uint64_t msgs;
+  volatile uint64_t connects;     // handshakes completed
+  volatile uint64_t disconnects;
+  volatile uint64_t bad;          // wrong peer protocol or oversize records, the connection is dropped
+};
+
+struct tcp_sub_conn;
+
+struct tcp_sub {
+  int epoll_fd;
+  int recv_buf_size;              // SO_RCVBUF of each connection, 0 = system default
+  int watch_fd;
+
+  struct tcp_sub_conn **conns;    // by endpoint id
+  int      conns_cap;
+  uint32_t gen;                   // tells a reused endpoint id from the last connection with it
+  struct tcp_sub_conn *closed;    // shut down, freed by the receiving thread
+
+  struct epoll_event events[TCP_SUB_EVENTS];
+  int events_count;
+  int events_next;
+  struct tcp_sub_conn *cur;       // connection being parsed
+
+  volatile int waiting;           // connections waiting to reconnect
+  uint64_t retry_usec;            // earliest reconnect
+
+  struct tcp_sub_stats stats;
+};
+
+/* recv_buf_size is the SO_RCVBUF of each connection, 0 for the system default
+ *
+ * Returns 0 if epoll isn't available.
+ */
+struct tcp_sub *tcp_sub_new(int recv_buf_size);
+void tcp_sub_free(struct tcp_sub *ts);
+
+/* Also wake tcp_sub_wait() when fd is readable, e.g. the NN_RCVFD of a
+ * nanomsg socket
+ */
+int tcp_sub_watch(struct tcp_sub *ts, int fd);
+
+/* Connect to the publisher at addr, the connection is made in the background
+ *
+ * Returns the endpoint id, or -1.
+ */
+int tcp_sub_connect(struct tcp_sub *ts, const struct sockaddr_in *addr);
+
+/* Close the connection of endpoint id and stop retrying it
+ */
+void tcp_sub_shutdown(struct tcp_sub *ts, int eid);
+
+/* Wait up to timeout_msec for records, returns enum tcp_sub_ready bits
+ */
+int tcp_sub_wait(struct tcp_sub *ts, int timeout_msec);
+
+/* The next record of the connections tcp_sub_wait() found ready, reading
+ * them as needed
+ *
+ * The record is in the connection's buffer, valid until the next call.
+ * Returns 1, or 0 once the ready connections have been drained.
+ */
+int tcp_sub_next(struct tcp_sub *ts, void **msg, size_t *len);
+
+#endif /* _TCP_SUB_H_ */
@@ -0,0 +1,981 @@
+#define _GNU_SOURCE     /* for memmem */
+
+/* Rebuild call trees from function enter/exit trace (TRACE_FUNC_ENTER, TRACE_FUNC_EXIT)
+ *
+ * Reads captures written by log_to_file: binary segments, the legacy JSON
+ * format or JSON Lines, compressed or not, in one pass.  TF+ and TF-
+ * records are matched on a call stack per publisher (eid, pid) by function
+ * name, the payload (fptr is where the macro was called, it differs between
+ * the enter and the exit), and the inclusive and exclusive (self) time of
+ * each call is added to its call path and to its function.
+ *
+ *   -f  folded stacks, "program;outer;inner <self usec>" per call path, for
+ *       flamegraph.pl, inferno or speedscope
+ *   -c  Chrome trace event JSON, one complete event per call, for
+ *       chrome://tracing or ui.perfetto.dev
+ *   -s  calls, inclusive, exclusive and longest time per function, the
+ *       default on stdout
+ *
+ * Records carry no thread id, the threads of a process share its stack.
+ * Records that don't pair up are repaired rather than trusted:
+ *
+ *   - an exit below the top of the stack closes the frames above it, their
+ *     exits were lost (or they belong to another thread)
+ *   - an exit of a function that isn't on the stack is counted and skipped,
+ *     e.g. the capture started inside the call
+ *   - enters deeper than TREE_MAX_DEPTH are counted and skipped, with as
+ *     many exits
+ *   - frames still open at the end are closed at their publisher's last
+ *     record
+ *
+ * Memory is bounded by the call paths (-n), functions and publishers, not
+ * the size of the capture: files are mapped and read once, TREE_WINDOW at
+ * a time, compressed files are decompressed a window at a time.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>    /* for getopt */
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "segment.h"
+#include "log_wire.h"
+#include "zfile.h"
+#include "out_buf.h"
+#include "json_escape.h"
+#include "fnv_hash.h"
+
+#define TREE_MAX_DEPTH  256
+#define TREE_MAX_NODES  (1 << 20)   // default call paths
+#define TREE_WINDOW     (16 << 20)  // input read ahead and kept behind
+
+enum trace_kind {
+  TRACE_NONE = 0,
+  TRACE_ENTER,
+  TRACE_EXIT
+};
+
+/* Function names, interned
+ */
+struct names {
+  char   **strs;
+  uint32_t count;
+  uint32_t cap;
+  uint32_t *slots;          // index + 1, 0 = empty
+  uint64_t size;            // power of 2
+};
+
+struct func_stats {
+  uint64_t calls;
+  uint64_t incl_usec;       // outermost calls only, recursion isn't counted twice
+  uint64_t excl_usec;
+  uint64_t max_usec;
+};
+
+/* A call path, the root of each path is a program (or a process, -p)
+ */
+struct node {
+  uint32_t parent;          // 0 = root
+  uint32_t func;            // name, or index in roots for a root
+  uint64_t self_usec;
+};
+
+struct root {
+  uint64_t prog_hash;
+  uint64_t process_id;      // 0 unless -p
+};
+
+struct frame {
+  uint32_t func;
+  uint32_t node;
+  uint64_t enter_usec;
+  uint64_t child_usec;
+  int      recursive;       // func is also further down the stack
+};
+
+struct stack {
+  uint64_t prog_hash;
+  uint64_t process_id;
+  uint32_t root;            // node
+  int      depth;
+  uint64_t skipped;         // enters past TREE_MAX_DEPTH still open
+  uint64_t last_usec;
+  struct frame frames[TREE_MAX_DEPTH];
+};
+
+struct program {
+  uint64_t prog_hash;
+  char    *name;
+};
+
+struct tree_stats {
+  uint64_t records;         // TF+ and TF-
+  uint64_t enters;
+  uint64_t exits;
+  uint64_t unmatched_exits; // skipped, the function wasn't on the stack
+  uint64_t unclosed;        // frames closed by a later exit further down
+  uint64_t open_at_end;
+  uint64_t too_deep;
+  uint64_t truncated;       // calls counted to their caller's path, -n was reached
+  uint64_t backwards;       // exits before their enter
+  uint64_t bad;             // lines that aren't records
+};
+
+struct trace_tree {
+  struct names funcs;
+  struct func_stats *fstats;  // by name
+
+  struct node *nodes;         // [0] unused
+  uint32_t nodes_count;
+  uint32_t nodes_cap;
+  uint32_t max_nodes;
+  uint32_t *node_slots;       // (parent, func) -> node, open addressing
+  uint64_t node_slots_size;
+
+  struct root *roots;
+  uint32_t roots_count;
+  uint32_t roots_cap;
+  int split_pids;             // -p, a root per process
+
+  struct stack **stacks;      // open addressing on (eid, pid)
+  uint64_t stacks_size;
+  uint64_t stacks_count;
+
+  struct program *programs;
+  uint32_t programs_count;
+  uint32_t programs_cap;
+
+  struct out_buf *chrome;     // -c, 0 = no
+  uint64_t chrome_events;
+
+  struct tree_stats stats;
+};
+
+static inline uint64_t hash2(uint64_t a, uint64_t b){
+  uint64_t key[2] = {a, b};
+  return fnv_64a_buf(key, sizeof(key), FNV1A_64_INIT);
+}
+
+static void *grow(void *p, uint32_t *cap, size_t elem){
+  *cap = *cap ? *cap * 2 : 64;
+  p = realloc(p, *cap * elem);
+
+  if(!p){
+    fprintf(stderr, "out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+
+  return p;
+}
+
+/* Id of the function name, added on first use
+ */
+static uint32_t func_id(struct trace_tree *tt, const char *s, size_t len){
+  struct names *t = &tt->funcs;
+  uint64_t i, j;
+
+  if(((t->count + 1) * 2) > t->size){
+    uint32_t *old = t->slots;
+    uint64_t old_size = t->size;
+
+    t->size  = t->size ? t->size * 2 : 1024;
+    t->slots = calloc(t->size, sizeof(t->slots[0]));
+
+    for(j = 0; j < old_size; j++){
+      if(!old[j]) continue;
+      const char *o = t->strs[old[j] - 1];
+      for(i = fnv_64a_buf((void *)o, strlen(o), FNV1A_64_INIT) & (t->size - 1); t->slots[i]; i = (i + 1) & (t->size - 1));
+      t->slots[i] = old[j];
+    }
+
+    free(old);
+  }
+
+  for(i = fnv_64a_buf((void *)s, len, FNV1A_64_INIT) & (t->size - 1); t->slots[i]; i = (i + 1) & (t->size - 1)){
+    const char *n = t->strs[t->slots[i] - 1];
+    if(!strncmp(n, s, len) && !n[len]) return t->slots[i] - 1;
+  }
+
+  if(t->count == t->cap){
+    uint32_t cap = t->cap;
+    t->strs    = grow(t->strs, &t->cap, sizeof(t->strs[0]));
+    tt->fstats = realloc(tt->fstats, t->cap * sizeof(tt->fstats[0]));
+    memset(tt->fstats + cap, 0, (t->cap - cap) * sizeof(tt->fstats[0]));
+  }
+
+  t->strs[t->count] = strndup(s, len);
+  t->slots[i] = t->count + 1;
+
+  return t->count++;
+}
+
+static void add_program(struct trace_tree *tt, uint64_t prog_hash, const char *name, size_t len){
+  uint32_t i;
+
+  for(i = 0; i < tt->programs_count; i++){
+    if(tt->programs[i].prog_hash == prog_hash) return;
+  }
+
+  if(tt->programs_count == tt->programs_cap){
+    tt->programs = grow(tt->programs, &tt->programs_cap, sizeof(tt->programs[0]));
+  }
+
+  tt->programs[tt->programs_count].prog_hash = prog_hash;
+  tt->programs[tt->programs_count].name      = strndup(name, strnlen(name, len));
+  tt->programs_count += 1;
+}
+
+static const char *program_name(struct trace_tree *tt, uint64_t prog_hash){
+  uint32_t i;
+
+  for(i = 0; i < tt->programs_count; i++){
+    if(tt->programs[i].prog_hash == prog_hash) return tt->programs[i].name;
+  }
+
+  return 0;
+}
+
+/* The node of func called from parent, added on first use, 0 once
+ * max_nodes paths are known (roots are always added)
+ */
+static uint32_t node_id(struct trace_tree *tt, uint32_t parent, uint32_t func){
+  uint64_t i, j;
+
+  if(((uint64_t)tt->nodes_count * 2) >= tt->node_slots_size){
+    free(tt->node_slots);
+
+    tt->node_slots_size = tt->node_slots_size ? tt->node_slots_size * 2 : 1024;
+    tt->node_slots = calloc(tt->node_slots_size, sizeof(tt->node_slots[0]));
+
+    for(j = 1; j < tt->nodes_count; j++){
+      const struct node *n = &tt->nodes[j];
+      for(i = hash2(n->parent, n->func) & (tt->node_slots_size - 1); tt->node_slots[i];
+          i = (i + 1) & (tt->node_slots_size - 1));
+      tt->node_slots[i] = j;
+    }
+  }
+
+  for(i = hash2(parent, func) & (tt->node_slots_size - 1); tt->node_slots[i]; i = (i + 1) & (tt->node_slots_size - 1)){
+    const struct node *n = &tt->nodes[tt->node_slots[i]];
+    if((n->parent == parent) && (n->func == func)) return tt->node_slots[i];
+  }
+
+  if(parent && (tt->nodes_count > tt->max_nodes)) return 0;
+
+  // [0] is not a node
+  while(tt->nodes_count >= tt->nodes_cap){
+    tt->nodes = grow(tt->nodes, &tt->nodes_cap, sizeof(tt->nodes[0]));
+  }
+
+  struct node *n = &tt->nodes[tt->nodes_count];
+  memset(n, 0, sizeof(*n));
+  n->parent = parent;
+  n->func   = func;
+
+  tt->node_slots[i] = tt->nodes_count;
+  return tt->nodes_count++;
+}
+
+/* The root node of a publisher, a program's processes share it unless -p
+ */
+static uint32_t root_node(struct trace_tree *tt, uint64_t prog_hash, uint64_t process_id){
+  uint32_t i = tt->roots_count;
+
+  if(!tt->split_pids){
+    process_id = 0;
+    for(i = 0; i < tt->roots_count; i++){
+      if(tt->roots[i].prog_hash == prog_hash) break;
+    }
+  }
+
+  if(i == tt->roots_count){
+    if(tt->roots_count == tt->roots_cap) tt->roots = grow(tt->roots, &tt->roots_cap, sizeof(tt->roots[0]));
+
+    tt->roots[i].prog_hash  = prog_hash;
+    tt->roots[i].process_id = process_id;
+    tt->roots_count += 1;
+  }
+
+  return node_id(tt, 0, i);
+}
+
+static struct stack *find_stack(struct trace_tree *tt, uint64_t prog_hash, uint64_t process_id){
+  uint64_t i, j;
+
+  if(((tt->stacks_count + 1) * 2) > tt->stacks_size){
+    struct stack **old = tt->stacks;
+    uint64_t old_size = tt->stacks_size;
+
+    tt->stacks_size = tt->stacks_size ? tt->stacks_size * 2 : 256;
+    tt->stacks = calloc(tt->stacks_size, sizeof(tt->stacks[0]));
+
+    for(j = 0; j < old_size; j++){
+      if(!old[j]) continue;
+      for(i = hash2(old[j]->prog_hash, old[j]->process_id) & (tt->stacks_size - 1); tt->stacks[i];
+          i = (i + 1) & (tt->stacks_size - 1));
+      tt->stacks[i] = old[j];
+    }
+
+    free(old);
+  }
+
+  for(i = hash2(prog_hash, process_id) & (tt->stacks_size - 1); tt->stacks[i]; i = (i + 1) & (tt->stacks_size - 1)){
+    struct stack *st = tt->stacks[i];
+    if((st->prog_hash == prog_hash) && (st->process_id == process_id)) return st;
+  }
+
+  struct stack *st = calloc(1, sizeof(*st));
+  st->prog_hash  = prog_hash;
+  st->process_id = process_id;
+  st->root       = root_node(tt, prog_hash, process_id);
+
+  tt->stacks[i] = st;
+  tt->stacks_count += 1;
+
+  return st;
+}
+
+/* Append s as the contents of a JSON string
+ */
+static inline void out_buf_put_escaped(struct out_buf *out, const char *s){
+  size_t len = strlen(s);
+  char *p = out_buf_reserve(out, json_escaped_max_len(len));
+  out->len += json_escape(s, len, p);
+}
+
+static void put_chrome_event(struct trace_tree *tt, const struct stack *st, const struct frame *f, uint64_t dur,
+                             int unclosed){
+  struct out_buf *out = tt->chrome;
+
+  if(tt->chrome_events++) out_buf_put_lit(out, ",\n");
+
+  out_buf_put_lit(out, "{\"name\":\"");
+  out_buf_put_escaped(out, tt->funcs.strs[f->func]);
+  out_buf_put_lit(out, "\",\"cat\":\"TF\",\"ph\":\"X\",\"ts\":");
+  out_buf_put_dec(out, f->enter_usec, 0);
+  out_buf_put_lit(out, ",\"dur\":");
+  out_buf_put_dec(out, dur, 0);
+  out_buf_put_lit(out, ",\"pid\":");
+  out_buf_put_dec(out, st->process_id, 0);
+  out_buf_put_lit(out, ",\"tid\":");
+  out_buf_put_dec(out, st->process_id, 0);
+
+  if(unclosed) out_buf_put_lit(out, ",\"args\":{\"unclosed\":true}");
+
+  out_buf_put_lit(out, "}");
+}
+
+/* Pop the top frame, the call ended at usec
+ */
+static void close_frame(struct trace_tree *tt, struct stack *st, uint64_t usec, int unclosed){
+  struct frame *f = &st->frames[--st->depth];
+  uint64_t dur = 0;
+
+  if(usec >= f->enter_usec){
+    dur = usec - f->enter_usec;
+  } else {
+    tt->stats.backwards += 1;
+  }
+
+  uint64_t self = (dur > f->child_usec) ? (dur - f->child_usec) : 0;
+
+  tt->nodes[f->node].self_usec += self;
+
+  struct func_stats *fs = &tt->fstats[f->func];
+  fs->calls     += 1;
+  fs->excl_usec += self;
+  if(!f->recursive) fs->incl_usec += dur;
+  if(dur > fs->max_usec) fs->max_usec = dur;
+
+  if(st->depth) st->frames[st->depth - 1].child_usec += dur;
+
+  if(tt->chrome) put_chrome_event(tt, st, f, dur, unclosed);
+}
+
+static void enter(struct trace_tree *tt, struct stack *st, uint32_t func, uint64_t usec){
+  int i;
+
+  tt->stats.enters += 1;
+
+  if(st->depth == TREE_MAX_DEPTH){
+    st->skipped += 1;
+    tt->stats.too_deep += 1;
+    return;
+  }
+
+  struct frame *f = &st->frames[st->depth];
+  uint32_t parent = st->depth ? st->frames[st->depth - 1].node : st->root;
+
+  f->func       = func;
+  f->node       = node_id(tt, parent, func);
+  f->enter_usec = usec;
+  f->child_usec = 0;
+  f->recursive  = 0;
+
+  // past -n the call counts to its caller's path
+  if(!f->node){
+    f->node = parent;
+    tt->stats.truncated += 1;
+  }
+
+  for(i = 0; i < st->depth; i++){
+    if(st->frames[i].func == func){
+      f->recursive = 1;
+      break;
+    }
+  }
+
+  st->depth += 1;
+}
+
+static void leave(struct trace_tree *tt, struct stack *st, uint32_t func, uint64_t usec){
+  int i;
+
+  tt->stats.exits += 1;
+
+  if(st->skipped){
+    st->skipped -= 1;
+    return;
+  }
+
+  for(i = st->depth - 1; (i >= 0) && (st->frames[i].func != func); i--);
+
+  if(i < 0){
+    tt->stats.unmatched_exits += 1;
+    return;
+  }
+
+  while(st->depth - 1 > i){
+    close_frame(tt, st, usec, 1);
+    tt->stats.unclosed += 1;
+  }
+
+  close_frame(tt, st, usec, 0);
+}
+
+static void trace_record(struct trace_tree *tt, enum trace_kind kind, uint64_t prog_hash, uint64_t process_id,
+                         uint64_t usec, const char *name, size_t name_len){
+  if(!name_len) return;
+
+  struct stack *st = find_stack(tt, prog_hash, process_id);
+  uint32_t func = func_id(tt, name, name_len);
+
+  tt->stats.records += 1;
+  if(usec > st->last_usec) st->last_usec = usec;
+
+  if(kind == TRACE_ENTER){
+    enter(tt, st, func, usec);
+  } else {
+    leave(tt, st, func, usec);
+  }
+}
+
+static inline enum trace_kind trace_kind(const char *mask){
+  if((mask[0] != 'T') || (mask[1] != 'F')) return TRACE_NONE;
+  if(mask[2] == '+') return TRACE_ENTER;
+  if(mask[2] == '-') return TRACE_EXIT;
+  return TRACE_NONE;
+}
+
+/* A capture file, mapped, read front to back a window at a time
+ */
+struct input {
+  const char *base;
+  uint64_t    map_size;
+  struct zfile_reader zr;
+  int         compressed;
+
+  const char *data;         // uncompressed stream
+  uint64_t    size;
+  uint64_t    loaded;       // decompressed up to here
+  uint64_t    released;     // given back up to here
+};
+
+/* Make the window at pos readable and give back what is well behind it
+ */
+static void input_window(struct input *in, uint64_t pos){
+  long page = sysconf(_SC_PAGESIZE);
+
+  while(in->compressed && (in->loaded < in->size) && (in->loaded < pos + TREE_WINDOW)){
+    zfile_load(&in->zr, in->loaded, TREE_WINDOW);
+    in->loaded += TREE_WINDOW;
+  }
+
+  if(pos < in->released + 2 * TREE_WINDOW) return;
+
+  uint64_t len = (pos - TREE_WINDOW - in->released) & ~(uint64_t)(page - 1);
+
+  if(in->compressed){
+    zfile_unload(&in->zr, in->released, len);
+  } else {
+    madvise((void *)(in->base + in->released), len, MADV_DONTNEED);
+  }
+
+  in->released += len;
+}
+
+static void read_segments(struct trace_tree *tt, struct input *in){
+  struct seg_reader reader;
+  struct seg_rec rec;
+
+  input_window(in, 0);
+
+  if(seg_reader_init(&reader, in->data, in->size) < 0){
+    tt->stats.bad += 1;
+    return;
+  }
+
+  for(input_window(in, reader.pos); seg_next(&reader, &rec); input_window(in, reader.pos)){
+    if(rec.type == SEG_REC_MSG){
+      const struct log_wire_hdr *wh = rec.body;
+      enum trace_kind kind = trace_kind(wh->type_lvl);
+
+      if(kind != TRACE_NONE){
+        const char *name = (const char *)(wh + 1);
+        trace_record(tt, kind, wh->prog_hash, wh->process_id, wh->usec, name, strnlen(name, rec.len - sizeof(*wh)));
+      }
+
+    } else if((rec.type == SEG_REC_SVC) && !(rec.flags & SEG_SVC_GONE)){
+      const struct seg_svc *svc = rec.body;
+      add_program(tt, svc->prog_hash, (const char *)(svc + 1), rec.len - sizeof(*svc));
+    }
+  }
+
+  tt->stats.bad += reader.resyncs + reader.bad_segments;
+}
+
+/* One line of the legacy JSON format, see json_out.h
+ *
+ *   {usec: %li, eid: %lX, pid: %5li, fptr: %8lX[, func: ..][, src: ..], line: %4li, mask: %.8s, str: "%s"},
+ *   {usec: %li, eid: %lX, pid: %5li,  uri: %s:%i, prog: %s}
+ */
+static void parse_json_line(struct trace_tree *tt, const char *p, const char *eol){
+  const char *mask = memmem(p, eol - p, ", mask: TF", 10);
+  const char *prog = mask ? 0 : memmem(p, eol - p, ", prog: ", 8);
+  enum trace_kind kind = TRACE_NONE;
+  char *q;
+
+  if(mask){
+    kind = trace_kind(mask + 8);
+    if((kind == TRACE_NONE) || ((mask + 8 + 8 + 8) > eol) || memcmp(mask + 8 + 8, ", str: \"", 8)) return;
+  } else if(!prog){
+    return;
+  }
+
+  uint64_t usec = strtoull(p + 7, &q, 10);
+
+  if(strncmp(q, ", eid: ", 7)) goto bad;
+  uint64_t prog_hash = strtoull(q + 7, &q, 16);
+
+  if(strncmp(q, ", pid: ", 7)) goto bad;
+  uint64_t process_id = strtoull(q + 7, &q, 10);
+
+  if(prog){
+    const char *prog_end = eol;
+
+    prog += 8;
+    while((prog_end > prog) && (prog_end[-1] == '}')) prog_end--;
+
+    add_program(tt, prog_hash, prog, prog_end - prog);
+    return;
+  }
+
+  const char *name = mask + 8 + 8 + 8;
+  const char *name_end = memchr(name, '"', eol - name);
+  if(!name_end) goto bad;
+
+  trace_record(tt, kind, prog_hash, process_id, usec, name, name_end - name);
+  return;
+
+bad:
+  tt->stats.bad += 1;
+}
+
+/* One JSON Lines record, function and program names are taken as written
+ * (they don't need escaping)
+ */
+static void parse_jsonl_line(struct trace_tree *tt, const char *p, const char *eol){
+  const char *mask = memmem(p, eol - p, "\"mask\":\"TF", 10);
+  const char *prog = mask ? 0 : memmem(p, eol - p, "\"prog\":\"", 8);
+  const char *usec_p, *eid_p, *pid_p, *name, *name_end;
+  enum trace_kind kind = TRACE_NONE;
+
+  if(mask){
+    kind = trace_kind(mask + 8);
+    if(kind == TRACE_NONE) return;
+  } else if(!prog){
+    return;
+  }
+
+  usec_p = memmem(p, eol - p, "\"usec\":", 7);
+  eid_p  = memmem(p, eol - p, "\"eid\":\"", 7);
+  pid_p  = memmem(p, eol - p, "\"pid\":", 6);
+
+  if(!usec_p || !eid_p || !pid_p) goto bad;
+
+  uint64_t usec       = strtoull(usec_p + 7, 0, 10);
+  uint64_t prog_hash  = strtoull(eid_p + 7, 0, 16);
+  uint64_t process_id = strtoull(pid_p + 6, 0, 10);
+
+  if(prog){
+    name = prog + 8;
+  } else {
+    name = memmem(mask, eol - mask, "\"str\":\"", 7);
+    if(!name) goto bad;
+    name += 7;
+  }
+
+  name_end = memchr(name, '"', eol - name);
+  if(!name_end) goto bad;
+
+  if(prog){
+    add_program(tt, prog_hash, name, name_end - name);
+  } else {
+    trace_record(tt, kind, prog_hash, process_id, usec, name, name_end - name);
+  }
+  return;
+
+bad:
+  tt->stats.bad += 1;
+}
+
+static void read_json(struct trace_tree *tt, struct input *in){
+  const char *p = in->data, *end = in->data + in->size;
+
+  while(p < end){
+    input_window(in, p - in->data);
+
+    const char *eol = memchr(p, '\n', end - p);
+    if(!eol) eol = end;
+
+    if(((eol - p) > 7) && !memcmp(p, "{usec: ", 7)){
+      parse_json_line(tt, p, eol);
+    } else if(((eol - p) > 2) && (p[0] == '{') && (p[1] == '"')){
+      parse_jsonl_line(tt, p, eol);
+    } else if((eol > p) && (p[0] == '{')){
+      tt->stats.bad += 1;
+    }
+
+    p = eol + 1;
+  }
+}
+
+/* Read a capture, returns 0 on success
+ */
+static int read_file(struct trace_tree *tt, const char *file_name){
+  struct input in;
+  struct stat st;
+
+  memset(&in, 0, sizeof(in));
+
+  int fd = open(file_name, O_RDONLY);
+  if(fd < 0){
+    fprintf(stderr, "%s: %s\n", file_name, strerror(errno));
+    return -1;
+  }
+
+  if((fstat(fd, &st) < 0) || (st.st_size == 0)){
+    fprintf(stderr, "%s: empty or unreadable\n", file_name);
+    close(fd);
+    return -1;
+  }
+
+  in.base = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  in.map_size = st.st_size;
+  close(fd);
+
+  if(in.base == MAP_FAILED){
+    fprintf(stderr, "%s: mmap failed, %s\n", file_name, strerror(errno));
+    return -1;
+  }
+
+  madvise((void *)in.base, in.map_size, MADV_SEQUENTIAL);
+
+  // Compressed files (log_to_file -z) are decompressed a window at a time
+  in.compressed = (zfile_reader_init(&in.zr, in.base, in.map_size) == 0);
+  in.data = in.compressed ? in.zr.raw : in.base;
+  in.size = in.compressed ? in.zr.raw_size : in.map_size;
+
+  uint64_t records = tt->stats.records;
+
+  input_window(&in, 0);
+
+  if((in.size >= 8) && !memcmp(in.data, SEG_FILE_MAGIC, 8)){
+    read_segments(tt, &in);
+  } else {
+    read_json(tt, &in);
+  }
+
+  fprintf(stderr, "%s: %lu trace records\n", file_name, tt->stats.records - records);
+
+  if(in.compressed){
+    if(in.zr.bad_blocks) fprintf(stderr, "%s: %lu damaged compressed blocks skipped\n", file_name, in.zr.bad_blocks);
+    zfile_reader_free(&in.zr);
+  }
+
+  munmap((void *)in.base, in.map_size);
+
+  return 0;
+}
+
+/* Close the frames still open at the publisher's last record
+ */
+static void close_stacks(struct trace_tree *tt){
+  uint64_t i;
+
+  for(i = 0; i < tt->stacks_size; i++){
+    struct stack *st = tt->stacks[i];
+
+    if(!st) continue;
+
+    while(st->depth){
+      close_frame(tt, st, st->last_usec, 1);
+      tt->stats.open_at_end += 1;
+    }
+  }
+}
+
+static void put_root_name(struct trace_tree *tt, struct out_buf *out, const struct root *r){
+  const char *name = program_name(tt, r->prog_hash);
+
+  if(name){
+    out_buf_put_str(out, name);
+  } else {
+    out_buf_put_hex(out, r->prog_hash, 0);
+  }
+
+  if(tt->split_pids){
+    out_buf_put_lit(out, ":");
+    out_buf_put_dec(out, r->process_id, 0);
+  }
+}
+
+/* One line per call path with self time, outermost first
+ */
+static void write_folded(struct trace_tree *tt, struct out_buf *out){
+  uint32_t path[TREE_MAX_DEPTH + 1];
+  uint32_t i;
+  int depth;
+
+  for(i = 1; i < tt->nodes_count; i++){
+    const struct node *n = &tt->nodes[i];
+
+    // a root has time of calls past -n
+    if(!n->self_usec) continue;
+
+    for(depth = 0; n->parent; n = &tt->nodes[n->parent]) path[depth++] = n->func;
+
+    put_root_name(tt, out, &tt->roots[n->func]);
+
+    while(depth--){
+      out_buf_put_lit(out, ";");
+      out_buf_put_str(out, tt->funcs.strs[path[depth]]);
+    }
+
+    out_buf_put_lit(out, " ");
+    out_buf_put_dec(out, tt->nodes[i].self_usec, 0);
+    out_buf_put_lit(out, "\n");
+  }
+}
+
+static struct func_stats *sort_stats;
+
+static int excl_cmp(const void *a, const void *b){
+  uint64_t ea = sort_stats[*(const uint32_t *)a].excl_usec, eb = sort_stats[*(const uint32_t *)b].excl_usec;
+  return (ea > eb) ? -1 : (ea < eb);
+}
+
+/* Per function totals, most exclusive time first
+ */
+static void write_summary(struct trace_tree *tt, struct out_buf *out){
+  uint32_t *order = malloc((tt->funcs.count + 1) * sizeof(order[0]));
+  uint32_t i, count = 0;
+
+  for(i = 0; i < tt->funcs.count; i++){
+    if(tt->fstats[i].calls) order[count++] = i;
+  }
+
+  sort_stats = tt->fstats;
+  qsort(order, count, sizeof(order[0]), excl_cmp);
+
+  out_buf_put_lit(out, "# calls\tinclusive_usec\texclusive_usec\tmax_usec\tfunction\n");
+
+  for(i = 0; i < count; i++){
+    const struct func_stats *fs = &tt->fstats[order[i]];
+
+    out_buf_put_dec(out, fs->calls, 0);
+    out_buf_put_lit(out, "\t");
+    out_buf_put_dec(out, fs->incl_usec, 0);
+    out_buf_put_lit(out, "\t");
+    out_buf_put_dec(out, fs->excl_usec, 0);
+    out_buf_put_lit(out, "\t");
+    out_buf_put_dec(out, fs->max_usec, 0);
+    out_buf_put_lit(out, "\t");
+    out_buf_put_str(out, tt->funcs.strs[order[i]]);
+    out_buf_put_lit(out, "\n");
+  }
+
+  free(order);
+}
+
+/* Name the processes, then close the event array
+ */
+static void end_chrome(struct trace_tree *tt, struct out_buf *out){
+  uint64_t i;
+
+  for(i = 0; i < tt->stacks_size; i++){
+    struct stack *st = tt->stacks[i];
+    const char *name;
+
+    if(!st || !(name = program_name(tt, st->prog_hash))) continue;
+
+    if(tt->chrome_events++) out_buf_put_lit(out, ",\n");
+
+    out_buf_put_lit(out, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":");
+    out_buf_put_dec(out, st->process_id, 0);
+    out_buf_put_lit(out, ",\"args\":{\"name\":\"");
+    out_buf_put_escaped(out, name);
+    out_buf_put_lit(out, "\"}}");
+  }
+
+  out_buf_put_lit(out, "\n],\"displayTimeUnit\":\"ms\"}\n");
+}
+
+static int open_output(const char *file_name, struct out_buf *out){
+  int fd = open(file_name, O_RDWR | O_CREAT | O_TRUNC, 0666);
+
+  if(fd < 0){
+    fprintf(stderr, "%s: %s\n", file_name, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+
+  out_buf_init(out, fd, NULL, OUT_BUF_SIZE);
+  return fd;
+}
+
+static void close_output(struct out_buf *out){
+  out_buf_flush(out);
+  if(out->fd != STDOUT_FILENO) close(out->fd);
+  out_buf_free(out);
+}
+
+int main(int argc, char *argv[])
+{
+  int opt, i;
+  int verbose = 0;
+  int errors  = 0;
+
+  const char *folded_name  = 0;
+  const char *chrome_name  = 0;
+  const char *summary_name = 0;
+
+  struct trace_tree tt;
+  struct out_buf folded, chrome, summary;
+
+  memset(&tt, 0, sizeof(tt));
+  tt.max_nodes   = TREE_MAX_NODES;
+  tt.nodes_count = 1;   // node 0 means none
+
+  while ((opt = getopt(argc, argv, "hvpf:c:s:n:")) != -1) {
+    switch (opt) {
+
+      case 'v':
+        verbose = 1;
+        break;
+
+      case 'p':
+        tt.split_pids = 1;
+        break;
+
+      case 'f':
+        folded_name = optarg;
+        break;
+
+      case 'c':
+        chrome_name = optarg;
+        break;
+
+      case 's':
+        summary_name = optarg;
+        break;
+
+      case 'n':
+        tt.max_nodes = strtoul(optarg, 0, 0);
+        if(tt.max_nodes < 1) tt.max_nodes = 1;
+        break;
+
+      case 'h':
+      default: /* '?' */
+        fprintf(stderr, "Usage: %s [-h][-v][-p][-f <file>][-c <file>][-s <file>][-n <paths>] <capture file> ...\n"
+                "-h     help\n"
+                "-v     verbose \n"
+                "-p     a call tree per process (default per program)\n"
+                "-f     write folded stacks with self time in usec to <file>, for flame graphs\n"
+                "-c     write Chrome trace event JSON to <file>, for chrome://tracing or ui.perfetto.dev\n"
+                "-s     write calls, inclusive, exclusive and max usec per function to <file> (default stdout)\n"
+                "-n     keep at most <paths> call paths, deeper calls count to their caller (default %i)\n"
+                "\n"
+                "Capture files are log_to_file output: -b segments, -j JSON or -l JSON Lines, compressed or not.\n",
+                argv[0], TREE_MAX_NODES);
+        exit(EXIT_FAILURE);
+    }
+  }
+
+  if(optind >= argc){
+    fprintf(stderr, "%s: no capture file given, -h for help\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  if(chrome_name){
+    open_output(chrome_name, &chrome);
+    out_buf_put_lit(&chrome, "{\"traceEvents\":[\n");
+    tt.chrome = &chrome;
+  }
+
+  for(i = optind; i < argc; i++){
+    if(read_file(&tt, argv[i]) < 0) errors += 1;
+  }
+
+  close_stacks(&tt);
+
+  if(folded_name){
+    open_output(folded_name, &folded);
+    write_folded(&tt, &folded);
+    close_output(&folded);
+  }
+
+  if(chrome_name){
+    end_chrome(&tt, &chrome);
+    close_output(&chrome);
+  }
+
+  if(summary_name){
+    open_output(summary_name, &summary);
+  } else if(!folded_name && !chrome_name){
+    out_buf_init(&summary, STDOUT_FILENO, NULL, OUT_BUF_SIZE);
+  }
+
+  if(summary_name || (!folded_name && !chrome_name)){
+    write_summary(&tt, &summary);
+    close_output(&summary);
+  }
+
+  struct tree_stats *s = &tt.stats;
+
+  fprintf(stderr, "%lu trace records, %lu enters, %lu exits, %lu functions, %u call paths, %lu publishers\n",
+          s->records, s->enters, s->exits, (uint64_t)tt.funcs.count, tt.nodes_count - 1, tt.stacks_count);
+
+  if(verbose || s->unmatched_exits || s->unclosed || s->open_at_end || s->too_deep || s->truncated ||
+     s->backwards || s->bad){
+    fprintf(stderr, "%lu exits without enter, %lu frames closed by an outer exit, %lu open at the end, "
+            "%lu too deep, %lu past -n, %lu backwards, %lu bad\n",
+            s->unmatched_exits, s->unclosed, s->open_at_end, s->too_deep, s->truncated, s->backwards, s->bad);
+  }
+
+  return errors ? EXIT_FAILURE : 0;
+}
@@ -0,0 +1,524 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "zfile.h"
+#include "lz.h"
+
+#define ZFILE_BLOCKS_PER_THREAD  2   // blocks of a writer in flight per pool thread
+
+enum zblock_state {
+  ZBLOCK_FREE,
+  ZBLOCK_FILLING,       // owned by the appending thread
+  ZBLOCK_QUEUED,        // waiting for or being compressed
+  ZBLOCK_DONE           // compressed, waiting for the blocks before it to be written
+};
+
+struct zblock {
+  struct zfile_writer *zw;
+  uint64_t seq;
+  enum zblock_state state;
+
+  char    *raw;
+  size_t   raw_len;
+  uint64_t raw_offset;
+
+  struct zfile_block_hdr hdr;
+  char    *comp;        // LZ_BOUND(block_size)
+
+  struct zblock *next;  // pool queue
+};
+
+struct zfile_pool {
+  size_t block_size;
+
+  pthread_t *threads;
+  int        threads_count;
+
+  pthread_mutex_t lock;
+  pthread_cond_t  cond;
+  struct zblock  *head;
+  struct zblock  *tail;
+  int             stop;
+};
+
+struct zfile_writer {
+  struct zfile_pool *pool;
+  zfile_write_fn write;
+  void          *arg;
+
+  pthread_mutex_t lock;
+  pthread_cond_t  cond;       // a block was written
+
+  struct zblock *blocks;      // ring, block seq is at seq % blocks_count
+  int      blocks_count;
+  uint64_t fill_seq;          // block being filled (appending thread only)
+  uint64_t write_seq;         // next block to write
+  int      writing;           // a thread is writing blocks
+
+  uint64_t raw_offset;        // stream offset of the next byte appended
+  uint64_t fill_usec;         // when the filling block got its first byte
+  volatile uint64_t file_bytes;
+
+  struct zfile_idx_entry *index;
+  uint64_t index_count;
+  uint64_t index_cap;
+};
+
+static uint64_t zfile_usec(){
+  struct timespec tv;
+  clock_gettime(CLOCK_MONOTONIC, &tv);
+  return tv.tv_sec * (uint64_t)1000000 + tv.tv_nsec / 1000;
+}
+
+/* Word at a time FNV style hash (as seg_checksum), then the tail
+ */
+static uint64_t zfile_checksum(const void *buf, uint64_t len){
+  const char *p = buf;
+  uint64_t h = 0xcbf29ce484222325ULL;
+  uint64_t i, w;
+
+  for(i = 0; (i + 8) <= len; i += 8){
+    memcpy(&w, p + i, sizeof(w));
+    h = (h ^ w) * 0x100000001b3ULL;
+    h ^= h >> 29;
+  }
+
+  for(; i < len; i++) h = (h ^ (uint8_t)p[i]) * 0x100000001b3ULL;
+
+  return h;
+}
+
+static void compress_block(struct zfile_pool *pool, struct zblock *b, void *work){
+  size_t len = lz_compress(b->raw, b->raw_len, b->comp, LZ_BOUND(pool->block_size), work);
+
+  b->hdr.magic      = ZFILE_BLOCK_MAGIC;
+  b->hdr.raw_len    = b->raw_len;
+  b->hdr.raw_offset = b->raw_offset;
+
+  if(!len || (len >= b->raw_len)){
+    b->hdr.flags    = ZFILE_STORED;
+    b->hdr.comp_len = b->raw_len;
+    b->hdr.checksum = zfile_checksum(b->raw, b->raw_len);
+  } else {
+    b->hdr.flags    = 0;
+    b->hdr.comp_len = len;
+    b->hdr.checksum = zfile_checksum(b->comp, len);
+  }
+}
+
+/* Mark a block compressed and write the blocks that are ready, in order
+ *
+ * Only one thread writes at a time, the others leave their block for it.
+ */
+static void block_done(struct zblock *b){
+  struct zfile_writer *zw = b->zw;
+
+  pthread_mutex_lock(&zw->lock);
+
+  b->state = ZBLOCK_DONE;
+
+  if(!zw->writing){
+    zw->writing = 1;
+
+    while(1){
+      struct zblock *w = &zw->blocks[zw->write_seq % zw->blocks_count];
+      if((w->state != ZBLOCK_DONE) || (w->seq != zw->write_seq)) break;
+
+      uint64_t file_offset = zw->file_bytes;
+      pthread_mutex_unlock(&zw->lock);
+
+      zw->write(zw->arg, &w->hdr, sizeof(w->hdr));
+      zw->write(zw->arg, (w->hdr.flags & ZFILE_STORED) ? w->raw : w->comp, w->hdr.comp_len);
+
+      pthread_mutex_lock(&zw->lock);
+
+      if(zw->index_count == zw->index_cap){
+        zw->index_cap = zw->index_cap ? (zw->index_cap * 2) : 1024;
+        zw->index = realloc(zw->index, zw->index_cap * sizeof(zw->index[0]));
+      }
+
+      struct zfile_idx_entry *e = &zw->index[zw->index_count++];
+      e->raw_offset  = w->hdr.raw_offset;
+      e->file_offset = file_offset;
+      e->raw_len     = w->hdr.raw_len;
+      e->comp_len    = w->hdr.comp_len;
+
+      zw->file_bytes += sizeof(w->hdr) + w->hdr.comp_len;
+      w->state = ZBLOCK_FREE;
+      zw->write_seq += 1;
+      pthread_cond_broadcast(&zw->cond);
+    }
+
+    zw->writing = 0;
+  }
+
+  pthread_mutex_unlock(&zw->lock);
+}
+
+static void *pool_main(void *arg){
+  struct zfile_pool *pool = arg;
+  void *work = malloc(LZ_WORK_SIZE);
+
+  pthread_mutex_lock(&pool->lock);
+
+  while(1){
+    while(!pool->head && !pool->stop) pthread_cond_wait(&pool->cond, &pool->lock);
+    if(!pool->head) break;
+
+    struct zblock *b = pool->head;
+    pool->head = b->next;
+    if(!pool->head) pool->tail = 0;
+
+    pthread_mutex_unlock(&pool->lock);
+
+    compress_block(pool, b, work);
+    block_done(b);
+
+    pthread_mutex_lock(&pool->lock);
+  }
+
+  pthread_mutex_unlock(&pool->lock);
+  free(work);
+
+  return NULL;
+}
+
+struct zfile_pool *zfile_pool_new(int threads, size_t block_size){
+  struct zfile_pool *pool = calloc(1, sizeof(*pool));
+  int i;
+
+  if(threads < 1) threads = 1;
+  if(block_size < 4096) block_size = 4096;
+  if(block_size > (64 << 20)) block_size = 64 << 20;
+
+  pool->block_size    = block_size;
+  pool->threads_count = threads;
+  pool->threads       = calloc(threads, sizeof(pool->threads[0]));
+
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->cond, NULL);
+
+  for(i = 0; i < threads; i++) pthread_create(&pool->threads[i], NULL, pool_main, pool);
+
+  return pool;
+}
+
+/* Writers must be closed first
+ */
+void zfile_pool_free(struct zfile_pool *pool){
+  int i;
+
+  pthread_mutex_lock(&pool->lock);
+  pool->stop = 1;
+  pthread_cond_broadcast(&pool->cond);
+  pthread_mutex_unlock(&pool->lock);
+
+  for(i = 0; i < pool->threads_count; i++) pthread_join(pool->threads[i], NULL);
+
+  pthread_mutex_destroy(&pool->lock);
+  pthread_cond_destroy(&pool->cond);
+  free(pool->threads);
+  free(pool);
+}
+
+static void submit(struct zfile_writer *zw, struct zblock *b){
+  struct zfile_pool *pool = zw->pool;
+
+  pthread_mutex_lock(&zw->lock);
+  b->state = ZBLOCK_QUEUED;
+  pthread_mutex_unlock(&zw->lock);
+
+  zw->fill_seq += 1;
+
+  pthread_mutex_lock(&pool->lock);
+  b->next = 0;
+  if(pool->tail){
+    pool->tail->next = b;
+  } else {
+    pool->head = b;
+  }
+  pool->tail = b;
+  pthread_cond_signal(&pool->cond);
+  pthread_mutex_unlock(&pool->lock);
+}
+
+struct zfile_writer *zfile_writer_open(struct zfile_pool *pool, zfile_write_fn write, void *arg, uint64_t create_usec){
+  struct zfile_writer *zw = calloc(1, sizeof(*zw));
+  struct zfile_hdr hdr;
+  int i;
+
+  zw->pool  = pool;
+  zw->write = write;
+  zw->arg   = arg;
+
+  pthread_mutex_init(&zw->lock, NULL);
+  pthread_cond_init(&zw->cond, NULL);
+
+  // one filling, the rest compressing or waiting to be written
+  zw->blocks_count = (pool->threads_count * ZFILE_BLOCKS_PER_THREAD) + 1;
+  zw->blocks = calloc(zw->blocks_count, sizeof(zw->blocks[0]));
+
+  for(i = 0; i < zw->blocks_count; i++){
+    zw->blocks[i].zw   = zw;
+    zw->blocks[i].raw  = malloc(pool->block_size);
+    zw->blocks[i].comp = malloc(LZ_BOUND(pool->block_size));
+  }
+
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, ZFILE_MAGIC, sizeof(hdr.magic));
+  hdr.version     = ZFILE_VERSION;
+  hdr.block_size  = pool->block_size;
+  hdr.create_usec = create_usec;
+
+  write(arg, &hdr, sizeof(hdr));
+  zw->file_bytes = sizeof(hdr);
+
+  return zw;
+}
+
+void zfile_writer_append(struct zfile_writer *zw, const void *buf, size_t len){
+  const char *p = buf;
+  size_t block_size = zw->pool->block_size;
+
+  while(len > 0){
+    struct zblock *b = &zw->blocks[zw->fill_seq % zw->blocks_count];
+
+    if(b->state != ZBLOCK_FILLING){
+      // the slot's previous block may still be on its way to the file
+      pthread_mutex_lock(&zw->lock);
+      while(b->state != ZBLOCK_FREE) pthread_cond_wait(&zw->cond, &zw->lock);
+      b->state = ZBLOCK_FILLING;
+      pthread_mutex_unlock(&zw->lock);
+
+      b->seq        = zw->fill_seq;
+      b->raw_len    = 0;
+      b->raw_offset = zw->raw_offset;
+      zw->fill_usec = zfile_usec();
+    }
+
+    size_t n = block_size - b->raw_len;
+    if(n > len) n = len;
+
+    memcpy(b->raw + b->raw_len, p, n);
+    b->raw_len     += n;
+    zw->raw_offset += n;
+    p   += n;
+    len -= n;
+
+    if(b->raw_len == block_size) submit(zw, b);
+  }
+}
+
+void zfile_writer_flush(struct zfile_writer *zw){
+  struct zblock *b = &zw->blocks[zw->fill_seq % zw->blocks_count];
+
+  if((b->state == ZBLOCK_FILLING) && b->raw_len && ((zfile_usec() - zw->fill_usec) >= ZFILE_FLUSH_USEC)){
+    submit(zw, b);
+  }
+}
+
+void zfile_writer_close(struct zfile_writer *zw){
+  struct zblock *b = &zw->blocks[zw->fill_seq % zw->blocks_count];
+  struct zfile_trailer trailer;
+  int i;
+
+  if(b->state == ZBLOCK_FILLING){
+    if(b->raw_len){
+      submit(zw, b);
+    } else {
+      b->state = ZBLOCK_FREE;
+    }
+  }
+
+  pthread_mutex_lock(&zw->lock);
+  while(zw->write_seq != zw->fill_seq) pthread_cond_wait(&zw->cond, &zw->lock);
+  pthread_mutex_unlock(&zw->lock);
+
+  trailer.magic        = ZFILE_INDEX_MAGIC;
+  trailer.index_offset = zw->file_bytes;
+  trailer.count        = zw->index_count;
+  trailer.raw_size     = zw->raw_offset;
+
+  zw->write(zw->arg, zw->index, zw->index_count * sizeof(zw->index[0]));
+  zw->write(zw->arg, &trailer, sizeof(trailer));
+
+  for(i = 0; i < zw->blocks_count; i++){
+    free(zw->blocks[i].raw);
+    free(zw->blocks[i].comp);
+  }
+
+  pthread_mutex_destroy(&zw->lock);
+  pthread_cond_destroy(&zw->cond);
+  free(zw->blocks);
+  free(zw->index);
+  free(zw);
+}
+
+uint64_t zfile_writer_file_bytes(struct zfile_writer *zw){
+  return zw->file_bytes;
+}
+
+/* The index at the end of a closed file, 0 if there isn't a usable one
+ */
+static int read_trailer(struct zfile_reader *r){
+  const struct zfile_trailer *t;
+
+  if(r->size < (sizeof(struct zfile_hdr) + sizeof(*t))) return 0;
+
+  t = (const void *)(r->base + r->size - sizeof(*t));
+
+  if((t->magic != ZFILE_INDEX_MAGIC) ||
+     (t->count > (r->size / sizeof(struct zfile_idx_entry))) ||
+     ((t->index_offset + (t->count * sizeof(struct zfile_idx_entry)) + sizeof(*t)) != r->size)){
+    return 0;
+  }
+
+  r->count  = t->count;
+  r->blocks = malloc((r->count + 1) * sizeof(r->blocks[0]));
+  memcpy(r->blocks, r->base + t->index_offset, r->count * sizeof(r->blocks[0]));
+  r->raw_size = t->raw_size;
+
+  return 1;
+}
+
+/* Walk the block headers, up to the first incomplete or damaged block
+ */
+static void scan_blocks(struct zfile_reader *r){
+  uint64_t pos = sizeof(struct zfile_hdr);
+  uint64_t cap = 0;
+
+  r->count = 0;
+  r->raw_size = 0;
+
+  while((pos + sizeof(struct zfile_block_hdr)) <= r->size){
+    const struct zfile_block_hdr *bh = (const void *)(r->base + pos);
+
+    if((bh->magic != ZFILE_BLOCK_MAGIC) || (bh->raw_offset != r->raw_size) ||
+       (bh->comp_len > (r->size - pos - sizeof(*bh)))){
+      break;
+    }
+
+    if(r->count == cap){
+      cap = cap ? (cap * 2) : 1024;
+      r->blocks = realloc(r->blocks, cap * sizeof(r->blocks[0]));
+    }
+
+    struct zfile_idx_entry *e = &r->blocks[r->count++];
+    e->raw_offset  = bh->raw_offset;
+    e->file_offset = pos;
+    e->raw_len     = bh->raw_len;
+    e->comp_len    = bh->comp_len;
+
+    r->raw_size += bh->raw_len;
+    pos += sizeof(*bh) + bh->comp_len;
+  }
+}
+
+int zfile_reader_init(struct zfile_reader *r, const void *base, uint64_t size){
+  memset(r, 0, sizeof(*r));
+
+  if(!zfile_is_compressed(base, size)) return -1;
+
+  r->base = base;
+  r->size = size;
+
+  if(!read_trailer(r)) scan_blocks(r);
+
+  r->raw = mmap(0, r->raw_size ? r->raw_size : 1, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if(r->raw == MAP_FAILED){
+    free(r->blocks);
+    return -1;
+  }
+
+  r->loaded = calloc(r->count + 1, 1);
+
+  return 0;
+}
+
+void zfile_reader_free(struct zfile_reader *r){
+  munmap(r->raw, r->raw_size ? r->raw_size : 1);
+  free(r->blocks);
+  free(r->loaded);
+}
+
+static void load_block(struct zfile_reader *r, uint64_t i){
+  const struct zfile_idx_entry *e = &r->blocks[i];
+  const struct zfile_block_hdr *bh = (const void *)(r->base + e->file_offset);
+  const char *data = (const char *)(bh + 1);
+
+  r->loaded[i] = 1;
+  r->loads += 1;
+
+  if((e->file_offset + sizeof(*bh) + e->comp_len > r->size) ||
+     (e->raw_offset + e->raw_len > r->raw_size) ||
+     (bh->magic != ZFILE_BLOCK_MAGIC) || (bh->comp_len != e->comp_len) ||
+     (zfile_checksum(data, e->comp_len) != bh->checksum)){
+    r->bad_blocks += 1;
+    return;
+  }
+
+  if(bh->flags & ZFILE_STORED){
+    if(e->comp_len == e->raw_len){
+      memcpy(r->raw + e->raw_offset, data, e->raw_len);
+    } else {
+      r->bad_blocks += 1;
+    }
+  } else if(lz_decompress(data, e->comp_len, r->raw + e->raw_offset, e->raw_len) != e->raw_len){
+    memset(r->raw + e->raw_offset, 0, e->raw_len);
+    r->bad_blocks += 1;
+  }
+}
+
+/* First block ending after raw_offset
+ */
+static uint64_t find_block(struct zfile_reader *r, uint64_t raw_offset){
+  uint64_t lo = 0, hi = r->count;
+
+  while(lo < hi){
+    uint64_t mid = (lo + hi) / 2;
+    if((r->blocks[mid].raw_offset + r->blocks[mid].raw_len) <= raw_offset){
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  return lo;
+}
+
+const char *zfile_load(struct zfile_reader *r, uint64_t raw_offset, uint64_t len){
+  uint64_t lo = find_block(r, raw_offset);
+
+  for(; (lo < r->count) && (r->blocks[lo].raw_offset < (raw_offset + len)); lo++){
+    if(!r->loaded[lo]) load_block(r, lo);
+  }
+
+  return r->raw;
+}
+
+void zfile_unload(struct zfile_reader *r, uint64_t raw_offset, uint64_t len){
+  uint64_t i = find_block(r, raw_offset);
+  uint64_t start = UINT64_MAX, end = 0;
+  long page = sysconf(_SC_PAGESIZE);
+
+  for(; (i < r->count) && ((r->blocks[i].raw_offset + r->blocks[i].raw_len) <= (raw_offset + len)); i++){
+    if(r->blocks[i].raw_offset < raw_offset) continue;
+
+    if(start == UINT64_MAX) start = r->blocks[i].raw_offset;
+    end = r->blocks[i].raw_offset + r->blocks[i].raw_len;
+    r->loaded[i] = 0;
+  }
+
+  // pages shared with blocks outside the range are kept
+  start = (start + page - 1) & ~(uint64_t)(page - 1);
+  end  &= ~(uint64_t)(page - 1);
+
+  if((start != UINT64_MAX) && (end > start)) madvise(r->raw + start, end - start, MADV_DONTNEED);
+}
@@ -0,0 +1,150 @@
+
+/*
+ * zfile.h
+ *
+ * Compressed log_to_file output files, written in parallel and readable
+ * at any offset.
+ *
+ * The output stream (JSON, segments, pcapng) is cut into fixed size
+ * blocks.  Full blocks are compressed (lz.h) by a pool of threads shared
+ * by all files of an out_file, and written in order by whichever thread
+ * completes the oldest block, so the receive path only copies bytes and
+ * compression scales with the pool.
+ *
+ *   zfile_hdr
+ *   zfile_block_hdr, compressed bytes
+ *   zfile_block_hdr, compressed bytes
+ *   ...
+ *   zfile_idx_entry * count, zfile_trailer     (once the file is closed)
+ *
+ * Each block header has the block's offset in the uncompressed stream, so
+ * offsets into the stream (segment indexes, seg_index.h) stay valid, and a
+ * reader decompresses only the blocks covering what it needs.  The index
+ * at the end finds every block without reading the file; for a file that
+ * is still being written (or was not closed) the reader walks the block
+ * headers instead.
+ *
+ * A partially filled block is compressed when it is ZFILE_FLUSH_USEC old
+ * and the file is flushed, so an idle receiver's output reaches the disk
+ * within about a second.
+ */
+
+#ifndef _ZFILE_H_
+#define _ZFILE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#define ZFILE_MAGIC         "SLTLZ001"
+#define ZFILE_VERSION       1
+#define ZFILE_BLOCK_MAGIC   0x4B4C425AU               // "ZBLK"
+#define ZFILE_INDEX_MAGIC   0x58444E492D5A4C53ULL     // "SLZ-INDX"
+
+#define ZFILE_BLOCK_SIZE    (256 << 10)   // default uncompressed block size
+#define ZFILE_FLUSH_USEC    1000000
+
+enum zfile_block_flags {
+  ZFILE_STORED = 1      // didn't compress, stored as is
+};
+
+struct zfile_hdr {
+  char     magic[8];    // ZFILE_MAGIC
+  uint32_t version;
+  uint32_t block_size;
+  uint64_t create_usec;
+};
+
+struct zfile_block_hdr {
+  uint32_t magic;       // ZFILE_BLOCK_MAGIC
+  uint32_t flags;
+  uint32_t raw_len;
+  uint32_t comp_len;    // bytes following the header
+  uint64_t raw_offset;  // in the uncompressed stream
+  uint64_t checksum;    // of the compressed bytes
+};
+
+struct zfile_idx_entry {
+  uint64_t raw_offset;
+  uint64_t file_offset; // of the block header
+  uint32_t raw_len;
+  uint32_t comp_len;
+};
+
+struct zfile_trailer {
+  uint64_t magic;       // ZFILE_INDEX_MAGIC
+  uint64_t index_offset;
+  uint64_t count;
+  uint64_t raw_size;
+};
+
+/* Compression threads, shared by the writers of an out_file
+ */
+struct zfile_pool;
+
+struct zfile_pool *zfile_pool_new(int threads, size_t block_size);
+void zfile_pool_free(struct zfile_pool *pool);
+
+/* Writer of one file, compressed blocks go to write(arg, ...), called in
+ * file order from the pool threads
+ */
+typedef void (*zfile_write_fn)(void *arg, const void *buf, size_t len);
+
+struct zfile_writer;
+
+struct zfile_writer *zfile_writer_open(struct zfile_pool *pool, zfile_write_fn write, void *arg, uint64_t create_usec);
+
+/* Append to the uncompressed stream, waits while all the writer's blocks are
+ * being compressed.  One thread at a time.
+ */
+void zfile_writer_append(struct zfile_writer *zw, const void *buf, size_t len);
+
+/* Compress the partially filled block if it's older than ZFILE_FLUSH_USEC
+ */
+void zfile_writer_flush(struct zfile_writer *zw);
+
+/* Compress and write everything, then the index, and free the writer
+ */
+void zfile_writer_close(struct zfile_writer *zw);
+
+/* Compressed bytes written so far
+ */
+uint64_t zfile_writer_file_bytes(struct zfile_writer *zw);
+
+/* Reader over a file mapped in memory
+ *
+ * The uncompressed stream is an anonymous mapping, blocks are decompressed
+ * into it as they are loaded.
+ */
+struct zfile_reader {
+  const char *base;
+  uint64_t    size;
+
+  struct zfile_idx_entry *blocks;
+  uint64_t    count;
+  uint64_t    raw_size;
+
+  char       *raw;          // raw_size bytes
+  uint8_t    *loaded;       // per block
+  uint64_t    loads;        // blocks decompressed
+  uint64_t    bad_blocks;   // failed checksum or decompression, left zero
+};
+
+static inline int zfile_is_compressed(const void *base, uint64_t size){
+  return (size >= sizeof(struct zfile_hdr)) && !memcmp(base, ZFILE_MAGIC, 8);
+}
+
+/* Returns 0, or -1 if the file isn't a compressed file
+ */
+int zfile_reader_init(struct zfile_reader *r, const void *base, uint64_t size);
+void zfile_reader_free(struct zfile_reader *r);
+
+/* Decompress the blocks covering len bytes at raw_offset, returns r->raw
+ */
+const char *zfile_load(struct zfile_reader *r, uint64_t raw_offset, uint64_t len);
+
+/* Give back the memory of the blocks entirely within len bytes at raw_offset
+ */
+void zfile_unload(struct zfile_reader *r, uint64_t raw_offset, uint64_t len);
+
+#endif /* _ZFILE_H_ */
@@ -0,0 +1,159 @@
+/* Decompress a file written by "log_to_file -z", whole or a byte range
+ *
+ * Only the blocks covering the range are decompressed, found with the
+ * block index at the end of the file (or the block headers of a file that
+ * is still being written).
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>    /* for getopt */
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "zfile.h"
+
+static int write_all(int fd, const char *buf, uint64_t len){
+  while(len > 0){
+    ssize_t rc = write(fd, buf, len);
+
+    if(rc < 0){
+      if(errno == EINTR) continue;
+      return -1;
+    }
+
+    buf += rc;
+    len -= rc;
+  }
+
+  return 0;
+}
+
+/* Returns 0 on success
+ */
+int cat_file(const char *file_name, int out_fd, uint64_t offset, uint64_t len, int verbose){
+  struct zfile_reader zr;
+  struct stat st;
+  int rc = 0;
+
+  int fd = open(file_name, O_RDONLY);
+  if(fd < 0){
+    fprintf(stderr, "%s: %s\n", file_name, strerror(errno));
+    return -1;
+  }
+
+  if((fstat(fd, &st) < 0) || (st.st_size == 0)){
+    fprintf(stderr, "%s: empty or unreadable\n", file_name);
+    close(fd);
+    return -1;
+  }
+
+  void *base = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if(base == MAP_FAILED){
+    fprintf(stderr, "%s: mmap failed, %s\n", file_name, strerror(errno));
+    return -1;
+  }
+
+  if(zfile_reader_init(&zr, base, st.st_size) < 0){
+    fprintf(stderr, "%s: not a compressed log_to_file file\n", file_name);
+    munmap(base, st.st_size);
+    return -1;
+  }
+
+  if(offset > zr.raw_size) offset = zr.raw_size;
+  if(len > (zr.raw_size - offset)) len = zr.raw_size - offset;
+
+  // a block at a time, so memory is only what's being written
+  uint64_t end = offset + len;
+
+  while(offset < end){
+    uint64_t n = end - offset;
+    if(n > ZFILE_BLOCK_SIZE) n = ZFILE_BLOCK_SIZE;
+
+    const char *raw = zfile_load(&zr, offset, n);
+
+    if(write_all(out_fd, raw + offset, n) < 0){
+      fprintf(stderr, "write failed, %s\n", strerror(errno));
+      rc = -1;
+      break;
+    }
+
+    offset += n;
+
+    // give back the memory of what has been written
+    zfile_unload(&zr, 0, offset);
+  }
+
+  if(zr.bad_blocks || verbose){
+    fprintf(stderr, "%s: %lu blocks, %lu decompressed, %lu damaged, %lu of %lu bytes\n",
+            file_name, zr.count, zr.loads, zr.bad_blocks, len, zr.raw_size);
+  }
+
+  zfile_reader_free(&zr);
+  munmap(base, st.st_size);
+
+  return rc;
+}
+
+int main(int argc, char *argv[])
+{
+  int opt, i;
+  int verbose = 0;
+  int errors  = 0;
+  int out_fd  = STDOUT_FILENO;
+  uint64_t offset = 0;
+  uint64_t len    = UINT64_MAX;
+
+  while ((opt = getopt(argc, argv, "hvs:n:o:")) != -1) {
+    switch (opt) {
+
+      case 'v':
+        verbose = 1;
+        break;
+
+      case 's':
+        offset = strtoull(optarg, 0, 0);
+        break;
+
+      case 'n':
+        len = strtoull(optarg, 0, 0);
+        break;
+
+      case 'o':
+        out_fd = open(optarg, O_RDWR | O_CREAT | O_TRUNC, 0666);
+        if(out_fd < 0){
+          fprintf(stderr, "%s: %s\n", optarg, strerror(errno));
+          exit(EXIT_FAILURE);
+        }
+        break;
+
+      case 'h':
+      default: /* '?' */
+        fprintf(stderr, "Usage: %s [-h][-v][-s <offset>][-n <bytes>][-o <file>] <file> ...\n"
+                "-h     help\n"
+                "-v     verbose \n"
+                "-s     start at uncompressed <offset> (default 0)\n"
+                "-n     output at most <bytes> (default all)\n"
+                "-o     output to <file> (default stdout)\n",
+                argv[0]);
+        exit(EXIT_FAILURE);
+    }
+  }
+
+  if(optind >= argc){
+    fprintf(stderr, "%s: no file given, -h for help\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  for(i = optind; i < argc; i++){
+    if(cat_file(argv[i], out_fd, offset, len, verbose) < 0) errors += 1;
+  }
+
+  return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}